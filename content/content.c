@@ -688,6 +688,23 @@ bool content_is_shareable(struct content *c)
 	return c->handler->no_share == false;
 }
 
+/**
+ * Estimate the memory used by a content
+ *
+ * \param c  Content to consider
+ * \return Size of the content's decoded data and source data, in bytes
+ *
+ * The decoded size is that recorded by the content handler in c->size.
+ */
+size_t content__get_footprint(struct content *c)
+{
+	size_t source_size;
+
+	llcache_handle_get_source_data(c->llcache, &source_size);
+
+	return sizeof(struct content) + c->size + source_size;
+}
+
 /**
  * Send a message to all users.
  */
@@ -988,8 +1005,11 @@ bool content__add_rfc5988_link(struct content *c,
  */
 content_type content_get_type(hlcache_handle *h)
 {
-	struct content *c = hlcache_handle_get_content(h);
+	return content__get_type(hlcache_handle_get_content(h));
+}
 
+content_type content__get_type(struct content *c)
+{
 	if (c == NULL)
 		return CONTENT_NONE;
 
@@ -1157,6 +1177,22 @@ const char *content_get_source_data(hlcache_handle *h, unsigned long *size)
 	return content__get_source_data(hlcache_handle_get_content(h), size);
 }
 
+/**
+ * Retrieve the memory held by a content
+ *
+ * \param h  Content to consider
+ * \return Size of the content's decoded data and source data, in bytes
+ */
+size_t content_get_size(hlcache_handle *h)
+{
+	struct content *c = hlcache_handle_get_content(h);
+
+	if (c == NULL)
+		return 0;
+
+	return content__get_footprint(c);
+}
+
 const char *content__get_source_data(struct content *c, unsigned long *size)
 {
 	const uint8_t *data;
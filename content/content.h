@@ -233,7 +233,9 @@ void content_remove_user(struct content *c,
 uint32_t content_count_users(struct content *c);
 bool content_matches_quirks(struct content *c, bool quirks);
 bool content_is_shareable(struct content *c);
+size_t content__get_footprint(struct content *c);
 content_status content__get_status(struct content *c);
+content_type content__get_type(struct content *c);
 
 const struct llcache_handle *content_get_llcache_handle(struct content *c);
 nsurl *content_get_url(struct content *c);
@@ -285,6 +287,7 @@ int content_get_height(struct hlcache_handle *c);
 int content_get_available_width(struct hlcache_handle *c);
 const char *content_get_source_data(struct hlcache_handle *c, 
 		unsigned long *size);
+size_t content_get_size(struct hlcache_handle *c);
 void content_invalidate_reuse_data(struct hlcache_handle *c);
 nsurl *content_get_refresh_url(struct hlcache_handle *c);
 struct bitmap *content_get_bitmap(struct hlcache_handle *c);
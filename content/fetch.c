@@ -52,6 +52,7 @@
 #include "utils/nsurl.h"
 #include "utils/utils.h"
 #include "utils/ring.h"
+#include "utils/timing.h"
 
 /* Define this to turn on verbose fetch logging */
 #undef DEBUG_FETCH_VERBOSE
@@ -89,6 +90,7 @@ struct fetch {
 				   NULL if not set. */
 	void *fetcher_handle;	/**< The handle for the fetcher. */
 	bool fetch_is_active;	/**< This fetch is active. */
+	uint64_t start_time;	/**< Time fetch was queued, from timing_now() */
 	struct fetch *r_prev;	/**< Previous active fetch in ::fetch_ring. */
 	struct fetch *r_next;	/**< Next active fetch in ::fetch_ring. */
 };
@@ -96,6 +98,12 @@ struct fetch {
 static struct fetch *fetch_ring = 0;	/**< Ring of active fetches. */
 static struct fetch *queue_ring = 0;	/**< Ring of queued fetches */
 
+static unsigned int fetch_dispatched_count; /**< Fetches dispatched */
+static uint64_t fetch_wait_time;	/**< Total time dispatched fetches
+					     were queued */
+static uint64_t fetch_wait_max;		/**< Longest time a dispatched fetch
+					     was queued */
+
 #define fetch_ref_fetcher(F) F->refcount++
 
 /******************************************************************************
@@ -136,8 +144,16 @@ static bool fetch_dispatch_job(struct fetch *fetch)
 		RING_INSERT(queue_ring, fetch); /* Put it back on the end of the queue */
 		return false;
 	} else {
+		uint64_t wait = timing_now() - fetch->start_time;
+
 		RING_INSERT(fetch_ring, fetch);
 		fetch->fetch_is_active = true;
+
+		fetch_dispatched_count++;
+		fetch_wait_time += wait;
+		if (wait > fetch_wait_max)
+			fetch_wait_max = wait;
+
 		return true;
 	}
 }
@@ -336,6 +352,7 @@ struct fetch * fetch_start(nsurl *url, nsurl *referer,
 	fetch->fetcher_handle = NULL;
 	fetch->ops = NULL;
 	fetch->fetch_is_active = false;
+	fetch->start_time = timing_now();
 	fetch->host = nsurl_get_component(url, NSURL_HOST);
 
 	if (referer != NULL) {
@@ -446,6 +463,7 @@ void fetch_free(struct fetch *f)
 #endif
 	f->ops->free_fetch(f->fetcher_handle);
 	fetch_unref_fetcher(f->ops);
+	timing_record(TIMING_FETCH, f->start_time, f->url);
 	nsurl_unref(f->url);
 	if (f->referer != NULL)
 		nsurl_unref(f->referer);
@@ -681,3 +699,85 @@ void fetch_set_cookie(struct fetch *fetch, const char *data)
 		urldb_set_cookie(data, fetch->url, fetch->referer);
 	}
 }
+
+/* exported interface documented in content/fetch.h */
+void fetch_get_statistics(struct fetch_statistics *stats)
+{
+	int all_active, all_queued;
+
+	RING_GETSIZE(struct fetch, fetch_ring, all_active);
+	RING_GETSIZE(struct fetch, queue_ring, all_queued);
+
+	stats->active = all_active;
+	stats->queued = all_queued;
+	stats->dispatched = fetch_dispatched_count;
+	stats->wait_time = fetch_wait_time;
+	stats->wait_max = fetch_wait_max;
+}
+
+/**
+ * Add a ring of fetches to per host statistics
+ *
+ * \param ring   Ring of fetches to add
+ * \param now    Current time, from timing_now()
+ * \param stats  Array of per host statistics
+ * \param size   Number of entries in array
+ * \param count  Number of entries in use, updated
+ */
+static void fetch_add_host_statistics(struct fetch *ring, uint64_t now,
+		struct fetch_host_statistics *stats, unsigned int size,
+		unsigned int *count)
+{
+	struct fetch *f = ring;
+
+	if (ring == NULL)
+		return;
+
+	do {
+		struct fetch_host_statistics *host;
+		unsigned int h;
+
+		/* Find the host's entry, adding one if it has none.  Hosts
+		 * are interned, so equal hosts are the same string. */
+		for (h = 0; h < *count; h++) {
+			if (stats[h].host == f->host)
+				break;
+		}
+
+		if (h == *count) {
+			if (*count == size)
+				return;
+
+			stats[h].host = f->host;
+			stats[h].active = 0;
+			stats[h].queued = 0;
+			stats[h].wait_max = 0;
+			(*count)++;
+		}
+
+		host = &stats[h];
+
+		if (f->fetch_is_active) {
+			host->active++;
+		} else {
+			host->queued++;
+			if (now - f->start_time > host->wait_max)
+				host->wait_max = now - f->start_time;
+		}
+
+		f = f->r_next;
+	} while (f != ring);
+}
+
+/* exported interface documented in content/fetch.h */
+unsigned int fetch_get_host_statistics(struct fetch_host_statistics *stats,
+		unsigned int size)
+{
+	uint64_t now = timing_now();
+	unsigned int count = 0;
+
+	fetch_add_host_statistics(fetch_ring, now, stats, size, &count);
+	fetch_add_host_statistics(queue_ring, now, stats, size, &count);
+
+	return count;
+}
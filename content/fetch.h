@@ -24,6 +24,7 @@
 #define _NETSURF_DESKTOP_FETCH_H_
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <libwapcaplet/libwapcaplet.h>
 
@@ -38,6 +39,7 @@ typedef enum {
 	FETCH_PROGRESS,
 	FETCH_HEADER,
 	FETCH_DATA,
+	FETCH_DATA_OWNED,
 	FETCH_FINISHED,
 	FETCH_ERROR,
 	FETCH_REDIRECT,
@@ -58,6 +60,17 @@ typedef struct fetch_msg {
 			size_t len;
 		} header_or_data;
 
+		/** Data whose ownership passes to the fetch's user, which
+		 * must not modify it and must call release exactly once.
+		 * The data may be kept for as long as the cached object, so
+		 * it must not change under the user meanwhile: a mapping of
+		 * a file which may be truncated or rewritten is unsuitable */
+		struct {
+			const uint8_t *buf;
+			size_t len;
+			void (*release)(const uint8_t *buf, size_t len);
+		} owned_data;
+
 		const char *error;
 
 		/** \todo Use nsurl */
@@ -123,6 +136,9 @@ nserror fetch_init(void);
  * FETCH_FINISHED. Alternatively, FETCH_ERROR indicates an error occurred:
  * data contains an error message. FETCH_REDIRECT may replace the FETCH_HEADER,
  * FETCH_DATA, FETCH_FINISHED sequence if the server sends a replacement URL.
+ * FETCH_DATA_OWNED may be sent in place of FETCH_DATA by fetchers which
+ * already hold the data in a heap buffer of their own; the buffer is handed
+ * over rather than copied.
  *
  */
 struct fetch *fetch_start(nsurl *url, nsurl *referer,
@@ -179,6 +195,48 @@ long fetch_http_code(struct fetch *fetch);
  */
 bool fetch_get_verifiable(struct fetch *fetch);
 
+/** Fetch queue statistics */
+struct fetch_statistics {
+	unsigned int active;	/**< Number of active fetches */
+	unsigned int queued;	/**< Number of queued fetches */
+	unsigned int dispatched; /**< Fetches taken from the queue so far */
+	uint64_t wait_time;	/**< Total time dispatched fetches were queued,
+				     in microseconds */
+	uint64_t wait_max;	/**< Longest time a dispatched fetch was
+				     queued, in microseconds */
+};
+
+/** Fetch queue statistics for a host */
+struct fetch_host_statistics {
+	lwc_string *host;	/**< Host, or NULL for fetches without one */
+	unsigned int active;	/**< Number of active fetches */
+	unsigned int queued;	/**< Number of queued fetches */
+	uint64_t wait_max;	/**< Time the longest queued fetch has waited,
+				     in microseconds */
+};
+
+/**
+ * Get fetch queue statistics
+ *
+ * \param stats  Updated with current statistics
+ */
+void fetch_get_statistics(struct fetch_statistics *stats);
+
+/**
+ * Get fetch queue statistics for each host with active or queued fetches
+ *
+ * There are never more hosts than the total of active and queued fetches
+ * given by fetch_get_statistics().
+ *
+ * \param stats  Array to fill with statistics, one entry per host; the
+ *               host strings are not referenced and are only valid until
+ *               the next poll
+ * \param size   Number of entries in array
+ * \return Number of entries filled
+ */
+unsigned int fetch_get_host_statistics(struct fetch_host_statistics *stats,
+		unsigned int size);
+
 /**
  * Free a linked list of fetch_multipart_data.
  *
@@ -35,6 +35,7 @@
 #include <strings.h>
 #include <time.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <dirent.h>
 #include <limits.h>
 #include <stdarg.h>
@@ -45,6 +46,8 @@
 #include "content/dirlist.h"
 #include "content/fetch.h"
 #include "content/fetchers/about.h"
+#include "content/hlcache.h"
+#include "content/llcache.h"
 #include "content/urldb.h"
 #include "desktop/netsurf.h"
 #include "utils/nsoption.h"
@@ -55,6 +58,7 @@
 #include "utils/utils.h"
 #include "utils/ring.h"
 #include "utils/testament.h"
+#include "utils/timing.h"
 #include "image/image_cache.h"
 
 struct fetch_about_context;
@@ -299,6 +303,462 @@ fetch_about_imagecache_handler_aborted:
 	return false;
 }
 
+/**
+ * Calculate a percentage of a total
+ */
+static unsigned int fetch_about_percent(unsigned int count, unsigned int total)
+{
+	return (total > 0) ? (unsigned int) ((uint64_t) count * 100 / total) : 0;
+}
+
+/**
+ * Generate the text of the cache about page
+ *
+ * \param ctx The fetcher context.
+ * \return true if handled false if aborted.
+ */
+static bool fetch_about_cache_handler(struct fetch_about_context *ctx)
+{
+	static const char *type_names[HLCACHE_STATISTICS_TYPES] = {
+		"HTML", "Text", "CSS", "Image", "Plugin", "Theme", "Script"
+	};
+	struct llcache_statistics llstats;
+	struct hlcache_statistics hlstats;
+	unsigned int retrievals;
+	unsigned int type;
+	fetch_msg msg;
+	char buffer[4096]; /* output buffer */
+	int code = 200;
+	int slen;
+
+	llcache_get_statistics(&llstats);
+	hlcache_get_statistics(&hlstats);
+
+	/* content is going to return ok */
+	fetch_set_http_code(ctx->fetchh, code);
+
+	/* content type */
+	if (fetch_about_send_header(ctx, "Content-Type: text/html"))
+		goto fetch_about_cache_handler_aborted;
+
+	msg.type = FETCH_DATA;
+	msg.data.header_or_data.buf = (const uint8_t *) buffer;
+
+	retrievals = llstats.hits + llstats.revalidations + llstats.misses;
+
+	/* page head and low level cache */
+	slen = snprintf(buffer, sizeof buffer,
+			"<html>\n<head>\n"
+			"<title>NetSurf Browser Cache Status</title>\n"
+			"<link rel=\"stylesheet\" type=\"text/css\" "
+			"href=\"resource:internal.css\">\n"
+			"</head>\n"
+			"<body id =\"configlist\">\n"
+			"<p class=\"banner\">"
+			"<a href=\"http://www.netsurf-browser.org/\">"
+			"<img src=\"resource:netsurf.png\" alt=\"NetSurf\"></a>"
+			"</p>\n"
+			"<h1>NetSurf Browser Cache Status</h1>\n"
+			"<h2>Source data</h2>\n"
+			"<p>Total size %zu of limit %zu</p>\n"
+			"<p>Cacheable objects %u (%u fresh, %u stale)</p>\n"
+			"<p>Uncacheable objects %u</p>\n"
+			"<p>Retrievals %u: %u hit (%u%%), %u revalidated "
+			"(%u%%, %u unmodified), %u miss (%u%%)</p>\n",
+			llstats.size, llstats.limit,
+			llstats.cached, llstats.fresh, llstats.stale,
+			llstats.uncached,
+			retrievals,
+			llstats.hits,
+			fetch_about_percent(llstats.hits, retrievals),
+			llstats.revalidations,
+			fetch_about_percent(llstats.revalidations, retrievals),
+			llstats.not_modified,
+			llstats.misses,
+			fetch_about_percent(llstats.misses, retrievals));
+
+	/* high level cache */
+	slen += snprintf(buffer + slen, sizeof buffer - slen,
+			"<h2>Contents</h2>\n"
+			"<p>Total size %zu in %u contents</p>\n"
+			"<p>Retrievals %u: %u shared (%u%%), %u new</p>\n"
+			"<table class=\"config\">\n"
+			"<tr><th>Type</th><th>Contents</th><th>Unused</th>"
+			"<th>Users</th><th>Size</th></tr>\n",
+			hlstats.size, hlstats.contents,
+			hlstats.hits + hlstats.misses,
+			hlstats.hits,
+			fetch_about_percent(hlstats.hits,
+					hlstats.hits + hlstats.misses),
+			hlstats.misses);
+
+	for (type = 0; type < HLCACHE_STATISTICS_TYPES; type++) {
+		const struct hlcache_type_statistics *t = &hlstats.types[type];
+
+		slen += snprintf(buffer + slen, sizeof buffer - slen,
+				"<tr><th>%s</th><td>%u</td><td>%u</td>"
+				"<td>%u</td><td>%zu</td></tr>\n",
+				type_names[type], t->contents, t->unused,
+				t->users, t->size);
+	}
+
+	slen += snprintf(buffer + slen, sizeof buffer - slen,
+			"</table>\n"
+			"<p>Image cache details are shown by "
+			"<a href=\"about:imagecache\">about:imagecache</a>.</p>\n"
+			"</body>\n</html>\n");
+	if (slen >= (int) (sizeof(buffer)))
+		goto fetch_about_cache_handler_aborted; /* overflow */
+
+	msg.data.header_or_data.len = slen;
+	if (fetch_about_send_callback(&msg, ctx))
+		goto fetch_about_cache_handler_aborted;
+
+	msg.type = FETCH_FINISHED;
+	fetch_about_send_callback(&msg, ctx);
+
+	return true;
+
+fetch_about_cache_handler_aborted:
+	return false;
+}
+
+/**
+ * Generate the text of the fetch about page
+ *
+ * \param ctx The fetcher context.
+ * \return true if handled false if aborted.
+ */
+static bool fetch_about_fetch_handler(struct fetch_about_context *ctx)
+{
+	struct fetch_statistics stats;
+	struct fetch_host_statistics *hosts = NULL;
+	unsigned int host_count = 0;
+	unsigned int entry = 0;
+	fetch_msg msg;
+	char buffer[2048]; /* output buffer */
+	int code = 200;
+	int slen;
+	int res;
+
+	fetch_get_statistics(&stats);
+
+	/* there are no more hosts than fetches */
+	if (stats.active + stats.queued > 0) {
+		hosts = malloc((stats.active + stats.queued) *
+				sizeof(struct fetch_host_statistics));
+		if (hosts != NULL)
+			host_count = fetch_get_host_statistics(hosts,
+					stats.active + stats.queued);
+	}
+
+	/* content is going to return ok */
+	fetch_set_http_code(ctx->fetchh, code);
+
+	/* content type */
+	if (fetch_about_send_header(ctx, "Content-Type: text/html"))
+		goto fetch_about_fetch_handler_aborted;
+
+	msg.type = FETCH_DATA;
+	msg.data.header_or_data.buf = (const uint8_t *) buffer;
+
+	/* page head and queue summary */
+	slen = snprintf(buffer, sizeof buffer,
+			"<html>\n<head>\n"
+			"<title>NetSurf Browser Fetch Status</title>\n"
+			"<link rel=\"stylesheet\" type=\"text/css\" "
+			"href=\"resource:internal.css\">\n"
+			"</head>\n"
+			"<body id =\"configlist\">\n"
+			"<p class=\"banner\">"
+			"<a href=\"http://www.netsurf-browser.org/\">"
+			"<img src=\"resource:netsurf.png\" alt=\"NetSurf\"></a>"
+			"</p>\n"
+			"<h1>NetSurf Browser Fetch Status</h1>\n"
+			"<p>Active fetches %u (limit %d, %d per host)</p>\n"
+			"<p>Queued fetches %u</p>\n"
+			"<p>Fetches started %u, queued for %llums on average "
+			"and at most %llums</p>\n"
+			"<table class=\"config\">\n"
+			"<tr><th>Host</th><th>Active</th><th>Queued</th>"
+			"<th>Longest wait (ms)</th></tr>\n",
+			stats.active, nsoption_int(max_fetchers),
+			nsoption_int(max_fetchers_per_host),
+			stats.queued,
+			stats.dispatched,
+			(unsigned long long) ((stats.dispatched > 0) ?
+				stats.wait_time / stats.dispatched / 1000 : 0),
+			(unsigned long long) (stats.wait_max / 1000));
+	if (slen >= (int) (sizeof(buffer)))
+		goto fetch_about_fetch_handler_aborted; /* overflow */
+
+	/* hosts with active or queued fetches */
+	while (entry < host_count) {
+		const struct fetch_host_statistics *host = &hosts[entry];
+
+		res = snprintf(buffer + slen, sizeof buffer - slen,
+				"<tr><th>%s</th><td>%u</td><td>%u</td>"
+				"<td>%llu</td></tr>\n",
+				(host->host != NULL) ?
+					lwc_string_data(host->host) : "(none)",
+				host->active, host->queued,
+				(unsigned long long) (host->wait_max / 1000));
+
+		if (res >= (int) (sizeof buffer - slen)) {
+			if (slen == 0) {
+				/* entry too long for buffer, skip it */
+				entry++;
+				continue;
+			}
+
+			/* last entry would not fit in buffer, submit buffer */
+			msg.data.header_or_data.len = slen;
+			if (fetch_about_send_callback(&msg, ctx))
+				goto fetch_about_fetch_handler_aborted;
+			slen = 0;
+		} else {
+			/* normal addition */
+			slen += res;
+			entry++;
+		}
+	}
+
+	if (slen > 0) {
+		msg.data.header_or_data.len = slen;
+		if (fetch_about_send_callback(&msg, ctx))
+			goto fetch_about_fetch_handler_aborted;
+	}
+
+	slen = snprintf(buffer, sizeof buffer,
+			"</table>\n</body>\n</html>\n");
+
+	msg.data.header_or_data.len = slen;
+	if (fetch_about_send_callback(&msg, ctx))
+		goto fetch_about_fetch_handler_aborted;
+
+	msg.type = FETCH_FINISHED;
+	fetch_about_send_callback(&msg, ctx);
+
+	free(hosts);
+
+	return true;
+
+fetch_about_fetch_handler_aborted:
+	free(hosts);
+
+	return false;
+}
+
+/** Number of recent phase runs listed by about:timing */
+#define ABOUT_TIMING_RECENT 100
+
+/**
+ * Generate the text of the timing about page
+ *
+ * \param ctx The fetcher context.
+ * \return true if handled false if aborted.
+ */
+static bool fetch_about_timing_handler(struct fetch_about_context *ctx)
+{
+	fetch_msg msg;
+	char buffer[2048]; /* output buffer */
+	int code = 200;
+	int slen;
+	unsigned int entry = 0;
+	enum timing_phase phase;
+	int res = 0;
+
+	/* content is going to return ok */
+	fetch_set_http_code(ctx->fetchh, code);
+
+	/* content type */
+	if (fetch_about_send_header(ctx, "Content-Type: text/html"))
+		goto fetch_about_timing_handler_aborted;
+
+	msg.type = FETCH_DATA;
+	msg.data.header_or_data.buf = (const uint8_t *) buffer;
+
+	/* page head and phase totals */
+	slen = snprintf(buffer, sizeof buffer,
+			"<html>\n<head>\n"
+			"<title>NetSurf Browser Timing</title>\n"
+			"<link rel=\"stylesheet\" type=\"text/css\" "
+			"href=\"resource:internal.css\">\n"
+			"</head>\n"
+			"<body id =\"configlist\">\n"
+			"<p class=\"banner\">"
+			"<a href=\"http://www.netsurf-browser.org/\">"
+			"<img src=\"resource:netsurf.png\" alt=\"NetSurf\"></a>"
+			"</p>\n"
+			"<h1>NetSurf Browser Timing</h1>\n"
+			"<p>Times are in microseconds. A trace of recent "
+			"phases is available as "
+			"<a href=\"about:timing.json\">about:timing.json</a>."
+			"</p>\n"
+			"<table class=\"config\">\n"
+			"<tr><th>Phase</th><th>Count</th><th>Total</th>"
+			"<th>Mean</th><th>Max</th></tr>\n");
+
+	for (phase = 0; phase != TIMING_PHASE_COUNT; phase++) {
+		struct timing_totals totals;
+
+		timing_get(phase, &totals);
+
+		slen += snprintf(buffer + slen, sizeof buffer - slen,
+				"<tr><th>%s</th><td>%u</td><td>%llu</td>"
+				"<td>%llu</td><td>%llu</td></tr>\n",
+				timing_phase_name(phase), totals.count,
+				(unsigned long long) totals.time,
+				(unsigned long long) (totals.count > 0 ?
+					totals.time / totals.count : 0),
+				(unsigned long long) totals.max);
+	}
+
+	slen += snprintf(buffer + slen, sizeof buffer - slen,
+			"</table>\n"
+			"<h2>Recent phases</h2>\n"
+			"<table class=\"config\">\n"
+			"<tr><th>Phase</th><th>Start</th><th>Duration</th>"
+			"<th>URL</th></tr>\n");
+	if (slen >= (int) (sizeof(buffer)))
+		goto fetch_about_timing_handler_aborted; /* overflow */
+
+	msg.data.header_or_data.len = slen;
+	if (fetch_about_send_callback(&msg, ctx))
+		goto fetch_about_timing_handler_aborted;
+
+	/* recent phase runs, most recent first */
+	slen = 0;
+	while (entry < ABOUT_TIMING_RECENT) {
+		res = timing_trace_snentryf(buffer + slen, sizeof buffer - slen,
+				entry,
+				"<tr><th>%n</th><td>%s</td><td>%d</td>"
+				"<td>%H</td></tr>\n");
+		if (res <= 0)
+			break; /* last entry */
+
+		if (res >= (int) (sizeof buffer - slen)) {
+			if (slen == 0) {
+				/* entry too long for buffer, skip it */
+				entry++;
+				continue;
+			}
+
+			/* last entry would not fit in buffer, submit buffer */
+			msg.data.header_or_data.len = slen;
+			if (fetch_about_send_callback(&msg, ctx))
+				goto fetch_about_timing_handler_aborted;
+			slen = 0;
+		} else {
+			/* normal addition */
+			slen += res;
+			entry++;
+		}
+	}
+
+	if (slen > 0) {
+		msg.data.header_or_data.len = slen;
+		if (fetch_about_send_callback(&msg, ctx))
+			goto fetch_about_timing_handler_aborted;
+	}
+
+	slen = snprintf(buffer, sizeof buffer,
+			"</table>\n</body>\n</html>\n");
+
+	msg.data.header_or_data.len = slen;
+	if (fetch_about_send_callback(&msg, ctx))
+		goto fetch_about_timing_handler_aborted;
+
+	msg.type = FETCH_FINISHED;
+	fetch_about_send_callback(&msg, ctx);
+
+	return true;
+
+fetch_about_timing_handler_aborted:
+	return false;
+}
+
+/**
+ * Generate the recent phases as a trace event file
+ *
+ * The output can be loaded into Chrome's about:tracing viewer.
+ *
+ * \param ctx The fetcher context.
+ * \return true if handled false if aborted.
+ */
+static bool fetch_about_timing_json_handler(struct fetch_about_context *ctx)
+{
+	fetch_msg msg;
+	char buffer[2048]; /* output buffer */
+	int code = 200;
+	int slen;
+	unsigned int entry = 0;
+	int res = 0;
+	bool first = true;
+	const char *event = ",\n{\"name\":\"%n\",\"cat\":\"netsurf\","
+			"\"ph\":\"X\",\"ts\":%s,\"dur\":%d,"
+			"\"pid\":1,\"tid\":1,\"args\":{\"url\":\"%J\"}}";
+
+	/* content is going to return ok */
+	fetch_set_http_code(ctx->fetchh, code);
+
+	/* content type */
+	if (fetch_about_send_header(ctx, "Content-Type: application/json"))
+		goto fetch_about_timing_json_handler_aborted;
+
+	msg.type = FETCH_DATA;
+	msg.data.header_or_data.buf = (const uint8_t *) buffer;
+
+	slen = snprintf(buffer, sizeof buffer, "{\"traceEvents\":[\n");
+
+	do {
+		/* events after the first are preceded by a separator */
+		res = timing_trace_snentryf(buffer + slen, sizeof buffer - slen,
+				entry, event + (first ? 2 : 0));
+		if (res <= 0)
+			break; /* last entry */
+
+		if (res >= (int) (sizeof buffer - slen)) {
+			if (slen == 0) {
+				/* entry too long for buffer, skip it */
+				entry++;
+				continue;
+			}
+
+			/* last entry would not fit in buffer, submit buffer */
+			msg.data.header_or_data.len = slen;
+			if (fetch_about_send_callback(&msg, ctx))
+				goto fetch_about_timing_json_handler_aborted;
+			slen = 0;
+		} else {
+			/* normal addition */
+			slen += res;
+			entry++;
+			first = false;
+		}
+	} while (res > 0);
+
+	if (slen > 0) {
+		msg.data.header_or_data.len = slen;
+		if (fetch_about_send_callback(&msg, ctx))
+			goto fetch_about_timing_json_handler_aborted;
+	}
+
+	slen = snprintf(buffer, sizeof buffer, "\n]}\n");
+
+	msg.data.header_or_data.len = slen;
+	if (fetch_about_send_callback(&msg, ctx))
+		goto fetch_about_timing_json_handler_aborted;
+
+	msg.type = FETCH_FINISHED;
+	fetch_about_send_callback(&msg, ctx);
+
+	return true;
+
+fetch_about_timing_json_handler_aborted:
+	return false;
+}
+
 /** Handler to generate about:config page */
 static bool fetch_about_config_handler(struct fetch_about_context *ctx)
 {
@@ -599,9 +1059,20 @@ struct about_handlers about_handler_list[] = {
 			fetch_about_about_handler, true },
 	{ "logo", SLEN("logo"), NULL,
 			fetch_about_logo_handler, true },
+	/* details about the caches */
+	{ "cache", SLEN("cache"), NULL,
+			fetch_about_cache_handler, true },
 	/* details about the image cache */
 	{ "imagecache", SLEN("imagecache"), NULL,
 			fetch_about_imagecache_handler, true },
+	/* details about the fetch queue */
+	{ "fetch", SLEN("fetch"), NULL,
+			fetch_about_fetch_handler, true },
+	/* time spent in content processing phases */
+	{ "timing", SLEN("timing"), NULL,
+			fetch_about_timing_handler, true },
+	{ "timing.json", SLEN("timing.json"), NULL,
+			fetch_about_timing_json_handler, true },
 	/* The default blank page */
 	{ "blank", SLEN("blank"), NULL,
 			fetch_about_blank_handler, true } 
@@ -25,8 +25,6 @@
 #include <strings.h>
 #include <time.h>
 
-#include <curl/curl.h>		/* for URL unescaping functions */
-
 #include <libwapcaplet/libwapcaplet.h>
 
 #include "utils/config.h"
@@ -45,7 +43,7 @@
 
 struct fetch_data_context {
 	struct fetch *parent_fetch;
-	char *url;
+	nsurl *url;
 	char *mimetype;
 	char *data;
 	size_t datalen;
@@ -59,21 +57,15 @@ struct fetch_data_context {
 
 static struct fetch_data_context *ring = NULL;
 
-static CURL *curl;
-
 static bool fetch_data_initialise(lwc_string *scheme)
 {
 	LOG(("fetch_data_initialise called for %s", lwc_string_data(scheme)));
-	if ( (curl = curl_easy_init()) == NULL)
-		return false;
-	else
-		return true;
+	return true;
 }
 
 static void fetch_data_finalise(lwc_string *scheme)
 {
 	LOG(("fetch_data_finalise called for %s", lwc_string_data(scheme)));
-	curl_easy_cleanup(curl);
 }
 
 static bool fetch_data_can_fetch(const nsurl *url)
@@ -92,14 +84,7 @@ static void *fetch_data_setup(struct fetch *parent_fetch, nsurl *url,
 		return NULL;
 		
 	ctx->parent_fetch = parent_fetch;
-
-	/* TODO: keep as nsurl to avoid copy */
-	ctx->url = malloc(nsurl_length(url) + 1);
-	if (ctx->url == NULL) {
-		free(ctx);
-		return NULL;
-	}
-	memcpy(ctx->url, nsurl_access(url), nsurl_length(url) + 1);
+	ctx->url = nsurl_ref(url);
 
 	RING_INSERT(ring, ctx);
 	
@@ -115,7 +100,7 @@ static void fetch_data_free(void *ctx)
 {
 	struct fetch_data_context *c = ctx;
 
-	free(c->url);
+	nsurl_unref(c->url);
 	free(c->data);
 	free(c->mimetype);
 	RING_REMOVE(ring, c);
@@ -141,23 +126,91 @@ static void fetch_data_send_callback(const fetch_msg *msg,
 	c->locked = false;
 }
 
+static void fetch_data_release(const uint8_t *buf, size_t len)
+{
+	free((void *) buf);
+}
+
+/**
+ * Get the value of a hexadecimal digit
+ *
+ * \param c  Character to consider
+ * \return value of digit, or -1 if c is not a hexadecimal digit
+ */
+static int fetch_data_hex_value(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/**
+ * URL unescape data
+ *
+ * \param data  Data to unescape
+ * \param len   Length of data
+ * \param out   Buffer of at least len bytes to receive the result
+ * \return length of unescaped data
+ *
+ * Invalid escapes are copied unchanged.
+ */
+static size_t fetch_data_unescape(const char *data, size_t len, char *out)
+{
+	const char *end = data + len;
+	char *o = out;
+
+	while (data < end) {
+		const char *pct = memchr(data, '%', end - data);
+		int hi, lo;
+
+		if (pct == NULL)
+			pct = end;
+
+		/* Copy the run of unescaped data */
+		memcpy(o, data, pct - data);
+		o += pct - data;
+		data = pct;
+
+		if (data == end)
+			break;
+
+		if (end - data >= 3 &&
+				(hi = fetch_data_hex_value(data[1])) >= 0 &&
+				(lo = fetch_data_hex_value(data[2])) >= 0) {
+			*o++ = (hi << 4) | lo;
+			data += 3;
+		} else {
+			*o++ = *data++;
+		}
+	}
+
+	return o - out;
+}
+
 static bool fetch_data_process(struct fetch_data_context *c)
 {
 	fetch_msg msg;
-	char *params;
-	char *comma;
-	char *unescaped;
-        int templen;
+	const char *url = nsurl_access(c->url);
+	const char *params;
+	const char *comma;
+	const char *data;
+	char *unescaped = NULL;
+	size_t len;
 	
+
 	/* format of a data: URL is:
 	 *   data:[<mimetype>][;base64],<data>
 	 * The mimetype is optional.  If it is missing, the , before the
 	 * data must still be there.
 	 */
 	
-	LOG(("url: %.140s", c->url));
+	LOG(("url: %.140s", url));
 	
-	if (strlen(c->url) < 6) {
+	if (nsurl_length(c->url) < 6) {
 		/* 6 is the minimum possible length (data:,) */
 		msg.type = FETCH_ERROR;
 		msg.data.error = "Malformed data: URL";
@@ -166,7 +219,7 @@ static bool fetch_data_process(struct fetch_data_context *c)
 	}
 	
 	/* skip the data: part */
-	params = c->url + SLEN("data:");
+	params = url + SLEN("data:");
 	
 	/* find the comma */
 	if ( (comma = strchr(params, ',')) == NULL) {
@@ -199,44 +252,64 @@ static bool fetch_data_process(struct fetch_data_context *c)
 		c->base64 = false;
 	}
 	
+	data = comma + 1;
+	len = nsurl_length(c->url) - (data - url);
+
 	/* we URL unescape the data first, just incase some insane page
 	 * decides to nest URL and base64 encoding.  Like, say, Acid2.
+	 * Escapes are rare, so the data is usually decoded straight from
+	 * the URL.
 	 */
-        templen = c->datalen;
-        unescaped = curl_easy_unescape(curl, comma + 1, 0, &templen);
-        c->datalen = templen;
-        if (unescaped == NULL) {
-		msg.type = FETCH_ERROR;
-		msg.data.error = "Unable to URL decode data: URL";
-		fetch_data_send_callback(&msg, c);
-		return false;
+	if (memchr(data, '%', len) != NULL) {
+		unescaped = malloc(len > 0 ? len : 1);
+		if (unescaped == NULL) {
+			msg.type = FETCH_ERROR;
+			msg.data.error = "Unable to URL decode data: URL";
+			fetch_data_send_callback(&msg, c);
+			return false;
+		}
+		len = fetch_data_unescape(data, len, unescaped);
+		data = unescaped;
 	}
 	
 	if (c->base64) {
-		c->data = malloc(c->datalen); /* safe: always gets smaller */
-		if (base64_decode(unescaped, c->datalen, c->data,
+		/* safe: always gets smaller */
+		c->datalen = len / 4 * 3 + 3;
+		c->data = malloc(c->datalen);
+		if (c->data == NULL) {
+			msg.type = FETCH_ERROR;
+			msg.data.error =
+				"Unable to allocate memory for data: URL";
+			fetch_data_send_callback(&msg, c);
+			free(unescaped);
+			return false;
+		}
+		if (base64_decode(data, len, c->data,
 				&(c->datalen)) == false) {
 			msg.type = FETCH_ERROR;
 			msg.data.error = "Unable to Base64 decode data: URL";
 			fetch_data_send_callback(&msg, c);
-			curl_free(unescaped);
+			free(unescaped);
 			return false;
 		}
+		free(unescaped);
+	} else if (unescaped != NULL) {
+		/* the unescaped copy is the data */
+		c->data = unescaped;
+		c->datalen = len;
 	} else {
-		c->data = malloc(c->datalen);
+		c->data = malloc(len > 0 ? len : 1);
 		if (c->data == NULL) {
 			msg.type = FETCH_ERROR;
 			msg.data.error =
 				"Unable to allocate memory for data: URL";
 			fetch_data_send_callback(&msg, c);
-			curl_free(unescaped);
 			return false;
 		}
-		memcpy(c->data, unescaped, c->datalen);
+		memcpy(c->data, data, len);
+		c->datalen = len;
 	}
 	
-	curl_free(unescaped);
-	
 	return true;
 }
 
@@ -291,10 +364,15 @@ static void fetch_data_poll(lwc_string *scheme)
 			}
 
 			if (c->aborted == false) {
-				msg.type = FETCH_DATA;
-				msg.data.header_or_data.buf = 
+				/* Hand the decoded data over, so the cache
+				 * uses it directly */
+				msg.type = FETCH_DATA_OWNED;
+				msg.data.owned_data.buf = 
 						(const uint8_t *) c->data;
-				msg.data.header_or_data.len = c->datalen;
+				msg.data.owned_data.len = c->datalen;
+				msg.data.owned_data.release =
+						fetch_data_release;
+				c->data = NULL;
 				fetch_data_send_callback(&msg, c);
 			}
 
@@ -303,7 +381,8 @@ static void fetch_data_poll(lwc_string *scheme)
 				fetch_data_send_callback(&msg, c);
 			}
 		} else {
-			LOG(("Processing of %s failed!", c->url));
+			LOG(("Processing of %s failed!",
+					nsurl_access(c->url)));
 
 			/* Ensure that we're unlocked here. If we aren't, 
 			 * then fetch_data_process() is broken.
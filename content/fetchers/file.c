@@ -36,10 +36,6 @@
 
 #include "utils/config.h"
 
-#ifdef HAVE_MMAP
-#include <sys/mman.h>
-#endif
-
 #include <libwapcaplet/libwapcaplet.h>
 
 #include "content/dirlist.h"
@@ -57,9 +53,6 @@
 #include "utils/utils.h"
 #include "utils/ring.h"
 
-/* Maximum size of read buffer */
-#define FETCH_FILE_MAX_BUF_SIZE (1024 * 1024)
-
 /** Context for a fetch */
 struct fetch_file_context {
 	struct fetch_file_context *r_next, *r_prev;
@@ -254,16 +247,24 @@ fetch_file_process_error_aborted:
 }
 
 
+/** Release a file buffer handed over to the fetch's user */
+static void fetch_file_release_buffer(const uint8_t *buf, size_t len)
+{
+	free((void *) buf);
+}
+
 /** Process object as a regular file */
 static void fetch_file_process_plain(struct fetch_file_context *ctx,
 				     struct stat *fdstat)
 {
-#ifdef HAVE_MMAP
 	fetch_msg msg;
 	char *buf = NULL;
 	size_t buf_size;
 
-	int fd; /**< The file descriptor of the object */
+	size_t tot_read = 0;
+	size_t res;
+
+	FILE *infile;
 
 	/* Check if we can just return not modified */
 	if (ctx->file_etag != 0 && ctx->file_etag == fdstat->st_mtime) {
@@ -273,8 +274,8 @@ static void fetch_file_process_plain(struct fetch_file_context *ctx,
 		return;
 	}
 
-	fd = open(ctx->path, O_RDONLY);
-	if (fd < 0) {
+	infile = fopen(ctx->path, "rb");
+	if (infile == NULL) {
 		/* process errors as appropriate */
 		fetch_file_process_error(ctx,
 				fetch_file_errno_to_http_code(errno));
@@ -284,14 +285,16 @@ static void fetch_file_process_plain(struct fetch_file_context *ctx,
 	/* set buffer size */
 	buf_size = fdstat->st_size;
 
-	/* allocate the buffer storage */
+	/* allocate the buffer storage for the whole file, which is handed
+	 * over to become the cache's copy */
 	if (buf_size > 0) {
-		buf = mmap(NULL, buf_size, PROT_READ, MAP_SHARED, fd, 0);
-		if (buf == MAP_FAILED) {
+		buf = malloc(buf_size);
+		if (buf == NULL) {
 			msg.type = FETCH_ERROR;
-			msg.data.error = "Unable to map memory for file data buffer";
+			msg.data.error =
+				"Unable to allocate memory for file data buffer";
 			fetch_file_send_callback(&msg, ctx);
-			close(fd);
+			fclose(infile);
 			return;
 		}
 	}
@@ -299,86 +302,6 @@ static void fetch_file_process_plain(struct fetch_file_context *ctx,
 	/* fetch is going to be successful */
 	fetch_set_http_code(ctx->fetchh, 200);
 
-	/* Any callback can result in the fetch being aborted.
-	 * Therefore, we _must_ check for this after _every_ call to
-	 * fetch_file_send_callback().
-	 */
-
-	/* content type */
-	if (fetch_file_send_header(ctx, "Content-Type: %s", 
-			guit->fetch->filetype(ctx->path)))
-		goto fetch_file_process_aborted;
-
-	/* content length */
-	if (fetch_file_send_header(ctx, "Content-Length: %"SSIZET_FMT, fdstat->st_size))
-		goto fetch_file_process_aborted;
-
-	/* create etag */
-	if (fetch_file_send_header(ctx, "ETag: \"%10" PRId64 "\"",
-			(int64_t) fdstat->st_mtime))
-		goto fetch_file_process_aborted;
-
-
-	msg.type = FETCH_DATA;
-	msg.data.header_or_data.buf = (const uint8_t *) buf;
-	msg.data.header_or_data.len = buf_size;
-	fetch_file_send_callback(&msg, ctx);
-
-	if (ctx->aborted == false) {
-		msg.type = FETCH_FINISHED;
-		fetch_file_send_callback(&msg, ctx);
-	}
-
-fetch_file_process_aborted:
-
-	if (buf != NULL)
-		munmap(buf, buf_size);
-	close(fd);
-#else
-	fetch_msg msg;
-	char *buf;
-	size_t buf_size;
-
-	ssize_t tot_read = 0;
-	ssize_t res;
-
-	FILE *infile;
-
-	/* Check if we can just return not modified */
-	if (ctx->file_etag != 0 && ctx->file_etag == fdstat->st_mtime) {
-		fetch_set_http_code(ctx->fetchh, 304);
-		msg.type = FETCH_NOTMODIFIED;
-		fetch_file_send_callback(&msg, ctx);
-		return;
-	}
-
-	infile = fopen(ctx->path, "rb");
-	if (infile == NULL) {
-		/* process errors as appropriate */
-		fetch_file_process_error(ctx,
-				fetch_file_errno_to_http_code(errno));
-		return;
-	}
-
-	/* set buffer size */
-	buf_size = fdstat->st_size;
-	if (buf_size > FETCH_FILE_MAX_BUF_SIZE)
-		buf_size = FETCH_FILE_MAX_BUF_SIZE;
-
-	/* allocate the buffer storage */
-	buf = malloc(buf_size);
-	if (buf == NULL) {
-		msg.type = FETCH_ERROR;
-		msg.data.error =
-			"Unable to allocate memory for file data buffer";
-		fetch_file_send_callback(&msg, ctx);
-		fclose(infile);
-		return;
-	}
-
-	/* fetch is going to be successful */
-	fetch_set_http_code(ctx->fetchh, 200);
-
 	/* Any callback can result in the fetch being aborted.
 	 * Therefore, we _must_ check for this after _every_ call to
 	 * fetch_file_send_callback().
@@ -399,8 +322,8 @@ fetch_file_process_aborted:
 		goto fetch_file_process_aborted;
 
 	/* main data loop */
-	while (tot_read < fdstat->st_size) {
-		res = fread(buf, 1, buf_size, infile);
+	while (tot_read < buf_size) {
+		res = fread(buf + tot_read, 1, buf_size - tot_read, infile);
 		if (res == 0) {
 			if (feof(infile)) {
 				msg.type = FETCH_ERROR;
@@ -415,13 +338,21 @@ fetch_file_process_aborted:
 			}
 		}
 		tot_read += res;
+	}
 
+	if (buf != NULL) {
+		/* Hand the buffer over, so the cache uses it directly */
+		msg.type = FETCH_DATA_OWNED;
+		msg.data.owned_data.buf = (const uint8_t *) buf;
+		msg.data.owned_data.len = buf_size;
+		msg.data.owned_data.release = fetch_file_release_buffer;
+		buf = NULL;
+	} else {
 		msg.type = FETCH_DATA;
-		msg.data.header_or_data.buf = (const uint8_t *) buf;
-		msg.data.header_or_data.len = res;
-		if (fetch_file_send_callback(&msg, ctx))
-			break;
+		msg.data.header_or_data.buf = NULL;
+		msg.data.header_or_data.len = 0;
 	}
+	fetch_file_send_callback(&msg, ctx);
 
 	if (ctx->aborted == false) {
 		msg.type = FETCH_FINISHED;
@@ -432,7 +363,6 @@ fetch_file_process_aborted:
 
 	fclose(infile);
 	free(buf);
-#endif
 	return;
 }
 
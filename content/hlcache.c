@@ -85,6 +85,9 @@ struct hlcache_s {
 	/** Ring of retrieval contexts */
 	hlcache_retrieval_ctx *retrieval_ctx_ring;
 
+	/** Footprint of contents held by clients for reuse */
+	size_t held_size;
+
 	/* statsistics */
 	unsigned int hit_count;
 	unsigned int miss_count;
@@ -100,47 +103,111 @@ static struct hlcache_s *hlcache = NULL;
 
 
 /**
- * Attempt to clean the cache
+ * Remove an entry from the cache and destroy it
+ *
+ * \param entry  Entry to destroy
  */
-static void hlcache_clean(void *ignored)
+static void hlcache_entry_destroy(hlcache_entry *entry)
+{
+	/* Remove entry from cache */
+	if (entry->prev == NULL)
+		hlcache->content_list = entry->next;
+	else
+		entry->prev->next = entry->next;
+
+	if (entry->next != NULL)
+		entry->next->prev = entry->prev;
+
+	/* Destroy content */
+	if (entry->content != NULL)
+		content_destroy(entry->content);
+
+	/* Destroy entry */
+	free(entry);
+}
+
+/**
+ * Determine if an entry's content is unused and may be destroyed
+ *
+ * \param entry  Entry to consider
+ * \return True if the content has no users and is not loading
+ */
+static bool hlcache_entry_is_unused(hlcache_entry *entry)
+{
+	if (entry->content == NULL)
+		return false;
+
+	if (content__get_status(entry->content) == CONTENT_STATUS_LOADING)
+		return false;
+
+	return content_count_users(entry->content) == 0;
+}
+
+/**
+ * Clean the cache down to a size limit
+ *
+ * \param limit  Upper bound for the size of unused contents to keep
+ *
+ * Unused contents which can never be reused are destroyed.  The
+ * remainder are kept, least recently used first out, until their total
+ * size fits within \a limit.
+ */
+static void hlcache_clean_to(size_t limit)
 {
-	hlcache_entry *entry, *next;
+	hlcache_entry *entry, *next, *last = NULL;
+	size_t unused_size = 0;
 
+	/* Destroy unused contents which can't be found again: unshareable
+	 * ones, those in the error state, and those using stale source
+	 * data (the low-level cache won't return it to a new fetch). */
 	for (entry = hlcache->content_list; entry != NULL; entry = next) {
 		next = entry->next;
 
-		if (entry->content == NULL)
-			continue;
-
-		if (content__get_status(entry->content) ==
-				CONTENT_STATUS_LOADING)
+		if (hlcache_entry_is_unused(entry) == false) {
+			last = entry;
 			continue;
+		}
 
-		if (content_count_users(entry->content) != 0)
+		if (content_is_shareable(entry->content) == false ||
+				content__get_status(entry->content) ==
+						CONTENT_STATUS_ERROR ||
+				llcache_handle_is_fresh(
+						content_get_llcache_handle(
+						entry->content)) == false) {
+			hlcache_entry_destroy(entry);
 			continue;
+		}
 
-		/** \todo This is over-zealous: all unused contents
-		 * will be immediately destroyed. Ideally, we want to
-		 * purge all unused contents that are using stale
-		 * source data, and enough fresh contents such that
-		 * the cache fits in the configured cache size limit.
-		 */
+		unused_size += content__get_footprint(entry->content);
+		last = entry;
+	}
 
-		/* Remove entry from cache */
-		if (entry->prev == NULL)
-			hlcache->content_list = entry->next;
-		else
-			entry->prev->next = entry->next;
+	/* The list is kept in order of use, so evict from its tail */
+	for (entry = last; entry != NULL && unused_size > limit;
+			entry = next) {
+		next = entry->prev;
 
-		if (entry->next != NULL)
-			entry->next->prev = entry->prev;
+		if (hlcache_entry_is_unused(entry) == false)
+			continue;
 
-		/* Destroy content */
-		content_destroy(entry->content);
+		unused_size -= content__get_footprint(entry->content);
 
-		/* Destroy entry */
-		free(entry);
+		hlcache_entry_destroy(entry);
 	}
+}
+
+/**
+ * Attempt to clean the cache
+ */
+static void hlcache_clean(void *ignored)
+{
+	size_t limit = hlcache->params.content_limit;
+
+	/* Contents held by clients for reuse share the limit */
+	if (hlcache->held_size < limit)
+		hlcache_clean_to(limit - hlcache->held_size);
+	else
+		hlcache_clean_to(0);
 
 	/* Attempt to clean the llcache */
 	llcache_clean();
@@ -567,7 +634,10 @@ void hlcache_finalise(void)
 	do {
 		prev_contents = num_contents;
 
-		hlcache_clean(NULL);
+		hlcache_clean_to(0);
+
+		/* Attempt to clean the llcache */
+		llcache_clean();
 
 		for (num_contents = 0, entry = hlcache->content_list;
 				entry != NULL; entry = entry->next) {
@@ -622,6 +692,57 @@ void hlcache_finalise(void)
 	llcache_finalise();
 }
 
+/* See hlcache.h for documentation */
+void hlcache_get_statistics(struct hlcache_statistics *stats)
+{
+	hlcache_entry *entry;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (entry = hlcache->content_list; entry != NULL;
+			entry = entry->next) {
+		size_t size = content__get_footprint(entry->content);
+		uint32_t users = content_count_users(entry->content);
+		content_type type = content__get_type(entry->content);
+		unsigned int index = 0;
+
+		stats->contents++;
+		stats->size += size;
+
+		/* Contents have a single type, so use its bit number */
+		while (index < HLCACHE_STATISTICS_TYPES &&
+				(type & (1 << index)) == 0)
+			index++;
+
+		if (index < HLCACHE_STATISTICS_TYPES) {
+			stats->types[index].contents++;
+			stats->types[index].size += size;
+			stats->types[index].users += users;
+			if (users == 0)
+				stats->types[index].unused++;
+		}
+	}
+
+	stats->hits = hlcache->hit_count;
+	stats->misses = hlcache->miss_count;
+}
+
+/* See hlcache.h for documentation */
+size_t hlcache_get_content_limit(void)
+{
+	if (hlcache == NULL)
+		return 0;
+
+	return hlcache->params.content_limit;
+}
+
+/* See hlcache.h for documentation */
+void hlcache_set_held_size(size_t size)
+{
+	if (hlcache != NULL)
+		hlcache->held_size = size;
+}
+
 /* See hlcache.h for documentation */
 nserror hlcache_poll(void)
 {
@@ -691,9 +812,25 @@ nserror hlcache_handle_retrieve(nsurl *url, uint32_t flags,
 /* See hlcache.h for documentation */
 nserror hlcache_handle_release(hlcache_handle *handle)
 {
-	if (handle->entry != NULL) {
-		content_remove_user(handle->entry->content,
+	hlcache_entry *entry = handle->entry;
+
+	if (entry != NULL) {
+		content_remove_user(entry->content,
 				hlcache_content_callback, handle);
+
+		/* Move newly unused content to the head of the list, so it
+		 * is the last to be evicted */
+		if (content_count_users(entry->content) == 0 &&
+				entry->prev != NULL) {
+			entry->prev->next = entry->next;
+			if (entry->next != NULL)
+				entry->next->prev = entry->prev;
+
+			entry->prev = NULL;
+			entry->next = hlcache->content_list;
+			hlcache->content_list->prev = entry;
+			hlcache->content_list = entry;
+		}
 	} else {
 		RING_ITERATE_START(struct hlcache_retrieval_ctx,
 				   hlcache->retrieval_ctx_ring,
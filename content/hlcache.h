@@ -56,6 +56,32 @@ struct hlcache_parameters {
 	/** The hysteresis allowed round the target size */
 	size_t hysteresis;
 
+	/** The upper bound for the size of unused contents kept for reuse */
+	size_t content_limit;
+
+};
+
+/** Number of content types in high-level cache statistics */
+#define HLCACHE_STATISTICS_TYPES 7
+
+/** High-level cache statistics for contents of one type */
+struct hlcache_type_statistics {
+	unsigned int contents;	/**< Number of contents */
+	unsigned int unused;	/**< Number of contents without users */
+	unsigned int users;	/**< Total users of contents */
+	size_t size;		/**< Total footprint of contents, in bytes */
+};
+
+/** High-level cache statistics */
+struct hlcache_statistics {
+	unsigned int contents;	/**< Number of contents */
+	size_t size;		/**< Total footprint of contents, in bytes */
+	unsigned int hits;	/**< Retrievals which shared a content */
+	unsigned int misses;	/**< Retrievals which created a content */
+
+	/** Contents by type, indexed by the bit number of the
+	 * content_type; CONTENT_HTML is 0 */
+	struct hlcache_type_statistics types[HLCACHE_STATISTICS_TYPES];
 };
 
 /**
@@ -100,6 +126,30 @@ void hlcache_stop(void);
  */
 void hlcache_finalise(void);
 
+/**
+ * Get high-level cache statistics
+ *
+ * \param stats  Updated with current statistics
+ */
+void hlcache_get_statistics(struct hlcache_statistics *stats);
+
+/**
+ * Get the upper bound for the size of contents kept for reuse
+ *
+ * \return The content_limit the cache was initialised with, in bytes
+ */
+size_t hlcache_get_content_limit(void);
+
+/**
+ * Record the size of contents which clients hold for reuse
+ *
+ * \param size  Total footprint of the held contents, in bytes
+ *
+ * Contents held while not displayed, such as pages kept by local history,
+ * count against the content limit, so fewer unused contents are kept.
+ */
+void hlcache_set_held_size(size_t size);
+
 /**
  * Drive the low-level cache poll loop, and attempt to clean the cache.
  * No guarantee is made about what, if any, cache cleaning will occur.
@@ -129,6 +129,9 @@ struct llcache_object {
 	uint8_t *source_data;		/**< Source data for object */
 	size_t source_len;		/**< Byte length of source data */
 	size_t source_alloc;		/**< Allocated size of source buffer */
+	/** Release function for source data handed over by the fetcher, or
+	 * NULL if source data is allocated by the cache */
+	void (*source_release)(const uint8_t *buf, size_t len);
 
 	llcache_object_user *users;	/**< List of users */
 
@@ -158,6 +161,18 @@ struct llcache_s {
 	llcache_object *uncached_objects;
 
 	uint32_t limit;
+
+	/** Retrievals satisfied by a fresh cached object */
+	unsigned int hit_count;
+
+	/** Retrievals which revalidated a stale cached object */
+	unsigned int revalidate_count;
+
+	/** Revalidations which found the cached object unmodified */
+	unsigned int not_modified_count;
+
+	/** Retrievals which needed a full fetch */
+	unsigned int miss_count;
 };
 
 /** low level cache state */
@@ -772,6 +787,26 @@ static nserror llcache_object_fetch(llcache_object *object, uint32_t flags,
 	return llcache_object_refetch(object);
 }
 
+/**
+ * Free the source data of a low-level cache object
+ *
+ * \param object  Object to free source data of
+ */
+static void llcache_object_free_source(llcache_object *object)
+{
+	if (object->source_release != NULL) {
+		object->source_release(object->source_data,
+				object->source_alloc);
+		object->source_release = NULL;
+	} else {
+		free(object->source_data);
+	}
+
+	object->source_data = NULL;
+	object->source_len = 0;
+	object->source_alloc = 0;
+}
+
 /**
  * Destroy a low-level cache object
  *
@@ -791,7 +826,7 @@ static nserror llcache_object_destroy(llcache_object *object)
 #endif
 
 	nsurl_unref(object->url);
-	free(object->source_data);
+	llcache_object_free_source(object);
 
 	if (object->fetch.fetch != NULL) {
 		fetch_abort(object->fetch.fetch);
@@ -1013,6 +1048,7 @@ static nserror llcache_object_retrieve_from_cache(nsurl *url, uint32_t flags,
 	if (newest != NULL && llcache_object_is_fresh(newest)) {
 		/* Found a suitable object, and it's still fresh, so use it */
 		obj = newest;
+		llcache->hit_count++;
 
 #ifdef LLCACHE_TRACE
 		LOG(("Found fresh %p", obj));
@@ -1055,6 +1091,7 @@ static nserror llcache_object_retrieve_from_cache(nsurl *url, uint32_t flags,
 
 		/* Add new object to cache */
 		llcache_object_add_to_list(obj, &llcache->cached_objects);
+		llcache->revalidate_count++;
 	} else {
 		/* No object found; create a new one */
 		/* Create new object */
@@ -1076,6 +1113,7 @@ static nserror llcache_object_retrieve_from_cache(nsurl *url, uint32_t flags,
 
 		/* Add new object to cache */
 		llcache_object_add_to_list(obj, &llcache->cached_objects);
+		llcache->miss_count++;
 	}
 
 	*result = obj;
@@ -1145,6 +1183,7 @@ static nserror llcache_object_retrieve(nsurl *url, uint32_t flags,
 
 		/* Add new object to uncached list */
 		llcache_object_add_to_list(obj, &llcache->uncached_objects);
+		llcache->miss_count++;
 	} else {
 		error = llcache_object_retrieve_from_cache(defragmented_url,
 				flags, referer, post, redirect_count, &obj);
@@ -1387,6 +1426,8 @@ static nserror llcache_fetch_notmodified(llcache_object *object,
 		/* Candidate is now our object */
 		*replacement = object->candidate;
 		object->candidate = NULL;
+
+		llcache->not_modified_count++;
 	} else {
 		/* There was no candidate: retain object */
 		*replacement = object;
@@ -1418,6 +1459,23 @@ static nserror llcache_fetch_notmodified(llcache_object *object,
 static nserror llcache_fetch_process_data(llcache_object *object, const uint8_t *data, 
 		size_t len)
 {
+	/* Data handed over by the fetcher is immutable, so copy it to a
+	 * buffer of our own before appending */
+	if (object->source_release != NULL) {
+		const size_t new_len = object->source_len + len + 64 * 1024;
+		uint8_t *temp = malloc(new_len);
+		if (temp == NULL)
+			return NSERROR_NOMEM;
+
+		memcpy(temp, object->source_data, object->source_len);
+		object->source_release(object->source_data,
+				object->source_alloc);
+		object->source_release = NULL;
+
+		object->source_data = temp;
+		object->source_alloc = new_len;
+	}
+
 	/* Resize source buffer if it's too small */
 	if (object->source_len + len >= object->source_alloc) {
 		const size_t new_len = object->source_len + len + 64 * 1024;
@@ -1436,6 +1494,43 @@ static nserror llcache_fetch_process_data(llcache_object *object, const uint8_t
 	return NSERROR_OK;
 }
 
+/**
+ * Process fetched data handed over by the fetcher
+ *
+ * \param object   Object being fetched
+ * \param data	   Data to process
+ * \param len	   Byte length of data
+ * \param release  Function to release data
+ * \return NSERROR_OK on success, appropriate error otherwise.
+ *
+ * The data becomes the object's source data without copying, unless the
+ * object already has some.  It is released in any case.
+ */
+static nserror llcache_fetch_process_owned_data(llcache_object *object,
+		const uint8_t *data, size_t len,
+		void (*release)(const uint8_t *buf, size_t len))
+{
+	nserror error;
+
+	if (object->source_len == 0) {
+		llcache_object_free_source(object);
+
+		/* Never written through, as the data is immutable */
+		object->source_data = (uint8_t *) data;
+		object->source_len = len;
+		object->source_alloc = len;
+		object->source_release = release;
+
+		return NSERROR_OK;
+	}
+
+	error = llcache_fetch_process_data(object, data, len);
+
+	release(data, len);
+
+	return error;
+}
+
 /**
  * Handle a query response
  *
@@ -1670,6 +1765,7 @@ static void llcache_fetch_callback(const fetch_msg *msg, void *p)
 
 	/* Normal 2xx state machine */
 	case FETCH_DATA:
+	case FETCH_DATA_OWNED:
 		/* Received some data */
 		if (object->fetch.state != LLCACHE_FETCH_DATA) {
 			/* On entry into this state, check if we need to 
@@ -1703,9 +1799,16 @@ static void llcache_fetch_callback(const fetch_msg *msg, void *p)
 
 		object->fetch.state = LLCACHE_FETCH_DATA;
 
-		error = llcache_fetch_process_data(object, 
-				msg->data.header_or_data.buf,
-				msg->data.header_or_data.len);
+		if (msg->type == FETCH_DATA_OWNED) {
+			error = llcache_fetch_process_owned_data(object,
+					msg->data.owned_data.buf,
+					msg->data.owned_data.len,
+					msg->data.owned_data.release);
+		} else {
+			error = llcache_fetch_process_data(object, 
+					msg->data.header_or_data.buf,
+					msg->data.header_or_data.len);
+		}
 		break;
 	case FETCH_FINISHED:
 		/* Finished fetching */
@@ -1715,13 +1818,16 @@ static void llcache_fetch_callback(const fetch_msg *msg, void *p)
 		object->fetch.state = LLCACHE_FETCH_COMPLETE;
 		object->fetch.fetch = NULL;
 
-		/* Shrink source buffer to required size */
-		temp = realloc(object->source_data, 
-				object->source_len);
-		/* If source_len is 0, then temp may be NULL */
-		if (temp != NULL || object->source_len == 0) {
-			object->source_data = temp;
-			object->source_alloc = object->source_len;
+		/* Shrink source buffer to required size, unless it was
+		 * handed over by the fetcher */
+		if (object->source_release == NULL) {
+			temp = realloc(object->source_data, 
+					object->source_len);
+			/* If source_len is 0, then temp may be NULL */
+			if (temp != NULL || object->source_len == 0) {
+				object->source_data = temp;
+				object->source_alloc = object->source_len;
+			}
 		}
 
 		llcache_object_cache_update(object);
@@ -2170,6 +2276,37 @@ static nserror llcache_object_snapshot(llcache_object *object,
  * Public API								      *
  ******************************************************************************/
 
+/* Exported interface documented in llcache.h */
+void llcache_get_statistics(struct llcache_statistics *stats)
+{
+	llcache_object *object;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (object = llcache->cached_objects; object != NULL;
+			object = object->next) {
+		stats->cached++;
+		stats->size += object->source_len + sizeof(*object);
+
+		if (llcache_object_is_fresh(object))
+			stats->fresh++;
+		else
+			stats->stale++;
+	}
+
+	for (object = llcache->uncached_objects; object != NULL;
+			object = object->next) {
+		stats->uncached++;
+		stats->size += object->source_len + sizeof(*object);
+	}
+
+	stats->limit = llcache->limit;
+	stats->hits = llcache->hit_count;
+	stats->revalidations = llcache->revalidate_count;
+	stats->not_modified = llcache->not_modified_count;
+	stats->misses = llcache->miss_count;
+}
+
 /**
  * Attempt to clean the cache
  */
@@ -2575,6 +2712,18 @@ const char *llcache_handle_get_header(const llcache_handle *handle,
 	return NULL;
 }
 
+/* See llcache.h for documentation */
+bool llcache_handle_is_fresh(const llcache_handle *handle)
+{
+	const llcache_object *object = handle->object;
+
+	if (object == NULL || llcache_object_is_fresh(object) == false)
+		return false;
+
+	/* Uncached objects are never found by later retrievals */
+	return llcache_object_in_list(object, llcache->cached_objects);
+}
+
 /* See llcache.h for documentation */
 bool llcache_handle_references_same_object(const llcache_handle *a, 
 		const llcache_handle *b)
@@ -177,6 +177,27 @@ void llcache_finalise(void);
  */
 nserror llcache_poll(void);
 
+/** Low-level cache statistics */
+struct llcache_statistics {
+	unsigned int cached;	/**< Number of cacheable objects */
+	unsigned int uncached;	/**< Number of uncacheable objects */
+	unsigned int fresh;	/**< Cacheable objects usable unvalidated */
+	unsigned int stale;	/**< Cacheable objects needing validation */
+	size_t size;		/**< Total size of objects, in bytes */
+	size_t limit;		/**< Configured size limit, in bytes */
+	unsigned int hits;	/**< Retrievals of fresh objects */
+	unsigned int revalidations; /**< Retrievals of stale objects */
+	unsigned int not_modified; /**< Revalidations which were unmodified */
+	unsigned int misses;	/**< Retrievals needing a full fetch */
+};
+
+/**
+ * Get low-level cache statistics
+ *
+ * \param stats  Updated with current statistics
+ */
+void llcache_get_statistics(struct llcache_statistics *stats);
+
 /**
  * Cause the low-level cache to attempt to perform cleanup.  No
  * guarantees are made as to whether or not cleanups will take
@@ -288,6 +309,14 @@ const uint8_t *llcache_handle_get_source_data(const llcache_handle *handle,
 const char *llcache_handle_get_header(const llcache_handle *handle, 
 		const char *key);
 
+/**
+ * Determine if a handle's object may be returned by later retrievals
+ *
+ * \param handle  Handle to consider
+ * \return True if the object is cached and still fresh, false otherwise
+ */
+bool llcache_handle_is_fresh(const llcache_handle *handle);
+
 /**
  * Determine if the same underlying object is referenced by the given handles
  *
@@ -81,6 +81,35 @@
  * simpler implementation. Entries in this tree comprise pointers to the
  * leaf nodes of the host tree described above.
  *
+ * Nodes in both the host and path trees with many children additionally
+ * index those children in a hash table keyed on the segment, so that
+ * descending the trees does not require a scan of every sibling. Path
+ * nodes which represent an URL are also entered into a global hash table
+ * keyed on the URL's hash, allowing exact URL lookups to bypass the tree
+ * walk entirely.
+ *
+ * The database is saved in a binary format comprising a header, a flat
+ * array of hosts, a flat array of path nodes (each referring to its host
+ * and parent node by index, parents always preceding their children) and
+ * a table of NUL terminated strings referred to by offset. This allows the
+ * trees to be rebuilt directly from a mapping of the file, without parsing
+ * each URL's host and path. Databases in the earlier line based text
+ * format are still loaded, and are migrated the next time the database is
+ * saved.
+ *
+ * Cookie lookup walks the existing host and path trees without inserting
+ * the request URL. The resulting Cookie: header strings are kept in a small
+ * cache keyed on URL, which is invalidated whenever any cookie is added,
+ * replaced or removed, or when one of the matched cookies expires.
+ *
+ * Once the database and cookies have been loaded, changes to them may be
+ * recorded in an append-only journal. Records are buffered and written
+ * periodically from the scheduler, and the journal is replayed when it is
+ * next opened. When the journal grows large, it is compacted by rewriting
+ * the URL and cookie files in full, and truncating it. This bounds the
+ * amount of history lost if the browser is not shut down cleanly, and
+ * removes the need to save the database at exit.
+ *
  * REALLY IMPORTANT NOTE: urldb expects all URLs to be normalised. Use of 
  * non-normalised URLs with urldb will result in undefined behaviour and 
  * potential crashes.
@@ -88,15 +117,18 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include <time.h>
+#include <sys/stat.h>
 
 #include <curl/curl.h>
 
+#include "utils/config.h"
 #include "image/bitmap.h"
 #include "content/content.h"
 #include "content/urldb.h"
@@ -108,6 +140,17 @@
 #include "utils/url.h"
 #include "utils/utils.h"
 #include "utils/bloom.h"
+#include "utils/schedule.h"
+
+#ifdef HAVE_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#ifdef HAVE_FSYNC
+#include <unistd.h>
+#endif
 
 struct cookie_internal_data {
 	char *name;		/**< Cookie name */
@@ -186,6 +229,16 @@ struct path_data {
 	struct path_data *parent;	/**< Parent path segment */
 	struct path_data *children;	/**< Child path segments */
 	struct path_data *last;		/**< Last child */
+
+	unsigned int segment_hash;	/**< Hash of segment */
+	struct path_data *hash_next;	/**< Next in parent's child hash chain */
+	struct path_data **child_hash;	/**< Hash of child segments, or NULL */
+	unsigned int child_hash_size;	/**< Number of chains in child_hash */
+	unsigned int child_count;	/**< Number of child segments */
+
+	struct path_data *url_next;	/**< Next in URL index chain */
+
+	bool journal_dirty;	/**< Awaiting a journal record */
 };
 
 struct host_part {
@@ -207,6 +260,12 @@ struct host_part {
 	struct host_part *prev;	/**< Previous sibling */
 	struct host_part *parent;	/**< Parent host part */
 	struct host_part *children;	/**< Child host parts */
+
+	unsigned int part_hash;		/**< Caseless hash of part */
+	struct host_part *hash_next;	/**< Next in parent's child hash chain */
+	struct host_part **child_hash;	/**< Hash of child parts, or NULL */
+	unsigned int child_hash_size;	/**< Number of chains in child_hash */
+	unsigned int child_count;	/**< Number of child parts */
 };
 
 struct search_node {
@@ -226,13 +285,17 @@ static void urldb_destroy_cookie(struct cookie_internal_data *c);
 static void urldb_destroy_prot_space(struct prot_space_data *space);
 static void urldb_destroy_search_tree(struct search_node *root);
 
-/* Saving */
-static void urldb_save_search_tree(struct search_node *root, FILE *fp);
-static void urldb_count_urls(const struct path_data *root, time_t expiry,
-		unsigned int *count);
-static void urldb_write_paths(const struct path_data *parent,
-		const char *host, FILE *fp, char **path, int *path_alloc,
-		int *path_used, time_t expiry);
+/* Loading and saving */
+struct urldb_save_ctx;
+static nserror urldb_load_binary(const char *filename);
+static bool urldb_write(const char *filename);
+static bool urldb_replace_file(const char *filename,
+		bool (*writer)(const char *filename));
+static bool urldb_save_search_tree(struct search_node *root,
+		struct urldb_save_ctx *ctx);
+static bool urldb_save_paths(const struct path_data *parent,
+		uint32_t host, uint32_t parent_index,
+		struct urldb_save_ctx *ctx);
 
 /* Iteration */
 static bool urldb_iterate_partial_host(struct search_node *root,
@@ -264,6 +327,19 @@ static struct path_data *urldb_add_path_fragment(struct path_data *segment,
 static struct path_data *urldb_find_url(nsurl *url);
 static struct path_data *urldb_match_path(const struct path_data *parent,
 		const char *path, lwc_string *scheme, unsigned short port);
+static struct host_part *urldb_find_host_child(const struct host_part *parent,
+		const char *part, size_t len);
+static struct path_data *urldb_find_path_child(const struct path_data *parent,
+		const char *segment, size_t seglen, lwc_string *scheme,
+		unsigned int port);
+
+/* Child and URL indices */
+static void urldb_host_child_index(struct host_part *parent,
+		struct host_part *child);
+static void urldb_path_child_index(struct path_data *parent,
+		struct path_data *child);
+static void urldb_url_index_add(struct path_data *p);
+static struct path_data *urldb_url_index_find(nsurl *url);
 static struct search_node **urldb_get_search_tree_direct(const char *host);
 static struct search_node *urldb_get_search_tree(const char *host);
 
@@ -297,6 +373,7 @@ static bool urldb_parse_avpair(struct cookie_internal_data *c, char *n,
 static bool urldb_insert_cookie(struct cookie_internal_data *c, 
 		lwc_string *scheme, nsurl *url);
 static void urldb_free_cookie(struct cookie_internal_data *c);
+static void urldb_cookie_cache_flush(void);
 static bool urldb_concat_cookie(struct cookie_internal_data *c, int version,
 		int *used, int *alloc, char **buf);
 static void urldb_delete_cookie_hosts(const char *domain, const char *path, 
@@ -305,10 +382,44 @@ static void urldb_delete_cookie_paths(const char *domain, const char *path,
 		const char *name, struct path_data *parent);
 static void urldb_save_cookie_hosts(FILE *fp, struct host_part *parent);
 static void urldb_save_cookie_paths(FILE *fp, struct path_data *parent);
+static bool urldb_load_cookie_line(char *s, int version);
+static bool urldb_write_cookies(const char *filename);
+
+/* Journal */
+static void urldb_journal_url(struct path_data *p);
+static void urldb_journal_cookie(const struct cookie_internal_data *c,
+		lwc_string *scheme, nsurl *url);
+static void urldb_journal_printf(const char *fmt, ...);
+static bool urldb_sync_file(FILE *fp);
 
 /** Root database handle */
 static struct host_part db_root;
 
+/** Cookies matched for a request */
+struct cookie_match {
+	struct cookie_internal_data **cookies;	/**< Matched cookies */
+	unsigned int count;			/**< Number of matches */
+	unsigned int alloc;			/**< Allocated entries */
+	int version;				/**< Lowest cookie version */
+	time_t expires;		/**< Earliest expiry of a match, or -1 */
+};
+
+/** Cached Cookie: header for an URL */
+struct cookie_cache_entry {
+	nsurl *url;		/**< URL of request, or NULL if unused */
+	bool include_http_only;	/**< HttpOnly cookies were considered */
+	unsigned int generation;	/**< Cookie generation when built */
+	char *header;		/**< Header value, or NULL for no cookies */
+	struct cookie_match match;	/**< Cookies contributing to header */
+};
+
+/** Number of entries in the Cookie: header cache; a power of two */
+#define COOKIE_CACHE_SIZE 64
+static struct cookie_cache_entry cookie_cache[COOKIE_CACHE_SIZE];
+
+/** Incremented whenever the set of cookies changes */
+static unsigned int cookie_generation = 1;
+
 /** Search trees - one per letter + 1 for IPs + 1 for Everything Else */
 #define NUM_SEARCH_TREES 28
 #define ST_IP 0
@@ -325,9 +436,98 @@ static struct search_node *search_trees[NUM_SEARCH_TREES] = {
 #define MIN_COOKIE_FILE_VERSION 100
 #define COOKIE_FILE_VERSION 102
 static int loaded_cookie_file_version;
+/** Format of a cookie in the cookie file and journal */
+#define COOKIE_FILE_LINE "%d\t%s\t%d\t%s\t%d\t%d\t%d\t%d\t%d\t%d\t" \
+		"%s\t%s\t%d\t%s\t%s\t%s\n"
 #define MIN_URL_FILE_VERSION 106
 #define URL_FILE_VERSION 106
 
+/** Binary URL file identifier */
+#define URL_BINARY_FILE_MAGIC "NSURLDB\n"
+#define URL_BINARY_FILE_VERSION 1
+/** Written in native byte order; files from other orders are rejected */
+#define URL_BINARY_FILE_BYTE_ORDER 0x01020304
+/** String offset indicating no string */
+#define URL_BINARY_FILE_NONE 0xffffffff
+
+/** Interval between journal writes, in cs */
+#define URLDB_JOURNAL_INTERVAL 1000
+/** Journal size beyond which it is compacted, in bytes */
+#define URLDB_JOURNAL_COMPACT_SIZE (256 * 1024)
+
+/** Journal of database changes */
+static struct {
+	char *filename;		/**< Journal file, or NULL if not open */
+	char *url_file;		/**< URL file compacted into */
+	char *cookie_file;	/**< Cookie file compacted into */
+
+	char *buffer;		/**< Pending cookie records */
+	size_t used;		/**< Bytes used in buffer */
+	size_t alloc;		/**< Bytes allocated for buffer */
+
+	struct path_data **dirty;	/**< URLs awaiting records */
+	unsigned int dirty_count;	/**< Entries used in dirty */
+	unsigned int dirty_alloc;	/**< Entries allocated for dirty */
+
+	long size;		/**< Size of journal file */
+} urldb_journal;
+
+/** Binary URL file header */
+struct urldb_file_header {
+	char magic[8];		/**< URL_BINARY_FILE_MAGIC */
+	uint32_t byte_order;	/**< URL_BINARY_FILE_BYTE_ORDER */
+	uint32_t version;	/**< URL_BINARY_FILE_VERSION */
+	uint32_t host_count;	/**< Number of host records */
+	uint32_t path_count;	/**< Number of path records */
+	uint32_t string_size;	/**< Size of string table in bytes */
+	uint32_t reserved;
+};
+
+/** Binary URL file host record */
+struct urldb_file_host {
+	uint32_t name;		/**< Host name string */
+};
+
+/** Binary URL file path record */
+struct urldb_file_path {
+	uint32_t host;		/**< Index of host */
+	uint32_t parent;	/**< Index of parent path plus one, or 0
+				 * for a top level segment */
+	uint32_t segment;	/**< Path segment string */
+	uint32_t scheme;	/**< Scheme string */
+	uint32_t url;		/**< URL string, or URL_BINARY_FILE_NONE */
+	uint32_t title;		/**< Title string, or URL_BINARY_FILE_NONE */
+	uint32_t port;		/**< Port, or 0 for the scheme's default */
+	uint32_t visits;	/**< Visit count */
+	uint32_t type;		/**< Content type */
+	uint32_t reserved;
+	int64_t last_visit;	/**< Last visit time */
+};
+
+/** Offset of the host records within a binary URL file */
+#define URL_BINARY_HOSTS_OFFSET sizeof(struct urldb_file_header)
+/** Offset of the path records within a binary URL file */
+#define URL_BINARY_PATHS_OFFSET(hosts) \
+	((URL_BINARY_HOSTS_OFFSET + \
+	(hosts) * sizeof(struct urldb_file_host) + 7) & ~((size_t) 7))
+
+/** State of a save in progress */
+struct urldb_save_ctx {
+	time_t expiry;		/**< URLs last visited before this expire */
+
+	struct urldb_file_host *hosts;	/**< Host records */
+	uint32_t host_count;		/**< Number of host records */
+	uint32_t host_alloc;		/**< Allocated host records */
+
+	struct urldb_file_path *paths;	/**< Path records */
+	uint32_t path_count;		/**< Number of path records */
+	uint32_t path_alloc;		/**< Allocated path records */
+
+	char *strings;			/**< String table */
+	uint32_t string_size;		/**< Used size of string table */
+	uint32_t string_alloc;		/**< Allocated size of string table */
+};
+
 /* Bloom filter used for short-circuting the false case of "is this
  * URL in the database?".  BLOOM_SIZE controls how large the filter is
  * in bytes.  Primitive experimentation shows that for a filter of X
@@ -339,6 +539,19 @@ static int loaded_cookie_file_version;
 static struct bloom_filter *url_bloom;
 #define BLOOM_SIZE (1024 * 32)
 
+/* Nodes gain a hash of their children once they have more than
+ * CHILD_HASH_THRESHOLD of them. The hash is grown whenever the average
+ * chain length would exceed CHILD_HASH_LOAD.
+ */
+#define CHILD_HASH_THRESHOLD 8
+#define CHILD_HASH_LOAD 2
+
+/* Index of all path nodes with an URL, keyed on the URL hash. */
+static struct path_data **url_index;
+static unsigned int url_index_size;
+static unsigned int url_index_count;
+#define URL_INDEX_INITIAL 256
+
 /**
  * Import an URL database from file, replacing any existing database
  *
@@ -363,6 +576,17 @@ void urldb_load(const char *filename)
         if (url_bloom == NULL)
                 url_bloom = bloom_create(BLOOM_SIZE);
 
+	switch (urldb_load_binary(filename)) {
+	case NSERROR_OK:
+		LOG(("Successfully loaded URL file"));
+		return;
+	case NSERROR_INVALID:
+		/* Not a binary file; try the text format */
+		break;
+	default:
+		return;
+	}
+
 	fp = fopen(filename, "r");
 	if (!fp) {
 		LOG(("Failed to open file '%s' for reading", filename));
@@ -537,257 +761,654 @@ void urldb_load(const char *filename)
 }
 
 /**
- * Export the current database to file
+ * Look up a string in a binary URL file's string table
  *
- * \param filename Name of file to export to
+ * \param strings String table
+ * \param string_size Size of string table
+ * \param offset Offset of string
+ * \return Pointer to string, or NULL if offset is out of range
+ *
+ * The string table is known to end with a NUL, so every in range offset
+ * yields a terminated string.
  */
-void urldb_save(const char *filename)
+static const char *urldb_binary_string(const char *strings,
+		uint32_t string_size, uint32_t offset)
 {
-	FILE *fp;
-	int i;
+	if (offset >= string_size)
+		return NULL;
 
-	assert(filename);
+	return strings + offset;
+}
 
-	fp = fopen(filename, "w");
-	if (!fp) {
-		LOG(("Failed to open file '%s' for writing", filename));
-		return;
+/**
+ * Rebuild the database from the contents of a binary URL file
+ *
+ * \param data File contents
+ * \param size Size of file contents
+ * \return NSERROR_OK on success, NSERROR_INVALID if data is not a valid
+ *         binary URL file
+ */
+static nserror urldb_load_binary_data(const uint8_t *data, size_t size)
+{
+	const struct urldb_file_header *header;
+	const struct urldb_file_host *hosts;
+	const struct urldb_file_path *paths;
+	const char *strings;
+	struct host_part **host_nodes;
+	struct path_data **path_nodes;
+	size_t paths_offset, strings_offset;
+	lwc_string *scheme = NULL;
+	uint32_t i;
+
+	if (size < sizeof(struct urldb_file_header))
+		return NSERROR_INVALID;
+
+	header = (const struct urldb_file_header *) data;
+	if (memcmp(header->magic, URL_BINARY_FILE_MAGIC,
+			sizeof(header->magic)) != 0)
+		return NSERROR_INVALID;
+
+	if (header->byte_order != URL_BINARY_FILE_BYTE_ORDER ||
+			header->version != URL_BINARY_FILE_VERSION) {
+		LOG(("Unsupported binary URL file"));
+		return NSERROR_INVALID;
 	}
 
-	/* file format version number */
-	fprintf(fp, "%d\n", URL_FILE_VERSION);
+	/* Validate the extents of every section before touching them */
+	if (header->host_count > size / sizeof(struct urldb_file_host) ||
+			header->path_count >
+				size / sizeof(struct urldb_file_path)) {
+		LOG(("Truncated binary URL file"));
+		return NSERROR_INVALID;
+	}
+
+	paths_offset = URL_BINARY_PATHS_OFFSET(header->host_count);
+	strings_offset = paths_offset +
+			header->path_count * sizeof(struct urldb_file_path);
 
-	for (i = 0; i != NUM_SEARCH_TREES; i++) {
-		urldb_save_search_tree(search_trees[i], fp);
+	if (strings_offset > size ||
+			header->string_size != size - strings_offset ||
+			header->string_size == 0 ||
+			data[size - 1] != '\0') {
+		LOG(("Truncated binary URL file"));
+		return NSERROR_INVALID;
 	}
 
-	fclose(fp);
+	hosts = (const struct urldb_file_host *)
+			(data + URL_BINARY_HOSTS_OFFSET);
+	paths = (const struct urldb_file_path *) (data + paths_offset);
+	strings = (const char *) (data + strings_offset);
+
+	for (i = 0; i < header->host_count; i++) {
+		if (hosts[i].name >= header->string_size)
+			return NSERROR_INVALID;
+	}
+
+	for (i = 0; i < header->path_count; i++) {
+		const struct urldb_file_path *r = &paths[i];
+
+		if (r->host >= header->host_count ||
+				r->parent > i ||
+				(r->parent != 0 &&
+				 paths[r->parent - 1].host != r->host) ||
+				r->segment >= header->string_size ||
+				r->scheme >= header->string_size ||
+				(r->url != URL_BINARY_FILE_NONE &&
+				 r->url >= header->string_size) ||
+				(r->title != URL_BINARY_FILE_NONE &&
+				 r->title >= header->string_size))
+			return NSERROR_INVALID;
+	}
+
+	host_nodes = malloc((header->host_count + 1) *
+			sizeof(struct host_part *));
+	path_nodes = malloc((header->path_count + 1) *
+			sizeof(struct path_data *));
+	if (host_nodes == NULL || path_nodes == NULL) {
+		die("Memory exhausted whilst loading URL file");
+	}
+
+	for (i = 0; i < header->host_count; i++) {
+		const char *name = urldb_binary_string(strings,
+				header->string_size, hosts[i].name);
+
+		host_nodes[i] = urldb_add_host(name);
+		if (host_nodes[i] == NULL) {
+			LOG(("Failed adding host: '%s'", name));
+			die("Memory exhausted whilst loading URL file");
+		}
+	}
+
+	for (i = 0; i < header->path_count; i++) {
+		const struct urldb_file_path *r = &paths[i];
+		struct path_data *parent, *p;
+		const char *segment, *url;
+
+		parent = (r->parent == 0) ? &host_nodes[r->host]->paths :
+				path_nodes[r->parent - 1];
+
+		/* Paths sharing a scheme tend to be adjacent */
+		if (scheme == NULL || strcmp(lwc_string_data(scheme),
+				strings + r->scheme) != 0) {
+			if (scheme != NULL)
+				lwc_string_unref(scheme);
+
+			if (lwc_intern_string(strings + r->scheme,
+					strlen(strings + r->scheme),
+					&scheme) != lwc_error_ok)
+				die("Memory exhausted whilst loading "
+						"URL file");
+		}
+
+		segment = strings + r->segment;
+
+		p = urldb_find_path_child(parent, segment, strlen(segment),
+				scheme, r->port);
+		if (p == NULL) {
+			p = urldb_add_path_node(scheme, r->port, segment,
+					NULL, parent);
+			if (p == NULL)
+				die("Memory exhausted whilst loading "
+						"URL file");
+		}
+		path_nodes[i] = p;
+
+		if (r->url != URL_BINARY_FILE_NONE && p->url == NULL) {
+			url = strings + r->url;
+
+			if (nsurl_create(url, &p->url) != NSERROR_OK) {
+				LOG(("Failed inserting '%s'", url));
+				die("Memory exhausted whilst loading "
+						"URL file");
+			}
+
+			if (url_bloom != NULL)
+				bloom_insert_hash(url_bloom,
+						nsurl_hash(p->url));
+
+			urldb_url_index_add(p);
+		}
+
+		p->urld.visits = r->visits;
+		p->urld.last_visit = (time_t) r->last_visit;
+		p->urld.type = (content_type) r->type;
+
+		if (r->title != URL_BINARY_FILE_NONE &&
+				strings[r->title] != '\0' &&
+				p->urld.title == NULL) {
+			p->urld.title = strdup(strings + r->title);
+			if (p->urld.title == NULL)
+				die("Memory exhausted whilst loading "
+						"URL file");
+		}
+	}
+
+	if (scheme != NULL)
+		lwc_string_unref(scheme);
+
+	free(path_nodes);
+	free(host_nodes);
+
+	return NSERROR_OK;
 }
 
 /**
- * Save a search (sub)tree
+ * Import a binary URL database from file
  *
- * \param root Root of (sub)tree to save
- * \param fp File to write to
+ * \param filename Name of file containing data
+ * \return NSERROR_OK on success, NSERROR_INVALID if the file is not a
+ *         binary URL file, or NSERROR_NOT_FOUND if it cannot be read
  */
-void urldb_save_search_tree(struct search_node *parent, FILE *fp)
+nserror urldb_load_binary(const char *filename)
 {
-	char host[256];
-	const struct host_part *h;
-	unsigned int path_count = 0;
-	char *path, *p, *end;
-	int path_alloc = 64, path_used = 1;
-	time_t expiry;
+	struct stat st;
+	uint8_t *data;
+	size_t size;
+	nserror error;
+#ifdef HAVE_MMAP
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		LOG(("Failed to open file '%s' for reading", filename));
+		return NSERROR_NOT_FOUND;
+	}
 
-	expiry = time(NULL) - ((60 * 60 * 24) * nsoption_int(expire_url));
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return NSERROR_NOT_FOUND;
+	}
 
-	if (parent == &empty)
-		return;
+	size = st.st_size;
+	if (size < sizeof(struct urldb_file_header)) {
+		close(fd);
+		return NSERROR_INVALID;
+	}
 
-	urldb_save_search_tree(parent->left, fp);
+	data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		LOG(("Unable to map URL file '%s'", filename));
+		return NSERROR_NOT_FOUND;
+	}
 
-	path = malloc(path_alloc);
-	if (!path)
-		return;
+	error = urldb_load_binary_data(data, size);
 
-	path[0] = '\0';
+	munmap(data, size);
+#else
+	FILE *fp;
 
-	for (h = parent->data, p = host, end = host + sizeof host;
-			h && h != &db_root && p < end; h = h->parent) {
-		int written = snprintf(p, end - p, "%s%s", h->part,
-				(h->parent && h->parent->parent) ? "." : "");
-		if (written < 0) {
-			free(path);
-			return;
-		}
-		p += written;
+	if (stat(filename, &st) != 0) {
+		LOG(("Failed to open file '%s' for reading", filename));
+		return NSERROR_NOT_FOUND;
 	}
 
-	urldb_count_urls(&parent->data->paths, expiry, &path_count);
+	size = st.st_size;
+	if (size < sizeof(struct urldb_file_header))
+		return NSERROR_INVALID;
+
+	fp = fopen(filename, "rb");
+	if (fp == NULL) {
+		LOG(("Failed to open file '%s' for reading", filename));
+		return NSERROR_NOT_FOUND;
+	}
 
-	if (path_count > 0) {
-		fprintf(fp, "%s\n%i\n", host, path_count);
+	data = malloc(size);
+	if (data == NULL) {
+		fclose(fp);
+		return NSERROR_NOMEM;
+	}
 
-		urldb_write_paths(&parent->data->paths, host, fp,
-				&path, &path_alloc, &path_used, expiry);
+	if (fread(data, 1, size, fp) != size) {
+		error = NSERROR_NOT_FOUND;
+	} else {
+		error = urldb_load_binary_data(data, size);
 	}
 
-	free(path);
+	free(data);
+	fclose(fp);
+#endif
 
-	urldb_save_search_tree(parent->right, fp);
+	return error;
 }
 
 /**
- * Count number of URLs associated with a host
+ * Add a string to the string table of a save in progress
  *
- * \param root Root of path data tree
- * \param expiry Expiry time for URLs
- * \param count Pointer to count
+ * \param ctx Save context
+ * \param str String to add
+ * \param offset Updated with offset of string in table
+ * \return true on success, false on memory exhaustion
  */
-void urldb_count_urls(const struct path_data *root, time_t expiry,
-		unsigned int *count)
+static bool urldb_save_string(struct urldb_save_ctx *ctx, const char *str,
+		uint32_t *offset)
 {
-	const struct path_data *p = root;
+	size_t len = strlen(str) + 1;
 
-	do {
-		if (p->children != NULL) {
-			/* Drill down into children */
-			p = p->children;
-		} else {
-			/* No more children, increment count if required */
-			if (p->persistent || ((p->urld.last_visit > expiry) &&
-					(p->urld.visits > 0)))
-				(*count)++;
+	if (ctx->string_size + len > ctx->string_alloc) {
+		uint32_t alloc = ctx->string_alloc ? ctx->string_alloc : 4096;
+		char *temp;
 
-			/* Now, find next node to process. */
-			while (p != root) {
-				if (p->next != NULL) {
-					/* Have a sibling, process that */
-					p = p->next;
-					break;
-				}
+		while (ctx->string_size + len > alloc)
+			alloc *= 2;
 
-				/* Ascend tree */
-				p = p->parent;
-			}
-		}
-	} while (p != root);
+		temp = realloc(ctx->strings, alloc);
+		if (temp == NULL)
+			return false;
+
+		ctx->strings = temp;
+		ctx->string_alloc = alloc;
+	}
+
+	memcpy(ctx->strings + ctx->string_size, str, len);
+	*offset = ctx->string_size;
+	ctx->string_size += len;
+
+	return true;
 }
 
 /**
- * Write paths associated with a host
+ * Tidy a title in the string table of a save in progress
  *
- * \param parent Root of (sub)tree to write
- * \param host Current host name
- * \param fp File to write to
- * \param path Current path string
- * \param path_alloc Allocated size of path
- * \param path_used Used size of path
- * \param expiry Expiry time of URLs
+ * \param s Title to tidy (modified)
+ *
+ * Control characters are replaced by spaces, and trailing spaces removed.
  */
-void urldb_write_paths(const struct path_data *parent, const char *host,
-		FILE *fp, char **path, int *path_alloc, int *path_used,
-		time_t expiry)
+static void urldb_save_sanitise_title(char *s)
 {
-	const struct path_data *p = parent;
+	uint8_t *t = (uint8_t *) s;
 	int i;
 
-	do {
-		int seglen = p->segment != NULL ? strlen(p->segment) : 0;
-		int len = *path_used + seglen + 1;
+	for (i = 0; t[i] != '\0'; i++)
+		if (t[i] < 32)
+			t[i] = ' ';
+	for (--i; ((i > 0) && (t[i] == ' ')); i--)
+		t[i] = '\0';
+}
 
-		if (*path_alloc < len) {
-			char *temp = realloc(*path,
-					(len > 64) ? len : *path_alloc + 64);
-			if (!temp)
-				return;
-			*path = temp;
-			*path_alloc = (len > 64) ? len : *path_alloc + 64;
-		}
+/**
+ * Rewrite a file using a writer, replacing the file atomically
+ *
+ * The file is written under a temporary name and renamed over the
+ * original, so a crash part way through leaves the original intact.
+ *
+ * \param filename File to replace
+ * \param writer Function to write file contents
+ * \return true on success, false otherwise
+ */
+bool urldb_replace_file(const char *filename,
+		bool (*writer)(const char *filename))
+{
+	size_t len = strlen(filename);
+	char *temp;
+	bool ok;
+
+	temp = malloc(len + sizeof(".new"));
+	if (temp == NULL)
+		return false;
 
-		if (p->segment != NULL)
-			memcpy(*path + *path_used - 1, p->segment, seglen);
+	memcpy(temp, filename, len);
+	memcpy(temp + len, ".new", sizeof(".new"));
 
-		if (p->children != NULL) {
-			(*path)[*path_used + seglen - 1] = '/';
-			(*path)[*path_used + seglen] = '\0';
-		} else {
-			(*path)[*path_used + seglen - 1] = '\0';
-			len -= 1;
-		}
+	ok = writer(temp);
+#ifdef _WIN32
+	/* rename() will not replace an existing file */
+	if (ok)
+		remove(filename);
+#endif
+	ok = ok && rename(temp, filename) == 0;
+	if (!ok) {
+		LOG(("Failed to replace '%s'", filename));
+		remove(temp);
+	}
 
-		*path_used = len;
+	free(temp);
 
-		if (p->children != NULL) {
-			/* Drill down into children */
-			p = p->children;
-		} else {
-			/* leaf node */
-			if (p->persistent ||((p->urld.last_visit > expiry) &&
-					(p->urld.visits > 0))) {
-				fprintf(fp, "%s\n", lwc_string_data(p->scheme));
+	return ok;
+}
 
-				if (p->port)
-					fprintf(fp,"%d\n", p->port);
-				else
-					fprintf(fp, "\n");
+/**
+ * Export the current database to file
+ *
+ * \param filename Name of file to export to
+ */
+void urldb_save(const char *filename)
+{
+	urldb_replace_file(filename, urldb_write);
+}
+
+/**
+ * Write the current database to file
+ *
+ * \param filename Name of file to write
+ * \return true on success, false otherwise
+ */
+bool urldb_write(const char *filename)
+{
+	struct urldb_file_header header;
+	struct urldb_save_ctx ctx;
+	static const uint8_t pad[8];
+	FILE *fp;
+	size_t padding;
+	bool ok = true;
+	int i;
 
-				fprintf(fp, "%s\n", *path);
+	assert(filename);
 
-				/** \todo handle fragments? */
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.expiry = time(NULL) - ((60 * 60 * 24) * nsoption_int(expire_url));
 
-				fprintf(fp, "%i\n%i\n%i\n", p->urld.visits,
-						(int)p->urld.last_visit,
-						(int)p->urld.type);
+	for (i = 0; i != NUM_SEARCH_TREES && ok; i++) {
+		ok = urldb_save_search_tree(search_trees[i], &ctx);
+	}
 
-				fprintf(fp, "\n");
+	/* Ensure the string table is never empty */
+	if (ok && ctx.string_size == 0) {
+		uint32_t offset;
+		ok = urldb_save_string(&ctx, "", &offset);
+	}
 
-				if (p->urld.title) {
-					uint8_t *s = (uint8_t *) p->urld.title;
+	if (!ok) {
+		LOG(("Memory exhausted whilst saving URL file"));
+		goto out;
+	}
 
-					for (i = 0; s[i] != '\0'; i++)
-						if (s[i] < 32)
-							s[i] = ' ';
-					for (--i; ((i > 0) && (s[i] == ' ')); 
-							i--)
-						s[i] = '\0';
-					fprintf(fp, "%s\n", p->urld.title);
-				} else
-					fprintf(fp, "\n");
-			}
+	fp = fopen(filename, "wb");
+	if (!fp) {
+		LOG(("Failed to open file '%s' for writing", filename));
+		ok = false;
+		goto out;
+	}
 
-			/* Now, find next node to process. */
-			while (p != parent) {
-				int seglen = p->segment != NULL 
-						? strlen(p->segment) : 0;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, URL_BINARY_FILE_MAGIC, sizeof(header.magic));
+	header.byte_order = URL_BINARY_FILE_BYTE_ORDER;
+	header.version = URL_BINARY_FILE_VERSION;
+	header.host_count = ctx.host_count;
+	header.path_count = ctx.path_count;
+	header.string_size = ctx.string_size;
+
+	padding = URL_BINARY_PATHS_OFFSET(ctx.host_count) -
+			(URL_BINARY_HOSTS_OFFSET +
+			ctx.host_count * sizeof(struct urldb_file_host));
+
+	if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+			fwrite(ctx.hosts, sizeof(struct urldb_file_host),
+				ctx.host_count, fp) != ctx.host_count ||
+			fwrite(pad, 1, padding, fp) != padding ||
+			fwrite(ctx.paths, sizeof(struct urldb_file_path),
+				ctx.path_count, fp) != ctx.path_count ||
+			fwrite(ctx.strings, 1, ctx.string_size, fp) !=
+				ctx.string_size) {
+		LOG(("Failed writing URL file '%s'", filename));
+		ok = false;
+	}
 
-				/* Remove our segment from the path */
-				*path_used -= seglen;
-				(*path)[*path_used - 1] = '\0';
+	if (!urldb_sync_file(fp))
+		ok = false;
 
-				if (p->next != NULL) {
-					/* Have a sibling, process that */
-					p = p->next;
-					break;
-				}
+	if (fclose(fp) != 0)
+		ok = false;
 
-				/* Going up, so remove '/' */
-				*path_used -= 1;
-				(*path)[*path_used - 1] = '\0';
+out:
+	free(ctx.hosts);
+	free(ctx.paths);
+	free(ctx.strings);
 
-				/* Ascend tree */
-				p = p->parent;
-			}
-		}
-	} while (p != parent);
+	return ok;
 }
 
 /**
- * Set the cross-session persistence of the entry for an URL
+ * Save a search (sub)tree
  *
- * \param url Absolute URL to persist
- * \param persist True to persist, false otherwise
+ * \param root Root of (sub)tree to save
+ * \param ctx Save context
+ * \return true on success, false on memory exhaustion
  */
-void urldb_set_url_persistence(nsurl *url, bool persist)
+bool urldb_save_search_tree(struct search_node *parent,
+		struct urldb_save_ctx *ctx)
 {
-	struct path_data *p;
+	char *host;
+	const struct host_part *h;
+	char *p;
+	size_t len = 0;
+	uint32_t host_index, string_size;
+	bool ok;
 
-	assert(url);
+	if (parent == &empty)
+		return true;
 
-	p = urldb_find_url(url);
-	if (!p)
-		return;
+	if (!urldb_save_search_tree(parent->left, ctx))
+		return false;
 
-	p->persistent = persist;
+	if (ctx->host_count == ctx->host_alloc) {
+		uint32_t alloc = ctx->host_alloc ? ctx->host_alloc * 2 : 64;
+		struct urldb_file_host *temp;
+
+		temp = realloc(ctx->hosts, alloc * sizeof(*temp));
+		if (temp == NULL)
+			return false;
+
+		ctx->hosts = temp;
+		ctx->host_alloc = alloc;
+	}
+
+	for (h = parent->data; h && h != &db_root; h = h->parent)
+		len += strlen(h->part) + 1;
+
+	host = malloc(len + 1);
+	if (host == NULL)
+		return false;
+
+	for (h = parent->data, p = host; h && h != &db_root; h = h->parent) {
+		size_t part_len = strlen(h->part);
+
+		memcpy(p, h->part, part_len);
+		p += part_len;
+		if (h->parent && h->parent->parent)
+			*p++ = '.';
+	}
+	*p = '\0';
+
+	/* Hosts without any saved paths are discarded again */
+	host_index = ctx->host_count;
+	string_size = ctx->string_size;
+
+	ok = urldb_save_string(ctx, host, &ctx->hosts[host_index].name);
+	free(host);
+	if (!ok)
+		return false;
+	ctx->host_count++;
+
+	if (!urldb_save_paths(&parent->data->paths, host_index, 0, ctx))
+		return false;
+
+	if (ctx->path_count == 0 ||
+			ctx->paths[ctx->path_count - 1].host != host_index) {
+		ctx->host_count = host_index;
+		ctx->string_size = string_size;
+	}
+
+	return urldb_save_search_tree(parent->right, ctx);
 }
 
 /**
- * Insert an URL into the database
+ * Save the children of a path node
  *
- * \param url Absolute URL to insert
- * \return true on success, false otherwise
+ * \param parent Node whose children to save
+ * \param host Index of host record
+ * \param parent_index Index of the parent's path record plus one, or 0
+ * \param ctx Save context
+ * \return true on success, false on memory exhaustion
+ *
+ * A node is saved if it is persistent or was visited recently, or if
+ * any of its descendants are saved.
  */
-bool urldb_add_url(nsurl *url)
+bool urldb_save_paths(const struct path_data *parent, uint32_t host,
+		uint32_t parent_index, struct urldb_save_ctx *ctx)
+{
+	const struct path_data *p;
+	struct urldb_file_path *r;
+	uint32_t index, string_size;
+	bool keep;
+
+	for (p = parent->children; p; p = p->next) {
+		if (ctx->path_count == ctx->path_alloc) {
+			uint32_t alloc = ctx->path_alloc ?
+					ctx->path_alloc * 2 : 256;
+			struct urldb_file_path *temp;
+
+			temp = realloc(ctx->paths, alloc * sizeof(*temp));
+			if (temp == NULL)
+				return false;
+
+			ctx->paths = temp;
+			ctx->path_alloc = alloc;
+		}
+
+		index = ctx->path_count;
+		string_size = ctx->string_size;
+
+		keep = p->url != NULL && (p->persistent ||
+				((p->urld.last_visit > ctx->expiry) &&
+				(p->urld.visits > 0)));
+
+		r = &ctx->paths[index];
+		memset(r, 0, sizeof(*r));
+		r->host = host;
+		r->parent = parent_index;
+		r->port = p->port;
+		r->url = URL_BINARY_FILE_NONE;
+		r->title = URL_BINARY_FILE_NONE;
+
+		if (!urldb_save_string(ctx, p->segment, &r->segment) ||
+				!urldb_save_string(ctx,
+					lwc_string_data(p->scheme),
+					&r->scheme))
+			return false;
+
+		if (keep) {
+			r->visits = p->urld.visits;
+			r->last_visit = p->urld.last_visit;
+			r->type = p->urld.type;
+
+			if (!urldb_save_string(ctx, nsurl_access(p->url),
+					&r->url))
+				return false;
+
+			if (p->urld.title != NULL) {
+				if (!urldb_save_string(ctx, p->urld.title,
+						&r->title))
+					return false;
+
+				urldb_save_sanitise_title(
+						ctx->strings + r->title);
+			}
+		}
+
+		ctx->path_count++;
+
+		if (!urldb_save_paths(p, host, index + 1, ctx))
+			return false;
+
+		if (!keep && ctx->path_count == index + 1) {
+			/* Neither this node nor its descendants are saved */
+			ctx->path_count = index;
+			ctx->string_size = string_size;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Set the cross-session persistence of the entry for an URL
+ *
+ * \param url Absolute URL to persist
+ * \param persist True to persist, false otherwise
+ */
+void urldb_set_url_persistence(nsurl *url, bool persist)
+{
+	struct path_data *p;
+
+	assert(url);
+
+	p = urldb_find_url(url);
+	if (!p)
+		return;
+
+	p->persistent = persist;
+
+	urldb_journal_url(p);
+}
+
+/**
+ * Insert an URL into the database
+ *
+ * \param url Absolute URL to insert
+ * \return true on success, false otherwise
+ */
+bool urldb_add_url(nsurl *url)
 {
 	struct host_part *h;
 	struct path_data *p;
@@ -886,6 +1507,8 @@ void urldb_set_url_title(nsurl *url, const char *title)
 
 	free(p->urld.title);
 	p->urld.title = temp;
+
+	urldb_journal_url(p);
 }
 
 /**
@@ -905,6 +1528,8 @@ void urldb_set_url_content_type(nsurl *url, content_type type)
 		return;
 
 	p->urld.type = type;
+
+	urldb_journal_url(p);
 }
 
 /**
@@ -924,6 +1549,8 @@ void urldb_update_url_visit_data(nsurl *url)
 
 	p->urld.last_visit = time(NULL);
 	p->urld.visits++;
+
+	urldb_journal_url(p);
 }
 
 /**
@@ -943,6 +1570,8 @@ void urldb_reset_url_visit_data(nsurl *url)
 
 	p->urld.last_visit = (time_t)0;
 	p->urld.visits = 0;
+
+	urldb_journal_url(p);
 }
 
 
@@ -1575,6 +2204,8 @@ struct host_part *urldb_add_host_node(const char *part,
 	d->parent = parent;
 	parent->children = d;
 
+	urldb_host_child_index(parent, d);
+
 	return d;
 }
 
@@ -1588,8 +2219,7 @@ struct host_part *urldb_add_host(const char *host)
 {
 	struct host_part *d = (struct host_part *) &db_root, *e;
 	struct search_node *s;
-	char buf[256]; /* 256 bytes is sufficient - domain names are
-			* limited to 255 chars. */
+	char *buf;
 	char *part;
 
 	assert(host);
@@ -1598,10 +2228,10 @@ struct host_part *urldb_add_host(const char *host)
 		/* Host is an IP, so simply add as TLD */
 
 		/* Check for existing entry */
-		for (e = d->children; e; e = e->next)
-			if (strcasecmp(host, e->part) == 0)
-				/* found => return it */
-				return e;
+		e = urldb_find_host_child(d, host, strlen(host));
+		if (e)
+			/* found => return it */
+			return e;
 
 		d = urldb_add_host_node(host, d);
 
@@ -1617,8 +2247,9 @@ struct host_part *urldb_add_host(const char *host)
 	}
 
 	/* Copy host string, so we can corrupt it */
-	strncpy(buf, host, sizeof buf);
-	buf[sizeof buf - 1] = '\0';
+	buf = strdup(host);
+	if (buf == NULL)
+		return NULL;
 
 	/* Process FQDN segments backwards */
 	do {
@@ -1626,9 +2257,7 @@ struct host_part *urldb_add_host(const char *host)
 		if (!part) {
 			/* last segment */
 			/* Check for existing entry */
-			for (e = d->children; e; e = e->next)
-				if (strcasecmp(buf, e->part) == 0)
-					break;
+			e = urldb_find_host_child(d, buf, strlen(buf));
 
 			if (e) {
 				d = e;
@@ -1653,9 +2282,7 @@ struct host_part *urldb_add_host(const char *host)
 		}
 
 		/* Check for existing entry */
-		for (e = d->children; e; e = e->next)
-			if (strcasecmp(part + 1, e->part) == 0)
-				break;
+		e = urldb_find_host_child(d, part + 1, strlen(part + 1));
 
 		d = e ? e : urldb_add_host_node(part + 1, d);
 		if (!d)
@@ -1664,6 +2291,8 @@ struct host_part *urldb_add_host(const char *host)
 		*part = '\0';
 	} while (1);
 
+	free(buf);
+
 	return d;
 }
 
@@ -1709,9 +2338,14 @@ struct path_data *urldb_add_path_node(lwc_string *scheme, unsigned int port,
 		}
 	}
 
-	for (e = parent->children; e; e = e->next)
-		if (strcmp(e->segment, d->segment) > 0)
-			break;
+	if (parent->last && strcmp(parent->last->segment, d->segment) <= 0) {
+		/* Belongs at the end; common when loading a sorted file */
+		e = NULL;
+	} else {
+		for (e = parent->children; e; e = e->next)
+			if (strcmp(e->segment, d->segment) > 0)
+				break;
+	}
 
 	if (e) {
 		d->prev = e->prev;
@@ -1732,6 +2366,8 @@ struct path_data *urldb_add_path_node(lwc_string *scheme, unsigned int port,
 	}
 	d->parent = parent;
 
+	urldb_path_child_index(parent, d);
+
 	return d;
 }
 
@@ -1753,7 +2389,6 @@ struct path_data *urldb_add_path(lwc_string *scheme, unsigned int port,
 	struct path_data *d, *e;
 	char *buf = path_query;
 	char *segment, *slash;
-	bool match;
 
 	assert(scheme && host && url);
 
@@ -1770,14 +2405,8 @@ struct path_data *urldb_add_path(lwc_string *scheme, unsigned int port,
 		if (!slash) {
 			/* last segment */
 			/* look for existing entry */
-			for (e = d->children; e; e = e->next)
-				if (strcmp(segment, e->segment) == 0 &&
-						lwc_string_isequal(scheme,
-						e->scheme, &match) ==
-						lwc_error_ok &&
-						match == true &&
-						e->port == port)
-					break;
+			e = urldb_find_path_child(d, segment, strlen(segment),
+					scheme, port);
 
 			d = e ? urldb_add_path_fragment(e, fragment) :
 					urldb_add_path_node(scheme, port,
@@ -1788,13 +2417,8 @@ struct path_data *urldb_add_path(lwc_string *scheme, unsigned int port,
 		*slash = '\0';
 
 		/* look for existing entry */
-		for (e = d->children; e; e = e->next)
-			if (strcmp(segment, e->segment) == 0 &&
-					lwc_string_isequal(scheme, e->scheme,
-						&match) == lwc_error_ok &&
-						match == true &&
-					e->port == port)
-				break;
+		e = urldb_find_path_child(d, segment, slash - segment,
+				scheme, port);
 
 		d = e ? e : urldb_add_path_node(scheme, port, segment, NULL, d);
 		if (!d)
@@ -1814,6 +2438,8 @@ struct path_data *urldb_add_path(lwc_string *scheme, unsigned int port,
 		} else {
 			d->url = nsurl_ref(url);
 		}
+
+		urldb_url_index_add(d);
 	}
 
 	return d;
@@ -1897,6 +2523,11 @@ struct path_data *urldb_find_url(nsurl *url)
 		}
 	}
 
+	/* Exact matches are found directly in the URL index */
+	p = urldb_url_index_find(url);
+	if (p != NULL)
+		return p;
+
 	scheme = nsurl_get_component(url, NSURL_SCHEME);
 	if (scheme == NULL)
 		return NULL;
@@ -1960,41 +2591,308 @@ struct path_data *urldb_match_path(const struct path_data *parent,
 {
 	const struct path_data *p;
 	const char *slash;
-	bool match;
 
 	assert(parent != NULL);
 	assert(parent->segment == NULL);
 	assert(path[0] == '/');
 
-	/* Start with children, as parent has no segment */
-	p = parent->children;
+	/* Start with parent, as it has no segment */
+	p = parent;
 
 	while (p != NULL) {
 		slash = strchr(path + 1, '/');
 		if (!slash)
 			slash = path + strlen(path);
 
-		if (strncmp(p->segment, path + 1, slash - path - 1) == 0 &&
-				lwc_string_isequal(p->scheme, scheme, &match) ==
-						lwc_error_ok &&
+		p = urldb_find_path_child(p, path + 1, slash - path - 1,
+				scheme, port);
+
+		if (p != NULL && *slash == '\0') {
+			/* Complete match */
+			return (struct path_data *) p;
+		}
+
+		/* Match so far, go down tree */
+		path = slash;
+	}
+
+	return NULL;
+}
+
+/**
+ * Calculate the hash of a path segment
+ *
+ * \param segment The segment to hash
+ * \param seglen Length of segment in bytes
+ * \return The hash value
+ */
+static unsigned int urldb_segment_hash(const char *segment, size_t seglen)
+{
+	unsigned int hash = 0x811c9dc5;
+
+	while (seglen-- > 0) {
+		hash ^= (unsigned char) *segment++;
+		hash *= 0x01000193;
+	}
+
+	return hash;
+}
+
+/**
+ * Calculate the caseless hash of a host part
+ *
+ * \param part The host part to hash (need not be NUL terminated)
+ * \param len Length of part in bytes
+ * \return The hash value
+ */
+static unsigned int urldb_part_hash(const char *part, size_t len)
+{
+	unsigned int hash = 0x811c9dc5;
+
+	while (len-- > 0) {
+		hash ^= (unsigned char) tolower((unsigned char) *part++);
+		hash *= 0x01000193;
+	}
+
+	return hash;
+}
+
+/**
+ * Find a child of a host tree node
+ *
+ * \param parent Node to search the children of
+ * \param part Host segment (or whole IP address) to look for (need not be
+ *             NUL terminated)
+ * \param len Length of part in bytes
+ * \return Pointer to child node, or NULL if not found
+ */
+struct host_part *urldb_find_host_child(const struct host_part *parent,
+		const char *part, size_t len)
+{
+	struct host_part *e;
+	unsigned int hash;
+
+	if (parent->child_hash == NULL) {
+		for (e = parent->children; e; e = e->next)
+			if (strncasecmp(part, e->part, len) == 0 &&
+					e->part[len] == '\0')
+				break;
+
+		return e;
+	}
+
+	hash = urldb_part_hash(part, len);
+
+	for (e = parent->child_hash[hash & (parent->child_hash_size - 1)];
+			e; e = e->hash_next)
+		if (e->part_hash == hash &&
+				strncasecmp(part, e->part, len) == 0 &&
+				e->part[len] == '\0')
+			break;
+
+	return e;
+}
+
+/**
+ * Find a child of a path tree node
+ *
+ * \param parent Node to search the children of
+ * \param segment Path segment to look for (need not be NUL terminated)
+ * \param seglen Length of segment in bytes
+ * \param scheme The URL scheme associated with the path
+ * \param port The port associated with the path
+ * \return Pointer to child node, or NULL if not found
+ */
+struct path_data *urldb_find_path_child(const struct path_data *parent,
+		const char *segment, size_t seglen, lwc_string *scheme,
+		unsigned int port)
+{
+	struct path_data *e;
+	unsigned int hash;
+	bool match;
+
+	hash = urldb_segment_hash(segment, seglen);
+
+	if (parent->child_hash == NULL) {
+		e = parent->children;
+	} else {
+		e = parent->child_hash[hash & (parent->child_hash_size - 1)];
+	}
+
+	while (e != NULL) {
+		if (e->segment_hash == hash &&
+				strncmp(e->segment, segment, seglen) == 0 &&
+				e->segment[seglen] == '\0' &&
+				lwc_string_isequal(e->scheme, scheme,
+						&match) == lwc_error_ok &&
 				match == true &&
-				p->port == port) {
-			if (*slash == '\0') {
-				/* Complete match */
-				return (struct path_data *) p;
+				e->port == port)
+			break;
+
+		e = (parent->child_hash == NULL) ? e->next : e->hash_next;
+	}
+
+	return e;
+}
+
+/**
+ * Record a newly added child of a host tree node in its parent's index
+ *
+ * \param parent Node the child was added to
+ * \param child The new child
+ *
+ * Failure to allocate the index is not fatal; lookups simply fall back
+ * to scanning the children.
+ */
+void urldb_host_child_index(struct host_part *parent, struct host_part *child)
+{
+	struct host_part **hash;
+	struct host_part *e;
+	unsigned int size, chain;
+
+	child->part_hash = urldb_part_hash(child->part, strlen(child->part));
+	parent->child_count++;
+
+	if (parent->child_count > CHILD_HASH_THRESHOLD &&
+			parent->child_count > (parent->child_hash_size *
+			CHILD_HASH_LOAD)) {
+		size = parent->child_hash_size ? parent->child_hash_size * 2 :
+				CHILD_HASH_THRESHOLD * 2;
+
+		hash = calloc(size, sizeof(struct host_part *));
+		if (hash != NULL) {
+			free(parent->child_hash);
+			parent->child_hash = hash;
+			parent->child_hash_size = size;
+
+			/* Rebuild chains (includes the new child) */
+			for (e = parent->children; e; e = e->next) {
+				chain = e->part_hash & (size - 1);
+				e->hash_next = hash[chain];
+				hash[chain] = e;
 			}
+			return;
+		}
+	}
 
-			/* Match so far, go down tree */
-			p = p->children;
+	if (parent->child_hash != NULL) {
+		chain = child->part_hash & (parent->child_hash_size - 1);
+		child->hash_next = parent->child_hash[chain];
+		parent->child_hash[chain] = child;
+	}
+}
 
-			path = slash;
-		} else {
-			/* No match, try next sibling */
-			p = p->next;
+/**
+ * Record a newly added child of a path tree node in its parent's index
+ *
+ * \param parent Node the child was added to
+ * \param child The new child
+ *
+ * Failure to allocate the index is not fatal; lookups simply fall back
+ * to scanning the children.
+ */
+void urldb_path_child_index(struct path_data *parent, struct path_data *child)
+{
+	struct path_data **hash;
+	struct path_data *e;
+	unsigned int size, chain;
+
+	child->segment_hash = urldb_segment_hash(child->segment,
+			strlen(child->segment));
+	parent->child_count++;
+
+	if (parent->child_count > CHILD_HASH_THRESHOLD &&
+			parent->child_count > (parent->child_hash_size *
+			CHILD_HASH_LOAD)) {
+		size = parent->child_hash_size ? parent->child_hash_size * 2 :
+				CHILD_HASH_THRESHOLD * 2;
+
+		hash = calloc(size, sizeof(struct path_data *));
+		if (hash != NULL) {
+			free(parent->child_hash);
+			parent->child_hash = hash;
+			parent->child_hash_size = size;
+
+			/* Rebuild chains (includes the new child) */
+			for (e = parent->children; e; e = e->next) {
+				chain = e->segment_hash & (size - 1);
+				e->hash_next = hash[chain];
+				hash[chain] = e;
+			}
+			return;
 		}
 	}
 
-	return NULL;
+	if (parent->child_hash != NULL) {
+		chain = child->segment_hash & (parent->child_hash_size - 1);
+		child->hash_next = parent->child_hash[chain];
+		parent->child_hash[chain] = child;
+	}
+}
+
+/**
+ * Enter a path node into the URL index
+ *
+ * \param p Path node, with URL set
+ */
+void urldb_url_index_add(struct path_data *p)
+{
+	struct path_data **index;
+	struct path_data *e, *next;
+	unsigned int size, chain, i;
+
+	assert(p->url != NULL);
+
+	if (url_index == NULL || url_index_count >= url_index_size * 2) {
+		size = url_index_size ? url_index_size * 2 : URL_INDEX_INITIAL;
+
+		index = calloc(size, sizeof(struct path_data *));
+		if (index != NULL) {
+			/* Move existing entries to the new chains */
+			for (i = 0; i < url_index_size; i++) {
+				for (e = url_index[i]; e; e = next) {
+					next = e->url_next;
+					chain = nsurl_hash(e->url) & (size - 1);
+					e->url_next = index[chain];
+					index[chain] = e;
+				}
+			}
+
+			free(url_index);
+			url_index = index;
+			url_index_size = size;
+		} else if (url_index == NULL) {
+			/* Lookups will use the tree */
+			return;
+		}
+	}
+
+	chain = nsurl_hash(p->url) & (url_index_size - 1);
+	p->url_next = url_index[chain];
+	url_index[chain] = p;
+	url_index_count++;
+}
+
+/**
+ * Look up an URL in the URL index
+ *
+ * \param url Absolute URL to find
+ * \return Pointer to path data, or NULL if not found
+ */
+struct path_data *urldb_url_index_find(nsurl *url)
+{
+	struct path_data *p;
+
+	/* Indexed URLs have no fragment */
+	if (url_index == NULL || nsurl_has_component(url, NSURL_FRAGMENT))
+		return NULL;
+
+	for (p = url_index[nsurl_hash(url) & (url_index_size - 1)];
+			p; p = p->url_next)
+		if (nsurl_compare(p->url, url, NSURL_COMPLETE))
+			break;
+
+	return p;
 }
 
 /**
@@ -2430,284 +3328,414 @@ struct search_node *urldb_search_split(struct search_node *root)
 }
 
 /**
- * Retrieve cookies for an URL
+ * Consider the cookies attached to a node for inclusion in a request
  *
- * \param url URL being fetched
- * \param include_http_only Whether to include HTTP(S) only cookies.
- * \return Cookies string for libcurl (on heap), or NULL on error/no cookies
+ * \param cookies First cookie in node's list
+ * \param path Path of the request URL
+ * \param secure The request is being made over a secure transport
+ * \param include_http_only Whether to include HTTP(S) only cookies
+ * \param now Current time
+ * \param m Matched cookies, updated
+ * \return true on success, false on memory exhaustion
  */
-char *urldb_get_cookie(nsurl *url, bool include_http_only)
+static bool urldb_match_cookies(struct cookie_internal_data *cookies,
+		const char *path, bool secure, bool include_http_only,
+		time_t now, struct cookie_match *m)
 {
-	const struct path_data *p, *q;
-	const struct host_part *h;
-	lwc_string *path_lwc;
 	struct cookie_internal_data *c;
-	int count = 0, version = COOKIE_RFC2965;
-	struct cookie_internal_data **matched_cookies;
-	int matched_cookies_size = 20;
-	int ret_alloc = 4096, ret_used = 1;
-	const char *path;
-	char *ret;
-	lwc_string *scheme;
-	time_t now;
-	int i;
-	bool match;
 
-	assert(url != NULL);
+	for (c = cookies; c; c = c->next) {
+		if (c->expires != -1 && c->expires < now)
+			/* cookie has expired => ignore */
+			continue;
 
-	/* The URL must exist in the db in order to find relevant cookies, since
-	 * we search up the tree from the URL node, and cookies from further
-	 * up also apply. */
-	urldb_add_url(url);
+		/* Ensure cookie path is a prefix of the resource */
+		if (strncmp(c->path, path, strlen(c->path)) != 0)
+			/* paths don't match => ignore */
+			continue;
 
-	p = urldb_find_url(url);
-	if (!p)
-		return NULL;
+		if (c->secure && !secure)
+			/* secure cookie for insecure host. ignore */
+			continue;
 
-	scheme = p->scheme;
+		if (c->http_only && !include_http_only)
+			/* Ignore HttpOnly */
+			continue;
 
-	matched_cookies = malloc(matched_cookies_size * 
-			sizeof(struct cookie_internal_data *));
-	if (!matched_cookies)
-		return NULL;
+		if (m->count == m->alloc) {
+			struct cookie_internal_data **temp;
 
-#define GROW_MATCHED_COOKIES						\
-	do {								\
-		if (count == matched_cookies_size) {			\
-			struct cookie_internal_data **temp;		\
-			temp = realloc(matched_cookies,			\
-				(matched_cookies_size + 20) *		\
-				sizeof(struct cookie_internal_data *));	\
-									\
-			if (temp == NULL) {				\
-				free(ret);				\
-				free(matched_cookies);			\
-				return NULL;				\
-			}						\
-									\
-			matched_cookies = temp;				\
-			matched_cookies_size += 20;			\
-		}							\
-	} while(0)
+			temp = realloc(m->cookies, (m->alloc + 20) *
+					sizeof(struct cookie_internal_data *));
+			if (temp == NULL)
+				return false;
 
-	ret = malloc(ret_alloc);
-	if (!ret) {
-		free(matched_cookies);
-		return NULL;
-	}
+			m->cookies = temp;
+			m->alloc += 20;
+		}
 
-	ret[0] = '\0';
+		m->cookies[m->count++] = c;
 
-	path_lwc = nsurl_get_component(url, NSURL_PATH);
-	if (path_lwc == NULL) {
-		free(ret);
-		free(matched_cookies);
-		return NULL;
-	}
-	path = lwc_string_data(path_lwc);
-	lwc_string_unref(path_lwc);
+		if (c->version < (unsigned int) m->version)
+			m->version = c->version;
 
-	now = time(NULL);
+		if (c->expires != -1 &&
+				(m->expires == -1 || c->expires < m->expires))
+			m->expires = c->expires;
+	}
 
-	if (*(p->segment) != '\0') {
-		/* Match exact path, unless directory, when prefix matching
-		 * will handle this case for us. */
-		for (q = p->parent->children; q; q = q->next) {
-			if (strcmp(q->segment, p->segment))
-				continue;
+	return true;
+}
 
-			/* Consider all cookies associated with
-			 * this exact path */
-			for (c = q->cookies; c; c = c->next) {
-				if (c->expires != -1 && c->expires < now)
-					/* cookie has expired => ignore */
-					continue;
+/**
+ * Find the next child of a path node with a given segment
+ *
+ * \param parent Node to search the children of
+ * \param after Previous result, or NULL to find the first
+ * \param segment Path segment to look for (need not be NUL terminated)
+ * \param seglen Length of segment in bytes
+ * \param hash Hash of segment
+ * \return Pointer to child node, or NULL if there are no more
+ *
+ * Unlike urldb_find_path_child(), children with any scheme or port are
+ * returned. Cookies are shared between them.
+ */
+static struct path_data *urldb_next_path_child(const struct path_data *parent,
+		const struct path_data *after, const char *segment,
+		size_t seglen, unsigned int hash)
+{
+	struct path_data *e;
 
-				if (c->secure && lwc_string_isequal(
-							q->scheme,
-							corestring_lwc_https,
-							&match) &&
-						match == false)
-					/* secure cookie for insecure host.
-					 * ignore */
-					continue;
+	if (after == NULL) {
+		e = (parent->child_hash == NULL) ? parent->children :
+			parent->child_hash[hash & (parent->child_hash_size - 1)];
+	} else {
+		e = (parent->child_hash == NULL) ? after->next :
+				after->hash_next;
+	}
 
-				if (c->http_only && !include_http_only)
-					/* Ignore HttpOnly */
-					continue;
+	while (e != NULL) {
+		if (e->segment_hash == hash &&
+				strncmp(e->segment, segment, seglen) == 0 &&
+				e->segment[seglen] == '\0')
+			break;
 
-				matched_cookies[count++] = c;
+		e = (parent->child_hash == NULL) ? e->next : e->hash_next;
+	}
 
-				GROW_MATCHED_COOKIES;
+	return e;
+}
 
-				if (c->version < (unsigned int)version)
-					version = c->version;
+/**
+ * Find host specific cookies in a path tree applicable to a request
+ *
+ * \param parent Node to search beneath
+ * \param remaining Remainder of request path beneath parent, without the
+ *                  leading '/'
+ * \param path Complete path of the request URL
+ * \param secure The request is being made over a secure transport
+ * \param include_http_only Whether to include HTTP(S) only cookies
+ * \param now Current time
+ * \param m Matched cookies, updated
+ * \return true on success, false on memory exhaustion
+ *
+ * Cookies are gathered most specific path first.
+ */
+static bool urldb_match_path_cookies(const struct path_data *parent,
+		const char *remaining, const char *path, bool secure,
+		bool include_http_only, time_t now, struct cookie_match *m)
+{
+	const struct path_data *q;
+	const char *slash;
+	size_t seglen;
+	unsigned int hash;
+
+	slash = strchr(remaining, '/');
+	seglen = (slash != NULL) ? (size_t) (slash - remaining) :
+			strlen(remaining);
+	hash = urldb_segment_hash(remaining, seglen);
+
+	/* Entries for the next segment, possibly under several schemes */
+	for (q = urldb_next_path_child(parent, NULL, remaining, seglen, hash);
+			q != NULL;
+			q = urldb_next_path_child(parent, q, remaining,
+					seglen, hash)) {
+		if (slash != NULL) {
+			if (!urldb_match_path_cookies(q, slash + 1, path,
+					secure, include_http_only, now, m))
+				return false;
+		} else if (!urldb_match_cookies(q->cookies, path, secure,
+				include_http_only, now, m)) {
+			return false;
+		}
+	}
 
-				c->last_used = now;
+	/* This directory's entries, unless already considered above */
+	if (seglen > 0) {
+		hash = urldb_segment_hash("", 0);
 
-				cookie_manager_add((struct cookie_data *)c);
-			}
+		for (q = urldb_next_path_child(parent, NULL, "", 0, hash);
+				q != NULL;
+				q = urldb_next_path_child(parent, q, "", 0, hash)) {
+			if (!urldb_match_cookies(q->cookies, path, secure,
+					include_http_only, now, m))
+				return false;
 		}
 	}
 
-	/* Now consider cookies whose paths prefix-match ours */
-	for (p = p->parent; p; p = p->parent) {
-		/* Find directory's path entry(ies) */
-		/* There are potentially multiple due to differing schemes */
-		for (q = p->children; q; q = q->next) {
-			if (*(q->segment) != '\0')
-				continue;
+	/* The node itself, which may be the result of Path=/foo.
+	 * The cookies of a host's root are domain cookies. */
+	if (parent->parent != NULL) {
+		if (!urldb_match_cookies(parent->cookies, path, secure,
+				include_http_only, now, m))
+			return false;
+	}
 
-			for (c = q->cookies; c; c = c->next) {
-				if (c->expires != -1 && c->expires < now)
-					/* cookie has expired => ignore */
-					continue;
+	return true;
+}
 
-				if (c->secure && lwc_string_isequal(
-							q->scheme,
-							corestring_lwc_https,
-							&match) &&
-						match == false)
-					/* Secure cookie for insecure server
-					 * => ignore */
-					continue;
+/**
+ * Find the host tree node for a host, without inserting it
+ *
+ * \param host Host name to look for
+ * \param exact Updated to indicate whether the result is the node for
+ *              host, rather than that of its closest known parent domain
+ * \return The host's node or that of its closest known parent domain, or
+ *         NULL if neither are present
+ */
+static const struct host_part *urldb_find_host_or_parent(const char *host,
+		bool *exact)
+{
+	const struct host_part *d = &db_root, *e;
+	const char *part, *end = host + strlen(host);
 
-				matched_cookies[count++] = c;
+	*exact = false;
 
-				GROW_MATCHED_COOKIES;
+	if (url_host_is_ip_address(host)) {
+		e = urldb_find_host_child(d, host, end - host);
+		*exact = (e != NULL);
+		return e;
+	}
 
-				if (c->version < (unsigned int) version)
-					version = c->version;
+	/* Process FQDN segments backwards, in place */
+	do {
+		for (part = end; part > host && part[-1] != '.'; part--)
+			; /* do nothing */
 
-				c->last_used = now;
+		e = urldb_find_host_child(d, part, end - part);
+		if (e == NULL)
+			break;
 
-				cookie_manager_add((struct cookie_data *)c);
-			}
-		}
+		d = e;
 
-		if (!p->parent) {
-			/* No parent, so bail here. This can't go in
-			 * the loop exit condition as we also want to
-			 * process the top-level node.
-                         *
-                         * If p->parent is NULL then p->cookies are
-                         * the domain cookies and thus we don't even
-                         * try matching against them.
-                         */
+		if (part == host) {
+			*exact = true;
 			break;
 		}
 
-		/* Consider p itself - may be the result of Path=/foo */
-		for (c = p->cookies; c; c = c->next) {
-			if (c->expires != -1 && c->expires < now)
-				/* cookie has expired => ignore */
-				continue;
-
-			/* Ensure cookie path is a prefix of the resource */
-			if (strncmp(c->path, path, strlen(c->path)) != 0)
-				/* paths don't match => ignore */
-				continue;
+		end = part - 1;
+	} while (1);
 
-			if (c->secure && lwc_string_isequal(p->scheme,
-						corestring_lwc_https,
-						&match) &&
-					match == false)
-				/* Secure cookie for insecure server
-				 * => ignore */
-				continue;
+	return (d != &db_root) ? d : NULL;
+}
 
-			matched_cookies[count++] = c;
+/**
+ * Find an entry in the Cookie: header cache
+ *
+ * \param url URL being fetched
+ * \param include_http_only Whether to include HTTP(S) only cookies.
+ * \param now Current time
+ * \return Valid cache entry, or NULL if none
+ */
+static struct cookie_cache_entry *urldb_cookie_cache_find(nsurl *url,
+		bool include_http_only, time_t now)
+{
+	struct cookie_cache_entry *entry;
 
-			GROW_MATCHED_COOKIES;
+	entry = &cookie_cache[nsurl_hash(url) & (COOKIE_CACHE_SIZE - 1)];
 
-			if (c->version < (unsigned int) version)
-				version = c->version;
+	if (entry->url == NULL ||
+			entry->generation != cookie_generation ||
+			entry->include_http_only != include_http_only ||
+			(entry->match.expires != -1 &&
+			 entry->match.expires < now) ||
+			nsurl_compare(entry->url, url,
+					NSURL_COMPLETE) == false)
+		return NULL;
 
-			c->last_used = now;
+	return entry;
+}
 
-			cookie_manager_add((struct cookie_data *)c);
-		}
+/**
+ * Flush the Cookie: header cache
+ */
+static void urldb_cookie_cache_flush(void)
+{
+	int i;
 
+	for (i = 0; i < COOKIE_CACHE_SIZE; i++) {
+		if (cookie_cache[i].url != NULL)
+			nsurl_unref(cookie_cache[i].url);
+		free(cookie_cache[i].header);
+		free(cookie_cache[i].match.cookies);
 	}
 
-	/* Finally consider domain cookies for hosts which domain match ours */
-	for (h = (const struct host_part *)p; h && h != &db_root;
-			h = h->parent) {
-		for (c = h->paths.cookies; c; c = c->next) {
-			if (c->expires != -1 && c->expires < now)
-				/* cookie has expired => ignore */
-				continue;
+	memset(cookie_cache, 0, sizeof(cookie_cache));
 
-			/* Ensure cookie path is a prefix of the resource */
-			if (strncmp(c->path, path, strlen(c->path)) != 0)
-				/* paths don't match => ignore */
-				continue;
+	cookie_generation++;
+}
 
-			if (c->secure && lwc_string_isequal(scheme,
-						corestring_lwc_https,
-						&match) &&
-					match == false)
-				/* secure cookie for insecure host. ignore */
-				continue;
+/**
+ * Retrieve cookies for an URL
+ *
+ * \param url URL being fetched
+ * \param include_http_only Whether to include HTTP(S) only cookies.
+ * \return Cookies string for libcurl (on heap), or NULL on error/no cookies
+ */
+char *urldb_get_cookie(nsurl *url, bool include_http_only)
+{
+	const struct host_part *h;
+	struct cookie_cache_entry *entry;
+	struct cookie_match m;
+	lwc_string *path_lwc, *scheme, *host;
+	int ret_alloc = 4096, ret_used = 1;
+	const char *host_str;
+	char *ret;
+	time_t now;
+	unsigned int i;
+	bool secure, exact, match;
 
-			matched_cookies[count++] = c;
+	assert(url != NULL);
 
-			GROW_MATCHED_COOKIES;
+	now = time(NULL);
 
-			if (c->version < (unsigned int)version)
-				version = c->version;
+	entry = urldb_cookie_cache_find(url, include_http_only, now);
+	if (entry == NULL) {
+		memset(&m, 0, sizeof(m));
+		m.version = COOKIE_RFC2965;
+		m.expires = -1;
 
-			c->last_used = now;
+		scheme = nsurl_get_component(url, NSURL_SCHEME);
+		if (scheme == NULL)
+			return NULL;
 
-			cookie_manager_add((struct cookie_data *)c);
-		}
-	}
+		secure = (lwc_string_isequal(scheme, corestring_lwc_https,
+				&match) == lwc_error_ok && match == true);
 
-	if (count == 0) {
-		/* No cookies found */
-		free(ret);
-		free(matched_cookies);
-		return NULL;
-	}
+		host = nsurl_get_component(url, NSURL_HOST);
+		if (host != NULL) {
+			host_str = lwc_string_data(host);
+			lwc_string_unref(host);
 
-	/* and build output string */
-	if (version > COOKIE_NETSCAPE) {
-		sprintf(ret, "$Version=%d", version);
-		ret_used = strlen(ret) + 1;
-	}
+		} else if (lwc_string_isequal(scheme, corestring_lwc_file,
+				&match) == lwc_error_ok && match == true) {
+			host_str = "localhost";
 
-	for (i = 0; i < count; i++) {
-		if (!urldb_concat_cookie(matched_cookies[i], version,
-				&ret_used, &ret_alloc, &ret)) {
-			free(ret);
-			free(matched_cookies);
+		} else {
+			lwc_string_unref(scheme);
 			return NULL;
 		}
-	}
 
-	if (version == COOKIE_NETSCAPE) {
-		/* Old-style cookies => no version & skip "; " */
-		memmove(ret, ret + 2, ret_used - 2);
-		ret_used -= 2;
-	}
+		lwc_string_unref(scheme);
 
-	/* Now, shrink the output buffer to the required size */
-	{
-		char *temp = realloc(ret, ret_used);
-		if (!temp) {
-			free(ret);
-			free(matched_cookies);
+		path_lwc = nsurl_get_component(url, NSURL_PATH);
+		if (path_lwc == NULL)
+			return NULL;
+
+		h = urldb_find_host_or_parent(host_str, &exact);
+
+		/* Host specific cookies, most specific path first */
+		if (h != NULL && exact &&
+				lwc_string_data(path_lwc)[0] == '/' &&
+				!urldb_match_path_cookies(&h->paths,
+					lwc_string_data(path_lwc) + 1,
+					lwc_string_data(path_lwc), secure,
+					include_http_only, now, &m)) {
+			lwc_string_unref(path_lwc);
+			free(m.cookies);
 			return NULL;
 		}
 
-		ret = temp;
+		/* Finally consider domain cookies for hosts which domain
+		 * match ours */
+		for (; h && h != &db_root; h = h->parent) {
+			if (!urldb_match_cookies(h->paths.cookies,
+					lwc_string_data(path_lwc), secure,
+					include_http_only, now, &m)) {
+				lwc_string_unref(path_lwc);
+				free(m.cookies);
+				return NULL;
+			}
+		}
+
+		lwc_string_unref(path_lwc);
+
+		/* and build output string */
+		ret = NULL;
+
+		if (m.count > 0) {
+			ret = malloc(ret_alloc);
+			if (!ret) {
+				free(m.cookies);
+				return NULL;
+			}
+
+			ret[0] = '\0';
+
+			if (m.version > COOKIE_NETSCAPE) {
+				sprintf(ret, "$Version=%d", m.version);
+				ret_used = strlen(ret) + 1;
+			}
+
+			for (i = 0; i < m.count; i++) {
+				if (!urldb_concat_cookie(m.cookies[i],
+						m.version, &ret_used,
+						&ret_alloc, &ret)) {
+					free(ret);
+					free(m.cookies);
+					return NULL;
+				}
+			}
+
+			if (m.version == COOKIE_NETSCAPE) {
+				/* Old-style cookies => no version &
+				 * skip "; " */
+				memmove(ret, ret + 2, ret_used - 2);
+				ret_used -= 2;
+			}
+		}
+
+		/* Replace the cache entry for this URL */
+		entry = &cookie_cache[nsurl_hash(url) &
+				(COOKIE_CACHE_SIZE - 1)];
+
+		if (entry->url != NULL)
+			nsurl_unref(entry->url);
+		free(entry->header);
+		free(entry->match.cookies);
+
+		entry->url = nsurl_ref(url);
+		entry->include_http_only = include_http_only;
+		entry->generation = cookie_generation;
+		entry->header = ret;
+		entry->match = m;
 	}
 
-	free(matched_cookies);
+	/* Note use of the cookies */
+	for (i = 0; i < entry->match.count; i++) {
+		struct cookie_internal_data *c = entry->match.cookies[i];
 
-	return ret;
+		if (c->last_used != now) {
+			c->last_used = now;
+
+			cookie_manager_add((struct cookie_data *) c);
+		}
+	}
+
+	if (entry->header == NULL)
+		return NULL;
 
-#undef GROW_MATCHED_COOKIES
+	return strdup(entry->header);
 }
 
 /**
@@ -3355,6 +4383,8 @@ bool urldb_insert_cookie(struct cookie_internal_data *c, lwc_string *scheme,
 
 	assert(c);
 
+	cookie_generation++;
+
 	if (c->domain[0] == '.') {
 		h = urldb_search_find(
 			urldb_get_search_tree(&(c->domain[1])),
@@ -3416,8 +4446,14 @@ bool urldb_insert_cookie(struct cookie_internal_data *c, lwc_string *scheme,
 
 			cookie_manager_remove((struct cookie_data *)d);
 
+			if (d->expires != -1)
+				urldb_journal_printf("D\t%s\t%s\t%s\n",
+						d->domain, d->path, d->name);
+
 			urldb_free_cookie(d);
 			urldb_free_cookie(c);
+
+			return true;
 		} else {
 			/* replace d with c */
 			c->prev = d->prev;
@@ -3432,6 +4468,13 @@ bool urldb_insert_cookie(struct cookie_internal_data *c, lwc_string *scheme,
 				p->cookies = c;
 
 			cookie_manager_remove((struct cookie_data *)d);
+
+			/* A session cookie replacing a persistent one must
+			 * remove it from the journal's view too */
+			if (c->expires == -1 && d->expires != -1)
+				urldb_journal_printf("D\t%s\t%s\t%s\n",
+						d->domain, d->path, d->name);
+
 			urldb_free_cookie(d);
 
 			cookie_manager_add((struct cookie_data *)c);
@@ -3448,6 +4491,11 @@ bool urldb_insert_cookie(struct cookie_internal_data *c, lwc_string *scheme,
 		cookie_manager_add((struct cookie_data *)c);
 	}
 
+	/* Only journalled once inserted, so a failed insertion is never
+	 * replayed */
+	if (c->expires != -1)
+		urldb_journal_cookie(c, scheme, url);
+
 	return true;
 }
 
@@ -3643,46 +4691,23 @@ void urldb_load_cookies(const char *filename)
 	if (!fp)
 		return;
 
-#define FIND_T {							\
-		for (; *p && *p != '\t'; p++)				\
-			; /* do nothing */				\
-		if (p >= end) {						\
-			LOG(("Overran input"));				\
-			continue;					\
-		}							\
-		*p++ = '\0';						\
-}
-
-#define SKIP_T {							\
-		for (; *p && *p == '\t'; p++)				\
-			; /* do nothing */				\
-		if (p >= end) {						\
-			LOG(("Overran input"));				\
-			continue;					\
-		}							\
-}
-
 	while (fgets(s, sizeof s, fp)) {
-		char *p = s, *end = 0,
-			*domain, *path, *name, *value, *scheme, *url,
-			*comment;
-		int version, domain_specified, path_specified,
-			secure, http_only, no_destroy, value_quoted;
-		time_t expires, last_used;
-		struct cookie_internal_data *c;
+		char *p = s;
 
 		if(s[0] == 0 || s[0] == '#')
 			/* Skip blank lines or comments */
 			continue;
 
 		s[strlen(s) - 1] = '\0'; /* lose terminating newline */
-		end = s + strlen(s);
 
 		/* Look for file version first
 		 * (all input is ignored until this is read)
 		 */
 		if (strncasecmp(s, "Version:", 8) == 0) {
-			FIND_T; SKIP_T; loaded_cookie_file_version = atoi(p);
+			for (p += 8; *p == '\t'; p++)
+				; /* do nothing */
+
+			loaded_cookie_file_version = atoi(p);
 
 			if (loaded_cookie_file_version < 
 					MIN_COOKIE_FILE_VERSION) {
@@ -3697,103 +4722,144 @@ void urldb_load_cookies(const char *filename)
 		}
 
 		/* One cookie/line */
+		if (!urldb_load_cookie_line(s, loaded_cookie_file_version))
+			break;
+	}
 
-		/* Parse input */
-		FIND_T; version = atoi(s);
-		SKIP_T; domain = p; FIND_T;
-		SKIP_T; domain_specified = atoi(p); FIND_T;
-		SKIP_T; path = p; FIND_T;
-		SKIP_T; path_specified = atoi(p); FIND_T;
-		SKIP_T; secure = atoi(p); FIND_T;
-		if (loaded_cookie_file_version > 101) {
-			/* Introduced in version 1.02 */
-			SKIP_T; http_only = atoi(p); FIND_T;
-		} else {
-			http_only = 0;
-		}
-		SKIP_T; expires = (time_t)atoi(p); FIND_T;
-		SKIP_T; last_used = (time_t)atoi(p); FIND_T;
-		SKIP_T; no_destroy = atoi(p); FIND_T;
-		SKIP_T; name = p; FIND_T;
-		SKIP_T; value = p; FIND_T;
-		if (loaded_cookie_file_version > 100) {
-			/* Introduced in version 1.01 */
-			SKIP_T;	value_quoted = atoi(p); FIND_T;
-		} else {
-			value_quoted = 0;
-		}
-		SKIP_T; scheme = p; FIND_T;
-		SKIP_T; url = p; FIND_T;
+	fclose(fp);
+}
 
-		/* Comment may have no content, so don't
-		 * use macros as they'll break */
-		for (; *p && *p == '\t'; p++)
-			; /* do nothing */
-		comment = p;
+/**
+ * Parse a cookie from a line of a cookie file and insert it into database
+ *
+ * \param s Line to parse, without terminating newline (modified)
+ * \param version Version of the cookie file format
+ * \return true on success or a malformed line, false on memory exhaustion
+ */
+bool urldb_load_cookie_line(char *s, int version)
+{
+	char *p = s, *end = s + strlen(s),
+		*domain, *path, *name, *value, *scheme, *url,
+		*comment;
+	int cookie_version, domain_specified, path_specified,
+		secure, http_only, no_destroy, value_quoted;
+	time_t expires, last_used;
+	struct cookie_internal_data *c;
 
-		assert(p <= end);
+#define FIND_T {							\
+		for (; *p && *p != '\t'; p++)				\
+			; /* do nothing */				\
+		if (p >= end) {						\
+			LOG(("Overran input"));				\
+			return true;					\
+		}							\
+		*p++ = '\0';						\
+}
 
-		/* Now create cookie */
-		c = malloc(sizeof(struct cookie_internal_data));
-		if (!c)
-			break;
+#define SKIP_T {							\
+		for (; *p && *p == '\t'; p++)				\
+			; /* do nothing */				\
+		if (p >= end) {						\
+			LOG(("Overran input"));				\
+			return true;					\
+		}							\
+}
 
-		c->name = strdup(name);
-		c->value = strdup(value);
-		c->value_was_quoted = value_quoted;
-		c->comment = strdup(comment);
-		c->domain_from_set = domain_specified;
-		c->domain = strdup(domain);
-		c->path_from_set = path_specified;
-		c->path = strdup(path);
-		c->expires = expires;
-		c->last_used = last_used;
-		c->secure = secure;
-		c->http_only = http_only;
-		c->version = version;
-		c->no_destroy = no_destroy;
-
-		if (!(c->name && c->value && c->comment &&
-				c->domain && c->path)) {
-			urldb_free_cookie(c);
-			break;
-		}
+	/* Parse input */
+	FIND_T; cookie_version = atoi(s);
+	SKIP_T; domain = p; FIND_T;
+	SKIP_T; domain_specified = atoi(p); FIND_T;
+	SKIP_T; path = p; FIND_T;
+	SKIP_T; path_specified = atoi(p); FIND_T;
+	SKIP_T; secure = atoi(p); FIND_T;
+	if (version > 101) {
+		/* Introduced in version 1.02 */
+		SKIP_T; http_only = atoi(p); FIND_T;
+	} else {
+		http_only = 0;
+	}
+	SKIP_T; expires = (time_t)atoi(p); FIND_T;
+	SKIP_T; last_used = (time_t)atoi(p); FIND_T;
+	SKIP_T; no_destroy = atoi(p); FIND_T;
+	SKIP_T; name = p; FIND_T;
+	SKIP_T; value = p; FIND_T;
+	if (version > 100) {
+		/* Introduced in version 1.01 */
+		SKIP_T;	value_quoted = atoi(p); FIND_T;
+	} else {
+		value_quoted = 0;
+	}
+	SKIP_T; scheme = p; FIND_T;
+	SKIP_T; url = p; FIND_T;
 
-		if (c->domain[0] != '.') {
-			lwc_string *scheme_lwc = NULL;
-			nsurl *url_nsurl = NULL;
+#undef SKIP_T
+#undef FIND_T
 
-			assert(scheme[0] != 'u');
+	/* Comment may have no content, so don't
+	 * use macros as they'll break */
+	for (; *p && *p == '\t'; p++)
+		; /* do nothing */
+	comment = p;
 
-			if (nsurl_create(url, &url_nsurl) != NSERROR_OK) {
-				urldb_free_cookie(c);
-				break;
-			}
-			scheme_lwc = nsurl_get_component(url_nsurl,
-					NSURL_SCHEME);
-
-			/* And insert it into database */
-			if (!urldb_insert_cookie(c, scheme_lwc, url_nsurl)) {
-				/* Cookie freed for us */
-				nsurl_unref(url_nsurl);
-				lwc_string_unref(scheme_lwc);
-				break;
-			}
+	assert(p <= end);
+
+	/* Now create cookie */
+	c = malloc(sizeof(struct cookie_internal_data));
+	if (!c)
+		return false;
+
+	c->name = strdup(name);
+	c->value = strdup(value);
+	c->value_was_quoted = value_quoted;
+	c->comment = strdup(comment);
+	c->domain_from_set = domain_specified;
+	c->domain = strdup(domain);
+	c->path_from_set = path_specified;
+	c->path = strdup(path);
+	c->expires = expires;
+	c->last_used = last_used;
+	c->secure = secure;
+	c->http_only = http_only;
+	c->version = cookie_version;
+	c->no_destroy = no_destroy;
+
+	if (!(c->name && c->value && c->comment &&
+			c->domain && c->path)) {
+		urldb_free_cookie(c);
+		return false;
+	}
+
+	if (c->domain[0] != '.') {
+		lwc_string *scheme_lwc = NULL;
+		nsurl *url_nsurl = NULL;
+
+		assert(scheme[0] != 'u');
+
+		if (nsurl_create(url, &url_nsurl) != NSERROR_OK) {
+			urldb_free_cookie(c);
+			return false;
+		}
+		scheme_lwc = nsurl_get_component(url_nsurl,
+				NSURL_SCHEME);
+
+		/* And insert it into database */
+		if (!urldb_insert_cookie(c, scheme_lwc, url_nsurl)) {
+			/* Cookie freed for us */
 			nsurl_unref(url_nsurl);
 			lwc_string_unref(scheme_lwc);
+			return false;
+		}
+		nsurl_unref(url_nsurl);
+		lwc_string_unref(scheme_lwc);
 
-		} else {
-			if (!urldb_insert_cookie(c, NULL, NULL)) {
-				/* Cookie freed for us */
-				break;
-			}
+	} else {
+		if (!urldb_insert_cookie(c, NULL, NULL)) {
+			/* Cookie freed for us */
+			return false;
 		}
 	}
 
-#undef SKIP_T
-#undef FIND_T
-
-	fclose(fp);
+	return true;
 }
 
 /**
@@ -3806,6 +4872,8 @@ void urldb_load_cookies(const char *filename)
 void urldb_delete_cookie(const char *domain, const char *path,
 		const char *name)
 {
+	urldb_journal_printf("D\t%s\t%s\t%s\n", domain, path, name);
+
 	urldb_delete_cookie_hosts(domain, path, name, &db_root);
 }
 
@@ -3846,6 +4914,8 @@ void urldb_delete_cookie_paths(const char *domain, const char *path,
 
 				urldb_free_cookie(c);
 
+				cookie_generation++;
+
 				return;
 			}
 		}
@@ -3871,6 +4941,17 @@ void urldb_delete_cookie_paths(const char *domain, const char *path,
  * \param filename Path to save to
  */
 void urldb_save_cookies(const char *filename)
+{
+	urldb_replace_file(filename, urldb_write_cookies);
+}
+
+/**
+ * Write persistent cookies to file
+ *
+ * \param filename Path to write to
+ * \return true on success, false otherwise
+ */
+bool urldb_write_cookies(const char *filename)
 {
 	FILE *fp;
 	int cookie_file_version = max(loaded_cookie_file_version, 
@@ -3880,7 +4961,7 @@ void urldb_save_cookies(const char *filename)
 
 	fp = fopen(filename, "w");
 	if (!fp)
-		return;
+		return false;
 
 	fprintf(fp, "# >%s\n", filename);
 	fprintf(fp, "# NetSurf cookies file.\n"
@@ -3899,7 +4980,12 @@ void urldb_save_cookies(const char *filename)
 
 	urldb_save_cookie_hosts(fp, &db_root);
 
-	fclose(fp);
+	if (ferror(fp) || !urldb_sync_file(fp)) {
+		fclose(fp);
+		return false;
+	}
+
+	return (fclose(fp) == 0);
 }
 
 /**
@@ -3941,9 +5027,7 @@ void urldb_save_cookie_paths(FILE *fp, struct path_data *parent)
 					/* Skip expired & session cookies */
 					continue;
 
-				fprintf(fp, 
-					"%d\t%s\t%d\t%s\t%d\t%d\t%d\t%d\t%d\t%d\t"
-					"%s\t%s\t%d\t%s\t%s\t%s\n",
+				fprintf(fp, COOKIE_FILE_LINE,
 					c->version, c->domain,
 					c->domain_from_set, c->path,
 					c->path_from_set, c->secure,
@@ -3975,6 +5059,404 @@ void urldb_save_cookie_paths(FILE *fp, struct path_data *parent)
 }
 
 
+/**
+ * Flush a file's buffered data through to storage
+ *
+ * \param fp File to flush
+ * \return true on success, false otherwise
+ *
+ * Data is only durable once this succeeds, so it is called before any
+ * point at which the data is relied upon, such as replacing a file with
+ * a rewritten copy.
+ */
+bool urldb_sync_file(FILE *fp)
+{
+	if (fflush(fp) != 0)
+		return false;
+
+#ifdef HAVE_FSYNC
+	if (fsync(fileno(fp)) != 0)
+		return false;
+#endif
+
+	return true;
+}
+
+/**
+ * Append a record to the journal's buffer
+ *
+ * \param fmt Format string for record
+ * \param ... Arguments for format string
+ *
+ * Nothing is recorded if the journal is not open.
+ */
+void urldb_journal_printf(const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	if (urldb_journal.filename == NULL)
+		return;
+
+	va_start(ap, fmt);
+	len = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+
+	if (len < 0)
+		return;
+
+	if (urldb_journal.used + len + 1 > urldb_journal.alloc) {
+		size_t alloc = urldb_journal.alloc + len + 1 + 4096;
+		char *temp = realloc(urldb_journal.buffer, alloc);
+		if (temp == NULL) {
+			LOG(("Memory exhausted; journal record dropped"));
+			return;
+		}
+
+		urldb_journal.buffer = temp;
+		urldb_journal.alloc = alloc;
+	}
+
+	va_start(ap, fmt);
+	vsnprintf(urldb_journal.buffer + urldb_journal.used, len + 1, fmt, ap);
+	va_end(ap);
+
+	urldb_journal.used += len;
+}
+
+/**
+ * Note a change to an URL's data in the journal
+ *
+ * \param p Path node of changed URL
+ *
+ * The URL's state is recorded when the journal is next written, so that
+ * multiple changes result in a single record.
+ */
+void urldb_journal_url(struct path_data *p)
+{
+	if (urldb_journal.filename == NULL || p->journal_dirty ||
+			p->url == NULL)
+		return;
+
+	if (urldb_journal.dirty_count == urldb_journal.dirty_alloc) {
+		unsigned int alloc = urldb_journal.dirty_alloc + 64;
+		struct path_data **temp = realloc(urldb_journal.dirty,
+				alloc * sizeof(struct path_data *));
+		if (temp == NULL) {
+			LOG(("Memory exhausted; journal record dropped"));
+			return;
+		}
+
+		urldb_journal.dirty = temp;
+		urldb_journal.dirty_alloc = alloc;
+	}
+
+	urldb_journal.dirty[urldb_journal.dirty_count++] = p;
+	p->journal_dirty = true;
+}
+
+/**
+ * Record a cookie's insertion in the journal
+ *
+ * \param c Cookie being inserted
+ * \param scheme URL scheme associated with cookie path, or NULL
+ * \param url URL associated with cookie path, or NULL
+ */
+void urldb_journal_cookie(const struct cookie_internal_data *c,
+		lwc_string *scheme, nsurl *url)
+{
+	urldb_journal_printf("C\t" COOKIE_FILE_LINE,
+			c->version, c->domain,
+			c->domain_from_set, c->path,
+			c->path_from_set, c->secure,
+			c->http_only,
+			(int)c->expires, (int)c->last_used,
+			c->no_destroy, c->name, c->value,
+			c->value_was_quoted,
+			scheme ? lwc_string_data(scheme) : "unused",
+			url ? nsurl_access(url) : "unused",
+			c->comment ? c->comment : "");
+}
+
+/**
+ * Write pending journal records to the journal file
+ *
+ * \return true on success, false otherwise
+ */
+static bool urldb_journal_write(void)
+{
+	unsigned int i;
+	FILE *fp;
+	bool ok;
+
+	/* Snapshot the state of changed URLs */
+	for (i = 0; i != urldb_journal.dirty_count; i++) {
+		struct path_data *p = urldb_journal.dirty[i];
+		const char *title = p->urld.title ? p->urld.title : "";
+		size_t len = strcspn(title, "\t\r\n");
+
+		urldb_journal_printf("U\t%d\t%lld\t%d\t%d\t%s\t%.*s\n",
+				p->urld.visits,
+				(long long) p->urld.last_visit,
+				(int) p->urld.type, p->persistent ? 1 : 0,
+				nsurl_access(p->url), (int) len, title);
+
+		p->journal_dirty = false;
+	}
+	urldb_journal.dirty_count = 0;
+
+	if (urldb_journal.used == 0)
+		return true;
+
+	fp = fopen(urldb_journal.filename, "a");
+	if (fp == NULL) {
+		LOG(("Failed to open journal '%s'", urldb_journal.filename));
+		return false;
+	}
+
+	ok = (fwrite(urldb_journal.buffer, 1, urldb_journal.used, fp) ==
+			urldb_journal.used) && urldb_sync_file(fp);
+	if (fclose(fp) != 0)
+		ok = false;
+
+	if (ok) {
+		urldb_journal.size += urldb_journal.used;
+		urldb_journal.used = 0;
+	} else {
+		LOG(("Failed writing journal '%s'", urldb_journal.filename));
+	}
+
+	return ok;
+}
+
+/**
+ * Compact the journal into the URL and cookie files
+ */
+static void urldb_journal_compact(void)
+{
+	FILE *fp;
+
+	LOG(("Compacting journal '%s'", urldb_journal.filename));
+
+	if (!urldb_journal_write())
+		return;
+
+	/* The journal may only be discarded once both files are safe */
+	if (!urldb_replace_file(urldb_journal.url_file, urldb_write) ||
+			!urldb_replace_file(urldb_journal.cookie_file,
+					urldb_write_cookies))
+		return;
+
+	fp = fopen(urldb_journal.filename, "w");
+	if (fp != NULL) {
+		urldb_sync_file(fp);
+		fclose(fp);
+		urldb_journal.size = 0;
+	}
+}
+
+/**
+ * Scheduled journal writer
+ *
+ * \param p Unused
+ */
+static void urldb_journal_callback(void *p)
+{
+	urldb_journal_write();
+
+	if (urldb_journal.size > URLDB_JOURNAL_COMPACT_SIZE)
+		urldb_journal_compact();
+
+	schedule(URLDB_JOURNAL_INTERVAL, urldb_journal_callback, NULL);
+}
+
+/**
+ * Apply an URL record from the journal
+ *
+ * \param s Record, without the type or terminating newline (modified)
+ * \return true on success or a malformed record, false on memory exhaustion
+ */
+static bool urldb_journal_replay_url(char *s)
+{
+	char *field[6];
+	char *p = s;
+	struct path_data *d;
+	nsurl *url;
+	int i;
+
+	/* visits, last visit, type, persistent, url, title */
+	for (i = 0; i != 5; i++) {
+		field[i] = p;
+		p = strchr(p, '\t');
+		if (p == NULL) {
+			LOG(("Malformed journal record"));
+			return true;
+		}
+		*p++ = '\0';
+	}
+	field[5] = p;
+
+	if (nsurl_create(field[4], &url) != NSERROR_OK)
+		return false;
+
+	if (!urldb_add_url(url)) {
+		nsurl_unref(url);
+		return false;
+	}
+
+	d = urldb_find_url(url);
+	nsurl_unref(url);
+	if (d == NULL)
+		return false;
+
+	d->urld.visits = atoi(field[0]);
+	d->urld.last_visit = (time_t) strtoll(field[1], NULL, 10);
+	d->urld.type = (content_type) atoi(field[2]);
+	d->persistent = atoi(field[3]) != 0;
+
+	if (*field[5] != '\0') {
+		char *title = strdup(field[5]);
+		if (title == NULL)
+			return false;
+
+		free(d->urld.title);
+		d->urld.title = title;
+	}
+
+	return true;
+}
+
+/**
+ * Apply the records in a journal to the database
+ *
+ * \param filename Journal file
+ * \return Size of journal file
+ */
+static long urldb_journal_replay(const char *filename)
+{
+	char s[16*1024];
+	size_t len;
+	long size = 0;
+	FILE *fp;
+	bool ok = true;
+
+	fp = fopen(filename, "r");
+	if (fp == NULL)
+		return 0;
+
+	while (ok && fgets(s, sizeof s, fp)) {
+		len = strlen(s);
+		size += len;
+
+		if (len < 3 || s[len - 1] != '\n' || s[1] != '\t') {
+			/* Overlong, or truncated by a crash */
+			LOG(("Malformed journal record"));
+			continue;
+		}
+
+		s[len - 1] = '\0';
+
+		switch (s[0]) {
+		case 'U':
+			ok = urldb_journal_replay_url(s + 2);
+			break;
+		case 'C':
+			ok = urldb_load_cookie_line(s + 2, COOKIE_FILE_VERSION);
+			break;
+		case 'D':
+		{
+			char *path = strchr(s + 2, '\t');
+			char *name = path ? strchr(path + 1, '\t') : NULL;
+
+			if (name != NULL) {
+				*path++ = '\0';
+				*name++ = '\0';
+				urldb_delete_cookie_hosts(s + 2, path, name,
+						&db_root);
+			}
+		}
+			break;
+		default:
+			LOG(("Unknown journal record '%c'", s[0]));
+			break;
+		}
+	}
+
+	if (!ok)
+		LOG(("Memory exhausted whilst replaying journal"));
+
+	fclose(fp);
+
+	return size;
+}
+
+/**
+ * Open the journal of database and cookie changes
+ *
+ * \param filename Journal file
+ * \param url_file URL file to compact into
+ * \param cookie_file Cookie file to compact into
+ * \return NSERROR_OK on success, appropriate error otherwise
+ *
+ * Any records in the journal are applied to the database, so this must be
+ * called after the URL and cookie files have been loaded.
+ */
+nserror urldb_journal_open(const char *filename, const char *url_file,
+		const char *cookie_file)
+{
+	char *journal;
+
+	if (filename == NULL || url_file == NULL || cookie_file == NULL)
+		return NSERROR_BAD_PARAMETER;
+
+	urldb_journal_close();
+
+	journal = strdup(filename);
+	urldb_journal.url_file = strdup(url_file);
+	urldb_journal.cookie_file = strdup(cookie_file);
+	if (journal == NULL || urldb_journal.url_file == NULL ||
+			urldb_journal.cookie_file == NULL) {
+		free(journal);
+		free(urldb_journal.url_file);
+		free(urldb_journal.cookie_file);
+		memset(&urldb_journal, 0, sizeof(urldb_journal));
+		return NSERROR_NOMEM;
+	}
+
+	LOG(("Replaying journal '%s'", filename));
+
+	/* Records are not journalled until the filename is set */
+	urldb_journal.size = urldb_journal_replay(filename);
+	urldb_journal.filename = journal;
+
+	if (urldb_journal.size > URLDB_JOURNAL_COMPACT_SIZE)
+		urldb_journal_compact();
+
+	schedule(URLDB_JOURNAL_INTERVAL, urldb_journal_callback, NULL);
+
+	return NSERROR_OK;
+}
+
+/**
+ * Write any pending journal records and close the journal
+ */
+void urldb_journal_close(void)
+{
+	if (urldb_journal.filename == NULL)
+		return;
+
+	schedule_remove(urldb_journal_callback, NULL);
+
+	urldb_journal_write();
+
+	free(urldb_journal.filename);
+	free(urldb_journal.url_file);
+	free(urldb_journal.cookie_file);
+	free(urldb_journal.buffer);
+	free(urldb_journal.dirty);
+	memset(&urldb_journal, 0, sizeof(urldb_journal));
+}
+
 /**
  * Destroy urldb
  */
@@ -3983,21 +5465,41 @@ void urldb_destroy(void)
 	struct host_part *a, *b;
 	int i;
 
+	/* Pending journal records refer to the database */
+	urldb_journal_close();
+
 	/* Clean up search trees */
 	for (i = 0; i < NUM_SEARCH_TREES; i++) {
 		if (search_trees[i] != &empty)
 			urldb_destroy_search_tree(search_trees[i]);
+		search_trees[i] = &empty;
 	}
 
+	/* Cached cookie headers refer to the database */
+	urldb_cookie_cache_flush();
+
 	/* And database */
 	for (a = db_root.children; a; a = b) {
 		b = a->next;
 		urldb_destroy_host_tree(a);
 	}
+	db_root.children = NULL;
+	free(db_root.child_hash);
+	db_root.child_hash = NULL;
+	db_root.child_hash_size = 0;
+	db_root.child_count = 0;
         
         /* And the bloom filter */
-        if (url_bloom != NULL)
+        if (url_bloom != NULL) {
                 bloom_destroy(url_bloom);
+                url_bloom = NULL;
+        }
+
+	/* And the URL index */
+	free(url_index);
+	url_index = NULL;
+	url_index_size = 0;
+	url_index_count = 0;
 }
 
 /**
@@ -4033,6 +5535,7 @@ void urldb_destroy_host_tree(struct host_part *root)
 	}
 
 	/* And ourselves */
+	free(root->child_hash);
 	free(root->part);
 	free(root);
 }
@@ -4089,6 +5592,7 @@ void urldb_destroy_path_node_content(struct path_data *node)
 		lwc_string_unref(node->scheme);
 
 	free(node->segment);
+	free(node->child_hash);
 	for (i = 0; i < node->frag_cnt; i++)
 		free(node->fragment[i]);
 	free(node->fragment);
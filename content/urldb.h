@@ -118,6 +118,11 @@ void urldb_delete_cookie(const char *domain, const char *path, const char *name)
 void urldb_load_cookies(const char *filename);
 void urldb_save_cookies(const char *filename);
 
+/* Journal */
+nserror urldb_journal_open(const char *filename, const char *url_file,
+		const char *cookie_file);
+void urldb_journal_close(void);
+
 
 /* test harness only */
 struct host_part *urldb_add_host(const char *host);
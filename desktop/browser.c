@@ -1181,6 +1181,50 @@ static void browser_window_convert_to_download(struct browser_window *bw,
 }
 
 
+/**
+ * Get the scroll offsets of a browser window.
+ *
+ * \param  bw  browser window
+ * \param  sx  updated to horizontal scroll offset
+ * \param  sy  updated to vertical scroll offset
+ */
+static void browser_window_get_scroll(struct browser_window *bw,
+		int *sx, int *sy)
+{
+	*sx = 0;
+	*sy = 0;
+
+	if (bw->window != NULL) {
+		guit->window->get_scroll(bw->window, sx, sy);
+	} else {
+		if (bw->scroll_x != NULL)
+			*sx = scrollbar_get_offset(bw->scroll_x);
+		if (bw->scroll_y != NULL)
+			*sy = scrollbar_get_offset(bw->scroll_y);
+	}
+}
+
+/**
+ * Dispose of a closed content that has left a browser window.
+ *
+ * \param  bw        browser window the content has left
+ * \param  c         content, whose handle is taken over
+ * \param  scroll_x  horizontal scroll offset the content had
+ * \param  scroll_y  vertical scroll offset the content had
+ *
+ * Root windows keep the content in local history, to restore it if the
+ * user goes back to it.  Frames refetch their contents.
+ */
+static void browser_window_retire_content(struct browser_window *bw,
+		hlcache_handle *c, int scroll_x, int scroll_y)
+{
+	if (bw->browser_window_type == BROWSER_WINDOW_NORMAL &&
+			bw->history != NULL)
+		history_cache_content(bw->history, c, scroll_x, scroll_y);
+	else
+		hlcache_handle_release(c);
+}
+
 /**
  * Callback handler for content event messages.
  */
@@ -1220,19 +1264,20 @@ static nserror browser_window_callback(hlcache_handle *c,
 
 	case CONTENT_MSG_READY:
 	{
+		hlcache_handle *old = bw->current_content;
 		int width, height;
+		int scroll_x = 0, scroll_y = 0;
 
 		assert(bw->loading_content == c);
 
-		if (bw->current_content != NULL) {
-			content_status status = 
-					content_get_status(bw->current_content);
+		if (old != NULL) {
+			content_status status = content_get_status(old);
+
+			browser_window_get_scroll(bw, &scroll_x, &scroll_y);
 
 			if (status == CONTENT_STATUS_READY ||
 					status == CONTENT_STATUS_DONE)
-				content_close(bw->current_content);
-
-			hlcache_handle_release(bw->current_content);
+				content_close(old);
 		}
 
 		bw->current_content = c;
@@ -1299,6 +1344,12 @@ static nserror browser_window_callback(hlcache_handle *c,
 		if (content_get_type(c) == CONTENT_HTML && 
 				html_get_iframe(c) != NULL)
 			browser_window_create_iframes(bw, html_get_iframe(c));
+
+		/* keep the old content for going back to it, now the new
+		 * content's history entry exists */
+		if (old != NULL)
+			browser_window_retire_content(bw, old,
+					scroll_x, scroll_y);
 	}
 		break;
 
@@ -1949,6 +2000,89 @@ nserror browser_window_navigate(struct browser_window *bw,
 }
 
 
+/* Exported interface, documented in browser.h */
+nserror browser_window_restore(struct browser_window *bw,
+		hlcache_handle *c, nsurl *url, int scroll_x, int scroll_y)
+{
+	hlcache_handle *old = bw->current_content;
+	int width, height;
+	int old_x = 0, old_y = 0;
+	nserror error;
+
+	assert(bw);
+	assert(c);
+	assert(content_get_status(c) == CONTENT_STATUS_DONE);
+
+	LOG(("bw %p, url %s", bw, nsurl_access(url)));
+
+	error = hlcache_handle_replace_callback(c, browser_window_callback, bw);
+	if (error != NSERROR_OK) {
+		hlcache_handle_release(c);
+		return error;
+	}
+
+	browser_window_stop(bw);
+	browser_window_remove_caret(bw, false);
+	browser_window_destroy_children(bw);
+
+	if (bw->frag_id != NULL) {
+		lwc_string_unref(bw->frag_id);
+	}
+	bw->frag_id = NULL;
+
+	if (nsurl_has_component(url, NSURL_FRAGMENT)) {
+		bw->frag_id = nsurl_get_component(url, NSURL_FRAGMENT);
+	}
+
+	if (old != NULL) {
+		content_status status = content_get_status(old);
+
+		browser_window_get_scroll(bw, &old_x, &old_y);
+
+		if (status == CONTENT_STATUS_READY ||
+				status == CONTENT_STATUS_DONE)
+			content_close(old);
+	}
+
+	bw->current_content = c;
+	bw->history_add = false;
+	bw->refresh_interval = -1;
+
+	/* Format the content to the window's current dimensions; this does
+	 * nothing if they have not changed since it was displayed */
+	browser_window_get_dimensions(bw, &width, &height, true);
+	content_reformat(c, false, width, height);
+
+	if (bw->window != NULL) {
+		guit->window->new_content(bw->window);
+
+		browser_window_refresh_url_bar(bw);
+	}
+
+	content_open(c, bw, 0, 0);
+	browser_window_update(bw, false);
+	browser_window_set_scroll(bw, scroll_x, scroll_y);
+	browser_window_set_status(bw, content_get_status_message(c));
+	browser_window_update_favicon(c, bw, NULL);
+
+	/* frames */
+	if (content_get_type(c) == CONTENT_HTML && 
+			html_get_frameset(c) != NULL)
+		browser_window_create_frameset(bw, html_get_frameset(c));
+	if (content_get_type(c) == CONTENT_HTML && 
+			html_get_iframe(c) != NULL)
+		browser_window_create_iframes(bw, html_get_iframe(c));
+
+	if (old != NULL)
+		browser_window_retire_content(bw, old, old_x, old_y);
+
+	/* Record time */
+	bw->last_action = wallclock();
+
+	return NSERROR_OK;
+}
+
+
 /* Exported interface, documented in browser.h */
 nsurl * browser_window_get_url(struct browser_window *bw)
 {
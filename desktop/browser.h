@@ -151,6 +151,22 @@ nserror browser_window_navigate(struct browser_window *bw,
 			     struct fetch_multipart_data *post_multipart,
 			     struct hlcache_handle *parent);
 
+/**
+ * Restore a content retained by local history to a browser window.
+ *
+ * \param bw        browser window
+ * \param c         complete content to display, whose handle is taken over
+ * \param url       URL of history entry, including any fragment
+ * \param scroll_x  horizontal scroll offset to restore
+ * \param scroll_y  vertical scroll offset to restore
+ * \return NSERROR_OK, or appropriate error otherwise.
+ *
+ * Any existing fetches in the window are aborted.  On error the content
+ * has been released and the caller should fetch the URL instead.
+ */
+nserror browser_window_restore(struct browser_window *bw,
+		struct hlcache_handle *c, nsurl *url, int scroll_x, int scroll_y);
+
 /**
  * Get a browser window's URL.
  *
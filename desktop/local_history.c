@@ -38,6 +38,7 @@
 #include "image/bitmap.h"
 #include "render/font.h"
 #include "utils/log.h"
+#include "utils/nsoption.h"
 #include "utils/nsurl.h"
 #include "utils/utils.h"
 
@@ -66,6 +67,14 @@ struct history_entry {
 	int x;  /**< Position of node. */
 	int y;  /**< Position of node. */
 	struct bitmap *bitmap;  /**< Thumbnail bitmap, or 0. */
+
+	struct hlcache_handle *content;  /**< Retained content, or 0. */
+	size_t content_size;  /**< Footprint of retained content. */
+	int scroll_x;  /**< Scroll offset of retained content. */
+	int scroll_y;  /**< Scroll offset of retained content. */
+	struct history *owner;  /**< History retaining content. */
+	struct history_entry *cache_prev;  /**< Previous in retained list. */
+	struct history_entry *cache_next;  /**< Next in retained list. */
 };
 
 /** History tree for a window. */
@@ -80,11 +89,24 @@ struct history {
 	int height;
 	/** Browser window that local history belongs to */
 	struct browser_window *bw;
+	/** Entry whose content the window is displaying. */
+	struct history_entry *shown;
+	/** Number of entries with retained contents. */
+	unsigned int cached;
 };
 
+/** Entries with retained contents, least recently retained first. */
+static struct history_entry *history_cache_head;
+/** Last entry with a retained content. */
+static struct history_entry *history_cache_tail;
+/** Total footprint of retained contents. */
+static size_t history_cache_bytes;
+
 static struct history_entry *history_clone_entry(struct history *history,
 		struct history_entry *entry);
 static void history_free_entry(struct history_entry *entry);
+static void history_cache_unlink(struct history_entry *entry);
+static void history_cache_evict(struct history_entry *entry);
 static void history_layout(struct history *history);
 static int history_layout_subtree(struct history *history,
 		struct history_entry *entry, int x, int y, bool shuffle);
@@ -151,6 +173,8 @@ struct history *history_clone(struct history *history,
 	}
 
 	new_history->bw = bw;
+	new_history->shown = new_history->current;
+	new_history->cached = 0;
 
 	return new_history;
 }
@@ -182,6 +206,9 @@ struct history_entry *history_clone_entry(struct history *history,
 		return NULL;
 
 	memcpy(new_entry, entry, sizeof *entry);
+	new_entry->content = NULL;
+	new_entry->owner = NULL;
+	new_entry->cache_prev = new_entry->cache_next = NULL;
 	new_entry->page.url = nsurl_ref(entry->page.url);
 	if (entry->page.frag_id)
 		new_entry->page.frag_id = lwc_string_ref(entry->page.frag_id);
@@ -270,6 +297,19 @@ void history_add(struct history *history, hlcache_handle *content,
 	entry->forward = entry->forward_pref = entry->forward_last = 0;
 	entry->children = 0;
 	entry->bitmap = 0;
+	entry->content = 0;
+	entry->content_size = 0;
+	entry->scroll_x = entry->scroll_y = 0;
+	entry->owner = 0;
+	entry->cache_prev = entry->cache_next = 0;
+
+	/* the first page, or a move within the displayed page, is shown
+	 * without changing content */
+	if (history->current == NULL || (history->shown == history->current &&
+			nsurl_compare(history->current->page.url, nsurl,
+					NSURL_COMPLETE)))
+		history->shown = entry;
+
 	if (history->current) {
 		if (history->current->forward_last)
 			history->current->forward_last->next = entry;
@@ -363,6 +403,8 @@ void history_free_entry(struct history_entry *entry)
 		return;
 	history_free_entry(entry->forward);
 	history_free_entry(entry->next);
+	if (entry->content)
+		history_cache_evict(entry);
 	nsurl_unref(entry->page.url);
 	if (entry->page.frag_id)
 		lwc_string_unref(entry->page.frag_id);
@@ -371,6 +413,141 @@ void history_free_entry(struct history_entry *entry)
 }
 
 
+/**
+ * Callback for retained contents.
+ *
+ * The contents are not displayed, so their messages are ignored until they
+ * are restored to the window.
+ */
+
+static nserror history_cache_callback(hlcache_handle *handle,
+		const hlcache_event *event, void *pw)
+{
+	return NSERROR_OK;
+}
+
+
+/**
+ * Remove an entry from the list of retained contents, keeping its content.
+ *
+ * \param  entry  entry with retained content
+ */
+
+void history_cache_unlink(struct history_entry *entry)
+{
+	assert(entry->content);
+
+	if (entry->cache_prev)
+		entry->cache_prev->cache_next = entry->cache_next;
+	else
+		history_cache_head = entry->cache_next;
+	if (entry->cache_next)
+		entry->cache_next->cache_prev = entry->cache_prev;
+	else
+		history_cache_tail = entry->cache_prev;
+
+	history_cache_bytes -= entry->content_size;
+	hlcache_set_held_size(history_cache_bytes);
+	entry->owner->cached--;
+
+	entry->content = 0;
+	entry->content_size = 0;
+	entry->owner = 0;
+	entry->cache_prev = entry->cache_next = 0;
+}
+
+
+/**
+ * Release the retained content of an entry.
+ *
+ * \param  entry  entry with retained content
+ */
+
+void history_cache_evict(struct history_entry *entry)
+{
+	hlcache_handle *content = entry->content;
+
+	LOG(("Releasing %s", nsurl_access(entry->page.url)));
+
+	history_cache_unlink(entry);
+	hlcache_handle_release(content);
+}
+
+
+/**
+ * Retain the content leaving a window for its history entry.
+ *
+ * \param  history   history of the window
+ * \param  content   content leaving the window, already closed
+ * \param  scroll_x  horizontal scroll offset of the content
+ * \param  scroll_y  vertical scroll offset of the content
+ *
+ * The caller's handle is taken over and released if the content is not
+ * retained.  Up to the history_cache_size option contents are retained per
+ * window.  Retained contents hold their layouts as well as their source, so
+ * their total footprint shares the high-level cache's limit on contents
+ * kept for reuse; the least recently retained contents of any window are
+ * released first when it is exceeded.
+ */
+
+void history_cache_content(struct history *history, hlcache_handle *content,
+		int scroll_x, int scroll_y)
+{
+	struct history_entry *entry = history->shown;
+	struct history_entry *oldest;
+	size_t budget = hlcache_get_content_limit();
+	size_t size = content_get_size(content);
+	int limit = nsoption_int(history_cache_size);
+
+	history->shown = history->current;
+
+	if (!entry || entry == history->current || limit <= 0 ||
+			content_get_status(content) != CONTENT_STATUS_DONE ||
+			!nsurl_compare(hlcache_handle_get_url(content),
+					entry->page.url, NSURL_COMPLETE) ||
+			size > budget) {
+		hlcache_handle_release(content);
+		return;
+	}
+
+	if (hlcache_handle_replace_callback(content, history_cache_callback,
+			entry) != NSERROR_OK) {
+		hlcache_handle_release(content);
+		return;
+	}
+
+	if (entry->content)
+		history_cache_evict(entry);
+
+	entry->content = content;
+	entry->content_size = size;
+	entry->scroll_x = scroll_x;
+	entry->scroll_y = scroll_y;
+	entry->owner = history;
+	entry->cache_prev = history_cache_tail;
+	entry->cache_next = 0;
+	if (history_cache_tail)
+		history_cache_tail->cache_next = entry;
+	else
+		history_cache_head = entry;
+	history_cache_tail = entry;
+
+	history_cache_bytes += size;
+	hlcache_set_held_size(history_cache_bytes);
+	history->cached++;
+
+	while (history->cached > (unsigned int) limit) {
+		for (oldest = history_cache_head; oldest->owner != history;
+				oldest = oldest->cache_next)
+			;
+		history_cache_evict(oldest);
+	}
+
+	while (history_cache_bytes > budget)
+		history_cache_evict(history_cache_head);
+}
+
+
 /**
  * Go back in the history.
  *
@@ -460,6 +637,26 @@ void history_go(struct history *history, struct history_entry *entry,
 		browser_window_create(BW_CREATE_CLONE,
 				url, NULL, history->bw, NULL);
 		history->current = current;
+	} else if (entry->content && entry != history->shown) {
+		hlcache_handle *content = entry->content;
+		int scroll_x = entry->scroll_x;
+		int scroll_y = entry->scroll_y;
+
+		/* restore the retained content if it is still complete */
+		history_cache_unlink(entry);
+		history->current = entry;
+
+		if (content_get_status(content) != CONTENT_STATUS_DONE) {
+			hlcache_handle_release(content);
+			content = NULL;
+		} else if (browser_window_restore(history->bw, content, url,
+				scroll_x, scroll_y) != NSERROR_OK) {
+			content = NULL;
+		}
+
+		if (!content)
+			browser_window_navigate(history->bw, url, NULL,
+					BW_NAVIGATE_NONE, NULL, NULL, NULL);
 	} else {
 		history->current = entry;
 		browser_window_navigate(history->bw, url, NULL,
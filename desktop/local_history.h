@@ -38,6 +38,8 @@ struct history *history_clone(struct history *history,
 void history_add(struct history *history, struct hlcache_handle *content,
 		lwc_string *frag_id);
 void history_update(struct history *history, struct hlcache_handle *content);
+void history_cache_content(struct history *history,
+		struct hlcache_handle *content, int scroll_x, int scroll_y);
 void history_destroy(struct history *history);
 void history_back(struct history *history, bool new_window);
 void history_forward(struct history *history, bool new_window);
@@ -53,6 +53,7 @@
 #include "utils/utf8.h"
 #include "utils/utils.h"
 #include "utils/messages.h"
+#include "utils/timing.h"
 
 /** speculative pre-conversion small image size
  *
@@ -119,6 +120,7 @@ nserror netsurf_init(const char *messages, struct gui_table *gt)
 	nserror error;
 	struct utsname utsname;
 	nserror ret = NSERROR_OK;
+	int content_percent;
 	struct hlcache_parameters hlcache_parameters = {
 		.bg_clean_time = HL_CACHE_CLEAN_TIME,
 		.cb = netsurf_llcache_query_handler,
@@ -178,6 +180,17 @@ nserror netsurf_init(const char *messages, struct gui_table *gt)
 	/* account for image cache use from total */
 	hlcache_parameters.limit -= image_cache_parameters.limit;
 
+	/* unused contents kept for reuse may take a configured share of the
+	 * remainder; their source data is also counted in the low-level
+	 * cache */
+	content_percent = nsoption_int(memory_cache_contents);
+	if (content_percent < 0)
+		content_percent = 0;
+	else if (content_percent > 100)
+		content_percent = 100;
+	hlcache_parameters.content_limit =
+			(hlcache_parameters.limit * content_percent) / 100;
+
 	/* image handler bitmap cache */
 	error = image_cache_init(&image_cache_parameters);
 	if (error != NSERROR_OK)
@@ -217,6 +230,9 @@ nserror netsurf_init(const char *messages, struct gui_table *gt)
 	/* Initialise the hlcache and allow it to init the llcache for us */
 	hlcache_initialise(&hlcache_parameters);
 
+	/* Start loading the stylesheets shared by all html contents */
+	html_css_init_ua_stylesheets();
+
 	/* Initialize system colours */
 	error = ns_system_colour_init();
 	if (error != NSERROR_OK)
@@ -258,6 +274,9 @@ void netsurf_exit(void)
 	LOG(("Closing search and related resources"));
 	search_web_cleanup();
 
+	LOG(("Releasing user agent stylesheets"));
+	html_css_fini_ua_stylesheets();
+
 	LOG(("Finalising high-level cache"));
 	hlcache_finalise();
 
@@ -269,6 +288,9 @@ void netsurf_exit(void)
 	/* dump any remaining cache entries */
 	image_cache_fini();
 
+	/* release the URLs held by the timing trace */
+	timing_finalise();
+
 	/* Clean up after content handlers */
 	content_factory_fini();
 
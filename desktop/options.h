@@ -88,6 +88,13 @@ NSOPTION_STRING(accept_charset, NULL)
 /** Preferred maximum size of memory cache / bytes. */
 NSOPTION_INTEGER(memory_cache_size, 12 * 1024 * 1024)
 
+/** Percentage of the memory cache which may hold contents kept for reuse,
+ * both unused ones and pages kept by local history. */
+NSOPTION_INTEGER(memory_cache_contents, 50)
+
+/** Number of laid out pages kept per window for back and forward. */
+NSOPTION_INTEGER(history_cache_size, 4)
+
 /** Preferred expiry size of disc cache / bytes. */
 NSOPTION_INTEGER(disc_cache_size, 1024 * 1024 * 1024)
 
@@ -122,6 +129,15 @@ NSOPTION_BOOL(enable_javascript, false)
 /** Maximum time (in seconds) to wait for a script to run */
 NSOPTION_INTEGER(script_timeout, 10)
 
+/** Maximum size (in bytes) of the javascript garbage collected heap */
+NSOPTION_INTEGER(script_heap_size, 32 * 1024 * 1024)
+
+/** Size (in bytes) of javascript context stack chunks */
+NSOPTION_INTEGER(script_stack_chunk, 8192)
+
+/** Whether to log every javascript garbage collection */
+NSOPTION_BOOL(script_gc_log, false)
+
 /** How many days to retain URL data for */
 NSOPTION_INTEGER(expire_url, 28)
 
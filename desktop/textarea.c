@@ -135,6 +135,8 @@ struct textarea {
 #define LINE_CHUNK_SIZE 32
 	struct line_info *lines;	/**< Line info array */
 	unsigned int lines_alloc_size;	/**< Number of LINE_CHUNK_SIZEs */
+	int lines_avail_width;		/**< Width lines were wrapped to */
+	unsigned int lines_text_len;	/**< Text length when lines wrapped */
 
 	/** Callback function for messages to client */
 	textarea_client_callback callback;
@@ -891,9 +893,14 @@ static bool textarea_reflow_singleline(struct textarea *ta, size_t b_off,
 /**
  * Reflow a multiline textarea from the given line onwards
  *
+ * Line breaking stops as soon as a new line starts at the same place in the
+ * unchanged text following the modification as a line of the previous
+ * layout did.  From there on the previous layout is reused, including its
+ * cached line widths, so unchanged lines are not measured again.
+ *
  * \param ta		Textarea to reflow
  * \param b_start	0-based byte offset in ta->text to start of modification
- * \param b_length	Byte length of change in textarea text
+ * \param b_length	Byte length of text at b_start that is new or changed
  * \return true on success false otherwise
  */
 static bool textarea_reflow_multiline(struct textarea *ta,
@@ -912,6 +919,12 @@ static bool textarea_reflow_multiline(struct textarea *ta,
 	int v_extent; /* vertical extent */
 	bool restart = false;
 	bool skip_line = false;
+	struct line_info *old_lines = NULL; /* previous layout below change */
+	unsigned int old_count = 0;
+	unsigned int old_line = 0;
+	size_t b_resync = b_start + b_length; /* end of change */
+	int b_delta = ta->text.len - ta->lines_text_len;
+	unsigned int resync_line = 0;
 
 	assert(ta->flags & TEXTAREA_MULTILINE);
 
@@ -941,11 +954,33 @@ static bool textarea_reflow_multiline(struct textarea *ta,
 	if (start != 0)
 		start--;
 
+	/* Keep the old lines from the start point, if they were wrapped to
+	 * the current width, so they can be reused below the change */
+	avail_width = ta->vis_width - 2 * ta->border_width -
+			ta->pad_left - ta->pad_right;
+	if (avail_width < 0)
+		avail_width = 0;
+	if ((signed) start < ta->line_count && ta->lines_text_len != 0 &&
+			ta->lines_avail_width == avail_width &&
+			!(ta->flags & TEXTAREA_PASSWORD)) {
+		old_count = ta->line_count - start;
+		old_lines = malloc(old_count * sizeof(struct line_info));
+		if (old_lines != NULL)
+			memcpy(old_lines, ta->lines + start,
+					old_count * sizeof(struct line_info));
+	}
+
 	do {
 		/* Set line count to start point */
-		if (restart)
+		if (restart) {
 			start = 0;
 
+			/* Scrollbar changed the available width */
+			free(old_lines);
+			old_lines = NULL;
+			resync_line = 0;
+		}
+
 		line = start;
 
 		/* Find available width */
@@ -982,6 +1017,55 @@ static bool textarea_reflow_multiline(struct textarea *ta,
 
 		restart = false;
 		for (; len > 0; len -= b_off, text += b_off) {
+			size_t b_line = text - ta->text.data;
+
+			/* Skip old lines starting before this one */
+			while (old_lines != NULL && old_line < old_count &&
+					(long) old_lines[old_line].b_start +
+					b_delta < (long) b_line)
+				old_line++;
+
+			if (old_lines != NULL && b_line >= b_resync &&
+					old_line < old_count &&
+					(long) old_lines[old_line].b_start +
+					b_delta == (long) b_line) {
+				/* Line breaks have resynchronised with the
+				 * unchanged text; the rest of the old layout
+				 * applies, shifted by the change in length */
+				unsigned int count = old_count - old_line;
+				unsigned int i;
+
+				if (line + count + 2 > ta->lines_alloc_size) {
+					struct line_info *temp = realloc(
+							ta->lines,
+							(line + count + 2 +
+							LINE_CHUNK_SIZE) *
+							sizeof(struct
+							line_info));
+					if (temp == NULL) {
+						LOG(("realloc failed"));
+						free(old_lines);
+						return false;
+					}
+
+					ta->lines = temp;
+					ta->lines_alloc_size = line + count +
+							2 + LINE_CHUNK_SIZE;
+				}
+
+				resync_line = (line == start + old_line) ?
+						line : 0;
+				for (i = old_line; i < old_count; i++) {
+					ta->lines[line] = old_lines[i];
+					ta->lines[line].b_start += b_delta;
+					if (ta->lines[line].width > h_extent)
+						h_extent =
+							ta->lines[line].width;
+					line++;
+				}
+				break;
+			}
+
 			/* Find end of paragraph */
 			for (para_end = text; para_end < text + len;
 					para_end++) {
@@ -1002,8 +1086,10 @@ static bool textarea_reflow_multiline(struct textarea *ta,
 				int w = ta->vis_width - 2 * ta->border_width;
 				if (!scrollbar_create(true, w, w, w,
 						ta, textarea_scrollbar_callback,
-						&(ta->bar_x)))
+						&(ta->bar_x))) {
+					free(old_lines);
 					return false;
+				}
 				if (ta->bar_y != NULL)
 					scrollbar_make_pair(ta->bar_x,
 							ta->bar_y);
@@ -1024,6 +1110,7 @@ static bool textarea_reflow_multiline(struct textarea *ta,
 						sizeof(struct line_info));
 				if (temp == NULL) {
 					LOG(("realloc failed"));
+					free(old_lines);
 					return false;
 				}
 
@@ -1093,8 +1180,10 @@ static bool textarea_reflow_multiline(struct textarea *ta,
 			int h = ta->vis_height - 2 * ta->border_width;
 			if (!scrollbar_create(false, h, h, h,
 					ta, textarea_scrollbar_callback,
-					&(ta->bar_y)))
+					&(ta->bar_y))) {
+				free(old_lines);
 				return false;
+			}
 			if (ta->bar_x != NULL)
 				scrollbar_make_pair(ta->bar_x,
 						ta->bar_y);
@@ -1110,6 +1199,10 @@ static bool textarea_reflow_multiline(struct textarea *ta,
 		}
 	} while (restart);
 
+	free(old_lines);
+	ta->lines_avail_width = avail_width;
+	ta->lines_text_len = ta->text.len;
+
 	h_extent += ta->pad_left + ta->pad_right -
 			(ta->bar_y != NULL ? SCROLLBAR_WIDTH : 0);
 	v_extent = line * ta->line_height + ta->pad_top +
@@ -1146,6 +1239,12 @@ static bool textarea_reflow_multiline(struct textarea *ta,
 	r->y0 = max(r->y0, (signed)(ta->line_height * start +
 			ta->text_y_offset - ta->scroll_y));
 
+	if (resync_line > start) {
+		/* Lines from resynchronisation point are where they were */
+		r->y1 = min(r->y1, (signed)(ta->line_height * resync_line +
+				ta->text_y_offset - ta->scroll_y));
+	}
+
 	/* Reduce redraw region to single line if possible */
 	if ((skip_line || start == 0) &&
 			ta->lines[start].b_start + ta->lines[start].b_length >=
@@ -1481,7 +1580,7 @@ static bool textarea_replace_text_internal(struct textarea *ta, size_t b_start,
 
 	/* See to reflow */
 	if (ta->flags & TEXTAREA_MULTILINE) {
-		if (!textarea_reflow_multiline(ta, b_start, *byte_delta, r))
+		if (!textarea_reflow_multiline(ta, b_start, rep_len, r))
 			return false;
 	} else {
 		if (!textarea_reflow_singleline(ta, show_b_off, r))
@@ -1896,6 +1995,8 @@ struct textarea *textarea_create(const textarea_flags flags,
 	ret->line_count = 0;
 	ret->lines = NULL;
 	ret->lines_alloc_size = 0;
+	ret->lines_avail_width = 0;
+	ret->lines_text_len = 0;
 
 	textarea_setup_text_offsets(ret);
 
@@ -24,6 +24,7 @@
 
 #include "utils/schedule.h"
 #include "utils/log.h"
+#include "utils/timing.h"
 #include "content/content_protected.h"
 
 #include "image/image_cache.h"
@@ -36,11 +37,18 @@
  */
 typedef unsigned int cache_age;
 
+/** Initial number of chains in the content lookup hash */
+#define IMAGE_CACHE_HASH_INITIAL 64
+
+/** Average chain length at which the content lookup hash is grown */
+#define IMAGE_CACHE_HASH_LOAD 2
+
 /** Image cache entry
  */
 struct image_cache_entry_s {
 	struct image_cache_entry_s *next; /* next cache entry in list */
 	struct image_cache_entry_s *prev; /* previous cache entry in list */
+	struct image_cache_entry_s *hash_next; /* next entry in hash chain */
 
 	struct content *content; /** content is used as a key */
 	struct bitmap *bitmap; /** associated bitmap entry */
@@ -74,6 +82,19 @@ struct image_cache_s {
 	/* The objects the cache holds */
 	struct image_cache_entry_s *entries;
 
+	/** Number of entries the cache holds */
+	unsigned int entry_count;
+
+	/** Content lookup hash chains */
+	struct image_cache_entry_s **hash;
+	/** Number of chains in the lookup hash, always a power of two */
+	unsigned int hash_size;
+
+	/** Entry last returned by image_cache__findn() */
+	struct image_cache_entry_s *findn_entry;
+	/** Index of the entry last returned by image_cache__findn() */
+	int findn_index;
+
 
 	/* Statistics for management algorithm */
 
@@ -125,17 +146,48 @@ struct image_cache_s {
 static struct image_cache_s *image_cache = NULL;
 
 
+/** Compute the hash chain a content is held on
+ */
+static inline unsigned int image_cache__hash(const struct content *c)
+{
+	uintptr_t key = (uintptr_t) c;
+
+	/* allocations are aligned so the low bits carry no information */
+	key ^= key >> 16;
+	key *= 0x45d9f3b;
+	key ^= key >> 16;
+
+	return (unsigned int) key & (image_cache->hash_size - 1);
+}
+
 /** Find the nth cache entry
+ *
+ * Consecutive entries are normally requested in order when
+ * enumerating the cache so the walk is resumed from the previous
+ * result where possible.
  */
 static struct image_cache_entry_s *image_cache__findn(int entryn)
 {
 	struct image_cache_entry_s *found;
+	int index;
 
-	found = image_cache->entries;
-	while ((found != NULL) && (entryn > 0)) {
-		entryn--;
+	if ((image_cache->findn_entry != NULL) &&
+	    (image_cache->findn_index <= entryn)) {
+		found = image_cache->findn_entry;
+		index = image_cache->findn_index;
+	} else {
+		found = image_cache->entries;
+		index = 0;
+	}
+
+	while ((found != NULL) && (index < entryn)) {
+		index++;
 		found = found->next;
 	}
+
+	image_cache->findn_entry = found;
+	image_cache->findn_index = index;
+
 	return found;
 }
 
@@ -145,13 +197,42 @@ static struct image_cache_entry_s *image_cache__find(const struct content *c)
 {
 	struct image_cache_entry_s *found;
 
-	found = image_cache->entries;
+	found = image_cache->hash[image_cache__hash(c)];
 	while ((found != NULL) && (found->content != c)) {
-		found = found->next;
+		found = found->hash_next;
 	}
 	return found;
 }
 
+/** Resize the content lookup hash
+ *
+ * On allocation failure the existing hash is retained; lookups remain
+ * correct with longer chains.
+ */
+static void image_cache__rehash(unsigned int hash_size)
+{
+	struct image_cache_entry_s **hash;
+	struct image_cache_entry_s *centry;
+	unsigned int chain;
+
+	hash = calloc(hash_size, sizeof(struct image_cache_entry_s *));
+	if (hash == NULL) {
+		return;
+	}
+
+	free(image_cache->hash);
+	image_cache->hash = hash;
+	image_cache->hash_size = hash_size;
+
+	for (centry = image_cache->entries;
+	     centry != NULL;
+	     centry = centry->next) {
+		chain = image_cache__hash(centry->content);
+		centry->hash_next = hash[chain];
+		hash[chain] = centry;
+	}
+}
+
 static void image_cache_stats_bitmap_add(struct image_cache_entry_s *centry)
 {
 	centry->bitmap_age = image_cache->current_age;
@@ -189,16 +270,42 @@ static void image_cache_stats_bitmap_add(struct image_cache_entry_s *centry)
 
 static void image_cache__link(struct image_cache_entry_s *centry)
 {
+	unsigned int chain;
+
 	centry->next = image_cache->entries;
 	centry->prev = NULL;
 	if (centry->next != NULL) {
 		centry->next->prev = centry;
 	}
 	image_cache->entries = centry;
+
+	chain = image_cache__hash(centry->content);
+	centry->hash_next = image_cache->hash[chain];
+	image_cache->hash[chain] = centry;
+
+	image_cache->entry_count++;
+	image_cache->findn_entry = NULL;
+
+	if (image_cache->entry_count >
+	    (image_cache->hash_size * IMAGE_CACHE_HASH_LOAD)) {
+		image_cache__rehash(image_cache->hash_size * 2);
+	}
 }
 
 static void image_cache__unlink(struct image_cache_entry_s *centry)
 {
+	struct image_cache_entry_s **chain;
+
+	/* remove from hash chain */
+	chain = &image_cache->hash[image_cache__hash(centry->content)];
+	while (*chain != centry) {
+		chain = &(*chain)->hash_next;
+	}
+	*chain = centry->hash_next;
+
+	image_cache->entry_count--;
+	image_cache->findn_entry = NULL;
+
 	/* unlink entry */
 	if (centry->prev == NULL) {
 		/* first in list */
@@ -257,6 +364,19 @@ static void image_cache__free_entry(struct image_cache_entry_s *centry)
 	free(centry);
 }
 
+/** Convert an entry's content to a bitmap
+ *
+ * \param centry The cache entry to convert, which must have a converter
+ */
+static void image_cache__convert(struct image_cache_entry_s *centry)
+{
+	uint64_t start = timing_start();
+
+	centry->bitmap = centry->convert(centry->content);
+
+	timing_record(TIMING_IMAGE, start, content_get_url(centry->content));
+}
+
 /** Cache cleaner */
 static void image_cache__clean(struct image_cache_s *icache)
 {
@@ -307,7 +427,7 @@ struct bitmap *image_cache_get_bitmap(const struct content *c)
 
 	if (centry->bitmap == NULL) {
 		if (centry->convert != NULL) {
-			centry->bitmap = centry->convert(centry->content);
+			image_cache__convert(centry);
 		}
 
 		if (centry->bitmap != NULL) {
@@ -372,6 +492,15 @@ image_cache_init(const struct image_cache_parameters *image_cache_parameters)
 
 	image_cache->params = *image_cache_parameters;
 
+	image_cache->hash = calloc(IMAGE_CACHE_HASH_INITIAL,
+				   sizeof(struct image_cache_entry_s *));
+	if (image_cache->hash == NULL) {
+		free(image_cache);
+		image_cache = NULL;
+		return NSERROR_NOMEM;
+	}
+	image_cache->hash_size = IMAGE_CACHE_HASH_INITIAL;
+
 	schedule((image_cache->params.bg_clean_time / 10),
 		 image_cache__background_update,
 		 image_cache);
@@ -446,6 +575,7 @@ nserror image_cache_fini(void)
 	     image_cache->peak_conversions_size,
 	     image_cache->peak_conversions));
 
+	free(image_cache->hash);
 	free(image_cache);
 
 	return NSERROR_OK;
@@ -470,8 +600,8 @@ nserror image_cache_add(struct content *content,
 		if (centry == NULL) {
 			return NSERROR_NOMEM;
 		}
-		image_cache__link(centry);
 		centry->content = content;
+		image_cache__link(centry);
 
 		centry->bitmap_size = content->width * content->height * 4;
 	}
@@ -492,7 +622,7 @@ nserror image_cache_add(struct content *content,
 		/* no bitmap, check to see if we should speculatively convert */
 		if ((centry->convert != NULL) &&
 		    (image_cache_speculate(content) == true)) {
-			centry->bitmap = centry->convert(centry->content);
+			image_cache__convert(centry);
 
 			if (centry->bitmap != NULL) {
 				image_cache_stats_bitmap_add(centry);
@@ -751,7 +881,7 @@ bool image_cache_redraw(struct content *c,
 
 	if (centry->bitmap == NULL) {
 		if (centry->convert != NULL) {
-			centry->bitmap = centry->convert(centry->content);
+			image_cache__convert(centry);
 		}
 
 		if (centry->bitmap != NULL) {
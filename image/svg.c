@@ -22,6 +22,7 @@
 
 #include <assert.h>
 #include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <svgtiny.h>
@@ -33,6 +34,13 @@
 #include "utils/messages.h"
 #include "utils/utils.h"
 
+/** Alignment of a viewBox within its viewport, along one axis */
+typedef enum {
+	SVG_ALIGN_MIN = 0,
+	SVG_ALIGN_MID = 1,
+	SVG_ALIGN_MAX = 2
+} svg_align;
+
 typedef struct svg_content {
 	struct content base;
 
@@ -40,6 +48,25 @@ typedef struct svg_content {
 
 	int current_width;
 	int current_height;
+
+	/** Viewport dimensions the diagram was parsed with */
+	int parse_width;
+	int parse_height;
+
+	/** Root element lacks an absolute width or height, so the
+	 * diagram's size is that of the viewport */
+	bool viewport_sized;
+
+	/** Root element has a usable viewBox */
+	bool view_box;
+	float view_box_width;
+	float view_box_height;
+
+	/** preserveAspectRatio of the root element */
+	bool aspect_none;	/**< Stretch the viewBox to the viewport */
+	bool aspect_slice;	/**< Cover the viewport, rather than fit */
+	svg_align align_x;
+	svg_align align_y;
 } svg_content;
 
 
@@ -55,6 +82,16 @@ static nserror svg_create_svg_data(svg_content *c)
 	c->current_width = INT_MAX;
 	c->current_height = INT_MAX;
 
+	c->parse_width = INT_MAX;
+	c->parse_height = INT_MAX;
+
+	c->viewport_sized = true;
+	c->view_box = false;
+	c->aspect_none = false;
+	c->aspect_slice = false;
+	c->align_x = SVG_ALIGN_MID;
+	c->align_y = SVG_ALIGN_MID;
+
 	return NSERROR_OK;
 
 no_memory:
@@ -100,12 +137,245 @@ static nserror svg_create(const content_handler *handler,
 
 
 
+/**
+ * Find the end of a run of characters in an SVG source.
+ *
+ * \param  data  source to scan
+ * \param  end   end of source
+ * \param  stop  characters ending the run
+ * \return  pointer to the first character in stop, or end if none
+ */
+
+static const char *svg_scan_to(const char *data, const char *end,
+		const char *stop)
+{
+	while (data != end && strchr(stop, *data) == NULL)
+		data++;
+
+	return data;
+}
+
+
+/**
+ * Skip whitespace in an SVG source.
+ */
+
+static const char *svg_skip_space(const char *data, const char *end)
+{
+	while (data != end && strchr(" \t\r\n", *data) != NULL)
+		data++;
+
+	return data;
+}
+
+
+/**
+ * Compare an attribute name in an SVG source with a string.
+ */
+
+static bool svg_name_is(const char *name, size_t len, const char *match)
+{
+	return strlen(match) == len && strncmp(name, match, len) == 0;
+}
+
+
+/**
+ * Parse the viewBox attribute of the root element.
+ *
+ * \param  svg    content to update
+ * \param  value  attribute value
+ * \param  len    length of value
+ *
+ * A viewBox without a positive width and height is ignored.  Its origin is
+ * not needed, as libsvgtiny places it at the diagram's origin.
+ */
+
+static void svg_parse_view_box(svg_content *svg, const char *value,
+		size_t len)
+{
+	char buf[128];
+	char *s = buf, *end;
+	float box[4];
+	int i;
+
+	if (len >= sizeof buf)
+		return;
+	memcpy(buf, value, len);
+	buf[len] = 0;
+
+	for (i = 0; i != 4; i++) {
+		while (*s == ',' || *s == ' ' || *s == '\t' ||
+				*s == '\r' || *s == '\n')
+			s++;
+		box[i] = strtof(s, &end);
+		if (end == s)
+			return;
+		s = end;
+	}
+
+	if (box[2] <= 0 || box[3] <= 0)
+		return;
+
+	svg->view_box = true;
+	svg->view_box_width = box[2];
+	svg->view_box_height = box[3];
+}
+
+
+/**
+ * Parse the preserveAspectRatio attribute of the root element.
+ *
+ * \param  svg    content to update
+ * \param  value  attribute value
+ * \param  len    length of value
+ */
+
+static void svg_parse_aspect_ratio(svg_content *svg, const char *value,
+		size_t len)
+{
+	static const char *align[] = { "Min", "Mid", "Max" };
+	const char *end = value + len;
+	const char *word;
+	int i;
+
+	value = svg_skip_space(value, end);
+	word = svg_scan_to(value, end, " \t\r\n");
+	if (svg_name_is(value, word - value, "defer")) {
+		value = svg_skip_space(word, end);
+		word = svg_scan_to(value, end, " \t\r\n");
+	}
+
+	if (svg_name_is(value, word - value, "none")) {
+		svg->aspect_none = true;
+	} else if (word - value == 8 && value[0] == 'x' && value[4] == 'Y') {
+		for (i = 0; i != 3; i++) {
+			if (strncmp(value + 1, align[i], 3) == 0)
+				svg->align_x = i;
+			if (strncmp(value + 5, align[i], 3) == 0)
+				svg->align_y = i;
+		}
+	} else {
+		/* Invalid, so keep the default of xMidYMid meet */
+		return;
+	}
+
+	value = svg_skip_space(word, end);
+	word = svg_scan_to(value, end, " \t\r\n");
+	if (svg_name_is(value, word - value, "slice"))
+		svg->aspect_slice = true;
+}
+
+
+/**
+ * Read the attributes of the root element of an SVG source which affect
+ * how the diagram is scaled.
+ *
+ * \param  svg   content to update
+ * \param  data  source data
+ * \param  size  length of source data
+ *
+ * libsvgtiny maps the viewBox onto the diagram's dimensions without regard
+ * to preserveAspectRatio, and does not report either, so they are found
+ * here.  Sources that cannot be understood are left with the defaults.
+ */
+
+static void svg_parse_root(svg_content *svg, const char *data,
+		unsigned long size)
+{
+	const char *end = data + size;
+	const char *name, *value, *p;
+	size_t len;
+	bool width = false, height = false;
+
+	/* Find the first element, skipping the XML declaration,
+	 * processing instructions, comments and the document type */
+	for (;;) {
+		data = svg_scan_to(data, end, "<");
+		if (end - data < 2)
+			return;
+		data++;
+
+		if (*data == '?') {
+			for (; data != end; data++)
+				if (*data == '>' && data[-1] == '?')
+					break;
+		} else if (end - data >= 3 && strncmp(data, "!--", 3) == 0) {
+			for (data += 3; data != end; data++)
+				if (*data == '>' && data[-1] == '-' &&
+						data[-2] == '-')
+					break;
+		} else if (*data == '!') {
+			/* The document type may have an internal subset */
+			data = svg_scan_to(data, end, "[>");
+			if (data != end && *data == '[')
+				data = svg_scan_to(data, end, "]");
+			data = svg_scan_to(data, end, ">");
+		} else {
+			break;
+		}
+	}
+
+	/* The root element may be svg or, with a namespace prefix, x:svg */
+	name = data;
+	data = svg_scan_to(data, end, " \t\r\n/>");
+	for (p = name; p != data; p++)
+		if (*p == ':')
+			name = p + 1;
+	if (!svg_name_is(name, data - name, "svg"))
+		return;
+
+	/* Attributes */
+	for (;;) {
+		data = svg_skip_space(data, end);
+		if (data == end || *data == '/' || *data == '>')
+			break;
+
+		name = data;
+		data = svg_scan_to(data, end, " \t\r\n=/>");
+		len = data - name;
+
+		data = svg_skip_space(data, end);
+		if (data == end || *data != '=')
+			return;
+		data = svg_skip_space(data + 1, end);
+		if (data == end || (*data != '"' && *data != '\''))
+			return;
+
+		value = data + 1;
+		data = svg_scan_to(value, end, *data == '"' ? "\"" : "'");
+		if (data == end)
+			return;
+
+		if (svg_name_is(name, len, "width"))
+			width = value != data && data[-1] != '%';
+		else if (svg_name_is(name, len, "height"))
+			height = value != data && data[-1] != '%';
+		else if (svg_name_is(name, len, "viewBox"))
+			svg_parse_view_box(svg, value, data - value);
+		else if (svg_name_is(name, len, "preserveAspectRatio"))
+			svg_parse_aspect_ratio(svg, value, data - value);
+
+		data++;
+	}
+
+	svg->viewport_sized = !(width && height);
+}
+
+
 /**
  * Convert a CONTENT_SVG for display.
  */
 
 static bool svg_convert(struct content *c)
 {
+	svg_content *svg = (svg_content *) c;
+	const char *source_data;
+	unsigned long source_size;
+
+	source_data = content__get_source_data(c, &source_size);
+	if (source_data != NULL)
+		svg_parse_root(svg, source_data, source_size);
+
 	/*c->title = malloc(100);
 	if (c->title)
 		snprintf(c->title, 100, messages_get("svgTitle"),
@@ -121,30 +391,129 @@ static bool svg_convert(struct content *c)
 
 /**
  * Reformat a CONTENT_SVG.
+ *
+ * The source is parsed on the first reformat.  Later reformats retain the
+ * diagram and leave scaling it to the new size to the redraw transform,
+ * except where the diagram's size is that of the viewport and it has no
+ * viewBox: then its layout depends on the viewport, so it is parsed again.
  */
 
 static void svg_reformat(struct content *c, int width, int height)
 {
 	svg_content *svg = (svg_content *) c;
+	struct svgtiny_diagram *diagram = svg->diagram;
 	const char *source_data;
 	unsigned long source_size;
+	bool reparse = false;
 
-	assert(svg->diagram);
+	assert(diagram);
 
 	/* Avoid reformats to same width/height as we already reformatted to */
-	if (width != svg->current_width || height != svg->current_height) {
+	if (width == svg->current_width && height == svg->current_height)
+		return;
+
+	if (svg->parse_width == INT_MAX) {
+		/* Never parsed */
+		reparse = true;
+	} else if ((diagram->width == 0 || diagram->height == 0) &&
+			width > 0 && height > 0) {
+		/* Previous parse was against an empty viewport and
+		 * produced nothing that can be scaled */
+		reparse = true;
+	} else if (svg->viewport_sized && !svg->view_box &&
+			(width != svg->parse_width ||
+			height != svg->parse_height)) {
+		/* Lengths are relative to a viewport which has changed */
+		reparse = true;
+	}
+
+	if (reparse) {
+		if (svg->parse_width != INT_MAX) {
+			/* svgtiny_parse() adds to a diagram's shapes, so
+			 * start again with an empty one */
+			diagram = svgtiny_create();
+			if (diagram == NULL)
+				return;
+			svgtiny_free(svg->diagram);
+			svg->diagram = diagram;
+		}
+
 		source_data = content__get_source_data(c, &source_size);
 
-		svgtiny_parse(svg->diagram, source_data, source_size,
+		svgtiny_parse(diagram, source_data, source_size,
 				nsurl_access(content_get_url(c)),
 				width, height);
 
-		svg->current_width = width;
-		svg->current_height = height;
+		svg->parse_width = width;
+		svg->parse_height = height;
 	}
 
-	c->width = svg->diagram->width;
-	c->height = svg->diagram->height;
+	svg->current_width = width;
+	svg->current_height = height;
+
+	if (svg->viewport_sized) {
+		/* Diagram takes its dimensions from the viewport, so
+		 * follow the viewport as it changes */
+		c->width = width;
+		c->height = height;
+	} else {
+		c->width = diagram->width;
+		c->height = diagram->height;
+	}
+}
+
+
+/**
+ * Find the transform from a diagram's coordinates to an area of the page.
+ *
+ * \param  svg        content to plot
+ * \param  x          left of area
+ * \param  y          top of area
+ * \param  width      width of area
+ * \param  height     height of area
+ * \param  transform  updated with transform matrix
+ *
+ * libsvgtiny has already stretched the viewBox, if any, over the diagram's
+ * dimensions.  That is undone here, and the viewBox placed in the area as
+ * preserveAspectRatio requires.  Diagrams without a viewBox, or with
+ * preserveAspectRatio="none", are stretched over the area.
+ */
+
+static void svg_transform(svg_content *svg, int x, int y,
+		int width, int height, float transform[6])
+{
+	struct svgtiny_diagram *diagram = svg->diagram;
+	float scale_x = (float) width / (float) diagram->width;
+	float scale_y = (float) height / (float) diagram->height;
+	float offset_x = 0, offset_y = 0;
+
+	if (svg->view_box && !svg->aspect_none) {
+		float view_x = (float) width / svg->view_box_width;
+		float view_y = (float) height / svg->view_box_height;
+		float scale;
+
+		if (svg->aspect_slice)
+			scale = view_x > view_y ? view_x : view_y;
+		else
+			scale = view_x < view_y ? view_x : view_y;
+
+		/* The diagram has (diagram->width / view_box_width) units
+		 * per viewBox unit */
+		scale_x = scale * svg->view_box_width / diagram->width;
+		scale_y = scale * svg->view_box_height / diagram->height;
+
+		offset_x = (width - svg->view_box_width * scale) *
+				svg->align_x / 2;
+		offset_y = (height - svg->view_box_height * scale) *
+				svg->align_y / 2;
+	}
+
+	transform[0] = scale_x;
+	transform[1] = 0;
+	transform[2] = 0;
+	transform[3] = scale_y;
+	transform[4] = x + offset_x;
+	transform[5] = y + offset_y;
 }
 
 
@@ -160,26 +529,42 @@ static bool svg_redraw_internal(struct content *c, int x, int y,
 	svg_content *svg = (svg_content *) c;
 	float transform[6];
 	struct svgtiny_diagram *diagram = svg->diagram;
-	bool ok;
+	bool ok = true, clipped;
 	int px, py;
 	unsigned int i;
 	plot_font_style_t fstyle = *plot_style_font;
 
 	assert(diagram);
 
-	transform[0] = (float) width / (float) c->width;
-	transform[1] = 0;
-	transform[2] = 0;
-	transform[3] = (float) height / (float) c->height;
-	transform[4] = x;
-	transform[5] = y;
+	if (diagram->width == 0 || diagram->height == 0)
+		return true;
+
+	/* The diagram is in the coordinate space it was parsed in, which
+	 * need not match the content's current dimensions */
+	svg_transform(svg, x, y, width, height, transform);
+
+	clipped = svg->view_box && svg->aspect_slice && !svg->aspect_none;
+	if (clipped) {
+		/* The viewBox overflows the area; keep within it */
+		struct rect r;
+
+		r.x0 = x > clip->x0 ? x : clip->x0;
+		r.y0 = y > clip->y0 ? y : clip->y0;
+		r.x1 = x + width < clip->x1 ? x + width : clip->x1;
+		r.y1 = y + height < clip->y1 ? y + height : clip->y1;
+		if (r.x0 >= r.x1 || r.y0 >= r.y1)
+			return true;
+
+		if (!ctx->plot->clip(&r))
+			return false;
+	}
 
 #define BGR(c) ((c) == svgtiny_TRANSPARENT ? NS_TRANSPARENT :		\
 		((svgtiny_RED((c))) |					\
 		 (svgtiny_GREEN((c)) << 8) |				\
 		 (svgtiny_BLUE((c)) << 16)))
 
-	for (i = 0; i != diagram->shape_count; i++) {
+	for (i = 0; ok && i != diagram->shape_count; i++) {
 		if (diagram->shape[i].path) {
 			ok = ctx->plot->path(diagram->shape[i].path,
 					diagram->shape[i].path_length,
@@ -187,8 +572,6 @@ static bool svg_redraw_internal(struct content *c, int x, int y,
 					diagram->shape[i].stroke_width,
 					BGR(diagram->shape[i].stroke),
 					transform);
-			if (!ok)
-				return false;
 
 		} else if (diagram->shape[i].text) {
 			px = transform[0] * diagram->shape[i].text_x +
@@ -206,14 +589,16 @@ static bool svg_redraw_internal(struct content *c, int x, int y,
 					diagram->shape[i].text,
 					strlen(diagram->shape[i].text),
 					&fstyle);
-			if (!ok)
-				return false;
 		}
         }
 
 #undef BGR
 
-	return true;
+	/* Restore the caller's clip rectangle, even if plotting failed */
+	if (clipped && !ctx->plot->clip(clip))
+		return false;
+
+	return ok;
 }
 
 
@@ -58,8 +58,18 @@ void js_destroycontext(jscontext *ctx);
  */
 jsobject *js_newcompartment(jscontext *ctx, void *win_priv, void *doc_priv);
 
-/* execute some javascript in a context */
-bool js_exec(jscontext *ctx, const char *txt, size_t txtlen);
+/** Execute some javascript in a context
+ *
+ * Compiled external scripts are cached, keyed on their URL and a hash of
+ * their source, so a script shared between pages is only compiled once.
+ *
+ * \param ctx     context to execute in
+ * \param txt     script source
+ * \param txtlen  length of script source
+ * \param name    URL of script source, or NULL for an inline script
+ * \return true if the script executed successfully
+ */
+bool js_exec(jscontext *ctx, const char *txt, size_t txtlen, const char *name);
 
 
 /* fire an event at a dom node */
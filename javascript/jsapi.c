@@ -18,6 +18,10 @@
 
 #include <unistd.h>
 #include <signal.h>
+#include <sys/time.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "javascript/jsapi.h"
 #include "render/html_internal.h"
@@ -26,14 +30,41 @@
 #include "javascript/js.h"
 
 #include "utils/log.h"
+#include "utils/nsoption.h"
 
 #include "window.h"
 #include "event.h"
 
 #define ENABLE_JS_HEARTBEAT 1
 
+/** Maximum size of serialised scripts held in the compiled script cache */
+#define SCRIPT_CACHE_SIZE (4 * 1024 * 1024)
+
 static JSRuntime *rt; /* global runtime */
 
+/** Compiled script cache entry */
+struct script_cache_entry {
+	struct script_cache_entry *prev; /**< More recently used entry */
+	struct script_cache_entry *next; /**< Less recently used entry */
+
+	char *name; /**< URL of script source */
+	size_t txtlen; /**< Length of script source */
+	uint32_t hash; /**< Hash of script source */
+
+	void *xdr; /**< Serialised compiled script */
+	uint32_t xdrlen; /**< Length of serialised script */
+};
+
+/** Compiled scripts, most recently used first */
+static struct {
+	struct script_cache_entry *head;
+	struct script_cache_entry *tail;
+	size_t size; /**< Total size of serialised scripts */
+} script_cache;
+
+static void script_cache_flush(void);
+static JSBool js_gc_callback(JSContext *cx, JSGCStatus status);
+
 void js_initialise(void)
 {
 	/* Create a JS runtime. */
@@ -42,10 +73,13 @@ void js_initialise(void)
 	JS_SetCStringsAreUTF8(); /* we prefer our runtime to be utf-8 */
 #endif
 
-	rt = JS_NewRuntime(8L * 1024L * 1024L);
+	rt = JS_NewRuntime(nsoption_int(script_heap_size));
 	JSLOG("New runtime handle %p", rt);
 
 	if (rt != NULL) {
+		/* gather collection statistics for each context */
+		JS_SetGCCallbackRT(rt, js_gc_callback);
+
 		/* register script content handler */
 		javascript_init();
 	}
@@ -53,6 +87,8 @@ void js_initialise(void)
 
 void js_finalise(void)
 {
+	script_cache_flush();
+
 	if (rt != NULL) {
 		JSLOG("destroying runtime handle %p", rt);
 		JS_DestroyRuntime(rt);
@@ -70,6 +106,70 @@ js_reportError(JSContext *cx, const char *message, JSErrorReport *report)
 	      message);
 }
 
+/* private context for heartbeats and statistics */
+struct jscontext_priv {
+	int timeout;
+	jscallback *cb;
+	void *cbctx;
+
+	unsigned int branch_reset; /**< reset value for branch counter */
+	unsigned int branch_count; /**< counter for branch callback */
+	time_t last; /**< last time heartbeat happened */
+	time_t end; /**< end time for the current script execution */
+
+	unsigned int gc_count; /**< collections triggered by context */
+	unsigned long gc_time; /**< total collection time in microseconds */
+	unsigned long gc_max_time; /**< longest collection in microseconds */
+	unsigned long gc_heap; /**< heap size after last collection */
+	struct timeval gc_start; /**< start of collection in progress */
+};
+
+/** Garbage collection statistics callback */
+static JSBool js_gc_callback(JSContext *cx, JSGCStatus status)
+{
+	struct jscontext_priv *priv;
+	struct timeval now;
+	unsigned long elapsed;
+
+	if (cx == NULL) {
+		return JS_TRUE;
+	}
+
+	priv = JS_GetContextPrivate(cx);
+	if (priv == NULL) {
+		return JS_TRUE;
+	}
+
+	switch (status) {
+	case JSGC_BEGIN:
+		gettimeofday(&priv->gc_start, NULL);
+		break;
+
+	case JSGC_END:
+		gettimeofday(&now, NULL);
+		elapsed = (now.tv_sec - priv->gc_start.tv_sec) * 1000000 +
+				now.tv_usec - priv->gc_start.tv_usec;
+
+		priv->gc_count++;
+		priv->gc_time += elapsed;
+		if (elapsed > priv->gc_max_time) {
+			priv->gc_max_time = elapsed;
+		}
+		priv->gc_heap = JSAPI_GC_HEAP_BYTES(JS_GetRuntime(cx));
+
+		if (nsoption_bool(script_gc_log)) {
+			JSLOG("context %p collection %u took %luus heap %lu",
+			      cx, priv->gc_count, elapsed, priv->gc_heap);
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	return JS_TRUE;
+}
+
 /* heartbeat routines */
 #ifndef ENABLE_JS_HEARTBEAT
 
@@ -97,18 +197,6 @@ disable_heartbeat(struct heartbeat *hb)
 
 #else
 
-/* private context for heartbeats */
-struct jscontext_priv {
-	int timeout;
-	jscallback *cb;
-	void *cbctx;
-
-	unsigned int branch_reset; /**< reset value for branch counter */
-	unsigned int branch_count; /**< counter for branch callback */
-	time_t last; /**< last time heartbeat happened */
-	time_t end; /**< end time for the current script execution */
-};
-
 /** execution heartbeat */
 static JSBool heartbeat_callback(JSContext *cx)
 {
@@ -157,7 +245,7 @@ setup_heartbeat(JSContext *cx, int timeout, jscallback *cb, void *cbctx)
 		return true;
 	}
 
-	priv = calloc(1, sizeof(*priv));
+	priv = JS_GetContextPrivate(cx);
 	if (priv == NULL) {
 		return false;
 	}
@@ -166,10 +254,12 @@ setup_heartbeat(JSContext *cx, int timeout, jscallback *cb, void *cbctx)
 	priv->cb = cb;
 	priv->cbctx = cbctx;
 
-	JS_SetContextPrivate(cx, priv);
-
-	/* if heartbeat is enabled disable JIT or callbacks do not happen */
+#if JS_VERSION == 180
+	/* The 1.8.0 tracing JIT does not check for operation callbacks
+	 * within traced loops, so heartbeats would not happen.  Later
+	 * engines check for them in generated code so keep the JIT. */
 	JS_SetOptions(cx, JS_GetOptions(cx) & ~JSOPTION_JIT);
+#endif
 
 	JS_SetOperationCallback(cx, heartbeat_callback);
 
@@ -189,7 +279,7 @@ static struct heartbeat *enable_heartbeat(JSContext *cx)
 	struct sigaction sact;
 	struct heartbeat *hb;
 
-	if (priv == NULL) {
+	if ((priv == NULL) || (priv->timeout == 0)) {
 		return NULL;
 	}
 
@@ -273,7 +363,7 @@ setup_heartbeat(JSContext *cx, int timeout, jscallback *cb, void *cbctx)
 		return true;
 	}
 
-	priv = calloc(1, sizeof(*priv));
+	priv = JS_GetContextPrivate(cx);
 	if (priv == NULL) {
 		return false;
 	}
@@ -285,8 +375,6 @@ setup_heartbeat(JSContext *cx, int timeout, jscallback *cb, void *cbctx)
 	priv->branch_reset = INITIAL_BRANCH_RESET;
 	priv->branch_count = priv->branch_reset;
 
-	JS_SetContextPrivate(cx, priv);
-
 	JS_SetBranchCallback(cx, branch_callback);
 
 	return true;
@@ -316,18 +404,28 @@ disable_heartbeat(struct heartbeat *hb)
 jscontext *js_newcontext(int timeout, jscallback *cb, void *cbctx)
 {
 	JSContext *cx;
+	struct jscontext_priv *priv;
 
 	if (rt == NULL) {
 		return NULL;
 	}
 
-	cx = JS_NewContext(rt, 8192);
+	priv = calloc(1, sizeof(*priv));
+	if (priv == NULL) {
+		return NULL;
+	}
+
+	cx = JS_NewContext(rt, nsoption_int(script_stack_chunk));
 	if (cx == NULL) {
+		free(priv);
 		return NULL;
 	}
 
+	JS_SetContextPrivate(cx, priv);
+
 	/* set options on context */
-	JS_SetOptions(cx, JS_GetOptions(cx) | JSOPTION_VAROBJFIX | JSOPTION_JIT);
+	JS_SetOptions(cx, JS_GetOptions(cx) | JSOPTION_VAROBJFIX |
+		      JSOPTION_JIT | JSAPI_JSOPTION_METHODJIT);
 
 	JS_SetVersion(cx, JSVERSION_LATEST);
 	JS_SetErrorReporter(cx, js_reportError);
@@ -351,6 +449,13 @@ void js_destroycontext(jscontext *ctx)
 		JSLOG("Destroying Context %p", cx);
 		priv = JS_GetContextPrivate(cx);
 
+		if (priv->gc_count != 0) {
+			JSLOG("context %p %u collections in %luus "
+			      "(longest %luus) heap %lu",
+			      cx, priv->gc_count, priv->gc_time,
+			      priv->gc_max_time, priv->gc_heap);
+		}
+
 		JS_DestroyContext(cx);
 
 		free(priv);
@@ -387,9 +492,207 @@ jsobject *js_newcompartment(jscontext *ctx, void *win_priv, void *doc_priv)
 
 
 
-bool js_exec(jscontext *ctx, const char *txt, size_t txtlen)
+/**
+ * Hash script source
+ *
+ * \param txt     script source
+ * \param txtlen  length of source
+ * \return 32 bit FNV-1a hash of the source
+ */
+static uint32_t script_cache_hash(const char *txt, size_t txtlen)
+{
+	uint32_t hash = 0x811c9dc5;
+
+	while (txtlen-- > 0) {
+		hash ^= (uint8_t) *txt++;
+		hash *= 0x01000193;
+	}
+
+	return hash;
+}
+
+/** Unlink an entry from the compiled script cache */
+static void script_cache_unlink(struct script_cache_entry *entry)
+{
+	if (entry->prev != NULL)
+		entry->prev->next = entry->next;
+	else
+		script_cache.head = entry->next;
+
+	if (entry->next != NULL)
+		entry->next->prev = entry->prev;
+	else
+		script_cache.tail = entry->prev;
+
+	script_cache.size -= entry->xdrlen;
+}
+
+/** Link an entry at the head of the compiled script cache */
+static void script_cache_link(struct script_cache_entry *entry)
+{
+	entry->prev = NULL;
+	entry->next = script_cache.head;
+	if (script_cache.head != NULL)
+		script_cache.head->prev = entry;
+	else
+		script_cache.tail = entry;
+	script_cache.head = entry;
+
+	script_cache.size += entry->xdrlen;
+}
+
+/** Destroy a compiled script cache entry */
+static void script_cache_destroy(struct script_cache_entry *entry)
+{
+	script_cache_unlink(entry);
+	free(entry->name);
+	free(entry->xdr);
+	free(entry);
+}
+
+/** Empty the compiled script cache */
+static void script_cache_flush(void)
+{
+	while (script_cache.head != NULL)
+		script_cache_destroy(script_cache.head);
+}
+
+/**
+ * Find a script in the compiled script cache
+ *
+ * \param name    URL of script source
+ * \param txtlen  length of script source
+ * \param hash    hash of script source
+ * \return entry for script, or NULL if not cached
+ */
+static struct script_cache_entry *
+script_cache_find(const char *name, size_t txtlen, uint32_t hash)
+{
+	struct script_cache_entry *entry;
+
+	for (entry = script_cache.head; entry != NULL; entry = entry->next) {
+		if (entry->hash == hash && entry->txtlen == txtlen &&
+				strcmp(entry->name, name) == 0) {
+			/* Most recently used */
+			script_cache_unlink(entry);
+			script_cache_link(entry);
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Load a script from a compiled script cache entry
+ *
+ * The script is decoded into the compartment of the context.
+ *
+ * \param cx     context to load script into
+ * \param entry  cache entry
+ * \return compiled script, or NULL on error
+ */
+static JSAPI_SCRIPT *
+script_cache_load(JSContext *cx, struct script_cache_entry *entry)
+{
+	JSXDRState *xdr;
+	JSAPI_SCRIPT *script = NULL;
+
+	xdr = JS_XDRNewMem(cx, JSXDR_DECODE);
+	if (xdr == NULL) {
+		return NULL;
+	}
+
+	JS_XDRMemSetData(xdr, entry->xdr, entry->xdrlen);
+
+	if (JSAPI_XDR_SCRIPT(xdr, &script) != JS_TRUE) {
+		script = NULL;
+	}
+
+	/* the buffer belongs to the cache entry */
+	JS_XDRMemSetData(xdr, NULL, 0);
+	JS_XDRDestroy(xdr);
+
+	return script;
+}
+
+/**
+ * Add a compiled script to the compiled script cache
+ *
+ * Least recently used scripts are evicted to keep the cache within
+ * SCRIPT_CACHE_SIZE.
+ *
+ * \param cx      context script was compiled in
+ * \param script  compiled script
+ * \param name    URL of script source
+ * \param txtlen  length of script source
+ * \param hash    hash of script source
+ */
+static void script_cache_store(JSContext *cx, JSAPI_SCRIPT *script,
+		const char *name, size_t txtlen, uint32_t hash)
+{
+	struct script_cache_entry *entry;
+	JSXDRState *xdr;
+	void *data;
+	uint32_t datalen;
+
+	xdr = JS_XDRNewMem(cx, JSXDR_ENCODE);
+	if (xdr == NULL) {
+		return;
+	}
+
+	if (JSAPI_XDR_SCRIPT(xdr, &script) != JS_TRUE) {
+		JS_XDRDestroy(xdr);
+		return;
+	}
+
+	data = JS_XDRMemGetData(xdr, &datalen);
+	if (datalen > SCRIPT_CACHE_SIZE) {
+		JS_XDRDestroy(xdr);
+		return;
+	}
+
+	entry = malloc(sizeof(struct script_cache_entry));
+	if (entry == NULL) {
+		JS_XDRDestroy(xdr);
+		return;
+	}
+
+	entry->name = strdup(name);
+	entry->xdr = malloc(datalen);
+	if (entry->name == NULL || entry->xdr == NULL) {
+		free(entry->name);
+		free(entry->xdr);
+		free(entry);
+		JS_XDRDestroy(xdr);
+		return;
+	}
+
+	memcpy(entry->xdr, data, datalen);
+	entry->xdrlen = datalen;
+	entry->txtlen = txtlen;
+	entry->hash = hash;
+
+	JS_XDRDestroy(xdr);
+
+	while (script_cache.tail != NULL &&
+			script_cache.size + datalen > SCRIPT_CACHE_SIZE) {
+		script_cache_destroy(script_cache.tail);
+	}
+
+	script_cache_link(entry);
+
+	JSLOG("cached compiled script %s (%u bytes, %u in cache)",
+	      name, datalen, (unsigned int) script_cache.size);
+}
+
+bool js_exec(jscontext *ctx, const char *txt, size_t txtlen, const char *name)
 {
 	JSContext *cx = (JSContext *)ctx;
+	JSObject *global;
+	JSAPI_SCRIPT *script = NULL;
+	struct script_cache_entry *entry = NULL;
+	uint32_t hash = 0;
 	jsval rval;
 	JSBool eval_res;
 	struct heartbeat *hb;
@@ -408,15 +711,46 @@ bool js_exec(jscontext *ctx, const char *txt, size_t txtlen)
 		return false;
 	}
 
+	global = JS_GetGlobalObject(cx);
+
+	/* only external scripts are cached, keyed on their URL and a hash
+	 * of their source */
+	if (name != NULL) {
+		hash = script_cache_hash(txt, txtlen);
+		entry = script_cache_find(name, txtlen, hash);
+		if (entry != NULL) {
+			script = script_cache_load(cx, entry);
+			if (script == NULL) {
+				script_cache_destroy(entry);
+			}
+		}
+	}
+
+	if (script == NULL) {
+		script = JS_CompileScript(cx, global, txt, txtlen,
+				(name != NULL) ? name : "<head>", 0);
+		if (script == NULL) {
+			return false;
+		}
+
+		JSAPI_ADD_SCRIPT_ROOT(cx, &script);
+
+		if (name != NULL) {
+			script_cache_store(cx, script, name, txtlen, hash);
+		}
+	} else {
+		JSAPI_ADD_SCRIPT_ROOT(cx, &script);
+	}
+
 	hb = enable_heartbeat(cx);
 
-	eval_res = JS_EvaluateScript(cx,
-				     JS_GetGlobalObject(cx),
-				     txt, txtlen,
-				     "<head>", 0, &rval);
+	eval_res = JS_ExecuteScript(cx, global, script, &rval);
 
 	disable_heartbeat(hb);
 
+	JSAPI_REMOVE_SCRIPT_ROOT(cx, &script);
+	JSAPI_DESTROY_SCRIPT(cx, script);
+
 	if (eval_res == JS_TRUE) {
 
 		return true;
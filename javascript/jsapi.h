@@ -26,8 +26,10 @@
 /* include the correct header */
 #ifdef WITH_MOZJS
 #include "js/jsapi.h"
+#include "js/jsxdrapi.h"
 #else
 #include "mozjs/jsapi.h"
+#include "mozjs/jsxdrapi.h"
 #endif
 
 /* logging macros */
@@ -165,6 +167,19 @@ JS_NewCompartmentAndGlobalObject(JSContext *cx,
 #define JSAPI_ADD_VALUE_ROOT(cx, obj) JS_AddRoot(cx, obj)
 #define JSAPI_REMOVE_VALUE_ROOT(cx, obj) JS_RemoveRoot(cx, obj)
 
+/* Garbage collected heap size is not available */
+#define JSAPI_GC_HEAP_BYTES(rt) 0
+
+/* There is no method JIT */
+#define JSAPI_JSOPTION_METHODJIT 0
+
+/* Compiled scripts are not garbage collected and must be destroyed */
+#define JSAPI_SCRIPT JSScript
+#define JSAPI_XDR_SCRIPT(xdr, script) JS_XDRScript(xdr, script)
+#define JSAPI_ADD_SCRIPT_ROOT(cx, script)
+#define JSAPI_REMOVE_SCRIPT_ROOT(cx, script)
+#define JSAPI_DESTROY_SCRIPT(cx, script) JS_DestroyScript(cx, script)
+
 #elif JS_VERSION == 180
 
 /************************** Spidermonkey 1.8.0 **************************/
@@ -281,6 +296,19 @@ JS_NewCompartmentAndGlobalObject(JSContext *cx,
 #define JSAPI_ADD_VALUE_ROOT(cx, obj) JS_AddRoot(cx, obj)
 #define JSAPI_REMOVE_VALUE_ROOT(cx, obj) JS_RemoveRoot(cx, obj)
 
+/* Garbage collected heap size is not available */
+#define JSAPI_GC_HEAP_BYTES(rt) 0
+
+/* There is no method JIT */
+#define JSAPI_JSOPTION_METHODJIT 0
+
+/* Compiled scripts are not garbage collected and must be destroyed */
+#define JSAPI_SCRIPT JSScript
+#define JSAPI_XDR_SCRIPT(xdr, script) JS_XDRScript(xdr, script)
+#define JSAPI_ADD_SCRIPT_ROOT(cx, script)
+#define JSAPI_REMOVE_SCRIPT_ROOT(cx, script)
+#define JSAPI_DESTROY_SCRIPT(cx, script) JS_DestroyScript(cx, script)
+
 
 #else /* #if JS_VERSION == 180 */
 
@@ -389,6 +417,23 @@ JS_NewCompartmentAndGlobalObject(JSContext *cx,
 #define JSAPI_ADD_VALUE_ROOT(cx, val) JS_AddValueRoot(cx, val)
 #define JSAPI_REMOVE_VALUE_ROOT(cx, val) JS_RemoveValueRoot(cx, val)
 
+/* Garbage collected heap size */
+#define JSAPI_GC_HEAP_BYTES(rt) JS_GetGCParameter(rt, JSGC_BYTES)
+
+/* Method JIT, where it is available */
+#ifdef JSOPTION_METHODJIT
+#define JSAPI_JSOPTION_METHODJIT JSOPTION_METHODJIT
+#else
+#define JSAPI_JSOPTION_METHODJIT 0
+#endif
+
+/* Compiled scripts are objects owned by the garbage collector */
+#define JSAPI_SCRIPT JSObject
+#define JSAPI_XDR_SCRIPT(xdr, script) JS_XDRScriptObject(xdr, script)
+#define JSAPI_ADD_SCRIPT_ROOT(cx, script) JS_AddObjectRoot(cx, script)
+#define JSAPI_REMOVE_SCRIPT_ROOT(cx, script) JS_RemoveObjectRoot(cx, script)
+#define JSAPI_DESTROY_SCRIPT(cx, script)
+
 #endif
 
 /************************** **************************/
@@ -49,7 +49,7 @@ jsobject *js_newcompartment(jscontext *ctx, void *win_priv, void *doc_priv)
 	return NULL;
 }
 
-bool js_exec(jscontext *ctx, const char *txt, size_t txtlen)
+bool js_exec(jscontext *ctx, const char *txt, size_t txtlen, const char *name)
 {
 	return true;
 }
@@ -0,0 +1,296 @@
+/*
+ * Copyright 2013 The NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Page load benchmarking for the monkey frontend (implementation).
+ *
+ * Pages are loaded one at a time, each in a new window.  Once a page has
+ * loaded it is redrawn once with the raster plotters, and the time spent
+ * in each phase of processing is reported along with the memory and cache
+ * use.  Times are in microseconds.
+ *
+ * Phase times are inclusive, so they overlap and must not be summed: BOX
+ * includes STYLE and NORMALISE, and REDRAW includes any IMAGE conversions
+ * made while plotting and the redraws of nested objects, which are also
+ * counted as REDRAW runs of their own.  FETCH is the wall clock time of
+ * each fetch, which overlaps everything else.
+ *
+ * The memory figure is the peak resident size of the whole process so
+ * far, in kilobytes, so it only grows from one page to the next.
+ *
+ * Commands:
+ *
+ *   BENCH LOAD <url>   add a page to the queue
+ *   BENCH EXIT         quit once the queue is empty
+ *
+ * Output for each page:
+ *
+ *   BENCH START URL <url>
+ *   BENCH PHASE <phase> COUNT <n> INCLUSIVE <t> MAX <t> (one per phase)
+ *   BENCH LOAD TIME <t>                                 (navigate until done)
+ *   BENCH REDRAW TIME <t>                               (first redraw)
+ *   BENCH MEMORY PROCESS PEAK <kb>
+ *   BENCH LLCACHE CACHED <n> UNCACHED <n> SIZE <bytes>
+ *   BENCH HLCACHE CONTENTS <n> SIZE <bytes> HITS <n> MISSES <n>
+ *   BENCH STOP URL <url>
+ *
+ * or BENCH ERROR URL <url>, or BENCH TIMEOUT URL <url>, followed by
+ * BENCH FINISHED when the queue is empty.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "content/content.h"
+#include "content/hlcache.h"
+#include "content/llcache.h"
+#include "desktop/browser_private.h"
+#include "desktop/netsurf.h"
+#include "utils/log.h"
+#include "utils/nsurl.h"
+#include "utils/schedule.h"
+#include "utils/timing.h"
+#include "utils/utils.h"
+
+#include "monkey/bench.h"
+#include "monkey/browser.h"
+#include "monkey/raster.h"
+
+/** Time to wait for a page to load, in centiseconds */
+#define BENCH_TIMEOUT 6000
+
+struct bench_page {
+  struct bench_page *next;
+  char *url;
+};
+
+static struct {
+  struct bench_page *queue; /**< Pages waiting to be loaded */
+  struct bench_page *last; /**< Last page in queue */
+  struct bench_page *current; /**< Page being loaded, or NULL */
+  struct browser_window *bw; /**< Window page is loaded in */
+  uint64_t start; /**< Time load started */
+  uint64_t load_time; /**< Time taken to load */
+  bool loaded; /**< Page has loaded */
+  bool exit; /**< Quit once queue is empty */
+} bench;
+
+static void monkey_bench_start_next(void);
+static void monkey_bench_timeout(void *p);
+
+
+static void
+monkey_bench_end_page(void)
+{
+  browser_window_destroy(bench.bw);
+  bench.bw = NULL;
+
+  free(bench.current->url);
+  free(bench.current);
+  bench.current = NULL;
+  bench.loaded = false;
+
+  monkey_bench_start_next();
+}
+
+static void
+monkey_bench_report(void)
+{
+  struct gui_window *gw = bench.bw->window;
+  struct llcache_statistics llstats;
+  struct hlcache_statistics hlstats;
+  struct rusage usage;
+  uint64_t redraw_time = 0;
+  int phase;
+
+  if (bench.bw->reformat_pending)
+    browser_window_reformat(bench.bw, false, gw->width, gw->height);
+
+  if (monkey_raster_begin(gw->width, gw->height) == NSERROR_OK) {
+    struct rect clip = { 0, 0, gw->width, gw->height };
+    struct redraw_context ctx = {
+      .interactive = true,
+      .background_images = true,
+      .plot = &monkey_raster_plotters
+    };
+    uint64_t start = timing_now();
+
+    browser_window_redraw(bench.bw, 0, 0, &clip, &ctx);
+    redraw_time = timing_now() - start;
+    monkey_raster_end();
+  }
+
+  for (phase = 0; phase != TIMING_PHASE_COUNT; phase++) {
+    struct timing_totals totals;
+
+    timing_get(phase, &totals);
+    fprintf(stdout, "BENCH PHASE %s COUNT %u INCLUSIVE %llu MAX %llu\n",
+            timing_phase_name(phase), totals.count,
+            (unsigned long long)totals.time,
+            (unsigned long long)totals.max);
+  }
+
+  fprintf(stdout, "BENCH LOAD TIME %llu\n",
+          (unsigned long long)bench.load_time);
+  fprintf(stdout, "BENCH REDRAW TIME %llu\n",
+          (unsigned long long)redraw_time);
+
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+    fprintf(stdout, "BENCH MEMORY PROCESS PEAK %ld\n", usage.ru_maxrss);
+
+  llcache_get_statistics(&llstats);
+  fprintf(stdout, "BENCH LLCACHE CACHED %u UNCACHED %u SIZE %zu\n",
+          llstats.cached, llstats.uncached, llstats.size);
+
+  hlcache_get_statistics(&hlstats);
+  fprintf(stdout, "BENCH HLCACHE CONTENTS %u SIZE %zu HITS %u MISSES %u\n",
+          hlstats.contents, hlstats.size, hlstats.hits, hlstats.misses);
+
+  fprintf(stdout, "BENCH STOP URL %s\n", bench.current->url);
+}
+
+static void
+monkey_bench_finish(void *p)
+{
+  hlcache_handle *c = bench.bw->current_content;
+
+  schedule_remove(monkey_bench_timeout, NULL);
+
+  if (c == NULL || content_get_status(c) != CONTENT_STATUS_DONE) {
+    fprintf(stdout, "BENCH ERROR URL %s\n", bench.current->url);
+  } else {
+    monkey_bench_report();
+  }
+
+  monkey_bench_end_page();
+}
+
+static void
+monkey_bench_timeout(void *p)
+{
+  schedule_remove(monkey_bench_finish, NULL);
+
+  fprintf(stdout, "BENCH TIMEOUT URL %s\n", bench.current->url);
+
+  monkey_bench_end_page();
+}
+
+static void
+monkey_bench_start_next(void)
+{
+  while (bench.current == NULL && bench.queue != NULL) {
+    struct bench_page *page = bench.queue;
+    nsurl *url;
+    nserror error;
+
+    bench.queue = page->next;
+    if (bench.queue == NULL)
+      bench.last = NULL;
+
+    error = nsurl_create(page->url, &url);
+    if (error != NSERROR_OK) {
+      fprintf(stdout, "BENCH ERROR URL %s\n", page->url);
+      free(page->url);
+      free(page);
+      continue;
+    }
+
+    fprintf(stdout, "BENCH START URL %s\n", page->url);
+    LOG(("Benchmarking %s", page->url));
+
+    timing_reset();
+    bench.current = page;
+    bench.start = timing_now();
+
+    error = browser_window_create(BW_CREATE_HISTORY, url, NULL, NULL,
+                                  &bench.bw);
+    nsurl_unref(url);
+
+    if (error != NSERROR_OK) {
+      fprintf(stdout, "BENCH ERROR URL %s\n", page->url);
+      bench.current = NULL;
+      free(page->url);
+      free(page);
+      continue;
+    }
+
+    schedule(BENCH_TIMEOUT, monkey_bench_timeout, NULL);
+  }
+
+  if (bench.current == NULL) {
+    fprintf(stdout, "BENCH FINISHED\n");
+    if (bench.exit)
+      netsurf_quit = true;
+  }
+}
+
+/* exported interface documented in monkey/bench.h */
+void
+monkey_bench_window_stopped(struct gui_window *gw)
+{
+  if (bench.current == NULL || bench.loaded || gw->bw != bench.bw)
+    return;
+
+  bench.load_time = timing_now() - bench.start;
+  bench.loaded = true;
+
+  /* Don't destroy the window from within its own callback */
+  schedule(0, monkey_bench_finish, NULL);
+}
+
+/* exported interface documented in monkey/bench.h */
+void
+monkey_bench_handle_command(int argc, char **argv)
+{
+  if (argc == 1)
+    return;
+
+  if (strcmp(argv[1], "LOAD") == 0) {
+    struct bench_page *page;
+
+    if (argc != 3) {
+      fprintf(stdout, "ERROR BENCH LOAD ARGS BAD\n");
+      return;
+    }
+
+    page = malloc(sizeof(*page));
+    if (page == NULL || (page->url = strdup(argv[2])) == NULL) {
+      free(page);
+      warn_user("NoMemory", 0);
+      return;
+    }
+    page->next = NULL;
+
+    if (bench.last != NULL)
+      bench.last->next = page;
+    else
+      bench.queue = page;
+    bench.last = page;
+
+    if (bench.current == NULL)
+      monkey_bench_start_next();
+  } else if (strcmp(argv[1], "EXIT") == 0) {
+    bench.exit = true;
+    if (bench.current == NULL && bench.queue == NULL)
+      netsurf_quit = true;
+  } else {
+    fprintf(stdout, "ERROR BENCH COMMAND UNKNOWN %s\n", argv[1]);
+  }
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright 2013 The NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Page load benchmarking for the monkey frontend (interface).
+ */
+
+#ifndef NETSURF_MONKEY_BENCH_H
+#define NETSURF_MONKEY_BENCH_H 1
+
+struct gui_window;
+
+/**
+ * Handle a BENCH command from the monkey driver.
+ */
+void monkey_bench_handle_command(int argc, char **argv);
+
+/**
+ * Notify the benchmark that a window has stopped loading.
+ *
+ * \param gw  Window which stopped loading
+ */
+void monkey_bench_window_stopped(struct gui_window *gw);
+
+#endif /* NETSURF_MONKEY_BENCH_H */
@@ -27,8 +27,10 @@
 #include "utils/log.h"
 #include "utils/messages.h"
 
+#include "monkey/bench.h"
 #include "monkey/browser.h"
 #include "monkey/plot.h"
+#include "monkey/raster.h"
 
 static uint32_t win_ctr = 0;
 
@@ -165,6 +167,7 @@ static void
 gui_window_stop_throbber(struct gui_window *g)
 {
   fprintf(stdout, "WINDOW STOP_THROBBER WIN %u\n", g->win_num);
+  monkey_bench_window_stopped(g);
 }
 
 static void
@@ -426,6 +429,7 @@ monkey_window_handle_redraw(int argc, char **argv)
 {
   struct gui_window *gw;
   struct rect clip;
+  const struct plotter_table *raster;
   struct redraw_context ctx = {
     .interactive = true,
     .background_images = true,
@@ -456,10 +460,22 @@ monkey_window_handle_redraw(int argc, char **argv)
     clip.y1 = atoi(argv[6]);
   }
   
+  raster = monkey_raster_plotters_active();
+  if (raster != NULL) {
+    if (monkey_raster_begin(gw->width, gw->height) != NSERROR_OK) {
+      fprintf(stdout, "ERROR WINDOW REDRAW RASTER BAD\n");
+      return;
+    }
+    ctx.plot = raster;
+  }
+
   LOG(("Issue redraw"));
   fprintf(stdout, "WINDOW REDRAW WIN %d START\n", atoi(argv[2]));
   browser_window_redraw(gw->bw, gw->scrollx, gw->scrolly, &clip, &ctx);  
   fprintf(stdout, "WINDOW REDRAW WIN %d STOP\n", atoi(argv[2]));
+
+  if (raster != NULL)
+    monkey_raster_end();
 }
 
 static void
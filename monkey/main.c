@@ -23,11 +23,13 @@
 #include "utils/nsoption.h"
 #include "monkey/poll.h"
 #include "monkey/dispatch.h"
+#include "monkey/bench.h"
 #include "monkey/browser.h"
 #include "monkey/cert.h"
 #include "monkey/401login.h"
 #include "monkey/filetype.h"
 #include "monkey/fetch.h"
+#include "monkey/raster.h"
 
 #include "content/urldb.h"
 #include "content/fetchers/resource.h"
@@ -39,6 +41,8 @@
 
 char **respaths; /** resource search path vector */
 
+static bool monkey_journal_open = false;
+
 /* Stolen from gtk/gui.c */
 static char **
 nsmonkey_init_resource(const char *resource_path)
@@ -60,8 +64,13 @@ nsmonkey_init_resource(const char *resource_path)
 
 static void monkey_quit(void)
 {
-  urldb_save_cookies(nsoption_charp(cookie_jar));
-  urldb_save(nsoption_charp(url_file));
+  if (monkey_journal_open) {
+    /* everything since the last compaction is in the journal */
+    urldb_journal_close();
+  } else {
+    urldb_save_cookies(nsoption_charp(cookie_jar));
+    urldb_save(nsoption_charp(url_file));
+  }
   free(nsoption_charp(cookie_file));
   free(nsoption_charp(cookie_jar));
   monkey_fetch_filetype_fin();
@@ -161,9 +170,18 @@ main(int argc, char **argv)
   urldb_load(nsoption_charp(url_file));
   urldb_load_cookies(nsoption_charp(cookie_file));
 
+  if (nsoption_charp(url_journal) != NULL) {
+    monkey_journal_open = (urldb_journal_open(nsoption_charp(url_journal),
+					      nsoption_charp(url_file),
+					      nsoption_charp(cookie_jar)) ==
+			   NSERROR_OK);
+  }
+
   monkey_prepare_input();
   monkey_register_handler("QUIT", quit_handler);
   monkey_register_handler("WINDOW", monkey_window_handle_command);
+  monkey_register_handler("RASTER", monkey_raster_handle_command);
+  monkey_register_handler("BENCH", monkey_bench_handle_command);
 
   fprintf(stdout, "GENERIC STARTED\n");
   netsurf_main_loop();
@@ -171,6 +189,7 @@ main(int argc, char **argv)
   monkey_kill_browser_windows();
 
   netsurf_exit();
+  monkey_raster_finalise();
   fprintf(stdout, "GENERIC FINISHED\n");
 
   /* finalise options */
@@ -28,6 +28,7 @@ NSOPTION_BOOL(downloads_clear, false)
 NSOPTION_BOOL(request_overwrite, true)
 NSOPTION_STRING(downloads_directory, NULL)
 NSOPTION_STRING(url_file, NULL)
+NSOPTION_STRING(url_journal, NULL)
 NSOPTION_BOOL(show_single_tab, false)
 NSOPTION_INTEGER(button_type, 0)
 NSOPTION_BOOL(disable_popups, false)
@@ -0,0 +1,989 @@
+/*
+ * Copyright 2013 The NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Software rasterising plotters for the monkey frontend (implementation).
+ *
+ * The plotters favour simplicity over quality: there is no anti-aliasing,
+ * bitmaps are scaled with nearest neighbour sampling and, as monkey has no
+ * real fonts, each character of text is drawn as a block the size given by
+ * the monkey font metrics.  That is enough for the cost of a redraw to be
+ * representative, and for frames to be compared.
+ *
+ * Commands:
+ *
+ *   RASTER ON|OFF             use the raster plotters for WINDOW REDRAW
+ *   RASTER KNOCKOUT ON|OFF    enable or disable knockout rendering
+ *   RASTER DUMP <file>        write the surface to a PNG file
+ *   RASTER STATS              report plotter calls and times (microseconds)
+ *   RASTER RESET              clear the counts and times
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <zlib.h>
+
+#include "image/bitmap.h"
+#include "utils/log.h"
+#include "utils/utf8.h"
+
+#include "monkey/raster.h"
+
+/** Number of line segments a bezier curve is flattened into */
+#define RASTER_BEZIER_SEGMENTS 8
+
+/** Maximum number of line segments an arc is drawn with */
+#define RASTER_ARC_SEGMENTS_MAX 1024
+
+/** Plot operations which are timed */
+enum raster_op {
+  RASTER_OP_CLIP,
+  RASTER_OP_ARC,
+  RASTER_OP_DISC,
+  RASTER_OP_LINE,
+  RASTER_OP_RECTANGLE,
+  RASTER_OP_POLYGON,
+  RASTER_OP_PATH,
+  RASTER_OP_BITMAP,
+  RASTER_OP_TEXT,
+  RASTER_OP_COUNT
+};
+
+static const char *raster_op_name[RASTER_OP_COUNT] = {
+  "CLIP", "ARC", "DISC", "LINE", "RECTANGLE",
+  "POLYGON", "PATH", "BITMAP", "TEXT"
+};
+
+/** An edge of a shape to be filled */
+struct raster_edge {
+  float x0, y0, x1, y1;
+  bool stroke; /**< Edge is stroked, rather than closing a subpath */
+};
+
+/** The surface, in plot colours (0xBBGGRR) */
+static struct {
+  colour *pixels;
+  int *columns; /**< Scratch space for bitmap sampling, one per column */
+  int width;
+  int height;
+  struct rect clip; /**< Current clip, within the surface */
+} raster;
+
+static struct {
+  unsigned int count;
+  unsigned long long time;
+} raster_stats[RASTER_OP_COUNT];
+
+static unsigned int raster_frames;
+static unsigned long long raster_frame_time;
+static unsigned long long raster_frame_start;
+
+static bool raster_enabled = false;
+static bool raster_knockout = true;
+
+
+static unsigned long long
+raster_now(void)
+{
+  struct timeval tv;
+
+  if (gettimeofday(&tv, NULL) == -1)
+    return 0;
+
+  return (unsigned long long)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void
+raster_account(enum raster_op op, unsigned long long start)
+{
+  raster_stats[op].count++;
+  raster_stats[op].time += raster_now() - start;
+}
+
+
+/* Fill pixels x0 <= x < x1 of a row, within the clip */
+static void
+raster_span(int y, int x0, int x1, colour c)
+{
+  colour *row;
+  int x;
+
+  if (y < raster.clip.y0 || y >= raster.clip.y1)
+    return;
+  if (x0 < raster.clip.x0)
+    x0 = raster.clip.x0;
+  if (x1 > raster.clip.x1)
+    x1 = raster.clip.x1;
+
+  row = raster.pixels + (size_t)y * raster.width;
+  for (x = x0; x < x1; x++)
+    row[x] = c;
+}
+
+/* Fill a rectangle, excluding its right and bottom edges, within the clip */
+static void
+raster_fill(int x0, int y0, int x1, int y1, colour c)
+{
+  int y;
+
+  if (y0 < raster.clip.y0)
+    y0 = raster.clip.y0;
+  if (y1 > raster.clip.y1)
+    y1 = raster.clip.y1;
+
+  for (y = y0; y < y1; y++)
+    raster_span(y, x0, x1, c);
+}
+
+/* Clip a line to a rectangle; false if it lies outside */
+static bool
+raster_clip_line(float *x0, float *y0, float *x1, float *y1,
+                 float cx0, float cy0, float cx1, float cy1)
+{
+  float dx = *x1 - *x0;
+  float dy = *y1 - *y0;
+  float p[4] = { -dx, dx, -dy, dy };
+  float q[4] = { *x0 - cx0, cx1 - *x0, *y0 - cy0, cy1 - *y0 };
+  float t0 = 0, t1 = 1;
+  int i;
+
+  for (i = 0; i != 4; i++) {
+    float t;
+
+    if (p[i] == 0) {
+      if (q[i] < 0)
+        return false;
+      continue;
+    }
+
+    t = q[i] / p[i];
+    if (p[i] < 0) {
+      if (t > t1)
+        return false;
+      if (t > t0)
+        t0 = t;
+    } else {
+      if (t < t0)
+        return false;
+      if (t < t1)
+        t1 = t;
+    }
+  }
+
+  *x1 = *x0 + t1 * dx;
+  *y1 = *y0 + t1 * dy;
+  *x0 = *x0 + t0 * dx;
+  *y0 = *y0 + t0 * dy;
+
+  return true;
+}
+
+/* Draw a line, including both end points */
+static void
+raster_line(int x0, int y0, int x1, int y1, int width,
+            plot_operation_type_t type, colour c)
+{
+  float fx0 = x0, fy0 = y0, fx1 = x1, fy1 = y1;
+  int off, dx, dy, sx, sy, err;
+  unsigned int step = 0;
+
+  if (type == PLOT_OP_TYPE_NONE || (c & NS_TRANSPARENT))
+    return;
+
+  if (width < 1)
+    width = 1;
+  off = width / 2;
+
+  if (type == PLOT_OP_TYPE_SOLID && (x0 == x1 || y0 == y1)) {
+    raster_fill((x0 < x1 ? x0 : x1) - off, (y0 < y1 ? y0 : y1) - off,
+                (x0 < x1 ? x1 : x0) - off + width,
+                (y0 < y1 ? y1 : y0) - off + width, c);
+    return;
+  }
+
+  /* Only step along the part of the line which can reach the clip */
+  if (raster_clip_line(&fx0, &fy0, &fx1, &fy1,
+                       raster.clip.x0 - width, raster.clip.y0 - width,
+                       raster.clip.x1 + width, raster.clip.y1 + width) ==
+      false)
+    return;
+  x0 = lroundf(fx0);
+  y0 = lroundf(fy0);
+  x1 = lroundf(fx1);
+  y1 = lroundf(fy1);
+
+  dx = abs(x1 - x0);
+  dy = -abs(y1 - y0);
+  sx = x0 < x1 ? 1 : -1;
+  sy = y0 < y1 ? 1 : -1;
+  err = dx + dy;
+
+  while (true) {
+    bool on = true;
+    int e2;
+
+    if (type == PLOT_OP_TYPE_DOT)
+      on = (step / width) % 2 == 0;
+    else if (type == PLOT_OP_TYPE_DASH)
+      on = (step / (3 * width)) % 2 == 0;
+
+    if (on)
+      raster_fill(x0 - off, y0 - off, x0 - off + width, y0 - off + width, c);
+
+    if (x0 == x1 && y0 == y1)
+      break;
+
+    e2 = 2 * err;
+    if (e2 >= dy) {
+      err += dy;
+      x0 += sx;
+    }
+    if (e2 <= dx) {
+      err += dx;
+      y0 += sy;
+    }
+    step++;
+  }
+}
+
+/* Convert a coordinate to a pixel, within the range lo..hi */
+static int
+raster_clamp(float v, int lo, int hi)
+{
+  if (v < lo)
+    return lo;
+  if (v > hi)
+    return hi;
+  return (int)v;
+}
+
+/* Fill the pixels whose centres lie inside edges, by the even-odd rule */
+static bool
+raster_fill_edges(const struct raster_edge *edges, unsigned int n, colour c)
+{
+  float ymin, ymax;
+  float *xs;
+  unsigned int i;
+  int y, y0, y1;
+
+  if (n == 0 || (c & NS_TRANSPARENT))
+    return true;
+
+  ymin = ymax = edges[0].y0;
+  for (i = 0; i != n; i++) {
+    ymin = fminf(ymin, fminf(edges[i].y0, edges[i].y1));
+    ymax = fmaxf(ymax, fmaxf(edges[i].y0, edges[i].y1));
+  }
+
+  y0 = raster_clamp(ceilf(ymin - 0.5f), raster.clip.y0, raster.clip.y1);
+  y1 = raster_clamp(ceilf(ymax - 0.5f), raster.clip.y0, raster.clip.y1);
+  if (y0 >= y1)
+    return true;
+
+  xs = malloc(n * sizeof(float));
+  if (xs == NULL)
+    return false;
+
+  for (y = y0; y < y1; y++) {
+    float yc = y + 0.5f;
+    unsigned int count = 0;
+
+    for (i = 0; i != n; i++) {
+      const struct raster_edge *e = &edges[i];
+      float x;
+      unsigned int j;
+
+      if ((e->y0 <= yc) == (e->y1 <= yc))
+        continue;
+
+      x = e->x0 + (yc - e->y0) * (e->x1 - e->x0) / (e->y1 - e->y0);
+
+      /* Insert in order */
+      for (j = count; j > 0 && xs[j - 1] > x; j--)
+        xs[j] = xs[j - 1];
+      xs[j] = x;
+      count++;
+    }
+
+    for (i = 0; i + 1 < count; i += 2) {
+      raster_span(y,
+                  raster_clamp(ceilf(xs[i] - 0.5f),
+                               raster.clip.x0, raster.clip.x1),
+                  raster_clamp(ceilf(xs[i + 1] - 0.5f),
+                               raster.clip.x0, raster.clip.x1),
+                  c);
+    }
+  }
+
+  free(xs);
+
+  return true;
+}
+
+static void
+raster_arc(int x, int y, int radius, int angle1, int angle2, colour c)
+{
+  int segments, i;
+  int px, py;
+
+  while (angle2 <= angle1)
+    angle2 += 360;
+
+  segments = (int)(radius * (angle2 - angle1) * M_PI / 180 / 4) + 1;
+  if (segments > RASTER_ARC_SEGMENTS_MAX)
+    segments = RASTER_ARC_SEGMENTS_MAX;
+
+  px = x + lround(radius * cos(angle1 * M_PI / 180));
+  py = y - lround(radius * sin(angle1 * M_PI / 180));
+
+  for (i = 1; i <= segments; i++) {
+    double a = (angle1 + (double)(angle2 - angle1) * i / segments) *
+        M_PI / 180;
+    int nx = x + lround(radius * cos(a));
+    int ny = y - lround(radius * sin(a));
+
+    raster_line(px, py, nx, ny, 1, PLOT_OP_TYPE_SOLID, c);
+    px = nx;
+    py = ny;
+  }
+}
+
+
+static bool
+monkey_raster_clip(const struct rect *clip)
+{
+  unsigned long long start = raster_now();
+
+  raster.clip.x0 = clip->x0 < 0 ? 0 : clip->x0;
+  raster.clip.y0 = clip->y0 < 0 ? 0 : clip->y0;
+  raster.clip.x1 = clip->x1 > raster.width ? raster.width : clip->x1;
+  raster.clip.y1 = clip->y1 > raster.height ? raster.height : clip->y1;
+
+  raster_account(RASTER_OP_CLIP, start);
+  return true;
+}
+
+static bool
+monkey_raster_arc(int x, int y, int radius, int angle1, int angle2,
+                  const plot_style_t *style)
+{
+  unsigned long long start = raster_now();
+
+  raster_arc(x, y, radius, angle1, angle2, style->fill_colour);
+
+  raster_account(RASTER_OP_ARC, start);
+  return true;
+}
+
+static bool
+monkey_raster_disc(int x, int y, int radius, const plot_style_t *style)
+{
+  unsigned long long start = raster_now();
+
+  if (style->fill_type != PLOT_OP_TYPE_NONE &&
+      (style->fill_colour & NS_TRANSPARENT) == 0) {
+    int dy = -radius;
+    int last = radius;
+
+    if (y + dy < raster.clip.y0)
+      dy = raster.clip.y0 - y;
+    if (y + last >= raster.clip.y1)
+      last = raster.clip.y1 - 1 - y;
+
+    for (; dy <= last; dy++) {
+      int half = (int)sqrt((double)radius * radius - dy * dy);
+
+      raster_span(y + dy, x - half, x + half + 1, style->fill_colour);
+    }
+  }
+
+  if (style->stroke_type != PLOT_OP_TYPE_NONE)
+    raster_arc(x, y, radius, 0, 360, style->stroke_colour);
+
+  raster_account(RASTER_OP_DISC, start);
+  return true;
+}
+
+static bool
+monkey_raster_line(int x0, int y0, int x1, int y1, const plot_style_t *style)
+{
+  unsigned long long start = raster_now();
+
+  raster_line(x0, y0, x1, y1, style->stroke_width, style->stroke_type,
+              style->stroke_colour);
+
+  raster_account(RASTER_OP_LINE, start);
+  return true;
+}
+
+static bool
+monkey_raster_rectangle(int x0, int y0, int x1, int y1,
+                        const plot_style_t *style)
+{
+  unsigned long long start = raster_now();
+
+  if (style->fill_type != PLOT_OP_TYPE_NONE &&
+      (style->fill_colour & NS_TRANSPARENT) == 0)
+    raster_fill(x0, y0, x1, y1, style->fill_colour);
+
+  if (style->stroke_type != PLOT_OP_TYPE_NONE) {
+    raster_line(x0, y0, x1, y0, style->stroke_width, style->stroke_type,
+                style->stroke_colour);
+    raster_line(x1, y0, x1, y1, style->stroke_width, style->stroke_type,
+                style->stroke_colour);
+    raster_line(x1, y1, x0, y1, style->stroke_width, style->stroke_type,
+                style->stroke_colour);
+    raster_line(x0, y1, x0, y0, style->stroke_width, style->stroke_type,
+                style->stroke_colour);
+  }
+
+  raster_account(RASTER_OP_RECTANGLE, start);
+  return true;
+}
+
+static bool
+monkey_raster_polygon(const int *p, unsigned int n, const plot_style_t *style)
+{
+  unsigned long long start = raster_now();
+  struct raster_edge *edges;
+  unsigned int i;
+  bool ok;
+
+  if (n < 3)
+    goto done;
+
+  edges = malloc(n * sizeof(struct raster_edge));
+  if (edges == NULL)
+    return false;
+
+  for (i = 0; i != n; i++) {
+    unsigned int j = (i + 1) % n;
+
+    edges[i].x0 = p[i * 2];
+    edges[i].y0 = p[i * 2 + 1];
+    edges[i].x1 = p[j * 2];
+    edges[i].y1 = p[j * 2 + 1];
+    edges[i].stroke = false;
+  }
+
+  ok = raster_fill_edges(edges, n, style->fill_colour);
+
+  free(edges);
+
+  if (ok == false)
+    return false;
+
+ done:
+  raster_account(RASTER_OP_POLYGON, start);
+  return true;
+}
+
+static bool
+monkey_raster_path(const float *p, unsigned int n, colour fill, float width,
+                   colour c, const float transform[6])
+{
+  unsigned long long start = raster_now();
+  struct raster_edge *edges;
+  unsigned int count = 0;
+  unsigned int i = 0;
+  float cx = 0, cy = 0; /* Current point */
+  float sx = 0, sy = 0; /* Start of subpath */
+  bool ok = true;
+
+#define RASTER_TX(x, y) (transform[0] * (x) + transform[2] * (y) + transform[4])
+#define RASTER_TY(x, y) (transform[1] * (x) + transform[3] * (y) + transform[5])
+#define RASTER_EDGE(ax, ay, bx, by, s) do {                             \
+    edges[count].x0 = (ax);                                             \
+    edges[count].y0 = (ay);                                             \
+    edges[count].x1 = (bx);                                             \
+    edges[count].y1 = (by);                                             \
+    edges[count].stroke = (s);                                          \
+    count++;                                                            \
+  } while (0)
+
+  /* Every command is at least one number and adds at most
+   * RASTER_BEZIER_SEGMENTS edges, plus one edge closing the subpath */
+  edges = malloc((n + 1) * (RASTER_BEZIER_SEGMENTS + 1) *
+                 sizeof(struct raster_edge));
+  if (edges == NULL)
+    return false;
+
+  while (i < n) {
+    int cmd = (int)p[i];
+
+    if (cmd == PLOTTER_PATH_MOVE && i + 2 < n) {
+      if (cx != sx || cy != sy)
+        RASTER_EDGE(cx, cy, sx, sy, false);
+      cx = sx = RASTER_TX(p[i + 1], p[i + 2]);
+      cy = sy = RASTER_TY(p[i + 1], p[i + 2]);
+      i += 3;
+
+    } else if (cmd == PLOTTER_PATH_LINE && i + 2 < n) {
+      float x = RASTER_TX(p[i + 1], p[i + 2]);
+      float y = RASTER_TY(p[i + 1], p[i + 2]);
+
+      RASTER_EDGE(cx, cy, x, y, true);
+      cx = x;
+      cy = y;
+      i += 3;
+
+    } else if (cmd == PLOTTER_PATH_BEZIER && i + 6 < n) {
+      float x0 = cx, y0 = cy;
+      float x1 = RASTER_TX(p[i + 1], p[i + 2]);
+      float y1 = RASTER_TY(p[i + 1], p[i + 2]);
+      float x2 = RASTER_TX(p[i + 3], p[i + 4]);
+      float y2 = RASTER_TY(p[i + 3], p[i + 4]);
+      float x3 = RASTER_TX(p[i + 5], p[i + 6]);
+      float y3 = RASTER_TY(p[i + 5], p[i + 6]);
+      int s;
+
+      for (s = 1; s <= RASTER_BEZIER_SEGMENTS; s++) {
+        float t = (float)s / RASTER_BEZIER_SEGMENTS;
+        float u = 1 - t;
+        float x = u * u * u * x0 + 3 * u * u * t * x1 +
+            3 * u * t * t * x2 + t * t * t * x3;
+        float y = u * u * u * y0 + 3 * u * u * t * y1 +
+            3 * u * t * t * y2 + t * t * t * y3;
+
+        RASTER_EDGE(cx, cy, x, y, true);
+        cx = x;
+        cy = y;
+      }
+      i += 7;
+
+    } else if (cmd == PLOTTER_PATH_CLOSE) {
+      if (cx != sx || cy != sy)
+        RASTER_EDGE(cx, cy, sx, sy, true);
+      cx = sx;
+      cy = sy;
+      i++;
+
+    } else {
+      LOG(("bad path command %f", p[i]));
+      ok = false;
+      break;
+    }
+  }
+
+  if (ok && (cx != sx || cy != sy))
+    RASTER_EDGE(cx, cy, sx, sy, false);
+
+#undef RASTER_EDGE
+#undef RASTER_TY
+#undef RASTER_TX
+
+  if (ok)
+    ok = raster_fill_edges(edges, count, fill);
+
+  if (ok && width > 0) {
+    int w = lroundf(width);
+
+    for (i = 0; i != count; i++) {
+      if (edges[i].stroke == false)
+        continue;
+
+      raster_line(lroundf(edges[i].x0), lroundf(edges[i].y0),
+                  lroundf(edges[i].x1), lroundf(edges[i].y1),
+                  w, PLOT_OP_TYPE_SOLID, c);
+    }
+  }
+
+  free(edges);
+
+  raster_account(RASTER_OP_PATH, start);
+  return ok;
+}
+
+static bool
+monkey_raster_bitmap(int x, int y, int width, int height,
+                     struct bitmap *bitmap, colour bg,
+                     bitmap_flags_t flags)
+{
+  unsigned long long start = raster_now();
+  const unsigned char *buffer;
+  size_t rowstride;
+  int bw, bh;
+  int x0, y0, x1, y1;
+  int px, py;
+  bool opaque;
+
+  if (width <= 0 || height <= 0 || bitmap == NULL)
+    goto done;
+
+  buffer = bitmap_get_buffer(bitmap);
+  if (buffer == NULL)
+    goto done;
+  rowstride = bitmap_get_rowstride(bitmap);
+  bw = bitmap_get_width(bitmap);
+  bh = bitmap_get_height(bitmap);
+  opaque = bitmap_get_opaque(bitmap);
+
+  /* Area covered by the bitmap, or its tiles */
+  x0 = raster.clip.x0;
+  x1 = raster.clip.x1;
+  if ((flags & BITMAPF_REPEAT_X) == 0) {
+    if (x > x0)
+      x0 = x;
+    if (x + width < x1)
+      x1 = x + width;
+  }
+
+  y0 = raster.clip.y0;
+  y1 = raster.clip.y1;
+  if ((flags & BITMAPF_REPEAT_Y) == 0) {
+    if (y > y0)
+      y0 = y;
+    if (y + height < y1)
+      y1 = y + height;
+  }
+
+  /* Source column for each destination column */
+  for (px = x0; px < x1; px++) {
+    int rel = (px - x) % width;
+
+    if (rel < 0)
+      rel += width;
+    raster.columns[px] = (int)((long long)rel * bw / width) * 4;
+  }
+
+  for (py = y0; py < y1; py++) {
+    int rel = (py - y) % height;
+    const unsigned char *src;
+    colour *dst;
+
+    if (rel < 0)
+      rel += height;
+    src = buffer + (size_t)((long long)rel * bh / height) * rowstride;
+    dst = raster.pixels + (size_t)py * raster.width;
+
+    for (px = x0; px < x1; px++) {
+      const unsigned char *s = src + raster.columns[px];
+      colour c = s[0] | (s[1] << 8) | (s[2] << 16);
+
+      if (opaque || s[3] == 0xff)
+        dst[px] = c;
+      else if (s[3] != 0)
+        dst[px] = mix_colour(c, dst[px], s[3]);
+    }
+  }
+
+ done:
+  raster_account(RASTER_OP_BITMAP, start);
+  return true;
+}
+
+static bool
+monkey_raster_text(int x, int y, const char *text, size_t length,
+                   const plot_font_style_t *fstyle)
+{
+  unsigned long long start = raster_now();
+  /* Character cell, as given by the monkey font metrics */
+  int advance = fstyle->size / FONT_SIZE_SCALE;
+  int inset = advance / 8;
+  size_t offset = 0;
+
+  while (offset < length) {
+    uint32_t ucs4 = utf8_to_ucs4(text + offset, length - offset);
+
+    if (ucs4 > ' ')
+      raster_fill(x + inset, y - (advance * 2) / 3,
+                  x + advance - inset, y, fstyle->foreground);
+
+    x += advance;
+    offset = utf8_next(text, length, offset);
+  }
+
+  raster_account(RASTER_OP_TEXT, start);
+  return true;
+}
+
+const struct plotter_table monkey_raster_plotters = {
+  .clip = monkey_raster_clip,
+  .arc = monkey_raster_arc,
+  .disc = monkey_raster_disc,
+  .line = monkey_raster_line,
+  .rectangle = monkey_raster_rectangle,
+  .polygon = monkey_raster_polygon,
+  .path = monkey_raster_path,
+  .bitmap = monkey_raster_bitmap,
+  .text = monkey_raster_text,
+  .option_knockout = true,
+};
+
+const struct plotter_table monkey_raster_plotters_noknockout = {
+  .clip = monkey_raster_clip,
+  .arc = monkey_raster_arc,
+  .disc = monkey_raster_disc,
+  .line = monkey_raster_line,
+  .rectangle = monkey_raster_rectangle,
+  .polygon = monkey_raster_polygon,
+  .path = monkey_raster_path,
+  .bitmap = monkey_raster_bitmap,
+  .text = monkey_raster_text,
+  .option_knockout = false,
+};
+
+
+/* exported interface documented in monkey/raster.h */
+const struct plotter_table *
+monkey_raster_plotters_active(void)
+{
+  if (raster_enabled == false)
+    return NULL;
+
+  return raster_knockout ? &monkey_raster_plotters :
+      &monkey_raster_plotters_noknockout;
+}
+
+/* exported interface documented in monkey/raster.h */
+nserror
+monkey_raster_begin(int width, int height)
+{
+  if (raster.pixels == NULL ||
+      raster.width != width || raster.height != height) {
+    colour *pixels;
+    int *columns;
+    size_t i;
+
+    if (width <= 0 || height <= 0)
+      return NSERROR_BAD_PARAMETER;
+
+    pixels = malloc((size_t)width * height * sizeof(colour));
+    columns = malloc(width * sizeof(int));
+    if (pixels == NULL || columns == NULL) {
+      free(pixels);
+      free(columns);
+      return NSERROR_NOMEM;
+    }
+
+    for (i = 0; i != (size_t)width * height; i++)
+      pixels[i] = 0xffffff;
+
+    monkey_raster_finalise();
+    raster.pixels = pixels;
+    raster.columns = columns;
+    raster.width = width;
+    raster.height = height;
+  }
+
+  raster.clip.x0 = 0;
+  raster.clip.y0 = 0;
+  raster.clip.x1 = width;
+  raster.clip.y1 = height;
+
+  raster_frame_start = raster_now();
+
+  return NSERROR_OK;
+}
+
+/* exported interface documented in monkey/raster.h */
+void
+monkey_raster_end(void)
+{
+  raster_frames++;
+  raster_frame_time += raster_now() - raster_frame_start;
+}
+
+/* exported interface documented in monkey/raster.h */
+void
+monkey_raster_finalise(void)
+{
+  free(raster.pixels);
+  free(raster.columns);
+  raster.pixels = NULL;
+  raster.columns = NULL;
+  raster.width = raster.height = 0;
+}
+
+
+static void
+raster_put32(unsigned char *p, uint32_t v)
+{
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static bool
+raster_png_chunk(FILE *fp, const char *type,
+                 const unsigned char *data, size_t len)
+{
+  unsigned char word[4];
+  uLong crc;
+
+  crc = crc32(0, (const Bytef *)type, 4);
+  if (len != 0)
+    crc = crc32(crc, data, len);
+
+  raster_put32(word, len);
+  if (fwrite(word, 4, 1, fp) != 1 || fwrite(type, 4, 1, fp) != 1)
+    return false;
+  if (len != 0 && fwrite(data, len, 1, fp) != 1)
+    return false;
+  raster_put32(word, crc);
+
+  return fwrite(word, 4, 1, fp) == 1;
+}
+
+/**
+ * Write the surface to a PNG file.
+ *
+ * \param path  Name of file to write
+ * \return NSERROR_OK on success, or appropriate error otherwise
+ */
+static nserror
+raster_save_png(const char *path)
+{
+  static const unsigned char signature[8] = {
+    0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+  };
+  size_t rowlen = 1 + (size_t)raster.width * 3;
+  size_t rawlen = rowlen * raster.height;
+  unsigned char header[13];
+  unsigned char *raw, *deflated;
+  uLongf deflated_len;
+  FILE *fp;
+  int x, y;
+  bool ok;
+
+  if (raster.pixels == NULL)
+    return NSERROR_NOT_FOUND;
+
+  raw = malloc(rawlen);
+  deflated_len = compressBound(rawlen);
+  deflated = malloc(deflated_len);
+  if (raw == NULL || deflated == NULL) {
+    free(raw);
+    free(deflated);
+    return NSERROR_NOMEM;
+  }
+
+  /* Unfiltered 8 bit RGB rows */
+  for (y = 0; y != raster.height; y++) {
+    const colour *src = raster.pixels + (size_t)y * raster.width;
+    unsigned char *dst = raw + rowlen * y;
+
+    *dst++ = 0;
+    for (x = 0; x != raster.width; x++) {
+      *dst++ = red_from_colour(src[x]);
+      *dst++ = green_from_colour(src[x]);
+      *dst++ = blue_from_colour(src[x]);
+    }
+  }
+
+  if (compress2(deflated, &deflated_len, raw, rawlen, Z_BEST_SPEED) != Z_OK) {
+    free(raw);
+    free(deflated);
+    return NSERROR_NOMEM;
+  }
+  free(raw);
+
+  raster_put32(header, raster.width);
+  raster_put32(header + 4, raster.height);
+  header[8] = 8; /* bit depth */
+  header[9] = 2; /* truecolour */
+  header[10] = 0; /* deflate */
+  header[11] = 0; /* adaptive filtering */
+  header[12] = 0; /* not interlaced */
+
+  fp = fopen(path, "wb");
+  if (fp == NULL) {
+    free(deflated);
+    return NSERROR_SAVE_FAILED;
+  }
+
+  ok = fwrite(signature, sizeof(signature), 1, fp) == 1 &&
+      raster_png_chunk(fp, "IHDR", header, sizeof(header)) &&
+      raster_png_chunk(fp, "IDAT", deflated, deflated_len) &&
+      raster_png_chunk(fp, "IEND", NULL, 0);
+
+  if (fclose(fp) != 0)
+    ok = false;
+
+  free(deflated);
+
+  return ok ? NSERROR_OK : NSERROR_SAVE_FAILED;
+}
+
+static void
+raster_report(void)
+{
+  int op;
+
+  fprintf(stdout, "RASTER STATS FRAMES %u TIME %llu\n",
+          raster_frames, raster_frame_time);
+
+  for (op = 0; op != RASTER_OP_COUNT; op++) {
+    fprintf(stdout, "RASTER STATS OP %s COUNT %u TIME %llu\n",
+            raster_op_name[op], raster_stats[op].count, raster_stats[op].time);
+  }
+}
+
+static bool
+raster_parse_switch(int argc, char **argv, int i, bool *value)
+{
+  if (argc != i + 1)
+    return false;
+
+  if (strcmp(argv[i], "ON") == 0)
+    *value = true;
+  else if (strcmp(argv[i], "OFF") == 0)
+    *value = false;
+  else
+    return false;
+
+  return true;
+}
+
+/* exported interface documented in monkey/raster.h */
+void
+monkey_raster_handle_command(int argc, char **argv)
+{
+  if (argc == 1)
+    return;
+
+  if (strcmp(argv[1], "ON") == 0 || strcmp(argv[1], "OFF") == 0) {
+    if (raster_parse_switch(argc, argv, 1, &raster_enabled) == false)
+      fprintf(stdout, "ERROR RASTER ARGS BAD\n");
+  } else if (strcmp(argv[1], "KNOCKOUT") == 0) {
+    if (raster_parse_switch(argc, argv, 2, &raster_knockout) == false)
+      fprintf(stdout, "ERROR RASTER KNOCKOUT ARGS BAD\n");
+  } else if (strcmp(argv[1], "DUMP") == 0) {
+    if (argc != 3) {
+      fprintf(stdout, "ERROR RASTER DUMP ARGS BAD\n");
+    } else if (raster_save_png(argv[2]) != NSERROR_OK) {
+      fprintf(stdout, "ERROR RASTER DUMP FAILED %s\n", argv[2]);
+    } else {
+      fprintf(stdout, "RASTER DUMP FILE %s WIDTH %d HEIGHT %d\n",
+              argv[2], raster.width, raster.height);
+    }
+  } else if (strcmp(argv[1], "STATS") == 0) {
+    raster_report();
+  } else if (strcmp(argv[1], "RESET") == 0) {
+    memset(raster_stats, 0, sizeof(raster_stats));
+    raster_frames = 0;
+    raster_frame_time = 0;
+  } else {
+    fprintf(stdout, "ERROR RASTER COMMAND UNKNOWN %s\n", argv[1]);
+  }
+}
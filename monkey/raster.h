@@ -0,0 +1,73 @@
+/*
+ * Copyright 2013 The NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Software rasterising plotters for the monkey frontend (interface).
+ *
+ * When enabled with the RASTER command, window redraws plot into an
+ * in-memory RGBA surface instead of printing the plot operations, and the
+ * time spent in each plotter is accumulated so rendering cost can be
+ * measured headlessly.
+ */
+
+#ifndef NETSURF_MONKEY_RASTER_H
+#define NETSURF_MONKEY_RASTER_H 1
+
+#include <stdbool.h>
+
+#include "desktop/plotters.h"
+#include "utils/errors.h"
+
+extern const struct plotter_table monkey_raster_plotters;
+extern const struct plotter_table monkey_raster_plotters_noknockout;
+
+/**
+ * Find whether window redraws should use the raster plotters.
+ *
+ * \return the plotter table to use, or NULL if rasterising is disabled
+ */
+const struct plotter_table *monkey_raster_plotters_active(void);
+
+/**
+ * Prepare the surface for a redraw.
+ *
+ * The surface keeps its contents between redraws of the same size, so
+ * partial redraws update the previous frame.
+ *
+ * \param width   Width of the window being redrawn
+ * \param height  Height of the window being redrawn
+ * \return NSERROR_OK on success, or NSERROR_NOMEM
+ */
+nserror monkey_raster_begin(int width, int height);
+
+/**
+ * Finish a redraw started with monkey_raster_begin().
+ */
+void monkey_raster_end(void);
+
+/**
+ * Free the surface.
+ */
+void monkey_raster_finalise(void);
+
+/**
+ * Handle a RASTER command from the monkey driver.
+ */
+void monkey_raster_handle_command(int argc, char **argv);
+
+#endif /* NETSURF_MONKEY_RASTER_H */
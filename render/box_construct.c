@@ -47,6 +47,7 @@
 #include "utils/messages.h"
 #include "utils/schedule.h"
 #include "utils/talloc.h"
+#include "utils/timing.h"
 #include "utils/url.h"
 #include "utils/utils.h"
 
@@ -95,6 +96,7 @@ const char *TARGET_TOP = "_top";
 const char *TARGET_BLANK = "_blank";
 
 static void convert_xml_to_box(struct box_construct_ctx *ctx);
+static void convert_xml_to_box_nodes(struct box_construct_ctx *ctx);
 static bool box_construct_element(struct box_construct_ctx *ctx,
 		bool *convert_children);
 static void box_construct_element_after(dom_node *n, html_content *content);
@@ -368,6 +370,23 @@ static dom_node *next_node(dom_node *n, html_content *content,
  * then schedule conversion of the next ELEMENT node
  */
 void convert_xml_to_box(struct box_construct_ctx *ctx)
+{
+	uint64_t start = timing_start();
+	nsurl *url = nsurl_ref(content_get_url(&ctx->content->base));
+
+	/* ctx is freed when conversion completes */
+	convert_xml_to_box_nodes(ctx);
+
+	timing_record(TIMING_BOX, start, url);
+	nsurl_unref(url);
+}
+
+/**
+ * Convert a batch of nodes to boxes (see convert_xml_to_box)
+ *
+ * \param ctx  Context for conversion, freed on completion
+ */
+void convert_xml_to_box_nodes(struct box_construct_ctx *ctx)
 {
 	dom_node *next;
 	bool convert_children;
@@ -421,6 +440,8 @@ void convert_xml_to_box(struct box_construct_ctx *ctx)
 		if (next == NULL) {
 			/* Conversion complete */
 			struct box root;
+			uint64_t start;
+			bool normalised;
 
 			memset(&root, 0, sizeof(root));
 
@@ -429,7 +450,12 @@ void convert_xml_to_box(struct box_construct_ctx *ctx)
 			root.children->parent = &root;
 
 			/** \todo Remove box_normalise_block */
-			if (box_normalise_block(&root, ctx->content) == false) {
+			start = timing_start();
+			normalised = box_normalise_block(&root, ctx->content);
+			timing_record(TIMING_NORMALISE, start,
+					content_get_url(&ctx->content->base));
+
+			if (normalised == false) {
 				ctx->cb(ctx->content, false);
 			} else {
 				ctx->content->layout = root.children;
@@ -1311,6 +1337,7 @@ css_select_results *box_get_style(html_content *c,
 	css_stylesheet *inline_style = NULL;
 	css_select_results *styles;
 	nscss_select_ctx ctx;
+	uint64_t start = timing_start();
 
 	/* Firstly, construct inline stylesheet, if any */
 	err = dom_element_get_attribute(n, corestring_dom_style, &s);
@@ -1345,6 +1372,8 @@ css_select_results *box_get_style(html_content *c,
 	if (inline_style != NULL)
 		css_stylesheet_destroy(inline_style);
 
+	timing_record(TIMING_STYLE, start, content_get_url(&c->base));
+
 	return styles;
 }
 
@@ -28,6 +28,7 @@
 #include "render/box_textarea.h"
 #include "render/font.h"
 #include "render/form.h"
+#include "render/search.h"
 #include "utils/log.h"
 
 
@@ -209,6 +210,7 @@ static void box_textarea_callback(void *data, struct textarea_msg *msg)
 		form_gadget_update_value(gadget,
 					 strndup(msg->data.modified.text,
 						 msg->data.modified.len));
+		search_index_invalidate(d->html);
 		break;
 	}
 }
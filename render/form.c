@@ -49,6 +49,7 @@
 #include "render/html.h"
 #include "render/html_internal.h"
 #include "render/layout.h"
+#include "render/search.h"
 #include "utils/corestrings.h"
 #include "utils/log.h"
 #include "utils/messages.h"
@@ -1390,6 +1391,8 @@ static void form__select_process_selection(html_content *html,
 		inline_box->length = strlen(inline_box->text);
 	inline_box->width = control->box->width;
 
+	search_index_invalidate(html);
+
 	html__redraw_a_box(html, control->box);
 }
 
@@ -36,6 +36,7 @@
 #include "utils/messages.h"
 #include "utils/schedule.h"
 #include "utils/talloc.h"
+#include "utils/timing.h"
 #include "utils/url.h"
 #include "utils/utf8.h"
 #include "utils/utils.h"
@@ -86,6 +87,10 @@ static void html_box_convert_done(html_content *c, bool success)
 
 	LOG(("Done XML to box (%p)", c));
 
+	/* All resources have been requested, so speculative fetches
+	 * are no longer needed */
+	html_preload_free(c);
+
 	/* Clean up and report error if unsuccessful or aborted */
 	if ((success == false) || (c->aborted)) {
 		html_object_free_objects(c);
@@ -764,6 +769,12 @@ html_create_html_data(html_content *c, const http_parameter *params)
 	c->focus_owner.self = true;
 	c->search = NULL;
 	c->search_string = NULL;
+	c->search_index = NULL;
+	c->parse_blocked = false;
+	c->preloads = NULL;
+	c->preload_count = 0;
+	c->preload_offset = 0;
+	c->parse_offset = 0;
 	c->scripts_count = 0;
 	c->scripts = NULL;
 	c->jscontext = NULL;
@@ -950,6 +961,7 @@ html_process_encoding_change(struct content *c,
 	}
 
 	source_data = content__get_source_data(c, &source_size);
+	html->parse_offset = 0;
 
 	/* Reprocess all the data.  This is safe because
 	 * the encoding is now specified at parser start which means
@@ -973,6 +985,16 @@ html_process_data(struct content *c, const char *data, unsigned int size)
 	html_content *html = (html_content *) c;
 	dom_hubbub_error dom_ret;
 	nserror err = NSERROR_OK; /* assume its all going to be ok */
+	uint64_t start = timing_start();
+
+	if (html->parse_blocked == false) {
+		/* Data is always appended to the source, and the parser
+		 * reaches at least the start of this chunk */
+		unsigned long source_size;
+
+		content__get_source_data(c, &source_size);
+		html->parse_offset = source_size - size;
+	}
 
 	dom_ret = dom_hubbub_parser_parse_chunk(html->parser, 
 					      (const uint8_t *) data, 
@@ -980,11 +1002,18 @@ html_process_data(struct content *c, const char *data, unsigned int size)
 
 	err = libdom_hubbub_error_to_nserror(dom_ret);
 
+	/* look ahead in data the blocked parser has not reached */
+	if (err == NSERROR_OK && html->parse_blocked) {
+		html_preload_scan(html);
+	}
+
 	/* deal with encoding change */
 	if (err == NSERROR_ENCODING_CHANGE) {
 		 err = html_process_encoding_change(c, data, size);
 	}
 
+	timing_record(TIMING_PARSE, start, content_get_url(c));
+
 	/* broadcast the error if necessary */
 	if (err != NSERROR_OK) {
 		content_broadcast_errorcode(c, err);
@@ -1083,9 +1112,13 @@ html_begin_conversion(html_content *htmlc)
 	 * complete to avoid repeating the completion pointlessly.
 	 */
 	if (htmlc->parse_completed == false) {
+		uint64_t start = timing_start();
+
 		LOG(("Completing parse"));
 		/* complete parsing */
 		error = dom_hubbub_parser_completed(htmlc->parser);
+		timing_record(TIMING_PARSE, start,
+				content_get_url(&htmlc->base));
 		if (error != DOM_HUBBUB_OK) {
 			LOG(("Parsing failed"));
 	
@@ -1264,10 +1297,16 @@ static void html_reformat(struct content *c, int width, int height)
 	html_content *htmlc = (html_content *) c;
 	struct box *layout;
 	unsigned int time_before, time_taken;
+	uint64_t start;
 
 	time_before = wallclock();
 
+	/* layout splits text boxes, so any search index is invalidated */
+	search_index_invalidate(htmlc);
+
+	start = timing_start();
 	layout_document(htmlc, width, height);
+	timing_record(TIMING_LAYOUT, start, content_get_url(c));
 	layout = htmlc->layout;
 
 	/* width and height are at least margin box of document */
@@ -1286,6 +1325,11 @@ static void html_reformat(struct content *c, int width, int height)
 
 	selection_reinit(&htmlc->sel, htmlc->layout);
 
+	/* Account for the box tree, including the boxes layout splits off,
+	 * in the content's size.  The DOM is not included, as libdom does
+	 * not report its memory use. */
+	c->size = talloc_total_size(htmlc->bctx);
+
 	time_taken = wallclock() - time_before;
 	c->reformat_time = wallclock() +
 		((time_taken * 3 < nsoption_uint(min_reflow_period) ?
@@ -1379,6 +1423,8 @@ static void html_destroy_iframe(struct content_html_iframe *iframe)
 
 static void html_free_layout(html_content *htmlc)
 {
+	search_index_invalidate(htmlc);
+
 	if (htmlc->bctx != NULL) {
 		/* freeing talloc context should let the entire box
 		 * set be destroyed 
@@ -1470,6 +1516,9 @@ static void html_destroy(struct content *c)
 	/* Free scripts */
 	html_free_scripts(html);
 
+	/* Free speculative fetches */
+	html_preload_free(html);
+
 	/* Free objects */
 	html_object_free_objects(html);
 
@@ -1814,6 +1863,8 @@ static void html__set_file_gadget_filename(struct content *c,
 			free(oldfile);
 	}
 
+	search_index_invalidate(html);
+
 	/* Redraw box. */
 	html__redraw_a_box(html, file_box);		
 }
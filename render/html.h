@@ -191,6 +191,21 @@ void html_set_file_gadget_filename(struct hlcache_handle *hl,
 struct html_stylesheet *html_get_stylesheets(struct hlcache_handle *h,
 		unsigned int *n);
 
+/**
+ * Start fetching the user agent stylesheets shared by all HTML documents
+ *
+ * The stylesheets are kept until html_css_fini_ua_stylesheets() is called,
+ * so documents may use them without fetching them.
+ */
+void html_css_init_ua_stylesheets(void);
+
+/**
+ * Release the user agent stylesheets shared by all HTML documents
+ *
+ * This must be called before the high-level cache is finalised.
+ */
+void html_css_fini_ua_stylesheets(void);
+
 struct content_html_object *html_get_objects(struct hlcache_handle *h,
 		unsigned int *n);
 bool html_get_id_offset(struct hlcache_handle *h, lwc_string *frag_id,
@@ -40,6 +40,11 @@ static nsurl *html_adblock_stylesheet_url;
 static nsurl *html_quirks_stylesheet_url;
 static nsurl *html_user_stylesheet_url;
 
+/** User agent stylesheets, fetched once and shared by all documents.
+ * Stylesheets parse differently in quirks mode, so there is a set for
+ * each mode, indexed by the document's quirks flag. */
+static hlcache_handle *html_ua_stylesheets[2][STYLESHEET_START];
+
 static nserror css_error_to_nserror(css_error error)
 {
 	switch (error) {
@@ -477,39 +482,156 @@ nserror html_css_free_stylesheets(html_content *html)
 	return NSERROR_OK;
 }
 
-/* exported interface documented in render/html_internal.h */
-nserror html_css_quirks_stylesheets(html_content *c)
+/**
+ * Callback for user agent stylesheet fetches.
+ */
+static nserror
+html_css_ua_callback(hlcache_handle *css,
+		const hlcache_event *event,
+		void *pw)
 {
-	nserror ns_error = NSERROR_OK;
-	hlcache_child_context child;
+	hlcache_handle **slot = pw;
 
-	assert(c->stylesheets != NULL);
+	assert(*slot == css);
 
-	if (c->quirks == DOM_DOCUMENT_QUIRKS_MODE_FULL) {
-		child.charset = c->encoding;
-		child.quirks = c->base.quirks;
+	if (event->type == CONTENT_MSG_ERROR) {
+		LOG(("stylesheet %s failed: %s",
+				nsurl_access(hlcache_handle_get_url(css)),
+				event->data.error));
+		/* Documents fetch their own copy until this is retried */
+		hlcache_handle_release(css);
+		*slot = NULL;
+	}
 
-		ns_error = hlcache_handle_retrieve(html_quirks_stylesheet_url,
-				0, content_get_url(&c->base), NULL,
-				html_convert_css_callback, c, &child,
-				CONTENT_CSS,
-				&c->stylesheets[STYLESHEET_QUIRKS].sheet);
-		if (ns_error != NSERROR_OK) {
-			return ns_error;
+	return NSERROR_OK;
+}
+
+/**
+ * Get the URL of a user agent stylesheet
+ *
+ * \param i  Stylesheet slot, less than STYLESHEET_START
+ * \return URL of stylesheet
+ */
+static nsurl *html_css_ua_url(unsigned int i)
+{
+	switch (i) {
+	case STYLESHEET_BASE:
+		return html_default_stylesheet_url;
+	case STYLESHEET_QUIRKS:
+		return html_quirks_stylesheet_url;
+	case STYLESHEET_ADBLOCK:
+		return html_adblock_stylesheet_url;
+	default:
+		return html_user_stylesheet_url;
+	}
+}
+
+/**
+ * Get a user agent stylesheet, starting its fetch if required
+ *
+ * \param i       Stylesheet slot, less than STYLESHEET_START
+ * \param quirks  Whether the stylesheet is for a quirks mode document
+ * \return Stylesheet, or NULL if it has not finished loading
+ *
+ * The stylesheet is kept for the life of the browser, so documents may
+ * use it without fetching it.  Until it is available, documents fetch
+ * it themselves and share the content being loaded here.
+ */
+static css_stylesheet *html_css_ua_stylesheet(unsigned int i, bool quirks)
+{
+	hlcache_handle **slot = &html_ua_stylesheets[quirks ? 1 : 0][i];
+	hlcache_child_context child;
+	nserror error;
+
+	if (*slot == NULL) {
+		child.charset = NULL;
+		child.quirks = quirks;
+
+		error = hlcache_handle_retrieve(html_css_ua_url(i), 0,
+				NULL, NULL, html_css_ua_callback,
+				slot, &child, CONTENT_CSS, slot);
+		if (error != NSERROR_OK) {
+			*slot = NULL;
+			return NULL;
 		}
+	}
+
+	/* The fetch may have failed immediately */
+	if (*slot == NULL ||
+			content_get_status(*slot) != CONTENT_STATUS_DONE)
+		return NULL;
 
-		c->base.active++;
-		LOG(("%d fetches active", c->base.active));
+	return nscss_get_stylesheet(*slot);
+}
+
+/**
+ * Determine whether a user agent stylesheet applies to a document
+ *
+ * \param c  Content to consider
+ * \param i  Stylesheet slot, less than STYLESHEET_START
+ * \return true if the stylesheet is used
+ */
+static bool html_css_ua_applies(html_content *c, unsigned int i)
+{
+	switch (i) {
+	case STYLESHEET_QUIRKS:
+		return c->quirks == DOM_DOCUMENT_QUIRKS_MODE_FULL;
+	case STYLESHEET_ADBLOCK:
+		return nsoption_bool(block_advertisements);
+	default:
+		return true;
 	}
+}
+
+/**
+ * Fetch a user agent stylesheet for a document
+ *
+ * \param c  Content to fetch stylesheet for
+ * \param i  Stylesheet slot, less than STYLESHEET_START
+ * \return NSERROR_OK on success, appropriate error otherwise
+ *
+ * Nothing is fetched if the shared stylesheet is already available.
+ */
+static nserror html_css_ua_fetch(html_content *c, unsigned int i)
+{
+	hlcache_child_context child;
+	nserror ns_error;
 
-	return ns_error;
+	if (html_css_ua_stylesheet(i, c->base.quirks) != NULL)
+		return NSERROR_OK;
+
+	child.charset = c->encoding;
+	child.quirks = c->base.quirks;
+
+	ns_error = hlcache_handle_retrieve(html_css_ua_url(i), 0,
+			content_get_url(&c->base), NULL,
+			html_convert_css_callback, c, &child, CONTENT_CSS,
+			&c->stylesheets[i].sheet);
+	if (ns_error != NSERROR_OK) {
+		return ns_error;
+	}
+
+	c->base.active++;
+	LOG(("%d fetches active", c->base.active));
+
+	return NSERROR_OK;
+}
+
+/* exported interface documented in render/html_internal.h */
+nserror html_css_quirks_stylesheets(html_content *c)
+{
+	assert(c->stylesheets != NULL);
+
+	if (html_css_ua_applies(c, STYLESHEET_QUIRKS) == false)
+		return NSERROR_OK;
+
+	return html_css_ua_fetch(c, STYLESHEET_QUIRKS);
 }
 
 /* exported interface documented in render/html_internal.h */
 nserror html_css_new_stylesheets(html_content *c)
 {
 	nserror ns_error;
-	hlcache_child_context child;
 
 	if (c->stylesheets != NULL) {
 		return NSERROR_OK; /* already initialised */
@@ -531,48 +653,19 @@ nserror html_css_new_stylesheets(html_content *c)
 	c->stylesheets[STYLESHEET_USER].sheet = NULL;
 	c->stylesheet_count = STYLESHEET_START;
 
-	child.charset = c->encoding;
-	child.quirks = c->base.quirks;
-
-	ns_error = hlcache_handle_retrieve(html_default_stylesheet_url, 0,
-			content_get_url(&c->base), NULL,
-			html_convert_css_callback, c, &child, CONTENT_CSS,
-			&c->stylesheets[STYLESHEET_BASE].sheet);
+	ns_error = html_css_ua_fetch(c, STYLESHEET_BASE);
 	if (ns_error != NSERROR_OK) {
 		return ns_error;
 	}
 
-	c->base.active++;
-	LOG(("%d fetches active", c->base.active));
-
-
-	if (nsoption_bool(block_advertisements)) {
-		ns_error = hlcache_handle_retrieve(html_adblock_stylesheet_url,
-				0, content_get_url(&c->base), NULL,
-				html_convert_css_callback,
-				c, &child, CONTENT_CSS,
-				&c->stylesheets[STYLESHEET_ADBLOCK].sheet);
+	if (html_css_ua_applies(c, STYLESHEET_ADBLOCK)) {
+		ns_error = html_css_ua_fetch(c, STYLESHEET_ADBLOCK);
 		if (ns_error != NSERROR_OK) {
 			return ns_error;
 		}
-
-		c->base.active++;
-		LOG(("%d fetches active", c->base.active));
-
 	}
 
-	ns_error = hlcache_handle_retrieve(html_user_stylesheet_url, 0,
-			content_get_url(&c->base), NULL,
-			html_convert_css_callback, c, &child, CONTENT_CSS,
-			&c->stylesheets[STYLESHEET_USER].sheet);
-	if (ns_error != NSERROR_OK) {
-		return ns_error;
-	}
-
-	c->base.active++;
-	LOG(("%d fetches active", c->base.active));
-
-	return ns_error;
+	return html_css_ua_fetch(c, STYLESHEET_USER);
 }
 
 nserror
@@ -583,7 +676,9 @@ html_css_new_selection_context(html_content *c, css_select_ctx **ret_select_ctx)
 	css_select_ctx *select_ctx;
 
 	/* check that the base stylesheet loaded; layout fails without it */
-	if (c->stylesheets[STYLESHEET_BASE].sheet == NULL) {
+	if (c->stylesheets[STYLESHEET_BASE].sheet == NULL &&
+			html_css_ua_stylesheet(STYLESHEET_BASE,
+					c->base.quirks) == NULL) {
 		return NSERROR_CSS_BASE;
 	}
 
@@ -607,6 +702,10 @@ html_css_new_selection_context(html_content *c, css_select_ctx **ret_select_ctx)
 
 		if (hsheet->sheet != NULL) {
 			sheet = nscss_get_stylesheet(hsheet->sheet);
+		} else if (i < STYLESHEET_START &&
+				html_css_ua_applies(c, i)) {
+			/* Document is using the shared stylesheet */
+			sheet = html_css_ua_stylesheet(i, c->base.quirks);
 		}
 
 		if (sheet != NULL) {
@@ -653,6 +752,40 @@ nserror html_css_init(void)
 	return error;
 }
 
+/* exported interface documented in render/html.h */
+void html_css_init_ua_stylesheets(void)
+{
+	unsigned int i;
+
+	/* Most documents are in standards mode; the quirks mode set is
+	 * fetched when the first quirks mode document needs it */
+	for (i = STYLESHEET_BASE; i != STYLESHEET_START; i++) {
+		if (i == STYLESHEET_QUIRKS)
+			continue;
+
+		if (i != STYLESHEET_ADBLOCK ||
+				nsoption_bool(block_advertisements))
+			html_css_ua_stylesheet(i, false);
+	}
+}
+
+/* exported interface documented in render/html.h */
+void html_css_fini_ua_stylesheets(void)
+{
+	unsigned int i, mode;
+
+	for (mode = 0; mode != 2; mode++) {
+		for (i = STYLESHEET_BASE; i != STYLESHEET_START; i++) {
+			hlcache_handle **slot = &html_ua_stylesheets[mode][i];
+
+			if (*slot != NULL) {
+				hlcache_handle_release(*slot);
+				*slot = NULL;
+			}
+		}
+	}
+}
+
 void html_css_fini(void)
 {
 	if (html_user_stylesheet_url != NULL) {
@@ -170,6 +170,20 @@ typedef struct html_content {
 	struct search_context *search;
 	/** Search string or NULL */
 	char *search_string;
+	/** Flattened text of the box tree for searching, or NULL */
+	struct search_index *search_index;
+
+	/** Parse is paused waiting for a synchronous script */
+	bool parse_blocked;
+	/** Speculative fetches found while the parse was blocked */
+	struct html_preload *preloads;
+	/** Number of entries in preloads */
+	unsigned int preload_count;
+	/** Offset in source data the preload scanner has reached */
+	unsigned long preload_offset;
+	/** Offset in source data of the last chunk given to the parser
+	 * while it was not blocked, which it has consumed at least */
+	unsigned long parse_offset;
 
 } html_content;
 
@@ -265,6 +279,22 @@ dom_hubbub_error  html_process_script(void *ctx, dom_node *node);
 void html_free_scripts(html_content *html);
 bool html_scripts_exec(html_content *c);
 
+/* in render/html_preload.c */
+
+/**
+ * Start speculative fetches for resources in the unparsed source
+ *
+ * \param c  content whose parse is blocked
+ */
+void html_preload_scan(html_content *c);
+
+/**
+ * Release speculative fetches once the document has requested its resources
+ *
+ * \param c  content to release fetches for
+ */
+void html_preload_free(html_content *c);
+
 /* in render/html_forms.c */
 struct form *html_forms_get_forms(const char *docenc, dom_html_document *doc);
 struct form_control *html_forms_get_control_for_node(struct form *forms,
@@ -0,0 +1,490 @@
+/*
+ * Copyright 2013 The NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Speculative fetching of html subresources (implementation).
+ *
+ * While the parser is paused waiting for a synchronous script, the source
+ * received so far is scanned for stylesheets, scripts and images so their
+ * fetches overlap with the script's.  The scanner is a simple tokeniser
+ * rather than a parser; a wrong guess only costs a wasted fetch, as the
+ * document still requests everything it needs when it is parsed.  The
+ * fetches are shared with those later requests through the cache.  URLs
+ * the document has already requested are not fetched again.
+ */
+
+#include <assert.h>
+#include <ctype.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+
+#include "utils/corestrings.h"
+#include "utils/log.h"
+#include "content/content_protected.h"
+#include "content/hlcache.h"
+#include "render/html_internal.h"
+
+/** Maximum number of speculative fetches for a document */
+#define HTML_PRELOAD_MAX 32
+
+/** Maximum length of a speculatively fetched URL */
+#define HTML_PRELOAD_URL_MAX 2048
+
+/** A speculative fetch */
+struct html_preload {
+	struct html_preload *next;	/**< Next in list */
+	nsurl *url;			/**< URL fetched */
+	hlcache_handle *handle;		/**< Handle for fetch */
+};
+
+/** Attribute value found by the scanner */
+struct html_preload_attr {
+	const char *data;	/**< Value, in source data, or NULL if absent */
+	size_t len;		/**< Length of value */
+};
+
+
+/**
+ * Callback for speculative fetches.
+ *
+ * Nothing is done with the contents; they are held until the document
+ * takes them over by requesting the same URLs.
+ */
+static nserror
+html_preload_callback(hlcache_handle *handle,
+		const hlcache_event *event,
+		void *pw)
+{
+	return NSERROR_OK;
+}
+
+
+/**
+ * Compare a name in the source data with a lower case string
+ *
+ * \param name  Name in source data
+ * \param len   Length of name
+ * \param s     String to compare with
+ * \return true if the name matches ignoring case
+ */
+static bool html_preload_name_is(const char *name, size_t len, const char *s)
+{
+	return strlen(s) == len && strncasecmp(name, s, len) == 0;
+}
+
+
+/**
+ * Find a string in source data, ignoring case
+ *
+ * \param p    Start of data to search
+ * \param end  End of data
+ * \param s    String to find
+ * \return position of string, or NULL if not present
+ */
+static const char *
+html_preload_find(const char *p, const char *end, const char *s)
+{
+	size_t len = strlen(s);
+
+	for (; end - p >= (ptrdiff_t) len; p++) {
+		if (strncasecmp(p, s, len) == 0)
+			return p;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Determine if a link relation names a stylesheet to be applied
+ *
+ * \param rel  Value of rel attribute
+ * \return true for a persistent or preferred stylesheet
+ */
+static bool html_preload_rel_stylesheet(const struct html_preload_attr *rel)
+{
+	const char *p = rel->data;
+	const char *end = rel->data + rel->len;
+	bool stylesheet = false;
+
+	if (rel->data == NULL)
+		return false;
+
+	while (p < end) {
+		const char *token;
+
+		while (p < end && isspace((unsigned char) *p))
+			p++;
+		token = p;
+		while (p < end && !isspace((unsigned char) *p))
+			p++;
+
+		if (html_preload_name_is(token, p - token, "stylesheet"))
+			stylesheet = true;
+		else if (html_preload_name_is(token, p - token, "alternate"))
+			return false;
+	}
+
+	return stylesheet;
+}
+
+
+/**
+ * Determine if the document has already requested a URL
+ *
+ * \param c    Content to check
+ * \param url  URL to look for
+ * \return true if a script, stylesheet or object of the document is
+ *         being fetched from url
+ *
+ * The parser resumes at the start of the chunk it was blocked in, so the
+ * scanner sees elements the parser has already processed, including the
+ * blocking script itself.
+ */
+static bool html_preload_requested(html_content *c, nsurl *url)
+{
+	struct content_html_object *object;
+	unsigned int i;
+
+	for (i = 0; i != c->scripts_count; i++) {
+		if (c->scripts[i].type != HTML_SCRIPT_INLINE &&
+				c->scripts[i].data.handle != NULL &&
+				nsurl_compare(url, hlcache_handle_get_url(
+				c->scripts[i].data.handle), NSURL_COMPLETE))
+			return true;
+	}
+
+	for (i = 0; i != c->stylesheet_count; i++) {
+		if (c->stylesheets[i].sheet != NULL &&
+				nsurl_compare(url, hlcache_handle_get_url(
+				c->stylesheets[i].sheet), NSURL_COMPLETE))
+			return true;
+	}
+
+	for (object = c->object_list; object != NULL; object = object->next) {
+		if (object->content != NULL &&
+				nsurl_compare(url, hlcache_handle_get_url(
+				object->content), NSURL_COMPLETE))
+			return true;
+	}
+
+	return false;
+}
+
+
+/**
+ * Start a speculative fetch
+ *
+ * \param c      Content to fetch for
+ * \param value  URL attribute value from source data
+ * \param type   Type of content expected
+ */
+static void html_preload_fetch(html_content *c,
+		const struct html_preload_attr *value, content_type type)
+{
+	char buf[HTML_PRELOAD_URL_MAX];
+	size_t i, len = 0;
+	hlcache_child_context child;
+	struct html_preload *preload;
+	lwc_string *scheme;
+	nsurl *url;
+	bool match;
+	nserror error;
+
+	if (value->data == NULL || c->preload_count >= HTML_PRELOAD_MAX)
+		return;
+
+	for (i = 0; i < value->len; i++) {
+		if (len == sizeof(buf) - 1)
+			return;
+
+		buf[len++] = value->data[i];
+
+		if (value->data[i] == '&') {
+			/* Leave character references other than &amp; to
+			 * the parser */
+			if (value->len - i < 5 ||
+					strncmp(value->data + i, "&amp;", 5) != 0)
+				return;
+			i += 4;
+		}
+	}
+	buf[len] = '\0';
+
+	if (len == 0)
+		return;
+
+	error = nsurl_join(c->base_url, buf, &url);
+	if (error != NSERROR_OK)
+		return;
+
+	/* Only network fetches are worth starting early */
+	scheme = nsurl_get_component(url, NSURL_SCHEME);
+	if (scheme == NULL) {
+		nsurl_unref(url);
+		return;
+	}
+	if ((lwc_string_isequal(scheme, corestring_lwc_http,
+			&match) != lwc_error_ok || match == false) &&
+			(lwc_string_isequal(scheme, corestring_lwc_https,
+			&match) != lwc_error_ok || match == false)) {
+		lwc_string_unref(scheme);
+		nsurl_unref(url);
+		return;
+	}
+	lwc_string_unref(scheme);
+
+	for (preload = c->preloads; preload != NULL; preload = preload->next) {
+		if (nsurl_compare(url, preload->url, NSURL_COMPLETE)) {
+			nsurl_unref(url);
+			return;
+		}
+	}
+
+	if (html_preload_requested(c, url)) {
+		nsurl_unref(url);
+		return;
+	}
+
+	preload = malloc(sizeof(struct html_preload));
+	if (preload == NULL) {
+		nsurl_unref(url);
+		return;
+	}
+
+	child.charset = c->encoding;
+	child.quirks = c->base.quirks;
+
+	error = hlcache_handle_retrieve(url,
+			(type == CONTENT_IMAGE) ? HLCACHE_RETRIEVE_SNIFF_TYPE : 0,
+			content_get_url(&c->base), NULL,
+			html_preload_callback, c, &child, type,
+			&preload->handle);
+	if (error != NSERROR_OK) {
+		free(preload);
+		nsurl_unref(url);
+		return;
+	}
+
+	LOG(("preload %d '%s'", c->preload_count, nsurl_access(url)));
+
+	preload->url = url;
+	preload->next = c->preloads;
+	c->preloads = preload;
+	c->preload_count++;
+}
+
+
+/**
+ * Scan a tag in the source data
+ *
+ * \param c    Content being scanned
+ * \param p    Position of '<' starting the tag
+ * \param end  End of source data
+ * \return position to continue scanning from, or NULL if the tag, or the
+ *         raw text following it, is incomplete
+ */
+static const char *
+html_preload_tag(html_content *c, const char *p, const char *end)
+{
+	struct html_preload_attr src = { NULL, 0 };
+	struct html_preload_attr href = { NULL, 0 };
+	struct html_preload_attr rel = { NULL, 0 };
+	const char *name;
+	size_t name_len;
+	bool closed = false;
+
+	p++;
+
+	if (end - p < 3 && memcmp(p, "!--", end - p) == 0) {
+		/* Possible comment start */
+		return NULL;
+	}
+
+	if (end - p >= 3 && memcmp(p, "!--", 3) == 0) {
+		/* Comment */
+		p = html_preload_find(p + 3, end, "-->");
+		return (p != NULL) ? p + 3 : NULL;
+	}
+
+	name = p;
+	while (p < end && isalnum((unsigned char) *p))
+		p++;
+	name_len = p - name;
+
+	if (name_len == 0) {
+		/* End tag, doctype, or stray '<' */
+		return p;
+	}
+
+	/* Attributes */
+	while (p < end) {
+		struct html_preload_attr value = { NULL, 0 };
+		const char *attr;
+
+		while (p < end && (isspace((unsigned char) *p) || *p == '/'))
+			p++;
+		if (p == end)
+			break;
+		if (*p == '>') {
+			closed = true;
+			p++;
+			break;
+		}
+
+		attr = p;
+		while (p < end && !isspace((unsigned char) *p) &&
+				*p != '=' && *p != '>' && *p != '/')
+			p++;
+		if (p == attr) {
+			/* Stray '=' */
+			p++;
+			continue;
+		}
+
+		value.len = p - attr;
+		while (p < end && isspace((unsigned char) *p))
+			p++;
+		if (p < end && *p == '=') {
+			size_t attr_len = value.len;
+
+			p++;
+			while (p < end && isspace((unsigned char) *p))
+				p++;
+			if (p == end)
+				break;
+
+			if (*p == '"' || *p == '\'') {
+				const char *q = memchr(p + 1, *p, end - p - 1);
+				if (q == NULL)
+					break;
+				value.data = p + 1;
+				value.len = q - value.data;
+				p = q + 1;
+			} else {
+				value.data = p;
+				while (p < end && !isspace((unsigned char) *p)
+						&& *p != '>')
+					p++;
+				value.len = p - value.data;
+			}
+
+			if (html_preload_name_is(attr, attr_len, "src"))
+				src = value;
+			else if (html_preload_name_is(attr, attr_len, "href"))
+				href = value;
+			else if (html_preload_name_is(attr, attr_len, "rel"))
+				rel = value;
+		}
+	}
+
+	if (closed == false)
+		return NULL;
+
+	if (html_preload_name_is(name, name_len, "img")) {
+		html_preload_fetch(c, &src, CONTENT_IMAGE);
+
+	} else if (html_preload_name_is(name, name_len, "link")) {
+		if (html_preload_rel_stylesheet(&rel))
+			html_preload_fetch(c, &href, CONTENT_CSS);
+
+	} else if (html_preload_name_is(name, name_len, "script")) {
+		html_preload_fetch(c, &src, CONTENT_SCRIPT);
+
+		/* Skip script text */
+		p = html_preload_find(p, end, "</script");
+
+	} else if (html_preload_name_is(name, name_len, "style")) {
+		/* Skip style sheet text */
+		p = html_preload_find(p, end, "</style");
+	}
+
+	return p;
+}
+
+
+/* exported interface documented in render/html_internal.h */
+void html_preload_scan(html_content *c)
+{
+	const char *data;
+	const char *p;
+	const char *end;
+	unsigned long size;
+
+	/* The scanner only understands ASCII compatible encodings */
+	if (c->encoding != NULL &&
+			(strncasecmp(c->encoding, "UTF-16", 6) == 0 ||
+			strncasecmp(c->encoding, "UTF-32", 6) == 0))
+		return;
+
+	/* Start where the parser has got to, unless that has already been
+	 * scanned */
+	if (c->preload_offset < c->parse_offset)
+		c->preload_offset = c->parse_offset;
+
+	data = content__get_source_data(&c->base, &size);
+	if (data == NULL || c->preload_offset >= size)
+		return;
+
+	p = data + c->preload_offset;
+	end = data + size;
+
+	while (c->preload_count < HTML_PRELOAD_MAX) {
+		const char *tag = memchr(p, '<', end - p);
+		const char *next;
+
+		if (tag == NULL) {
+			p = end;
+			break;
+		}
+
+		next = html_preload_tag(c, tag, end);
+		if (next == NULL) {
+			/* Scan incomplete tag again when there is more data */
+			p = tag;
+			break;
+		}
+
+		p = next;
+	}
+
+	c->preload_offset = p - data;
+}
+
+
+/* exported interface documented in render/html_internal.h */
+void html_preload_free(html_content *c)
+{
+	struct html_preload *preload;
+	struct html_preload *next;
+
+	for (preload = c->preloads; preload != NULL; preload = next) {
+		next = preload->next;
+
+		hlcache_handle_release(preload->handle);
+		nsurl_unref(preload->url);
+		free(preload);
+	}
+
+	c->preloads = NULL;
+	c->preload_count = 0;
+}
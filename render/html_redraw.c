@@ -51,6 +51,7 @@
 #include "render/search.h"
 #include "utils/log.h"
 #include "utils/messages.h"
+#include "utils/timing.h"
 #include "utils/utils.h"
 
 
@@ -2499,6 +2500,7 @@ bool html_redraw(struct content *c, struct content_redraw_data *data,
 		.fill_type = PLOT_OP_TYPE_SOLID,
 		.fill_colour = data->background_colour,
 	};
+	uint64_t start = timing_start();
 
 	box = html->layout;
 	assert(box);
@@ -2545,6 +2547,8 @@ bool html_redraw(struct content *c, struct content_redraw_data *data,
 				data->scale, clip, ctx);
 	}
 
+	timing_record(TIMING_REDRAW, start, content_get_url(c));
+
 	return result;
 
 }
@@ -38,7 +38,7 @@
 #include "content/hlcache.h"
 #include "render/html_internal.h"
 
-typedef bool (script_handler_t)(struct jscontext *jscontext, const char *data, size_t size) ;
+typedef bool (script_handler_t)(struct jscontext *jscontext, const char *data, size_t size, const char *name) ;
 
 
 static script_handler_t *select_script_handler(content_type ctype)
@@ -94,7 +94,9 @@ bool html_scripts_exec(html_content *c)
 				unsigned long size;
 				data = content_get_source_data(
 						s->data.handle, &size );
-				script_handler(c->jscontext, data, size);
+				script_handler(c->jscontext, data, size,
+						nsurl_access(hlcache_handle_get_url(
+						s->data.handle)));
 
 				s->already_started = true;
 
@@ -287,10 +289,13 @@ convert_script_sync_cb(hlcache_handle *script,
 			const char *data;
 			unsigned long size;
 			data = content_get_source_data(s->data.handle, &size );
-			script_handler(parent->jscontext, data, size);
+			script_handler(parent->jscontext, data, size,
+					nsurl_access(hlcache_handle_get_url(
+					s->data.handle)));
 		}
 
 		/* continue parse */
+		parent->parse_blocked = false;
 		err = dom_hubbub_parser_pause(parent->parser, false);
 		if (err != DOM_HUBBUB_OK) {
 			LOG(("unpause returned 0x%x", err));
@@ -313,6 +318,7 @@ convert_script_sync_cb(hlcache_handle *script,
 		s->already_started = true;
 
 		/* continue parse */
+		parent->parse_blocked = false;
 		err = dom_hubbub_parser_pause(parent->parser, false);
 		if (err != DOM_HUBBUB_OK) {
 			LOG(("unpause returned 0x%x", err));
@@ -452,6 +458,12 @@ exec_src_script(html_content *c,
 		case HTML_SCRIPT_SYNC:
 			ret =  DOM_HUBBUB_HUBBUB_ERR | HUBBUB_PAUSED;
 
+			/* start fetches for what follows while the
+			 * parse waits for the script */
+			c->parse_blocked = true;
+			html_preload_scan(c);
+			break;
+
 		case HTML_SCRIPT_ASYNC:
 			break;
 
@@ -503,7 +515,8 @@ exec_inline_script(html_content *c, dom_node *node, dom_string *mimetype)
 	if (script_handler != NULL) {
 		script_handler(c->jscontext,
 			       dom_string_data(script),
-			       dom_string_byte_length(script));
+			       dom_string_byte_length(script),
+			       NULL);
 	}
 	return DOM_HUBBUB_OK;
 }
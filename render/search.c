@@ -61,6 +61,37 @@ struct list_entry {
 	struct list_entry *next;
 };
 
+/** Text of a box, within a search index */
+struct search_index_entry {
+	struct box *box;	/**< Box containing text */
+	size_t offset;		/**< Offset of box's text within index */
+};
+
+/**
+ * Flattened text of an HTML document's box tree
+ *
+ * Box texts are concatenated in tree order, each followed by a NUL, so
+ * that a search for a string without wildcards may be made over the
+ * whole document at once and can never match across boxes. The
+ * occurrences of the last such string are kept, so that when a search
+ * string is extended, as it is while being typed, only they need be
+ * checked.
+ */
+struct search_index {
+	char *text;		/**< Concatenated box texts */
+	char *folded;		/**< Upper case text, or NULL if not made */
+	size_t length;		/**< Length of text */
+
+	struct search_index_entry *entries;	/**< Boxes, in text order */
+	unsigned int entry_count;	/**< Number of entries */
+
+	char *pattern;		/**< Last string searched for, or NULL */
+	size_t p_len;		/**< Length of pattern */
+	bool case_sens;		/**< Case sensitivity of last search */
+	size_t *occurrences;	/**< All occurrences of pattern */
+	unsigned int occurrence_count;	/**< Number of occurrences */
+};
+
 struct search_context {
 	struct gui_search_callbacks *gui;
 	void *gui_p;
@@ -368,6 +399,279 @@ static bool find_occurrences_html(const char *pattern, int p_len,
 }
 
 
+/**
+ * Count the text boxes in a box tree, and the length of their text
+ *
+ * \param cur	  box tree to count
+ * \param count	  incremented by the number of boxes with text
+ * \param length  incremented by the length of the boxes' text
+ */
+static void search_index_measure(struct box *cur, unsigned int *count,
+		size_t *length)
+{
+	struct box *a;
+
+	if (!cur->object && cur->text) {
+		(*count)++;
+		*length += cur->length + 1;
+	}
+
+	for (a = cur->children; a; a = a->next)
+		search_index_measure(a, count, length);
+}
+
+
+/**
+ * Add the text boxes in a box tree to a search index
+ *
+ * \param cur	box tree to add
+ * \param index	index with sufficient space
+ */
+static void search_index_fill(struct box *cur, struct search_index *index)
+{
+	struct box *a;
+
+	if (!cur->object && cur->text) {
+		struct search_index_entry *entry =
+				&index->entries[index->entry_count++];
+
+		entry->box = cur;
+		entry->offset = index->length;
+
+		memcpy(index->text + index->length, cur->text, cur->length);
+		index->length += cur->length;
+		index->text[index->length++] = '\0';
+	}
+
+	for (a = cur->children; a; a = a->next)
+		search_index_fill(a, index);
+}
+
+
+/**
+ * Build the search index of a box tree
+ *
+ * \param layout  root of box tree
+ * \return new index, or NULL on memory exhaustion
+ */
+static struct search_index *search_index_create(struct box *layout)
+{
+	struct search_index *index;
+	unsigned int count = 0;
+	size_t length = 0;
+
+	search_index_measure(layout, &count, &length);
+
+	index = calloc(1, sizeof(*index));
+	if (index == NULL)
+		return NULL;
+
+	index->text = malloc(length + 1);
+	index->entries = malloc((count + 1) * sizeof(*index->entries));
+	if (index->text == NULL || index->entries == NULL) {
+		search_index_destroy(index);
+		return NULL;
+	}
+
+	search_index_fill(layout, index);
+
+	return index;
+}
+
+
+/* Exported function documented in search.h */
+void search_index_destroy(struct search_index *index)
+{
+	if (index == NULL)
+		return;
+
+	free(index->text);
+	free(index->folded);
+	free(index->entries);
+	free(index->pattern);
+	free(index->occurrences);
+	free(index);
+}
+
+
+/* Exported function documented in search.h */
+void search_index_invalidate(struct html_content *html)
+{
+	search_index_destroy(html->search_index);
+	html->search_index = NULL;
+}
+
+
+/**
+ * Find every occurrence of a string, using Boyer-Moore-Horspool
+ *
+ * \param text	     text to search
+ * \param length     length of text
+ * \param pattern    string to find, with no wildcards
+ * \param p_len      length of string
+ * \param positions  updated to array of match offsets, on heap
+ * \param count	     updated to number of matches
+ * \return true on success, false on memory exhaustion
+ *
+ * Overlapping occurrences are all reported.
+ */
+static bool search_index_scan(const char *text, size_t length,
+		const char *pattern, size_t p_len,
+		size_t **positions, unsigned int *count)
+{
+	const unsigned char *t = (const unsigned char *) text;
+	const unsigned char *p = (const unsigned char *) pattern;
+	size_t skip[256];
+	size_t *found = NULL;
+	unsigned int n = 0, alloc = 0;
+	size_t i;
+
+	for (i = 0; i != 256; i++)
+		skip[i] = p_len;
+	for (i = 0; i + 1 < p_len; i++)
+		skip[p[i]] = p_len - 1 - i;
+
+	for (i = 0; i + p_len <= length; i += skip[t[i + p_len - 1]]) {
+		if (t[i + p_len - 1] != p[p_len - 1] ||
+				memcmp(t + i, p, p_len - 1) != 0)
+			continue;
+
+		if (n == alloc) {
+			size_t *temp;
+
+			alloc = alloc ? alloc * 2 : 64;
+			temp = realloc(found, alloc * sizeof(*found));
+			if (temp == NULL) {
+				free(found);
+				return false;
+			}
+			found = temp;
+		}
+
+		found[n++] = i;
+	}
+
+	*positions = found;
+	*count = n;
+
+	return true;
+}
+
+
+/**
+ * Find all occurrences of a string without wildcards using a search index
+ *
+ * \param pattern   the string to search for
+ * \param p_len     pattern length
+ * \param index     the document's search index
+ * \param case_sens whether to perform a case sensitive search
+ * \return true on success, false on memory allocation failure
+ */
+static bool find_occurrences_index(const char *pattern, size_t p_len,
+		struct search_index *index, bool case_sens,
+		struct search_context *context)
+{
+	const char *text;
+	char *folded_pattern;
+	size_t *occurrences;
+	unsigned int count, i, entry = 0;
+	size_t end = 0;
+
+	if (!case_sens && index->folded == NULL) {
+		index->folded = malloc(index->length + 1);
+		if (index->folded == NULL)
+			return false;
+
+		for (i = 0; i != index->length; i++)
+			index->folded[i] = toupper(index->text[i]);
+	}
+
+	text = case_sens ? index->text : index->folded;
+
+	folded_pattern = malloc(p_len + 1);
+	if (folded_pattern == NULL)
+		return false;
+
+	for (i = 0; i != p_len; i++)
+		folded_pattern[i] = case_sens ? pattern[i] : toupper(pattern[i]);
+	folded_pattern[p_len] = '\0';
+
+	if (index->pattern != NULL && index->case_sens == case_sens &&
+			index->p_len <= p_len &&
+			memcmp(index->pattern, folded_pattern,
+				index->p_len) == 0) {
+		/* Extension of the last pattern; it can only occur where
+		 * that did */
+		occurrences = index->occurrences;
+		count = 0;
+
+		for (i = 0; i != index->occurrence_count; i++) {
+			size_t pos = occurrences[i];
+
+			if (pos + p_len <= index->length &&
+					memcmp(text + pos, folded_pattern,
+						p_len) == 0)
+				occurrences[count++] = pos;
+		}
+	} else {
+		if (!search_index_scan(text, index->length,
+				folded_pattern, p_len, &occurrences, &count)) {
+			free(folded_pattern);
+			return false;
+		}
+
+		free(index->occurrences);
+	}
+
+	free(index->pattern);
+	index->pattern = folded_pattern;
+	index->p_len = p_len;
+	index->case_sens = case_sens;
+	index->occurrences = occurrences;
+	index->occurrence_count = count;
+
+	/* Report leftmost non-overlapping matches, as find_pattern does */
+	for (i = 0; i != count; i++) {
+		struct list_entry *match;
+		struct box *box;
+		size_t pos = occurrences[i];
+		unsigned int lo, hi;
+
+		if (pos < end)
+			continue;
+
+		/* Find the box containing the match; the entries are
+		 * searched forwards from that of the previous match */
+		lo = entry;
+		hi = index->entry_count;
+		while (hi - lo > 1) {
+			unsigned int mid = lo + (hi - lo) / 2;
+
+			if (index->entries[mid].offset <= pos)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		entry = lo;
+
+		box = index->entries[entry].box;
+		pos -= index->entries[entry].offset;
+
+		match = add_entry(box->byte_offset + pos,
+				box->byte_offset + pos + p_len, context);
+		if (match == NULL)
+			return false;
+
+		match->start_box = box;
+		match->end_box = box;
+
+		end = occurrences[i] + p_len;
+	}
+
+	return true;
+}
+
+
 /**
  * Finds all occurrences of a given string in a textplain content
  *
@@ -472,8 +776,22 @@ static void search_text(const char *string, int string_len,
 			context->gui->hourglass(true, context->gui_p);
 
 		if (context->is_html == true) {
-			res = find_occurrences_html(string, string_len,
-					box, case_sensitive, context);
+			html_content *html = (html_content *)context->c;
+
+			if (strcspn(string, "*#") < (size_t) string_len) {
+				res = find_occurrences_html(string, string_len,
+						box, case_sensitive, context);
+			} else {
+				if (html->search_index == NULL)
+					html->search_index =
+						search_index_create(box);
+
+				res = (html->search_index != NULL) &&
+					find_occurrences_index(string,
+						string_len,
+						html->search_index,
+						case_sensitive, context);
+			}
 		} else {
 			res = find_occurrences_text(string, string_len,
 					context->c, case_sensitive, context);
@@ -24,7 +24,9 @@
 
 #include "desktop/search.h"
 
+struct html_content;
 struct search_context;
+struct search_index;
 
 /**
  * create a search_context
@@ -78,4 +80,25 @@ bool search_term_highlighted(struct content *c,
 		unsigned *start_idx, unsigned *end_idx,
 		struct search_context *context);
 
+/**
+ * Destroy an HTML document's search index
+ *
+ * The index must be destroyed whenever the document's box tree is laid
+ * out again, and is rebuilt by the next search.
+ *
+ * \param index  index to destroy, or NULL
+ */
+void search_index_destroy(struct search_index *index);
+
+/**
+ * Discard an HTML document's search index after its box text changes
+ *
+ * Anything which alters the text of a box outside of layout, such as a
+ * form control taking a new value, must call this so that the next
+ * search does not find text which is no longer there.
+ *
+ * \param html  document whose index to discard
+ */
+void search_index_invalidate(struct html_content *html);
+
 #endif
@@ -49,6 +49,7 @@
 #include "utils/http.h"
 #include "utils/log.h"
 #include "utils/messages.h"
+#include "utils/textscan.h"
 #include "utils/utils.h"
 #include "utils/utf8.h"
 
@@ -66,8 +67,20 @@ typedef struct textplain_content {
 	size_t utf8_data_size;
 	size_t utf8_data_allocated;
 	unsigned long physical_line_count;
+	unsigned long physical_line_allocated;
 	struct textplain_line *physical_line;
 	int formatted_width;
+	size_t formatted_columns;	/**< Columns of current layout */
+	size_t formatted_size;		/**< Data size of current layout */
+
+	/** Lines of the source, as delimited by newlines. The length of
+	 * the last line is not recorded, as it extends to the end of the
+	 * data indexed so far. */
+	struct textplain_line *logical_line;
+	unsigned long logical_line_count;
+	unsigned long logical_line_allocated;
+	size_t logical_max_length;	/**< Length of longest line */
+	size_t logical_scanned;		/**< Bytes of data indexed */
 	struct browser_window *bw;
 
 	struct selection sel;	/** Selection state */
@@ -134,6 +147,7 @@ static bool textplain_drain_input(textplain_content *c,
 		parserutils_inputstream *stream, parserutils_error terminator);
 static bool textplain_copy_utf8_data(textplain_content *c,
 		const uint8_t *buf, size_t len);
+static bool textplain_index_lines(textplain_content *c, bool eof);
 static int textplain_coord_from_offset(const char *text, size_t offset,
 	size_t length);
 static float textplain_line_height(void);
@@ -287,7 +301,15 @@ nserror textplain_create_internal(textplain_content *c, lwc_string *encoding)
 	c->utf8_data_allocated = CHUNK;
 	c->physical_line = 0;
 	c->physical_line_count = 0;
+	c->physical_line_allocated = 0;
 	c->formatted_width = 0;
+	c->formatted_columns = 0;
+	c->formatted_size = 0;
+	c->logical_line = NULL;
+	c->logical_line_count = 0;
+	c->logical_line_allocated = 0;
+	c->logical_max_length = 0;
+	c->logical_scanned = 0;
 	c->bw = NULL;
 
 	selection_prepare(&c->sel, (struct content *)c, false);
@@ -370,11 +392,14 @@ bool textplain_copy_utf8_data(textplain_content *c,
 		const uint8_t *buf, size_t len)
 {
 	if (c->utf8_data_size + len >= c->utf8_data_allocated) {
-		/* Compute next multiple of chunk above the required space */
+		/* Grow by half as much again, so that large documents are
+		 * not copied once per chunk, and round up to a multiple of
+		 * chunk */
 		size_t allocated; 
 		char *utf8_data; 
 
-		allocated = (c->utf8_data_size + len + CHUNK - 1) & ~(CHUNK - 1);
+		allocated = c->utf8_data_size + len + c->utf8_data_size / 2;
+		allocated = (allocated + CHUNK - 1) & ~(CHUNK - 1);
 		utf8_data = realloc(c->utf8_data, allocated);
 		if (utf8_data == NULL)
 			return false;
@@ -390,6 +415,75 @@ bool textplain_copy_utf8_data(textplain_content *c,
 }
 
 
+/**
+ * Extend the index of logical lines to cover newly converted data
+ *
+ * \param c	Text content
+ * \param eof	No further data will be converted
+ * \return true on success, false on memory exhaustion
+ */
+bool textplain_index_lines(textplain_content *c, bool eof)
+{
+	const char *data = c->utf8_data;
+	size_t size = c->utf8_data_size;
+	size_t i = c->logical_scanned;
+
+	if (c->logical_line_count == 0) {
+		c->logical_line = malloc(sizeof(struct textplain_line) * 1024);
+		if (c->logical_line == NULL)
+			return false;
+
+		c->logical_line_allocated = 1024;
+		c->logical_line[c->logical_line_count++].start = 0;
+	}
+
+	while (i < size) {
+		struct textplain_line *line;
+		size_t next;
+
+		i += textscan_line_end(data + i, size - i);
+		if (i == size)
+			break;
+
+		if (i + 1 == size && !eof) {
+			/* May be the first of a CR/LF or LF/CR pair */
+			break;
+		}
+
+		next = i + 1;
+
+		/* skip second char of CR/LF or LF/CR pair */
+		if (next < size && data[next] != data[i] &&
+				(data[next] == '\n' || data[next] == '\r'))
+			next++;
+
+		if (c->logical_line_count == c->logical_line_allocated) {
+			line = realloc(c->logical_line,
+					sizeof(struct textplain_line) *
+					c->logical_line_allocated * 2);
+			if (line == NULL)
+				return false;
+
+			c->logical_line = line;
+			c->logical_line_allocated *= 2;
+		}
+
+		line = &c->logical_line[c->logical_line_count - 1];
+		line->length = i - line->start;
+		if (line->length > c->logical_max_length)
+			c->logical_max_length = line->length;
+
+		c->logical_line[c->logical_line_count++].start = next;
+
+		i = next;
+	}
+
+	c->logical_scanned = i;
+
+	return true;
+}
+
+
 /**
  * Process data for CONTENT_TEXTPLAIN.
  */
@@ -411,6 +505,9 @@ bool textplain_process_data(struct content *c,
 	if (textplain_drain_input(text, stream, PARSERUTILS_NEEDDATA) == false)
 		goto no_memory;
 
+	if (textplain_index_lines(text, false) == false)
+		goto no_memory;
+
 	return true;
 
 no_memory:
@@ -438,6 +535,9 @@ bool textplain_convert(struct content *c)
 	if (textplain_drain_input(text, stream, PARSERUTILS_EOF) == false)
 		return false;
 
+	if (textplain_index_lines(text, true) == false)
+		return false;
+
 	parserutils_inputstream_destroy(stream);
 	text->inputstream = NULL;
 
@@ -449,22 +549,129 @@ bool textplain_convert(struct content *c)
 }
 
 
+/**
+ * Start a new physical line
+ *
+ * \param text	Text content
+ * \param start	Offset of the start of the line
+ * \return true on success, false on memory exhaustion
+ *
+ * Space is always left for the terminating entry.
+ */
+static bool textplain_add_line(textplain_content *text, size_t start)
+{
+	if (text->physical_line_count + 1 >= text->physical_line_allocated) {
+		unsigned long allocated = text->physical_line_allocated * 2;
+		struct textplain_line *line;
+
+		if (allocated < 1024)
+			allocated = 1024;
+
+		line = realloc(text->physical_line,
+				sizeof(struct textplain_line) * allocated);
+		if (line == NULL)
+			return false;
+
+		text->physical_line = line;
+		text->physical_line_allocated = allocated;
+	}
+
+	text->physical_line[text->physical_line_count++].start = start;
+
+	return true;
+}
+
+
+/**
+ * Break a logical line into physical lines no wider than the display
+ *
+ * \param text	  Text content
+ * \param start	  Offset of the start of the line
+ * \param length  Length of the line, in bytes
+ * \param columns Available columns
+ * \return true on success, false on memory exhaustion
+ *
+ * The first physical line must already have been started. The last
+ * physical line is ended, but no new line is started.
+ */
+static bool textplain_wrap_line(textplain_content *text, size_t start,
+		size_t length, size_t columns)
+{
+	const char *utf8_data = text->utf8_data;
+	size_t end = start + length;
+	size_t line_start = start;
+	size_t i, space = 0, col = 0;
+
+	for (i = start; i < end; i++) {
+		size_t next_col = col + 1;
+
+		if (next_col < columns && utf8_data[i] != '\t' &&
+				utf8_data[i] != ' ') {
+			/* Skip a run of characters which are neither tabs
+			 * nor break opportunities, up to the last that fits */
+			size_t run = textscan_blank(utf8_data + i, end - i);
+			if (run > columns - next_col)
+				run = columns - next_col;
+
+			if (run > 0) {
+				col += run;
+				i += run - 1;
+				continue;
+			}
+
+			/* A lone CR or LF within the line is treated as an
+			 * ordinary character below */
+		}
+
+		if (utf8_data[i] == '\t')
+			next_col = (next_col + TAB_WIDTH - 1) & ~(TAB_WIDTH - 1);
+
+		if (next_col >= columns) {
+			struct textplain_line *line = &text->physical_line[
+					text->physical_line_count - 1];
+
+			if (space) {
+				/* break at last space in line */
+				i = space;
+				line->length = (i + 1) - line_start;
+			} else
+				line->length = i - line_start;
+
+			if (!textplain_add_line(text, i + 1))
+				return false;
+
+			line_start = i + 1;
+			col = 0;
+			space = 0;
+		} else {
+			col++;
+			if (utf8_data[i] == ' ')
+				space = i;
+		}
+	}
+
+	text->physical_line[text->physical_line_count - 1].length =
+			end - line_start;
+
+	return true;
+}
+
+
 /**
  * Reformat a CONTENT_TEXTPLAIN to a new width.
+ *
+ * Logical lines which cannot need wrapping at this width are copied
+ * directly from the line index; only long lines are scanned.
  */
 
 void textplain_reformat(struct content *c, int width, int height)
 {
 	textplain_content *text = (textplain_content *) c;
-	char *utf8_data = text->utf8_data;
 	size_t utf8_data_size = text->utf8_data_size;
-	unsigned long line_count = 0;
-	struct textplain_line *line = text->physical_line;
-	struct textplain_line *line1;
-	size_t i, space, col;
 	size_t columns = 80;
+	size_t max_columns;
 	int character_width;
-	size_t line_start;
+	unsigned long l;
 
 	/* compute available columns (assuming monospaced font) - use 8
 	 * characters for better accuracy */
@@ -475,71 +682,71 @@ void textplain_reformat(struct content *c, int width, int height)
 
 	text->formatted_width = width;
 
-	text->physical_line_count = 0;
+	if (textplain_index_lines(text, false) == false)
+		goto no_memory;
 
-	if (!line) {
-		text->physical_line = line =
-			malloc(sizeof(struct textplain_line) * (1024 + 3));
-		if (!line)
-			goto no_memory;
+	/* Columns needed by the longest line, allowing for tabs */
+	max_columns = text->logical_max_length;
+	if (utf8_data_size - text->logical_line[
+			text->logical_line_count - 1].start > max_columns)
+		max_columns = utf8_data_size - text->logical_line[
+				text->logical_line_count - 1].start;
+	max_columns = (max_columns + TAB_WIDTH - 1) & ~(TAB_WIDTH - 1);
+
+	if (text->physical_line_count != 0 &&
+			text->formatted_size == utf8_data_size &&
+			(columns == text->formatted_columns ||
+			(max_columns < columns &&
+			 max_columns < text->formatted_columns))) {
+		/* No line is broken differently at this width */
+		c->width = width;
+		return;
 	}
 
-	line[line_count++].start = line_start = 0;
-	space = 0;
-	for (i = 0, col = 0; i != utf8_data_size; i++) {
-		bool term = (utf8_data[i] == '\n' || utf8_data[i] == '\r');
-		size_t next_col = col + 1;
+	text->physical_line_count = 0;
+	text->formatted_columns = 0;
 
-		if (utf8_data[i] == '\t')
-			next_col = (next_col + TAB_WIDTH - 1) & ~(TAB_WIDTH - 1);
+	for (l = 0; l != text->logical_line_count; l++) {
+		size_t start = text->logical_line[l].start;
+		size_t length;
 
-		if (term || next_col >= columns) {
-			if (line_count % 1024 == 0) {
-				line1 = realloc(line, 
-						sizeof(struct textplain_line) * 
-						(line_count + 1024 + 3));
-				if (!line1)
-					goto no_memory;
-				text->physical_line = line = line1;
-			}
-			if (term) {
-				line[line_count-1].length = i - line_start;
-
-				/* skip second char of CR/LF or LF/CR pair */
-				if (i + 1 < utf8_data_size &&
-					utf8_data[i+1] != utf8_data[i] &&
-					(utf8_data[i+1] == '\n' || utf8_data[i+1] == '\r'))
-					i++;
-			}
-			else {
-				if (space) {
-					/* break at last space in line */
-					i = space;
-					line[line_count-1].length = (i + 1) - line_start;
-
-				} else
-					line[line_count-1].length = i - line_start;
-			}
-			line[line_count++].start = line_start = i + 1;
-			col = 0;
-			space = 0;
-		} else {
-			col++;
-			if (utf8_data[i] == ' ')
-				space = i;
+		if (l + 1 < text->logical_line_count)
+			length = text->logical_line[l].length;
+		else
+			length = utf8_data_size - start;
+
+		if (!textplain_add_line(text, start))
+			goto no_memory;
+
+		if (((length + TAB_WIDTH - 1) & ~(TAB_WIDTH - 1)) < columns) {
+			/* Fits, even if it contains tabs */
+			text->physical_line[text->physical_line_count - 1]
+					.length = length;
+		} else if (!textplain_wrap_line(text, start, length, columns)) {
+			goto no_memory;
 		}
 	}
-	line[line_count-1].length = i - line[line_count-1].start;
-	line[line_count].start = utf8_data_size;
 
-	text->physical_line_count = line_count;
+	text->physical_line[text->physical_line_count].start = utf8_data_size;
+
+	text->formatted_columns = columns;
+	text->formatted_size = utf8_data_size;
 	c->width = width;
-	c->height = line_count * textplain_line_height() + MARGIN + MARGIN;
+	c->height = text->physical_line_count * textplain_line_height() +
+			MARGIN + MARGIN;
+
+	/* Account for the converted text and line tables in the content's
+	 * size, as they are held as long as the content is */
+	c->size = text->utf8_data_allocated +
+			(text->logical_line_allocated +
+			text->physical_line_allocated) *
+			sizeof(struct textplain_line);
 
 	return;
 
 no_memory:
-	LOG(("out of memory (line_count %lu)", line_count));
+	LOG(("out of memory (line_count %lu)", text->physical_line_count));
+	text->physical_line_count = 0;
 	return;
 }
 
@@ -562,6 +769,10 @@ void textplain_destroy(struct content *c)
 		free(text->physical_line);
 	}
 
+	if (text->logical_line != NULL) {
+		free(text->logical_line);
+	}
+
 	if (text->utf8_data != NULL) {
 		free(text->utf8_data);
 	}
@@ -1145,9 +1356,19 @@ int textplain_find_line(struct content *c, unsigned offset)
 	if (offset > text->utf8_data_size)
 		return -1;
 
-/* \todo - implement binary search here */
-	while (lineno < nlines && line[lineno].start < offset)
-		lineno++;
+	/* Find the first line starting at or after offset. The entry
+	 * after the last line starts at the end of the data. */
+	while (nlines > 0) {
+		int half = nlines / 2;
+
+		if (line[lineno + half].start < offset) {
+			lineno += half + 1;
+			nlines -= half + 1;
+		} else {
+			nlines = half;
+		}
+	}
+
 	if (line[lineno].start > offset)
 		lineno--;
 
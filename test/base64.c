@@ -0,0 +1,251 @@
+/*
+ * Copyright 2013 The NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Test and benchmark base64 encoding and decoding.
+ *
+ * Usage: base64
+ *
+ * Checks encoding and decoding of random data, including invalid and
+ * truncated input and short output buffers, against a character at a time
+ * implementation, then compares their throughput on a payload the size of
+ * a large data: URL.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utils/base64.h"
+
+#define PAYLOAD_SIZE (8 * 1024 * 1024)
+#define REPEATS 5
+
+static const char alphabet[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static int naive_value(char c)
+{
+	const char *p = (c != '\0') ? strchr(alphabet, c) : NULL;
+
+	return (p != NULL) ? p - alphabet : -1;
+}
+
+/* Encode a character at a time, with the semantics of base64_encode */
+static void naive_encode(const char *in, size_t inlen,
+		char *out, size_t outlen)
+{
+	size_t i, o = 0;
+
+	for (i = 0; i < inlen && o < outlen; i += 3) {
+		unsigned char b0 = in[i];
+		unsigned char b1 = (i + 1 < inlen) ? in[i + 1] : 0;
+		unsigned char b2 = (i + 2 < inlen) ? in[i + 2] : 0;
+		char quad[4];
+		int q;
+
+		quad[0] = alphabet[b0 >> 2];
+		quad[1] = alphabet[((b0 << 4) | (b1 >> 4)) & 0x3f];
+		quad[2] = (i + 1 < inlen) ?
+				alphabet[((b1 << 2) | (b2 >> 6)) & 0x3f] : '=';
+		quad[3] = (i + 2 < inlen) ? alphabet[b2 & 0x3f] : '=';
+
+		for (q = 0; q != 4 && o < outlen; q++)
+			out[o++] = quad[q];
+	}
+
+	if (o < outlen)
+		out[o] = '\0';
+}
+
+/* Decode a character at a time, with the semantics of base64_decode */
+static bool naive_decode(const char *in, size_t inlen,
+		char *out, size_t *outlen)
+{
+	size_t o = 0;
+
+	while (inlen >= 2) {
+		int v0 = naive_value(in[0]);
+		int v1 = naive_value(in[1]);
+		int v2, v3;
+
+		if (v0 < 0 || v1 < 0)
+			break;
+
+		if (o < *outlen)
+			out[o++] = (v0 << 2) | (v1 >> 4);
+
+		if (inlen == 2)
+			break;
+
+		if (in[2] == '=') {
+			/* Padding must end the data */
+			if (inlen != 4 || in[3] != '=')
+				break;
+		} else {
+			v2 = naive_value(in[2]);
+			if (v2 < 0)
+				break;
+
+			if (o < *outlen)
+				out[o++] = (v1 << 4) | (v2 >> 2);
+
+			if (inlen == 3)
+				break;
+
+			if (in[3] == '=') {
+				if (inlen != 4)
+					break;
+			} else {
+				v3 = naive_value(in[3]);
+				if (v3 < 0)
+					break;
+
+				if (o < *outlen)
+					out[o++] = (v2 << 6) | v3;
+			}
+		}
+
+		in += 4;
+		inlen -= 4;
+	}
+
+	*outlen = o;
+
+	return inlen == 0;
+}
+
+static void check(void)
+{
+	static char in[256], enc[400], a[400], b[400];
+	int r;
+
+	srand(1);
+
+	for (r = 0; r != 200000; r++) {
+		size_t inlen = rand() % 200;
+		size_t enclen, outlen, alen, blen;
+		bool aok, bok;
+		size_t i;
+
+		for (i = 0; i != inlen; i++)
+			in[i] = rand();
+
+		/* Encoding, sometimes into a short buffer */
+		outlen = (rand() % 2) ? BASE64_LENGTH(inlen) + 1 :
+				(size_t) rand() % (BASE64_LENGTH(inlen) + 2);
+		memset(a, '#', sizeof(a));
+		memset(b, '#', sizeof(b));
+		base64_encode(in, inlen, a, outlen);
+		naive_encode(in, inlen, b, outlen);
+		assert(memcmp(a, b, sizeof(a)) == 0);
+
+		/* Decoding, sometimes of damaged data or into a short
+		 * buffer */
+		enclen = BASE64_LENGTH(inlen);
+		base64_encode(in, inlen, enc, enclen + 1);
+		if (enclen > 0 && rand() % 4 == 0)
+			enc[rand() % enclen] = "=!A \n%"[rand() % 6];
+		if (enclen > 0 && rand() % 4 == 0)
+			enclen -= rand() % 3;
+
+		alen = blen = (rand() % 2) ? sizeof(a) :
+				(size_t) rand() % (inlen + 3);
+		aok = base64_decode(enc, enclen, a, &alen);
+		bok = naive_decode(enc, enclen, b, &blen);
+		assert(aok == bok);
+		assert(alen == blen);
+		assert(memcmp(a, b, alen) == 0);
+	}
+}
+
+static double time_decode(bool (*decode)(const char *, size_t,
+		char *, size_t *), const char *in, size_t inlen, char *out)
+{
+	clock_t start = clock();
+	int r;
+
+	for (r = 0; r != REPEATS; r++) {
+		size_t outlen = PAYLOAD_SIZE;
+		bool ok = decode(in, inlen, out, &outlen);
+		assert(ok && outlen == PAYLOAD_SIZE);
+	}
+
+	return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+static double time_encode(void (*encode)(const char *, size_t,
+		char *, size_t), const char *in, char *out, size_t outlen)
+{
+	clock_t start = clock();
+	int r;
+
+	for (r = 0; r != REPEATS; r++)
+		encode(in, PAYLOAD_SIZE, out, outlen);
+
+	return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void benchmark(void)
+{
+	size_t enclen = BASE64_LENGTH(PAYLOAD_SIZE);
+	double mb = (double) PAYLOAD_SIZE * REPEATS / (1024 * 1024);
+	double naive_time, time;
+	char *payload, *enc, *out;
+	size_t i;
+
+	payload = malloc(PAYLOAD_SIZE);
+	enc = malloc(enclen + 1);
+	out = malloc(PAYLOAD_SIZE);
+	assert(payload != NULL && enc != NULL && out != NULL);
+
+	for (i = 0; i != PAYLOAD_SIZE; i++)
+		payload[i] = rand();
+
+	naive_time = time_encode(naive_encode, payload, enc, enclen + 1);
+	time = time_encode(base64_encode, payload, enc, enclen + 1);
+
+	printf("encode: naive %.0f MB/s, base64 %.0f MB/s\n",
+			naive_time > 0 ? mb / naive_time : 0,
+			time > 0 ? mb / time : 0);
+
+	naive_time = time_decode(naive_decode, enc, enclen, out);
+	time = time_decode(base64_decode, enc, enclen, out);
+	assert(memcmp(out, payload, PAYLOAD_SIZE) == 0);
+
+	printf("decode: naive %.0f MB/s, base64 %.0f MB/s\n",
+			naive_time > 0 ? mb / naive_time : 0,
+			time > 0 ? mb / time : 0);
+
+	free(out);
+	free(enc);
+	free(payload);
+}
+
+int main(void)
+{
+	check();
+	benchmark();
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -299,6 +299,39 @@ int main(void)
 		count++;
 	}
 
+	/* Interning tests */
+	LOG(("Testing nsurl interning"));
+	for (test = join_tests; test->test != NULL; test++) {
+		nsurl *created;
+
+		if (nsurl_create("http://a/b/c/d;p?q", &base) != NSERROR_OK) {
+			LOG(("Failed to create base URL."));
+		} else if (nsurl_join(base, test->test, &joined) !=
+				NSERROR_OK) {
+			LOG(("Failed to join test URL."));
+			nsurl_unref(base);
+		} else if (nsurl_create(test->res, &created) != NSERROR_OK) {
+			LOG(("Failed to create URL:\n\t\t%s.", test->res));
+			nsurl_unref(joined);
+			nsurl_unref(base);
+		} else {
+			if (created == joined && nsurl_compare(created, joined,
+					NSURL_WITH_FRAGMENT)) {
+				LOG(("\tPASS: \"%s\"\t--> shared",
+						test->test));
+				passed++;
+			} else {
+				LOG(("\tFAIL: \"%s\"\t--> not shared",
+						test->test));
+			}
+
+			nsurl_unref(created);
+			nsurl_unref(joined);
+			nsurl_unref(base);
+		}
+		count++;
+	}
+
 	if (passed == count) {
 		LOG(("Testing complete: SUCCESS"));
 	} else {
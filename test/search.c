@@ -0,0 +1,255 @@
+/*
+ * Copyright 2013 The NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Test the search index of an HTML document's box tree.
+ *
+ * Builds a small box tree and checks that the index is built by the first
+ * search and reused by later ones, that it keeps the text it was built
+ * from until it is invalidated, and that the next search after
+ * search_index_invalidate() builds it again from the box tree.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "content/content_protected.h"
+#include "desktop/selection.h"
+#include "render/box.h"
+#include "render/html_internal.h"
+#include "render/search.h"
+#include "render/textplain.h"
+#include "utils/utils.h"
+
+/******************************************************************************
+ * Things that we'd reasonably expect to have to implement                    *
+ ******************************************************************************/
+
+/* utils/utils.h */
+void warn_user(const char *warning, const char *detail)
+{
+	fprintf(stderr, "%s %s\n", warning, detail);
+}
+
+/* render/box.h */
+void box_coords(struct box *box, int *x, int *y)
+{
+	*x = box->x;
+	*y = box->y;
+}
+
+/* content/content_protected.h */
+void content_broadcast(struct content *c, content_msg msg,
+		union content_msg_data data)
+{
+}
+
+/* desktop/selection.h */
+struct selection *selection_create(struct content *c, bool is_html)
+{
+	return NULL;
+}
+
+/* desktop/selection.h */
+void selection_destroy(struct selection *s)
+{
+}
+
+/* desktop/selection.h */
+void selection_init(struct selection *s, struct box *root)
+{
+}
+
+/* desktop/selection.h */
+void selection_clear(struct selection *s, bool redraw)
+{
+}
+
+/* desktop/selection.h */
+void selection_set_start(struct selection *s, unsigned idx)
+{
+}
+
+/* desktop/selection.h */
+void selection_set_end(struct selection *s, unsigned idx)
+{
+}
+
+/* desktop/selection.h */
+bool selection_highlighted(const struct selection *s,
+		unsigned start, unsigned end,
+		unsigned *start_idx, unsigned *end_idx)
+{
+	return false;
+}
+
+/* render/textplain.h */
+unsigned long textplain_line_count(struct content *c)
+{
+	return 0;
+}
+
+/* render/textplain.h */
+char *textplain_get_line(struct content *c, unsigned lineno,
+		size_t *poffset, size_t *plen)
+{
+	return NULL;
+}
+
+/* render/textplain.h */
+void textplain_coords_from_range(struct content *c,
+		unsigned start, unsigned end, struct rect *r)
+{
+}
+
+/******************************************************************************
+ * The actual test code                                                       *
+ ******************************************************************************/
+
+static bool found;
+
+static void test_status(bool f, void *p)
+{
+	found = f;
+}
+
+static struct gui_search_callbacks test_callbacks = {
+	NULL,
+	NULL,
+	test_status,
+	NULL,
+	NULL
+};
+
+static struct box *test_box(struct box *parent, const char *text)
+{
+	struct box *box = calloc(1, sizeof(*box));
+	struct box **link;
+
+	assert(box != NULL);
+
+	if (text != NULL) {
+		box->text = strdup(text);
+		assert(box->text != NULL);
+		box->length = strlen(text);
+	}
+
+	if (parent != NULL) {
+		for (link = &parent->children; *link; link = &(*link)->next)
+			;
+		*link = box;
+		box->parent = parent;
+	}
+
+	return box;
+}
+
+static void test_box_free(struct box *box)
+{
+	struct box *child, *next;
+
+	for (child = box->children; child; child = next) {
+		next = child->next;
+		test_box_free(child);
+	}
+
+	free(box->text);
+	free(box);
+}
+
+/* Search a document afresh, as a new search from the front end does */
+static bool test_search(html_content *html, const char *string)
+{
+	struct search_context *context;
+
+	context = search_create_context((struct content *) html,
+			CONTENT_HTML, &test_callbacks, NULL);
+	assert(context != NULL);
+
+	found = false;
+	search_step(context, SEARCH_FLAG_CASE_SENSITIVE |
+			SEARCH_FLAG_FORWARDS, string);
+	search_destroy_context(context);
+
+	return found;
+}
+
+int main(void)
+{
+	html_content *html = calloc(1, sizeof(*html));
+	struct search_index *index;
+	struct box *inline_box;
+
+	assert(html != NULL);
+
+	html->layout = test_box(NULL, NULL);
+	test_box(html->layout, "Choose a fruit:");
+	inline_box = test_box(test_box(html->layout, NULL), "apple");
+
+	/* The first search builds the index, and later ones reuse it */
+	assert(html->search_index == NULL);
+	assert(test_search(html, "fruit"));
+	index = html->search_index;
+	assert(index != NULL);
+	assert(test_search(html, "apple"));
+	assert(!test_search(html, "cherry"));
+	assert(html->search_index == index);
+
+	/* Extending a string, as while typing, checks previous matches */
+	assert(test_search(html, "ap"));
+	assert(test_search(html, "app"));
+	assert(!test_search(html, "appx"));
+
+	/* Matches never span boxes */
+	assert(test_search(html, "t:"));
+	assert(!test_search(html, ":a"));
+
+	/* The index holds the text it was built from, so a change to the
+	 * box tree is not seen until the index is invalidated */
+	free(inline_box->text);
+	inline_box->text = strdup("cherry");
+	assert(inline_box->text != NULL);
+	inline_box->length = strlen(inline_box->text);
+	assert(test_search(html, "apple"));
+	assert(!test_search(html, "cherry"));
+	assert(html->search_index == index);
+
+	search_index_invalidate(html);
+	assert(html->search_index == NULL);
+
+	/* The next search builds the index from the changed tree */
+	assert(!test_search(html, "apple"));
+	assert(html->search_index != NULL);
+	assert(test_search(html, "cherry"));
+	assert(test_search(html, "fruit"));
+
+	/* Wildcard searches walk the box tree rather than the index */
+	assert(test_search(html, "ch*ry"));
+	assert(!test_search(html, "ap#le"));
+
+	search_index_invalidate(html);
+	search_index_invalidate(html);
+	test_box_free(html->layout);
+	free(html);
+
+	printf("PASS\n");
+
+	return 0;
+}
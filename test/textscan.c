@@ -0,0 +1,219 @@
+/*
+ * Copyright 2013 The NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Test and benchmark text scanning.
+ *
+ * Usage: textscan [file ...]
+ *
+ * Scans each named file, or a generated corpus of log-like text if none
+ * are given, comparing results and throughput with a byte at a time scan.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utils/textscan.h"
+
+#define CORPUS_SIZE (64 * 1024 * 1024)
+#define REPEATS 5
+
+static size_t naive_line_end(const char *data, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i != len; i++) {
+		if (data[i] == '\n' || data[i] == '\r')
+			break;
+	}
+
+	return i;
+}
+
+static size_t naive_blank(const char *data, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i != len; i++) {
+		if (data[i] == ' ' || data[i] == '\t' ||
+				data[i] == '\n' || data[i] == '\r')
+			break;
+	}
+
+	return i;
+}
+
+/* Count the number of stops a scanner makes over a whole buffer */
+static size_t count_stops(size_t (*scan)(const char *, size_t),
+		const char *data, size_t len)
+{
+	size_t i = 0, count = 0;
+
+	while (i < len) {
+		i += scan(data + i, len - i);
+		if (i < len) {
+			count++;
+			i++;
+		}
+	}
+
+	return count;
+}
+
+static double time_scan(size_t (*scan)(const char *, size_t),
+		const char *data, size_t len, size_t *count)
+{
+	clock_t start = clock();
+	int r;
+
+	for (r = 0; r != REPEATS; r++)
+		*count = count_stops(scan, data, len);
+
+	return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+static void check(const char *data, size_t len)
+{
+	size_t i;
+
+	/* Every alignment and length, over the start of the data */
+	for (i = 0; i != 64 && i < len; i++) {
+		size_t l;
+
+		for (l = 0; l != 64 && i + l <= len; l++) {
+			assert(textscan_line_end(data + i, l) ==
+					naive_line_end(data + i, l));
+			assert(textscan_blank(data + i, l) ==
+					naive_blank(data + i, l));
+		}
+	}
+}
+
+static void benchmark(const char *name, const char *data, size_t len)
+{
+	size_t naive_count, count;
+	double naive_time, time;
+	double mb = (double) len * REPEATS / (1024 * 1024);
+
+	check(data, len);
+
+	naive_time = time_scan(naive_line_end, data, len, &naive_count);
+	time = time_scan(textscan_line_end, data, len, &count);
+	assert(count == naive_count);
+
+	printf("%s: %lu lines\n", name, (unsigned long) count);
+	printf("\tline end: naive %.0f MB/s, textscan %.0f MB/s\n",
+			naive_time > 0 ? mb / naive_time : 0,
+			time > 0 ? mb / time : 0);
+
+	naive_time = time_scan(naive_blank, data, len, &naive_count);
+	time = time_scan(textscan_blank, data, len, &count);
+	assert(count == naive_count);
+
+	printf("\tblank: naive %.0f MB/s, textscan %.0f MB/s\n",
+			naive_time > 0 ? mb / naive_time : 0,
+			time > 0 ? mb / time : 0);
+}
+
+/* Generate text resembling a log file, with lines of varying length */
+static char *make_corpus(size_t len)
+{
+	static const char *words[] = { "GET", "/index.html", "200",
+			"connection", "reset", "by", "peer", "0x7fff5fbff8a8",
+			"[notice]", "request_handler:", "\t", "-" };
+	char *data = malloc(len);
+	size_t i = 0;
+
+	if (data == NULL)
+		return NULL;
+
+	srand(1);
+
+	while (i < len) {
+		const char *word;
+		size_t wlen;
+
+		if (rand() % 12 == 0) {
+			data[i++] = (rand() % 8 == 0) ? '\r' : '\n';
+			continue;
+		}
+
+		word = words[rand() % (sizeof(words) / sizeof(words[0]))];
+		wlen = strlen(word);
+		if (i + wlen + 1 > len)
+			break;
+
+		memcpy(data + i, word, wlen);
+		i += wlen;
+		data[i++] = ' ';
+	}
+
+	for (; i < len; i++)
+		data[i] = '\n';
+
+	return data;
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+
+	if (argc < 2) {
+		char *data = make_corpus(CORPUS_SIZE);
+		assert(data != NULL);
+
+		benchmark("generated corpus", data, CORPUS_SIZE);
+
+		free(data);
+	}
+
+	for (i = 1; i < argc; i++) {
+		FILE *fp = fopen(argv[i], "rb");
+		char *data;
+		long len;
+
+		if (fp == NULL) {
+			perror(argv[i]);
+			return 1;
+		}
+
+		fseek(fp, 0, SEEK_END);
+		len = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+
+		data = malloc(len > 0 ? len : 1);
+		assert(data != NULL);
+
+		if (fread(data, 1, len, fp) != (size_t) len) {
+			perror(argv[i]);
+			return 1;
+		}
+		fclose(fp);
+
+		benchmark(argv[i], data, len);
+
+		free(data);
+	}
+
+	printf("PASS\n");
+
+	return 0;
+}
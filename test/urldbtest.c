@@ -61,6 +61,14 @@ void cookie_manager_remove(const struct cookie_data *data)
 {
 }
 
+void schedule(int t, void (*callback)(void *p), void *p)
+{
+}
+
+void schedule_remove(void (*callback)(void *p), void *p)
+{
+}
+
 void die(const char *error)
 {
 	printf("die: %s\n", error);
@@ -150,6 +158,19 @@ char *test_urldb_get_cookie(const char *url)
 	return ret;
 }
 
+/* Check the Cookie: header for an URL, with NULL expecting no cookies */
+void test_urldb_check_cookie(const char *url, const char *expected)
+{
+	char *cookie = test_urldb_get_cookie(url);
+
+	if (expected == NULL)
+		assert(cookie == NULL);
+	else
+		assert(cookie != NULL && strcmp(cookie, expected) == 0);
+
+	free(cookie);
+}
+
 int main(void)
 {
 	struct host_part *h;
@@ -161,9 +182,13 @@ int main(void)
 	nsurl *url;
 	nsurl *urlr;
 	char *path_query;
+	char long_host[256];
+	char long_url[300];
+	FILE *fp;
 
 	corestrings_init();
 	url_init();
+	nsoption_init(NULL, NULL, NULL);
 
 	h = urldb_add_host("127.0.0.1");
 	if (!h) {
@@ -263,7 +288,7 @@ int main(void)
 	nsurl_unref(urlr);
 
 	url = make_url("https://www.foo.com/blah/wxyzabc");
-	urldb_get_cookie(url, true);
+	free(urldb_get_cookie(url, true));
 	nsurl_unref(url);
 
 	/* 1563546 */
@@ -298,6 +323,39 @@ int main(void)
 	assert(urldb_get_url(url));
 	nsurl_unref(url);
 
+	/* Many siblings, so lookups go through the child hashes */
+	for (i = 0; i < 100; i++) {
+		char buf[64];
+
+		snprintf(buf, sizeof buf, "http://h%d.wide.org/", i);
+		url = make_url(buf);
+		assert(urldb_add_url(url));
+		nsurl_unref(url);
+
+		snprintf(buf, sizeof buf, "http://wide.org/p%d/leaf", i);
+		url = make_url(buf);
+		assert(urldb_add_url(url));
+		nsurl_unref(url);
+	}
+	for (i = 0; i < 100; i++) {
+		char buf[64];
+
+		snprintf(buf, sizeof buf, "http://h%d.wide.org/", i);
+		url = make_url(buf);
+		assert(urldb_get_url(url));
+		nsurl_unref(url);
+
+		snprintf(buf, sizeof buf, "http://wide.org/p%d/leaf", i);
+		url = make_url(buf);
+		assert(urldb_get_url(url));
+		nsurl_unref(url);
+
+		snprintf(buf, sizeof buf, "http://wide.org/p%d/lea", i);
+		url = make_url(buf);
+		assert(urldb_get_url(url) == NULL);
+		nsurl_unref(url);
+	}
+
 	/* Valid path */
 	assert(test_urldb_set_cookie("name=value;Path=/\r\n", "http://www.google.com/", NULL));
 
@@ -306,21 +364,27 @@ int main(void)
 
 	/* Defaulted path */
 	assert(test_urldb_set_cookie("name=value\r\n", "http://www.example.org/foo/bar/baz/bat.html", NULL));
-	assert(test_urldb_get_cookie("http://www.example.org/foo/bar/baz/quux.htm"));
+	test_urldb_check_cookie("http://www.example.org/foo/bar/baz/quux.htm", "name=value; name=value");
+	/* Cookie lookup must not add the request URL to the database */
+	url = make_url("http://www.example.org/foo/bar/baz/quux.htm");
+	assert(urldb_get_url(url) == NULL);
+	/* Cached header is returned on repeat lookup */
+	test_urldb_check_cookie("http://www.example.org/foo/bar/baz/quux.htm", "name=value; name=value");
+	nsurl_unref(url);
 
 	/* Defaulted path with no non-leaf path segments */
 	assert(test_urldb_set_cookie("name=value\r\n", "http://no-non-leaf.example.org/index.html", NULL));
-	assert(test_urldb_get_cookie("http://no-non-leaf.example.org/page2.html"));
-	assert(test_urldb_get_cookie("http://no-non-leaf.example.org/"));
+	test_urldb_check_cookie("http://no-non-leaf.example.org/page2.html", "name=value");
+	test_urldb_check_cookie("http://no-non-leaf.example.org/", "name=value");
 
 	/* Valid path (includes leafname) */
 	assert(test_urldb_set_cookie("name=value;Version=1;Path=/index.cgi\r\n", "http://example.org/index.cgi", NULL));
-	assert(test_urldb_get_cookie("http://example.org/index.cgi"));
+	test_urldb_check_cookie("http://example.org/index.cgi", "$Version=1; name=value; $Path=\"/index.cgi\"");
 
 	/* Valid path (includes leafname in non-root directory) */
 	assert(test_urldb_set_cookie("name=value;Path=/foo/index.html\r\n", "http://www.example.org/foo/index.html", NULL));
 	/* Should _not_ match the above, as the leafnames differ */
-	assert(test_urldb_get_cookie("http://www.example.org/foo/bar.html") == NULL);
+	test_urldb_check_cookie("http://www.example.org/foo/bar.html", NULL);
 
 	/* Invalid path (contains different leafname) */
 	assert(test_urldb_set_cookie("name=value;Path=/index.html\r\n", "http://example.org/index.htm", NULL) == false);
@@ -334,42 +398,130 @@ int main(void)
 	/* Test handling of non-domain cookie sent by server (domain part should
 	 * be ignored) */
 	assert(test_urldb_set_cookie("foo=value;Domain=blah.com\r\n", "http://www.example.com/", NULL));
-	assert(strcmp(test_urldb_get_cookie("http://www.example.com/"), "foo=value") == 0);
+	test_urldb_check_cookie("http://www.example.com/", "foo=value");
 
 	/* Test handling of domain cookie from wrong host (strictly invalid but
 	 * required to support the real world) */
 	assert(test_urldb_set_cookie("name=value;Domain=.example.com\r\n", "http://foo.bar.example.com/", NULL));
-	assert(strcmp(test_urldb_get_cookie("http://www.example.com/"), "foo=value; name=value") == 0);
+	test_urldb_check_cookie("http://www.example.com/", "foo=value; name=value");
 
 	/* Test presence of separators in cookie value */
 	assert(test_urldb_set_cookie("name=\"value=foo\\\\bar\\\\\\\";\\\\baz=quux\";Version=1\r\n", "http://www.example.org/", NULL));
-	assert(strcmp(test_urldb_get_cookie("http://www.example.org/"), "$Version=1; name=\"value=foo\\\\bar\\\\\\\";\\\\baz=quux\"") == 0);
+	test_urldb_check_cookie("http://www.example.org/", "$Version=1; name=\"value=foo\\\\bar\\\\\\\";\\\\baz=quux\"");
 
 	/* Test cookie with blank value */
 	assert(test_urldb_set_cookie("a=\r\n", "http://www.example.net/", NULL));
-	assert(strcmp(test_urldb_get_cookie("http://www.example.net/"), "a=") == 0);
+	test_urldb_check_cookie("http://www.example.net/", "a=");
 
 	/* Test specification of multiple cookies in one header */
 	assert(test_urldb_set_cookie("a=b, foo=bar; Path=/\r\n", "http://www.example.net/", NULL));
-	assert(strcmp(test_urldb_get_cookie("http://www.example.net/"), "a=b; foo=bar") == 0);
+	test_urldb_check_cookie("http://www.example.net/", "a=b; foo=bar");
 
 	/* Test use of separators in unquoted cookie value */
 	assert(test_urldb_set_cookie("foo=moo@foo:blah?moar\\ text\r\n", "http://example.com/", NULL));
-	assert(strcmp(test_urldb_get_cookie("http://example.com/"), "foo=moo@foo:blah?moar\\ text; name=value") == 0);
+	test_urldb_check_cookie("http://example.com/", "foo=moo@foo:blah?moar\\ text; name=value");
 
 	/* Test use of unnecessary quotes */
 	assert(test_urldb_set_cookie("foo=\"hello\";Version=1,bar=bat\r\n", "http://example.com/", NULL));
-	assert(strcmp(test_urldb_get_cookie("http://example.com/"), "foo=\"hello\"; bar=bat; name=value") == 0);
+	test_urldb_check_cookie("http://example.com/", "foo=\"hello\"; bar=bat; name=value");
 
 	/* Test domain matching in unverifiable transactions */
 	assert(test_urldb_set_cookie("foo=bar; domain=.example.tld\r\n", "http://www.foo.example.tld/", "http://bar.example.tld/"));
-	assert(strcmp(test_urldb_get_cookie("http://www.foo.example.tld/"), "foo=bar") == 0);
+	test_urldb_check_cookie("http://www.foo.example.tld/", "foo=bar");
 
 	/* Test expiry */
 	assert(test_urldb_set_cookie("foo=bar", "http://expires.com/", NULL));
-	assert(strcmp(test_urldb_get_cookie("http://expires.com/"), "foo=bar") == 0);
+	test_urldb_check_cookie("http://expires.com/", "foo=bar");
 	assert(test_urldb_set_cookie("foo=bar; expires=Thu, 01-Jan-1970 00:00:01 GMT\r\n", "http://expires.com/", NULL));
-	assert(test_urldb_get_cookie("http://expires.com/") == NULL);
+	test_urldb_check_cookie("http://expires.com/", NULL);
+
+	/* Hosts too long for a fixed buffer are neither truncated nor
+	 * confused with others sharing a prefix */
+	memset(long_host, 'a', sizeof long_host - 1);
+	for (i = 63; i < (int) sizeof long_host - 1; i += 64)
+		long_host[i] = '.';
+	long_host[sizeof long_host - 1] = '\0';
+	snprintf(long_url, sizeof long_url, "http://%s.long.test/", long_host);
+	assert(test_urldb_set_cookie("long=1\r\n", long_url, NULL));
+	test_urldb_check_cookie(long_url, "long=1");
+	snprintf(long_url, sizeof long_url, "http://%s.long.invalid/", long_host);
+	test_urldb_check_cookie(long_url, NULL);
+
+	/* Save and reload, in both the binary and legacy text formats */
+	url = make_url("http://persist.example.com/a/b?c=d");
+	assert(urldb_add_url(url));
+	urldb_update_url_visit_data(url);
+	urldb_set_url_title(url, "per\tsisted\r\n");
+	nsurl_unref(url);
+
+	urldb_save("urldbtest-urls");
+	urldb_destroy();
+	/* Saved under a temporary name which is renamed into place */
+	assert(fopen("urldbtest-urls.new", "r") == NULL);
+
+	urldb_load("urldbtest-urls");
+	url = make_url("http://persist.example.com/a/b?c=d");
+	u = urldb_get_url_data(url);
+	assert(u && u->visits == 1 && strcmp(u->title, "per sisted") == 0);
+	nsurl_unref(url);
+	url = make_url("http://wide.org/p42/leaf");
+	assert(urldb_get_url(url) == NULL);
+	nsurl_unref(url);
+	urldb_destroy();
+
+	fp = fopen("urldbtest-urls", "w");
+	assert(fp != NULL);
+	fprintf(fp, "106\ntext.example.com\n1\nhttp\n8080\n/x/y\n"
+			"3\n%d\n0\n\ntext title\n", (int) time(NULL));
+	fclose(fp);
+
+	urldb_load("urldbtest-urls");
+	url = make_url("http://text.example.com:8080/x/y");
+	u = urldb_get_url_data(url);
+	assert(u && u->visits == 3 && strcmp(u->title, "text title") == 0);
+	nsurl_unref(url);
+
+	urldb_save("urldbtest-urls");
+	urldb_destroy();
+
+	urldb_load("urldbtest-urls");
+	url = make_url("http://text.example.com:8080/x/y");
+	u = urldb_get_url_data(url);
+	assert(u && u->visits == 3 && strcmp(u->title, "text title") == 0);
+	nsurl_unref(url);
+	urldb_destroy();
+
+	/* Recover changes from the journal, without saving */
+	remove("urldbtest-journal");
+	assert(urldb_journal_open("urldbtest-journal", "urldbtest-urls",
+			"urldbtest-cookies") == NSERROR_OK);
+	url = make_url("http://journal.example.com/j");
+	assert(urldb_add_url(url));
+	urldb_update_url_visit_data(url);
+	urldb_update_url_visit_data(url);
+	urldb_set_url_title(url, "journalled");
+	nsurl_unref(url);
+	assert(test_urldb_set_cookie("j=k; expires=Fri, 01-Jan-2038 00:00:00 GMT\r\n", "http://journal.example.com/", NULL));
+	/* A session cookie replacing a persistent one removes it */
+	assert(test_urldb_set_cookie("s=p; expires=Fri, 01-Jan-2038 00:00:00 GMT\r\n", "http://journal.example.com/", NULL));
+	assert(test_urldb_set_cookie("s=q\r\n", "http://journal.example.com/", NULL));
+	urldb_destroy();
+
+	urldb_load("urldbtest-urls");
+	assert(urldb_journal_open("urldbtest-journal", "urldbtest-urls",
+			"urldbtest-cookies") == NSERROR_OK);
+	url = make_url("http://journal.example.com/j");
+	u = urldb_get_url_data(url);
+	assert(u && u->visits == 2 && strcmp(u->title, "journalled") == 0);
+	nsurl_unref(url);
+	test_urldb_check_cookie("http://journal.example.com/", "j=k");
+	url = make_url("http://text.example.com:8080/x/y");
+	assert(urldb_get_url_data(url) != NULL);
+	nsurl_unref(url);
+	urldb_journal_close();
+
+	remove("urldbtest-journal");
+	remove("urldbtest-urls");
 
 	urldb_dump();
 	urldb_destroy();
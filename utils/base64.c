@@ -52,6 +52,18 @@
 /* Get UCHAR_MAX. */
 #include <limits.h>
 
+/* Blocks of input are translated 16 characters at a time with SSSE3 where
+   the processor supports it, decided at run time.  Elsewhere they are
+   translated a group at a time without the per-character checks of the
+   general loops, which then deal only with the end of the data and any
+   invalid input. */
+#if defined __GNUC__ && (__GNUC__ >= 5 || defined __clang__) \
+    && (defined __x86_64__ || defined __i386__)
+# include <tmmintrin.h>
+# define BASE64_SSSE3 1
+# define BASE64_TARGET_SSSE3 __attribute__ ((target ("ssse3")))
+#endif
+
 /* C89 compliant way to cast 'char' to 'unsigned char'. */
 static inline unsigned char
 to_uchar (char ch)
@@ -59,6 +71,113 @@ to_uchar (char ch)
   return ch;
 }
 
+static const char b64str[64] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+#ifdef BASE64_SSSE3
+/* Determine whether the SSSE3 kernels may be used. */
+static bool
+base64_have_ssse3 (void)
+{
+# ifdef __SSSE3__
+  return true;
+# else
+  static int have_ssse3 = -1;
+
+  if (have_ssse3 < 0)
+    {
+      __builtin_cpu_init ();
+      have_ssse3 = __builtin_cpu_supports ("ssse3") ? 1 : 0;
+    }
+
+  return have_ssse3 != 0;
+# endif
+}
+
+/* Encode as many 12 byte groups of IN as possible, reading 16 bytes and
+   writing 16 characters at a time.  Return the number of bytes of IN
+   consumed. */
+static size_t BASE64_TARGET_SSSE3
+base64_encode_ssse3 (const char *in, size_t inlen, char *out, size_t outlen)
+{
+  const __m128i shuf = _mm_set_epi8 (10, 11, 9, 10, 7, 8, 6, 7,
+				     4, 5, 3, 4, 1, 2, 0, 1);
+  const __m128i shift_lut = _mm_setr_epi8 ('a' - 26, '0' - 52, '0' - 52,
+					   '0' - 52, '0' - 52, '0' - 52,
+					   '0' - 52, '0' - 52, '0' - 52,
+					   '0' - 52, '0' - 52, '+' - 62,
+					   '/' - 63, 'A', 0, 0);
+  size_t done = 0;
+
+  while (inlen - done >= 16 && outlen >= 16)
+    {
+      __m128i v, t0, t1, t2, t3, indices, result, less;
+
+      v = _mm_loadu_si128 ((const __m128i *) (in + done));
+
+      /* Split each group of 3 bytes into 4 6-bit indices */
+      v = _mm_shuffle_epi8 (v, shuf);
+      t0 = _mm_and_si128 (v, _mm_set1_epi32 (0x0fc0fc00));
+      t1 = _mm_mulhi_epu16 (t0, _mm_set1_epi32 (0x04000040));
+      t2 = _mm_and_si128 (v, _mm_set1_epi32 (0x003f03f0));
+      t3 = _mm_mullo_epi16 (t2, _mm_set1_epi32 (0x01000010));
+      indices = _mm_or_si128 (t1, t3);
+
+      /* Map indices to characters by adding an offset for their range */
+      result = _mm_subs_epu8 (indices, _mm_set1_epi8 (51));
+      less = _mm_cmpgt_epi8 (_mm_set1_epi8 (26), indices);
+      result = _mm_or_si128 (result,
+			     _mm_and_si128 (less, _mm_set1_epi8 (13)));
+      result = _mm_shuffle_epi8 (shift_lut, result);
+      result = _mm_add_epi8 (result, indices);
+
+      _mm_storeu_si128 ((__m128i *) out, result);
+
+      done += 12;
+      out += 16;
+      outlen -= 16;
+    }
+
+  return done;
+}
+#endif
+
+/* Encode as many whole 3 byte groups of IN as fit in OUT, returning the
+   number of bytes of IN consumed. */
+static size_t
+base64_encode_blocks (const char *restrict in, size_t inlen,
+		      char *restrict out, size_t outlen)
+{
+  size_t done = 0;
+
+#ifdef BASE64_SSSE3
+  if (base64_have_ssse3 ())
+    {
+      done = base64_encode_ssse3 (in, inlen, out, outlen);
+      out += done / 3 * 4;
+      outlen -= done / 3 * 4;
+    }
+#endif
+
+  while (inlen - done >= 3 && outlen >= 4)
+    {
+      unsigned long group = ((unsigned long) to_uchar (in[done]) << 16)
+	| ((unsigned long) to_uchar (in[done + 1]) << 8)
+	| to_uchar (in[done + 2]);
+
+      out[0] = b64str[(group >> 18) & 0x3f];
+      out[1] = b64str[(group >> 12) & 0x3f];
+      out[2] = b64str[(group >> 6) & 0x3f];
+      out[3] = b64str[group & 0x3f];
+
+      done += 3;
+      out += 4;
+      outlen -= 4;
+    }
+
+  return done;
+}
+
 /* Base64 encode IN array of size INLEN into OUT array of size OUTLEN.
    If OUTLEN is less than BASE64_LENGTH(INLEN), write as many bytes as
    possible.  If OUTLEN is larger than BASE64_LENGTH(INLEN), also zero
@@ -67,8 +186,12 @@ void
 base64_encode (const char *restrict in, size_t inlen,
 	       char *restrict out, size_t outlen)
 {
-  static const char b64str[64] =
-    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  size_t done = base64_encode_blocks (in, inlen, out, outlen);
+
+  in += done;
+  inlen -= done;
+  out += done / 3 * 4;
+  outlen -= done / 3 * 4;
 
   while (inlen && outlen)
     {
@@ -300,6 +423,112 @@ isbase64 (char ch)
   return uchar_in_range (to_uchar (ch)) && 0 <= b64[to_uchar (ch)];
 }
 
+#ifdef BASE64_SSSE3
+/* Decode as many 16 character blocks of IN as possible, stopping at the
+   first block containing anything other than alphabet characters.  16
+   bytes are written for each 12 decoded.  Return the number of characters
+   of IN consumed. */
+static size_t BASE64_TARGET_SSSE3
+base64_decode_ssse3 (const char *in, size_t inlen, char *out, size_t outlen)
+{
+  const __m128i lut_lo = _mm_setr_epi8 (0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+					0x11, 0x11, 0x11, 0x11, 0x13, 0x1a,
+					0x1b, 0x1b, 0x1b, 0x1a);
+  const __m128i lut_hi = _mm_setr_epi8 (0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+					0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+					0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll = _mm_setr_epi8 (0, 16, 19, 4, -65, -65, -71, -71,
+					  0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i mask_2f = _mm_set1_epi8 (0x2f);
+  const __m128i pack = _mm_setr_epi8 (2, 1, 0, 6, 5, 4, 10, 9, 8,
+				      14, 13, 12, -1, -1, -1, -1);
+  size_t done = 0;
+
+  while (inlen - done >= 16 && outlen >= 16)
+    {
+      __m128i v, hi_nibbles, lo_nibbles, hi, lo, roll;
+
+      v = _mm_loadu_si128 ((const __m128i *) (in + done));
+
+      /* Classify characters by nibble; any invalid one sets a bit in
+         both lookups */
+      hi_nibbles = _mm_and_si128 (_mm_srli_epi32 (v, 4), mask_2f);
+      lo_nibbles = _mm_and_si128 (v, mask_2f);
+      hi = _mm_shuffle_epi8 (lut_hi, hi_nibbles);
+      lo = _mm_shuffle_epi8 (lut_lo, lo_nibbles);
+      if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_and_si128 (lo, hi),
+					     _mm_setzero_si128 ()))
+	  != 0xffff)
+	break;
+
+      /* Map characters to their values by adding an offset for their
+         range */
+      roll = _mm_shuffle_epi8 (lut_roll,
+			       _mm_add_epi8 (_mm_cmpeq_epi8 (v, mask_2f),
+					     hi_nibbles));
+      v = _mm_add_epi8 (v, roll);
+
+      /* Pack 4 6-bit values into each 3 bytes */
+      v = _mm_maddubs_epi16 (v, _mm_set1_epi32 (0x01400140));
+      v = _mm_madd_epi16 (v, _mm_set1_epi32 (0x00011000));
+      v = _mm_shuffle_epi8 (v, pack);
+
+      _mm_storeu_si128 ((__m128i *) out, v);
+
+      done += 16;
+      out += 12;
+      outlen -= 12;
+    }
+
+  return done;
+}
+#endif
+
+/* Decode as many 4 character groups of IN as fit in OUT, stopping at the
+   first group containing anything other than alphabet characters.
+   Return the number of characters of IN consumed; 3 bytes are written
+   for each 4 consumed. */
+static size_t
+base64_decode_blocks (const char *restrict in, size_t inlen,
+		      char *restrict out, size_t outlen)
+{
+  size_t done = 0;
+
+#ifdef BASE64_SSSE3
+  if (base64_have_ssse3 ())
+    {
+      done = base64_decode_ssse3 (in, inlen, out, outlen);
+      out += done / 4 * 3;
+      outlen -= done / 4 * 3;
+    }
+#endif
+
+  while (inlen - done >= 4 && outlen >= 3)
+    {
+      int a = b64[to_uchar (in[done])];
+      int b = b64[to_uchar (in[done + 1])];
+      int c = b64[to_uchar (in[done + 2])];
+      int d = b64[to_uchar (in[done + 3])];
+      unsigned long group;
+
+      if ((a | b | c | d) < 0)
+	break;
+
+      group = ((unsigned long) a << 18) | ((unsigned long) b << 12)
+	| ((unsigned long) c << 6) | (unsigned long) d;
+
+      out[0] = (char) (group >> 16);
+      out[1] = (char) (group >> 8);
+      out[2] = (char) group;
+
+      done += 4;
+      out += 3;
+      outlen -= 3;
+    }
+
+  return done;
+}
+
 /* Decode base64 encoded input array IN of length INLEN to output
    array OUT that can hold *OUTLEN bytes.  Return true if decoding was
    successful, i.e. if the input was valid base64 data, false
@@ -314,6 +543,12 @@ base64_decode (const char *restrict in, size_t inlen,
 	       char *restrict out, size_t *outlen)
 {
   size_t outleft = *outlen;
+  size_t done = base64_decode_blocks (in, inlen, out, outleft);
+
+  in += done;
+  inlen -= done;
+  out += done / 4 * 3;
+  outleft -= done / 4 * 3;
 
   while (inlen >= 2)
     {
@@ -95,6 +95,11 @@ char *realpath(const char *path, char *resolved_path);
 #undef HAVE_MMAP
 #endif
 
+#define HAVE_FSYNC
+#if (defined(_WIN32))
+#undef HAVE_FSYNC
+#endif
+
 #define HAVE_SCANDIR
 #if (defined(_WIN32))
 #undef HAVE_SCANDIR
@@ -157,6 +157,8 @@ struct nsurl {
 	int count;	/* Number of references to NetSurf URL object */
 	uint32_t hash;	/* Hash value for nsurl identification */
 
+	struct nsurl *intern_next;	/* Next in intern table chain */
+
 	size_t length;	/* Length of string */
 	char string[FLEX_ARRAY_LEN_DECL];	/* Full URL as a string */
 };
@@ -1185,39 +1187,44 @@ static void nsurl_get_string(const struct nsurl_components *url, char *url_s,
 
 
 /**
- * Calculate hash value
+ * Calculate hash value of a URL string
  *
- * \param url		NetSurf URL object to set hash value for
+ * \param url_s	URL string
+ * \param length	Length of url_s
+ * \return hash value
  */
-static void nsurl_calc_hash(nsurl *url)
+static uint32_t nsurl__string_hash(const char *url_s, size_t length)
 {
-	uint32_t hash = 0;
-
-	if (url->components.scheme)
-		hash ^= lwc_string_hash_value(url->components.scheme);
-
-	if (url->components.username)
-		hash ^= lwc_string_hash_value(url->components.username);
+	/* FNV-1a over the string, so that every character and its position
+	 * contribute, followed by a final mix to spread the differences
+	 * between similar URLs over all the bits. */
+	uint32_t hash = 0x811c9dc5;
 
-	if (url->components.password)
-		hash ^= lwc_string_hash_value(url->components.password);
-
-	if (url->components.host)
-		hash ^= lwc_string_hash_value(url->components.host);
-
-	if (url->components.port)
-		hash ^= lwc_string_hash_value(url->components.port);
+	while (length-- > 0) {
+		hash ^= (unsigned char) *url_s++;
+		hash *= 0x01000193;
+	}
 
-	if (url->components.path)
-		hash ^= lwc_string_hash_value(url->components.path);
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6b;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35;
+	hash ^= hash >> 16;
 
-	if (url->components.query)
-		hash ^= lwc_string_hash_value(url->components.query);
+	return hash;
+}
 
-	if (url->components.fragment)
-		hash ^= lwc_string_hash_value(url->components.fragment);
 
-	url->hash = hash;
+/**
+ * Calculate hash value
+ *
+ * \param url		NetSurf URL object to set hash value for
+ *
+ * The URL's string must have been filled out.
+ */
+static void nsurl_calc_hash(nsurl *url)
+{
+	url->hash = nsurl__string_hash(url->string, url->length);
 }
 
 
@@ -1254,6 +1261,342 @@ static void nsurl_destroy_components(struct nsurl_components *c)
 }
 
 
+/** Initial number of intern table chains, must be a power of two */
+#define NSURL_INTERN_INITIAL_SIZE 256
+
+/** Initial intern table chains, so every object can always be entered */
+static struct nsurl *nsurl__intern_initial[NSURL_INTERN_INITIAL_SIZE];
+
+/**
+ * Table of live NetSurf URL objects, keyed on their string.
+ *
+ * Every nsurl is entered here when it is created, and removed when its last
+ * reference goes.  An identical URL being made again is given the existing
+ * object instead, so equal URLs share one object and can be compared by
+ * pointer.  The table holds no references itself.
+ */
+static struct {
+	struct nsurl **chain;	/* Chains of objects, by string hash */
+	uint32_t size;		/* Number of chains */
+	uint32_t count;		/* Number of objects in table */
+} nsurl__intern_table = {
+	nsurl__intern_initial,
+	NSURL_INTERN_INITIAL_SIZE,
+	0
+};
+
+
+/**
+ * Find a live NetSurf URL object with a given string
+ *
+ * \param url_s	URL string
+ * \param length	Length of url_s
+ * \param hash		Hash of url_s from nsurl__string_hash
+ * \return NetSurf URL object, or NULL if none.  No reference is added.
+ */
+static nsurl *nsurl__intern_find(const char *url_s, size_t length,
+		uint32_t hash)
+{
+	nsurl *url;
+
+	for (url = nsurl__intern_table.chain[hash &
+			(nsurl__intern_table.size - 1)];
+			url != NULL; url = url->intern_next) {
+		if (url->hash == hash && url->length == length &&
+				memcmp(url->string, url_s, length) == 0)
+			return url;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Double the number of intern table chains
+ *
+ * The table continues with its current chains if memory is short.
+ */
+static void nsurl__intern_grow(void)
+{
+	uint32_t size = nsurl__intern_table.size * 2;
+	struct nsurl **chain;
+	uint32_t i;
+
+	chain = calloc(size, sizeof(struct nsurl *));
+	if (chain == NULL)
+		return;
+
+	for (i = 0; i < nsurl__intern_table.size; i++) {
+		nsurl *url = nsurl__intern_table.chain[i];
+
+		while (url != NULL) {
+			nsurl *next = url->intern_next;
+			uint32_t index = url->hash & (size - 1);
+
+			url->intern_next = chain[index];
+			chain[index] = url;
+			url = next;
+		}
+	}
+
+	if (nsurl__intern_table.chain != nsurl__intern_initial)
+		free(nsurl__intern_table.chain);
+	nsurl__intern_table.chain = chain;
+	nsurl__intern_table.size = size;
+}
+
+
+/**
+ * Intern a newly created NetSurf URL object
+ *
+ * \param url		Pointer to new NetSurf URL object, with one reference.
+ *			Updated to an existing object for the same URL, if
+ *			there is one, in which case the new object is freed.
+ */
+static void nsurl__intern(nsurl **url)
+{
+	uint32_t hash = (*url)->hash;
+	nsurl *existing;
+	uint32_t index;
+
+	existing = nsurl__intern_find((*url)->string, (*url)->length, hash);
+	if (existing != NULL) {
+		nsurl_destroy_components(&(*url)->components);
+		free(*url);
+
+		existing->count++;
+		*url = existing;
+		return;
+	}
+
+	if (nsurl__intern_table.count >= nsurl__intern_table.size)
+		nsurl__intern_grow();
+
+	index = hash & (nsurl__intern_table.size - 1);
+	(*url)->intern_next = nsurl__intern_table.chain[index];
+	nsurl__intern_table.chain[index] = *url;
+	nsurl__intern_table.count++;
+}
+
+
+/**
+ * Remove a NetSurf URL object from the intern table
+ *
+ * \param url		NetSurf URL object with no remaining references
+ */
+static void nsurl__intern_remove(nsurl *url)
+{
+	nsurl **link;
+
+	for (link = &nsurl__intern_table.chain[url->hash &
+			(nsurl__intern_table.size - 1)];
+			*link != NULL; link = &(*link)->intern_next) {
+		if (*link == url) {
+			*link = url->intern_next;
+			nsurl__intern_table.count--;
+			return;
+		}
+	}
+}
+
+
+/**
+ * Create a NetSurf URL object from its components
+ *
+ * \param c		Components of URL, which are taken over by the object
+ * \param url		Returns new NetSurf URL object, or an existing one for
+ *			the same URL
+ * \return NSERROR_OK on success, appropriate error otherwise.  The
+ *	   components are released on failure.
+ */
+static nserror nsurl__create_from_components(struct nsurl_components *c,
+		nsurl **url)
+{
+	struct nsurl_component_lengths str_len = { 0, 0, 0, 0,  0, 0, 0, 0 };
+	enum nsurl_string_flags str_flags = 0;
+	size_t length;
+
+	/* Get the string length and find which parts of url are present */
+	nsurl__get_string_data(c, NSURL_WITH_FRAGMENT, &length,
+			&str_len, &str_flags);
+
+	/* Create NetSurf URL object */
+	*url = malloc(sizeof(nsurl) + length + 1); /* Add 1 for \0 */
+	if (*url == NULL) {
+		nsurl_destroy_components(c);
+		return NSERROR_NOMEM;
+	}
+
+	(*url)->components = *c;
+	(*url)->length = length;
+
+	/* Fill out the url string */
+	nsurl_get_string(c, (*url)->string, &str_len, str_flags);
+
+	/* Get the nsurl's hash */
+	nsurl_calc_hash(*url);
+
+	/* Give the URL a reference */
+	(*url)->count = 1;
+
+	/* Share an existing object for the same URL */
+	nsurl__intern(url);
+
+	return NSERROR_OK;
+}
+
+
+/**
+ * Check whether a string is made only of unreserved characters
+ *
+ * \param s		String to check
+ * \param len		Length of s
+ * \return true iff s needs no escaping or unescaping in any component
+ */
+static bool nsurl__is_unreserved_string(const char *s, size_t len)
+{
+	while (len-- > 0) {
+		if (nsurl__is_unreserved(*s++) == false)
+			return false;
+	}
+
+	return true;
+}
+
+
+/**
+ * Check whether a path contains dot segments
+ *
+ * \param path		Path to check
+ * \param len		Length of path
+ * \return true iff path contains a "." or ".." segment
+ */
+static bool nsurl__has_dot_segments(const char *path, size_t len)
+{
+	const char *end = path + len;
+	const char *seg = path;
+
+	while (seg < end) {
+		const char *seg_end = memchr(seg, '/', end - seg);
+		size_t seg_len;
+
+		if (seg_end == NULL)
+			seg_end = end;
+		seg_len = seg_end - seg;
+
+		if ((seg_len == 1 && seg[0] == '.') ||
+				(seg_len == 2 && seg[0] == '.' && seg[1] == '.'))
+			return true;
+
+		seg = seg_end + 1;
+	}
+
+	return false;
+}
+
+
+/**
+ * Join a relative URL to a base URL without parsing, for common cases
+ *
+ * \param base		NetSurf URL to join to
+ * \param rel		Relative URL to join
+ * \param joined	Returns joined URL on success
+ * \return NSERROR_OK on success, NSERROR_NOT_FOUND if rel is not a simple
+ *	   case, or appropriate error otherwise
+ *
+ * The simple cases are an absolute URL which is already live, a fragment
+ * only, and a path segment relative to the base's directory.  They give
+ * exactly the result of the full join; anything needing escaping or dot
+ * segment removal is left to it.
+ */
+static nserror nsurl__join_simple(const nsurl *base, const char *rel,
+		nsurl **joined)
+{
+	size_t rel_len = strlen(rel);
+	const char *p;
+
+	if (rel_len == 0)
+		return NSERROR_NOT_FOUND;
+
+	if (rel[0] == '#') {
+		/* Fragment only */
+		lwc_string *frag;
+		nserror error;
+
+		if (rel_len == 1 || nsurl__is_unreserved_string(rel + 1,
+				rel_len - 1) == false)
+			return NSERROR_NOT_FOUND;
+
+		if (lwc_intern_string(rel + 1, rel_len - 1, &frag) !=
+				lwc_error_ok)
+			return NSERROR_NOMEM;
+
+		error = nsurl_refragment(base, frag, joined);
+		lwc_string_unref(frag);
+
+		return error;
+	}
+
+	/* Scheme present? */
+	for (p = rel; isalnum((unsigned char) *p) || *p == '+' ||
+			*p == '-' || *p == '.'; p++)
+		;
+	if (*p == ':' && p != rel && isalpha((unsigned char) rel[0])) {
+		/* Absolute URL; if it is live it is already normalised */
+		*joined = nsurl__intern_find(rel, rel_len,
+				nsurl__string_hash(rel, rel_len));
+		if (*joined == NULL)
+			return NSERROR_NOT_FOUND;
+
+		(*joined)->count++;
+		return NSERROR_OK;
+	}
+
+	if (nsurl__is_unreserved_string(rel, rel_len) &&
+			nsurl__has_dot_segments(rel, rel_len) == false &&
+			base->components.path != NULL) {
+		/* Path segment, relative to base directory */
+		struct nsurl_components c;
+		const char *path = lwc_string_data(base->components.path);
+		size_t path_end = lwc_string_length(base->components.path);
+		char *merged;
+
+		while (path_end != 0 && path[path_end - 1] != '/')
+			path_end--;
+
+		if (nsurl__has_dot_segments(path, path_end))
+			return NSERROR_NOT_FOUND;
+
+		merged = malloc(path_end + rel_len);
+		if (merged == NULL)
+			return NSERROR_NOMEM;
+
+		memcpy(merged, path, path_end);
+		memcpy(merged + path_end, rel, rel_len);
+
+		if (lwc_intern_string(merged, path_end + rel_len, &c.path) !=
+				lwc_error_ok) {
+			free(merged);
+			return NSERROR_NOMEM;
+		}
+		free(merged);
+
+		c.scheme = nsurl__component_copy(base->components.scheme);
+		c.username = nsurl__component_copy(base->components.username);
+		c.password = nsurl__component_copy(base->components.password);
+		c.host = nsurl__component_copy(base->components.host);
+		c.port = nsurl__component_copy(base->components.port);
+		c.query = NULL;
+		c.fragment = NULL;
+		c.scheme_type = base->components.scheme_type;
+
+		return nsurl__create_from_components(&c, joined);
+	}
+
+	return NSERROR_NOT_FOUND;
+}
+
+
 #ifdef NSURL_DEBUG
 /**
  * Dump a NetSurf URL's internal components
@@ -1302,13 +1645,20 @@ nserror nsurl_create(const char * const url_s, nsurl **url)
 	struct nsurl_components c;
 	size_t length;
 	char *buff;
-	struct nsurl_component_lengths str_len = { 0, 0, 0, 0,  0, 0, 0, 0 };
-	enum nsurl_string_flags str_flags = 0;
 	nserror e = NSERROR_OK;
 	bool match;
 
 	assert(url_s != NULL);
 
+	/* Already normalised URLs may be live; use the existing object */
+	length = strlen(url_s);
+	*url = nsurl__intern_find(url_s, length,
+			nsurl__string_hash(url_s, length));
+	if (*url != NULL) {
+		(*url)->count++;
+		return NSERROR_OK;
+	}
+
 	/* Peg out the URL sections */
 	nsurl__get_string_markers(url_s, &m, false);
 
@@ -1351,30 +1701,7 @@ nserror nsurl_create(const char * const url_s, nsurl **url)
 		}
 	}
 
-	/* Get the string length and find which parts of url are present */
-	nsurl__get_string_data(&c, NSURL_WITH_FRAGMENT, &length,
-			&str_len, &str_flags);
-
-	/* Create NetSurf URL object */
-	*url = malloc(sizeof(nsurl) + length + 1); /* Add 1 for \0 */
-	if (*url == NULL) {
-		nsurl_destroy_components(&c);
-		return NSERROR_NOMEM;
-	}
-
-	(*url)->components = c;
-	(*url)->length = length;
-
-	/* Fill out the url string */
-	nsurl_get_string(&c, (*url)->string, &str_len, str_flags);
-
-	/* Get the nsurl's hash */
-	nsurl_calc_hash(*url);
-
-	/* Give the URL a reference */
-	(*url)->count = 1;
-
-	return NSERROR_OK;
+	return nsurl__create_from_components(&c, url);
 }
 
 
@@ -1402,6 +1729,8 @@ void nsurl_unref(nsurl *url)
 	nsurl__dump(url);
 #endif
 
+	nsurl__intern_remove(url);
+
 	/* Release lwc strings */
 	nsurl_destroy_components(&url->components);
 
@@ -1418,6 +1747,12 @@ bool nsurl_compare(const nsurl *url1, const nsurl *url2, nsurl_component parts)
 	assert(url1 != NULL);
 	assert(url2 != NULL);
 
+	/* Identical URLs share an object, so this is decided by pointer */
+	if (url1 == url2)
+		return true;
+	else if (parts == NSURL_WITH_FRAGMENT)
+		return false;
+
 	/* Compare URL components */
 
 	/* Path, host and query first, since they're most likely to differ */
@@ -1699,8 +2034,6 @@ nserror nsurl_join(const nsurl *base, const char *rel, nsurl **joined)
 	char *buff;
 	char *buff_pos;
 	char *buff_start;
-	struct nsurl_component_lengths str_len = { 0, 0, 0, 0,  0, 0, 0, 0 };
-	enum nsurl_string_flags str_flags = 0;
 	nserror error = 0;
 	enum {
 		NSURL_F_REL		=  0,
@@ -1714,6 +2047,12 @@ nserror nsurl_join(const nsurl *base, const char *rel, nsurl **joined)
 	assert(base != NULL);
 	assert(rel != NULL);
 
+	/* Try the common cases which need no parsing first */
+	error = nsurl__join_simple(base, rel, joined);
+	if (error != NSERROR_NOT_FOUND)
+		return error;
+	error = 0;
+
 	/* Peg out the URL sections */
 	nsurl__get_string_markers(rel, &m, true);
 
@@ -1880,28 +2219,7 @@ nserror nsurl_join(const nsurl *base, const char *rel, nsurl **joined)
 	if (error != NSERROR_OK)
 		return NSERROR_NOMEM;
 
-	/* Get the string length and find which parts of url are present */
-	nsurl__get_string_data(&c, NSURL_WITH_FRAGMENT, &length,
-			&str_len, &str_flags);
-
-	/* Create NetSurf URL object */
-	*joined = malloc(sizeof(nsurl) + length + 1); /* Add 1 for \0 */
-	if (*joined == NULL)
-		return NSERROR_NOMEM;
-
-	(*joined)->components = c;
-	(*joined)->length = length;
-
-	/* Fill out the url string */
-	nsurl_get_string(&c, (*joined)->string, &str_len, str_flags);
-
-	/* Get the nsurl's hash */
-	nsurl_calc_hash(*joined);
-
-	/* Give the URL a reference */
-	(*joined)->count = 1;
-
-	return NSERROR_OK;
+	return nsurl__create_from_components(&c, joined);
 }
 
 
@@ -1956,6 +2274,9 @@ nserror nsurl_defragment(const nsurl *url, nsurl **no_frag)
 	/* Give the URL a reference */
 	(*no_frag)->count = 1;
 
+	/* Share an existing object for the same URL */
+	nsurl__intern(no_frag);
+
 	return NSERROR_OK;
 }
 
@@ -2024,6 +2345,9 @@ nserror nsurl_refragment(const nsurl *url, lwc_string *frag, nsurl **new_url)
 	/* Give the URL a reference */
 	(*new_url)->count = 1;
 
+	/* Share an existing object for the same URL */
+	nsurl__intern(new_url);
+
 	return NSERROR_OK;
 }
 
@@ -2056,6 +2380,9 @@ nserror nsurl_replace_query(const nsurl *url, const char *query,
 
 	/* Set new_url's length */
 	len = base_len + query_len;
+	if (url->components.fragment != NULL) {
+		len += 1 + lwc_string_length(url->components.fragment);
+	}
 
 	/* Create NetSurf URL object */
 	*new_url = malloc(sizeof(nsurl) + len + 1); /* Add 1 for \0 */
@@ -2110,6 +2437,9 @@ nserror nsurl_replace_query(const nsurl *url, const char *query,
 	/* Give the URL a reference */
 	(*new_url)->count = 1;
 
+	/* Share an existing object for the same URL */
+	nsurl__intern(new_url);
+
 	return NSERROR_OK;
 }
 
@@ -2208,6 +2538,9 @@ nserror nsurl_parent(const nsurl *url, nsurl **new_url)
 	/* Give the URL a reference */
 	(*new_url)->count = 1;
 
+	/* Share an existing object for the same URL */
+	nsurl__intern(new_url);
+
 	return NSERROR_OK;
 }
 
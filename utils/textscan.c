@@ -0,0 +1,113 @@
+/*
+ * Copyright 2013 The NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Block-at-a-time scanning of text for line layout (implementation).
+ *
+ * Where SSE2 is available, 16 bytes are compared at a time. Otherwise,
+ * line terminators are found by testing a machine word at a time for the
+ * presence of CR or LF, examining only words which contain one byte by
+ * byte. Blanks are typically only a few bytes apart, so a portable search
+ * for them gains nothing over a simple loop.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define TEXTSCAN_SSE2
+#endif
+
+#include "utils/textscan.h"
+
+/** Word with every byte set to 0x01 */
+#define ONES ((size_t) -1 / 0xff)
+/** Word with every byte set to 0x80 */
+#define HIGHS (ONES * 0x80)
+
+/** Non-zero if any byte of a word is zero */
+#define HAS_ZERO(v) (((v) - ONES) & ~(v) & HIGHS)
+/** Non-zero if any byte of a word is equal to c */
+#define HAS_BYTE(v, c) HAS_ZERO((v) ^ (ONES * (c)))
+
+/* exported interface documented in utils/textscan.h */
+size_t textscan_line_end(const char *data, size_t len)
+{
+	size_t i = 0;
+
+#ifdef TEXTSCAN_SSE2
+	const __m128i cr = _mm_set1_epi8('\r');
+	const __m128i lf = _mm_set1_epi8('\n');
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (data + i));
+		int mask = _mm_movemask_epi8(_mm_or_si128(
+				_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+#else
+	for (; i + sizeof(size_t) <= len; i += sizeof(size_t)) {
+		size_t v;
+
+		memcpy(&v, data + i, sizeof(v));
+		if (HAS_BYTE(v, '\r') || HAS_BYTE(v, '\n'))
+			break;
+	}
+#endif
+
+	for (; i != len; i++) {
+		if (data[i] == '\n' || data[i] == '\r')
+			break;
+	}
+
+	return i;
+}
+
+/* exported interface documented in utils/textscan.h */
+size_t textscan_blank(const char *data, size_t len)
+{
+	size_t i = 0;
+
+#ifdef TEXTSCAN_SSE2
+	const __m128i cr = _mm_set1_epi8('\r');
+	const __m128i lf = _mm_set1_epi8('\n');
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i space = _mm_set1_epi8(' ');
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (data + i));
+		int mask = _mm_movemask_epi8(_mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(v, cr),
+					_mm_cmpeq_epi8(v, lf)),
+				_mm_or_si128(_mm_cmpeq_epi8(v, tab),
+					_mm_cmpeq_epi8(v, space))));
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+#endif
+
+	for (; i != len; i++) {
+		if (data[i] == ' ' || data[i] == '\t' ||
+				data[i] == '\n' || data[i] == '\r')
+			break;
+	}
+
+	return i;
+}
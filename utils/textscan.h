@@ -0,0 +1,46 @@
+/*
+ * Copyright 2013 The NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Block-at-a-time scanning of text for line layout (interface).
+ */
+
+#ifndef _NETSURF_UTILS_TEXTSCAN_H_
+#define _NETSURF_UTILS_TEXTSCAN_H_
+
+#include <stddef.h>
+
+/**
+ * Find the first line terminator in a block of text
+ *
+ * \param data Text to search
+ * \param len Length of text, in bytes
+ * \return Offset of first CR or LF, or len if none
+ */
+size_t textscan_line_end(const char *data, size_t len);
+
+/**
+ * Find the first whitespace character in a block of text
+ *
+ * \param data Text to search
+ * \param len Length of text, in bytes
+ * \return Offset of first space, tab, CR or LF, or len if none
+ */
+size_t textscan_blank(const char *data, size_t len);
+
+#endif
@@ -0,0 +1,285 @@
+/*
+ * Copyright 2013 The NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Time spent in content processing phases (implementation).
+ *
+ * A monotonic clock is used where the platform has one, so measurements
+ * are unaffected by changes to the time of day.
+ *
+ * The trace is a fixed size ring of the most recent runs, holding a
+ * truncated copy of each URL, so recording never allocates and the trace
+ * keeps no URLs alive.  Style selection runs once per element, so it is only
+ * included in the totals.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "utils/timing.h"
+
+static const char *timing_names[TIMING_PHASE_COUNT] = {
+	"FETCH", "PARSE", "STYLE", "BOX", "NORMALISE", "LAYOUT", "REDRAW",
+	"IMAGE"
+};
+
+#ifdef WITH_TIMING
+/** Number of runs kept in the trace */
+#define TIMING_TRACE_SIZE 4096
+
+/** Length beyond which URLs are truncated in the trace */
+#define TIMING_URL_MAX 256
+
+/** Traced run of a phase */
+struct timing_span {
+	uint64_t start;			/**< Start time, in microseconds */
+	uint64_t duration;		/**< Duration, in microseconds */
+	enum timing_phase phase;	/**< Phase which ran */
+	char url[TIMING_URL_MAX + 1];	/**< URL of content, or empty */
+	bool url_truncated;		/**< URL was longer than url */
+};
+
+static struct timing_totals timing_phase_totals[TIMING_PHASE_COUNT];
+
+static struct timing_span timing_trace[TIMING_TRACE_SIZE];
+static unsigned int timing_trace_next; /**< Slot for next run */
+static unsigned int timing_trace_used; /**< Number of slots in use */
+#endif
+
+/* exported interface documented in utils/timing.h */
+uint64_t timing_now(void)
+{
+#ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+	{
+		struct timeval tv;
+
+		if (gettimeofday(&tv, NULL) == -1)
+			return 0;
+
+		return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+	}
+}
+
+/* exported interface documented in utils/timing.h */
+const char *timing_phase_name(enum timing_phase phase)
+{
+	return timing_names[phase];
+}
+
+#ifdef WITH_TIMING
+
+/* exported interface documented in utils/timing.h */
+void timing_record(enum timing_phase phase, uint64_t start, nsurl *url)
+{
+	uint64_t duration = timing_now() - start;
+	struct timing_totals *totals = &timing_phase_totals[phase];
+	struct timing_span *span;
+
+	totals->count++;
+	totals->time += duration;
+	if (duration > totals->max)
+		totals->max = duration;
+
+	if (phase == TIMING_STYLE)
+		return;
+
+	span = &timing_trace[timing_trace_next];
+
+	span->start = start;
+	span->duration = duration;
+	span->phase = phase;
+	span->url[0] = '\0';
+	span->url_truncated = false;
+	if (url != NULL) {
+		const char *s = nsurl_access(url);
+		size_t len = strlen(s);
+
+		if (len > TIMING_URL_MAX) {
+			len = TIMING_URL_MAX;
+			span->url_truncated = true;
+		}
+		memcpy(span->url, s, len);
+		span->url[len] = '\0';
+	}
+
+	timing_trace_next = (timing_trace_next + 1) % TIMING_TRACE_SIZE;
+	if (timing_trace_used < TIMING_TRACE_SIZE)
+		timing_trace_used++;
+}
+
+/* exported interface documented in utils/timing.h */
+void timing_get(enum timing_phase phase, struct timing_totals *totals)
+{
+	*totals = timing_phase_totals[phase];
+}
+
+/* exported interface documented in utils/timing.h */
+void timing_reset(void)
+{
+	memset(timing_phase_totals, 0, sizeof(timing_phase_totals));
+
+	timing_finalise();
+}
+
+/**
+ * Copy a traced URL, escaped, to a buffer
+ *
+ * URLs which were truncated when recorded, such as those of data: URLs,
+ * are marked with an ellipsis.
+ *
+ * \param string Buffer to fill
+ * \param size Size of buffer
+ * \param slen Length of string already in buffer
+ * \param span Traced run whose URL to copy
+ * \param escape 'H' to escape for HTML, 'J' to escape for a JSON string,
+ *               or 'U' for no escaping
+ * \return Length of string in buffer, including any which did not fit
+ */
+static size_t timing_copy_url(char *string, size_t size, size_t slen,
+		const struct timing_span *span, char escape)
+{
+	const char *s;
+	char esc[8];
+
+	for (s = span->url; *s != '\0'; s++) {
+		const char *out = esc;
+		unsigned char c = *s;
+
+		esc[0] = c;
+		esc[1] = '\0';
+
+		if (escape == 'J') {
+			if (c == '"' || c == '\\') {
+				esc[0] = '\\';
+				esc[1] = c;
+				esc[2] = '\0';
+			} else if (c < 0x20) {
+				snprintf(esc, sizeof(esc), "\\u%04x", c);
+			}
+		} else if (escape == 'H') {
+			if (c == '&')
+				out = "&amp;";
+			else if (c == '<')
+				out = "&lt;";
+			else if (c == '>')
+				out = "&gt;";
+			else if (c == '"')
+				out = "&quot;";
+		}
+
+		for (; *out != '\0'; out++) {
+			if (slen + 1 < size)
+				string[slen] = *out;
+			slen++;
+		}
+	}
+
+	if (span->url_truncated) {
+		for (s = "..."; *s != '\0'; s++) {
+			if (slen + 1 < size)
+				string[slen] = *s;
+			slen++;
+		}
+	}
+
+	return slen;
+}
+
+/* exported interface documented in utils/timing.h */
+int timing_trace_snentryf(char *string, size_t size, unsigned int entry,
+		const char *fmt)
+{
+	const struct timing_span *span;
+	size_t slen = 0;
+	int fmtc;
+
+	if (entry >= timing_trace_used)
+		return 0;
+
+	span = &timing_trace[(timing_trace_next + TIMING_TRACE_SIZE - 1 -
+			entry) % TIMING_TRACE_SIZE];
+
+	for (fmtc = 0; fmt[fmtc] != '\0'; fmtc++) {
+		char num[24];
+		const char *out = num;
+
+		if (fmt[fmtc] != '%' || fmt[fmtc + 1] == '\0') {
+			if (slen + 1 < size)
+				string[slen] = fmt[fmtc];
+			slen++;
+			continue;
+		}
+
+		fmtc++;
+		switch (fmt[fmtc]) {
+		case 'n':
+			out = timing_names[span->phase];
+			break;
+
+		case 's':
+			snprintf(num, sizeof(num), "%llu",
+					(unsigned long long) span->start);
+			break;
+
+		case 'd':
+			snprintf(num, sizeof(num), "%llu",
+					(unsigned long long) span->duration);
+			break;
+
+		case 'U':
+		case 'H':
+		case 'J':
+			slen = timing_copy_url(string, size, slen, span,
+					fmt[fmtc]);
+			continue;
+
+		default:
+			num[0] = fmt[fmtc];
+			num[1] = '\0';
+			break;
+		}
+
+		for (; *out != '\0'; out++) {
+			if (slen + 1 < size)
+				string[slen] = *out;
+			slen++;
+		}
+	}
+
+	if (size > 0)
+		string[(slen < size) ? slen : size - 1] = '\0';
+
+	return slen;
+}
+
+/* exported interface documented in utils/timing.h */
+void timing_finalise(void)
+{
+	timing_trace_next = 0;
+	timing_trace_used = 0;
+}
+
+#endif
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2013 The NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Time spent in content processing phases (interface).
+ *
+ * Each phase accumulates the number of times it ran and the time taken,
+ * over all contents, until the totals are reset.  The most recent runs
+ * are also kept as a trace, tagged with the URL of the content concerned.
+ *
+ * Recording is only built when WITH_TIMING is defined; otherwise
+ * timing_start() and the recording functions compile to nothing.
+ */
+
+#ifndef _NETSURF_UTILS_TIMING_H_
+#define _NETSURF_UTILS_TIMING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "utils/nsurl.h"
+
+/** Content processing phases */
+enum timing_phase {
+	TIMING_FETCH,	  /**< Fetch, from start until freed */
+	TIMING_PARSE,	  /**< HTML parsing */
+	TIMING_STYLE,	  /**< Selection of an element's style */
+	TIMING_BOX,	  /**< Box tree construction, including TIMING_STYLE
+			   and TIMING_NORMALISE */
+	TIMING_NORMALISE, /**< Box tree normalisation */
+	TIMING_LAYOUT,	  /**< Document layout */
+	TIMING_REDRAW,	  /**< Document redraw */
+	TIMING_IMAGE,	  /**< Image conversion to a bitmap */
+	TIMING_PHASE_COUNT
+};
+
+/** Totals for a phase */
+struct timing_totals {
+	unsigned int count;	/**< Number of runs */
+	uint64_t time;		/**< Total time of runs, in microseconds */
+	uint64_t max;		/**< Longest run, in microseconds */
+};
+
+/**
+ * Read the time used for measuring phases
+ *
+ * \return Microseconds since an arbitrary point
+ */
+uint64_t timing_now(void);
+
+/**
+ * Get the name of a phase
+ *
+ * \param phase Phase to name
+ * \return Upper case name of phase
+ */
+const char *timing_phase_name(enum timing_phase phase);
+
+#ifdef WITH_TIMING
+
+/** Get the start time of a phase, to pass to timing_record() */
+#define timing_start() timing_now()
+
+/**
+ * Record a run of a phase which started at a given time and ends now
+ *
+ * \param phase Phase which ran
+ * \param start Time the phase started, from timing_start()
+ * \param url URL of content the phase ran for, or NULL
+ */
+void timing_record(enum timing_phase phase, uint64_t start, nsurl *url);
+
+/**
+ * Get the totals for a phase
+ *
+ * \param phase Phase to get totals for
+ * \param totals Updated with totals for phase
+ */
+void timing_get(enum timing_phase phase, struct timing_totals *totals);
+
+/**
+ * Reset the totals of all phases, and discard the trace
+ */
+void timing_reset(void);
+
+/**
+ * Fill a string with details of a traced phase run
+ *
+ * Runs are numbered from the most recent.  The format is copied to the
+ * string with the following substitutions:
+ *
+ *  - %n  name of phase
+ *  - %s  start time, in microseconds
+ *  - %d  duration, in microseconds
+ *  - %U  URL, or nothing if the run has no URL; long URLs are truncated
+ *  - %H  URL, escaped for HTML
+ *  - %J  URL, escaped for a JSON string
+ *
+ * \param string Buffer to fill
+ * \param size Size of buffer
+ * \param entry Number of run
+ * \param fmt Format string
+ * \return Length of the complete string, as for snprintf, or 0 if there is
+ *         no such run
+ */
+int timing_trace_snentryf(char *string, size_t size, unsigned int entry,
+		const char *fmt);
+
+/**
+ * Discard the trace
+ */
+void timing_finalise(void);
+
+#else
+
+#define timing_start() 0
+
+static inline void timing_record(enum timing_phase phase, uint64_t start,
+		nsurl *url)
+{
+}
+
+static inline void timing_get(enum timing_phase phase,
+		struct timing_totals *totals)
+{
+	totals->count = 0;
+	totals->time = 0;
+	totals->max = 0;
+}
+
+static inline void timing_reset(void)
+{
+}
+
+static inline int timing_trace_snentryf(char *string, size_t size,
+		unsigned int entry, const char *fmt)
+{
+	return 0;
+}
+
+static inline void timing_finalise(void)
+{
+}
+
+#endif
+
+#endif
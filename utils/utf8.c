@@ -136,28 +136,215 @@ size_t utf8_next(const char *s, size_t l, size_t o)
 	return next;
 }
 
-/* Cache of previous iconv conversion descriptor used by utf8_convert */
-static struct {
+/** Number of iconv conversion descriptors kept for reuse */
+#define UTF8_CD_CACHE_SIZE 4
+
+/** Cached iconv conversion descriptor */
+struct utf8_cd {
 	char from[32];	/**< Encoding name to convert from */
 	char to[32];	/**< Encoding name to convert to */
-	iconv_t cd;	/**< Iconv conversion descriptor */
-} last_cd;
+	iconv_t cd;	/**< Iconv conversion descriptor, or 0 if unused */
+};
+
+/** Cache of conversion descriptors, most recently used first */
+static struct utf8_cd utf8_cd_cache[UTF8_CD_CACHE_SIZE];
 
-static inline void utf8_clear_cd_cache(void)
+/**
+ * Get a conversion descriptor, from the cache if possible
+ *
+ * \param from  The encoding name to convert from
+ * \param to    The encoding name to convert to
+ * \param cd    Pointer to location in which to store descriptor
+ * \return NSERROR_OK on success, NSERROR_BAD_ENCODING for an unsupported
+ *         encoding, NSERROR_NOMEM otherwise
+ *
+ * The descriptor remains owned by the cache, and is in its initial state.
+ */
+static nserror utf8_cd_get(const char *from, const char *to, iconv_t *cd)
 {
-	last_cd.from[0] = '\0';
-	last_cd.to[0] = '\0';
-	last_cd.cd = 0;
+	struct utf8_cd found;
+	int i;
+
+	for (i = 0; i < UTF8_CD_CACHE_SIZE; i++) {
+		if (utf8_cd_cache[i].cd == 0)
+			break;
+
+		if (strncasecmp(utf8_cd_cache[i].from, from,
+				sizeof(utf8_cd_cache[i].from)) == 0 &&
+				strncasecmp(utf8_cd_cache[i].to, to,
+				sizeof(utf8_cd_cache[i].to)) == 0) {
+			found = utf8_cd_cache[i];
+
+			/* Reset any shift state left by the last user */
+			iconv(found.cd, NULL, NULL, NULL, NULL);
+
+			/* Move to front */
+			memmove(&utf8_cd_cache[1], &utf8_cd_cache[0],
+					i * sizeof(struct utf8_cd));
+			utf8_cd_cache[0] = found;
+
+			*cd = found.cd;
+			return NSERROR_OK;
+		}
+	}
+
+	/* no match, so create a new cd */
+	found.cd = iconv_open(to, from);
+	if (found.cd == (iconv_t) -1) {
+		if (errno == EINVAL)
+			return NSERROR_BAD_ENCODING;
+		/* default to no memory */
+		return NSERROR_NOMEM;
+	}
+
+	/* close the least recently used cd - we don't care if this fails */
+	i = UTF8_CD_CACHE_SIZE - 1;
+	if (utf8_cd_cache[i].cd != 0)
+		iconv_close(utf8_cd_cache[i].cd);
+
+	strncpy(found.from, from, sizeof(found.from));
+	strncpy(found.to, to, sizeof(found.to));
+
+	memmove(&utf8_cd_cache[1], &utf8_cd_cache[0],
+			i * sizeof(struct utf8_cd));
+	utf8_cd_cache[0] = found;
+
+	*cd = found.cd;
+	return NSERROR_OK;
+}
+
+/**
+ * Remove a conversion descriptor from the cache and close it
+ *
+ * \param cd  Descriptor obtained from utf8_cd_get()
+ */
+static void utf8_cd_discard(iconv_t cd)
+{
+	int i;
+
+	for (i = 0; i < UTF8_CD_CACHE_SIZE; i++) {
+		if (utf8_cd_cache[i].cd == cd) {
+			memmove(&utf8_cd_cache[i], &utf8_cd_cache[i + 1],
+					(UTF8_CD_CACHE_SIZE - i - 1) *
+					sizeof(struct utf8_cd));
+			memset(&utf8_cd_cache[UTF8_CD_CACHE_SIZE - 1], 0,
+					sizeof(struct utf8_cd));
+			break;
+		}
+	}
+
+	iconv_close(cd);
 }
 
 /* exported interface documented in utils/utf8.h */
 nserror utf8_finalise(void)
 {
-	if (last_cd.cd != 0)
-		iconv_close(last_cd.cd);
+	int i;
+
+	for (i = 0; i < UTF8_CD_CACHE_SIZE; i++) {
+		if (utf8_cd_cache[i].cd != 0)
+			iconv_close(utf8_cd_cache[i].cd);
+	}
 
 	/* paranoia follows */
-	utf8_clear_cd_cache();
+	memset(utf8_cd_cache, 0, sizeof(utf8_cd_cache));
+
+	return NSERROR_OK;
+}
+
+
+/**
+ * Determine if an encoding name refers to UTF-8
+ *
+ * \param encname  The encoding name to consider
+ * \return true if the encoding is UTF-8
+ */
+static bool utf8_encoding_is_utf8(const char *encname)
+{
+	return strcasecmp(encname, "UTF-8") == 0 ||
+			strcasecmp(encname, "UTF8") == 0;
+}
+
+/**
+ * Determine if an encoding represents ASCII characters as ASCII does
+ *
+ * \param encname  The encoding name to consider
+ * \return true if the encoding is known to be ASCII compatible
+ */
+static bool utf8_encoding_is_ascii_compatible(const char *encname)
+{
+	static const char *prefixes[] = {
+		"UTF-8", "UTF8", "US-ASCII", "ASCII", "ISO-8859-",
+		"ISO8859-", "ISO_8859-", "WINDOWS-125", "CP125", "KOI8-"
+	};
+	size_t i;
+
+	for (i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++) {
+		if (strncasecmp(encname, prefixes[i],
+				strlen(prefixes[i])) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * Determine if a string contains only ASCII characters
+ *
+ * \param string  The string to consider
+ * \param len     Length of string, in bytes
+ * \return true if no byte of the string has its top bit set
+ */
+static bool utf8_is_ascii(const char *string, size_t len)
+{
+	const uint64_t high = 0x8080808080808080ULL;
+	uint64_t word, acc = 0;
+	size_t i = 0;
+
+	/* Test a word at a time */
+	for (; i + 4 * sizeof(word) <= len; i += 4 * sizeof(word)) {
+		memcpy(&word, string + i, sizeof(word));
+		acc |= word;
+		memcpy(&word, string + i + sizeof(word), sizeof(word));
+		acc |= word;
+		memcpy(&word, string + i + 2 * sizeof(word), sizeof(word));
+		acc |= word;
+		memcpy(&word, string + i + 3 * sizeof(word), sizeof(word));
+		acc |= word;
+
+		if ((acc & high) != 0)
+			return false;
+	}
+
+	for (; i < len; i++)
+		acc |= (uint8_t) string[i];
+
+	return (acc & high) == 0;
+}
+
+/**
+ * Copy a string which needs no conversion
+ *
+ * \param string  The string to copy
+ * \param len     Length of string, in bytes
+ * \param result  Pointer to location in which to store result.
+ * \param result_len Pointer to location in which to store result length.
+ * \return NSERROR_OK for no error, NSERROR_NOMEM on allocation error
+ */
+static nserror
+utf8_copy(const char *string, size_t len, char **result, size_t *result_len)
+{
+	*result = malloc(len + 4);
+	if (*result == NULL)
+		return NSERROR_NOMEM;
+
+	memcpy(*result, string, len);
+
+	/* NULL terminate, as utf8_convert does */
+	memset(*result + len, 0, 4);
+
+	if (result_len != NULL)
+		*result_len = len;
 
 	return NSERROR_OK;
 }
@@ -186,6 +373,7 @@ utf8_convert(const char *string,
 	iconv_t cd;
 	char *temp, *out, *in;
 	size_t slen, rlen;
+	nserror error;
 
 	assert(string && from && to && result);
 
@@ -202,47 +390,31 @@ utf8_convert(const char *string,
 		return NSERROR_OK;
 	}
 
-	if (strcasecmp(from, to) == 0) {
-		/* conversion from an encoding to itself == strdup */
-		slen = len ? len : strlen(string);
-		*(result) = strndup(string, slen);
-		if (!(*result)) {
-			*(result) = NULL;
-			return NSERROR_NOMEM;
-		}
+	slen = len ? len : strlen(string);
 
-		return NSERROR_OK;
+	if (strcasecmp(from, to) == 0) {
+		/* conversion from an encoding to itself == copy */
+		return utf8_copy(string, slen, result, result_len);
 	}
 
-	in = (char *)string;
+	if (utf8_encoding_is_utf8(from) && utf8_encoding_is_utf8(to)) {
+		/* different names for UTF-8 */
+		return utf8_copy(string, slen, result, result_len);
+	}
 
-	/* we cache the last used conversion descriptor,
-	 * so check if we're trying to use it here */
-	if (strncasecmp(last_cd.from, from, sizeof(last_cd.from)) == 0 &&
-			strncasecmp(last_cd.to, to, sizeof(last_cd.to)) == 0) {
-		cd = last_cd.cd;
+	if (utf8_encoding_is_ascii_compatible(from) &&
+			utf8_encoding_is_ascii_compatible(to) &&
+			utf8_is_ascii(string, slen)) {
+		/* pure ASCII is the same in both encodings */
+		return utf8_copy(string, slen, result, result_len);
 	}
-	else {
-		/* no match, so create a new cd */
-		cd = iconv_open(to, from);
-		if (cd == (iconv_t)-1) {
-			if (errno == EINVAL)
-				return NSERROR_BAD_ENCODING;
-			/* default to no memory */
-			return NSERROR_NOMEM;
-		}
 
-		/* close the last cd - we don't care if this fails */
-		if (last_cd.cd)
-			iconv_close(last_cd.cd);
+	in = (char *)string;
 
-		/* and copy the to/from/cd data into last_cd */
-		strncpy(last_cd.from, from, sizeof(last_cd.from));
-		strncpy(last_cd.to, to, sizeof(last_cd.to));
-		last_cd.cd = cd;
-	}
+	error = utf8_cd_get(from, to, &cd);
+	if (error != NSERROR_OK)
+		return error;
 
-	slen = len ? len : strlen(string);
 	/* Worst case = ASCII -> UCS4, so allocate an output buffer
 	 * 4 times larger than the input buffer, and add 4 bytes at
 	 * the end for the NULL terminator
@@ -257,10 +429,8 @@ utf8_convert(const char *string,
 	/* perform conversion */
 	if (iconv(cd, (void *) &in, &slen, &out, &rlen) == (size_t)-1) {
 		free(temp);
-		/* clear the cached conversion descriptor as it's invalid */
-		if (last_cd.cd)
-			iconv_close(last_cd.cd);
-		utf8_clear_cd_cache();
+		/* discard the cached conversion descriptor as it's invalid */
+		utf8_cd_discard(cd);
 		/** \todo handle the various cases properly
 		 * There are 3 possible error cases:
 		 * a) Insufficiently large output buffer
@@ -339,6 +509,47 @@ utf8_convert_html_chunk(iconv_t cd,
 	return NSERROR_OK;
 }
 
+/**
+ * Escape an ASCII string for html, in an ASCII compatible encoding
+ *
+ * \param string  The string to escape
+ * \param len     Length of string, in bytes
+ * \param result  Pointer to location in which to store result
+ * \return NSERROR_OK for no error, NSERROR_NOMEM on allocation error
+ */
+static nserror
+utf8_ascii_to_html(const char *string, size_t len, char **result)
+{
+	size_t off, outlen = len;
+	char *out;
+
+	for (off = 0; off < len; off++) {
+		if (string[off] == '&' || string[off] == '<' ||
+				string[off] == '>')
+			outlen += 9; /* "&#xYYYYYY;" replaces the character */
+	}
+
+	out = malloc(outlen + 4);
+	if (out == NULL)
+		return NSERROR_NOMEM;
+
+	*result = out;
+
+	for (off = 0; off < len; off++) {
+		if (string[off] == '&' || string[off] == '<' ||
+				string[off] == '>') {
+			out += sprintf(out, "&#x%06x;", string[off]);
+		} else {
+			*out++ = string[off];
+		}
+	}
+
+	/* Terminate string, as utf8_to_html does */
+	memset(out, 0, 4);
+
+	return NSERROR_OK;
+}
+
 /* exported interface documented in utils/utf8.h */
 nserror
 utf8_to_html(const char *string, const char *encname, size_t len, char **result)
@@ -353,33 +564,16 @@ utf8_to_html(const char *string, const char *encname, size_t len, char **result)
 	if (len == 0)
 		len = strlen(string);
 
-	/* we cache the last used conversion descriptor,
-	 * so check if we're trying to use it here */
-	if (strncasecmp(last_cd.from, "UTF-8", sizeof(last_cd.from)) == 0 &&
-			strncasecmp(last_cd.to, encname,
-					sizeof(last_cd.to)) == 0 &&
-			last_cd.cd != 0) {
-		cd = last_cd.cd;
-	} else {
-		/* no match, so create a new cd */
-		cd = iconv_open(encname, "UTF-8");
-		if (cd == (iconv_t) -1) {
-			if (errno == EINVAL)
-				return NSERROR_BAD_ENCODING;
-			/* default to no memory */
-			return NSERROR_NOMEM;
-		}
-
-		/* close the last cd - we don't care if this fails */
-		if (last_cd.cd)
-			iconv_close(last_cd.cd);
-
-		/* and copy the to/from/cd data into last_cd */
-		strncpy(last_cd.from, "UTF-8", sizeof(last_cd.from));
-		strncpy(last_cd.to, encname, sizeof(last_cd.to));
-		last_cd.cd = cd;
+	if (utf8_encoding_is_ascii_compatible(encname) &&
+			utf8_is_ascii(string, len)) {
+		/* No conversion needed: only escape '&', '<', and '>' */
+		return utf8_ascii_to_html(string, len, result);
 	}
 
+	ret = utf8_cd_get("UTF-8", encname, &cd);
+	if (ret != NSERROR_OK)
+		return ret;
+
 	/* Worst case is ASCII -> UCS4, with all characters escaped:
 	 * "&#xYYYYYY;", thus each input character may become a string
 	 * of 10 UCS4 characters, each 4 bytes in length, plus four for
@@ -387,8 +581,7 @@ utf8_to_html(const char *string, const char *encname, size_t len, char **result)
 	origoutlen = outlen = len * 10 * 4 + 4;
 	origout = out = malloc(outlen);
 	if (out == NULL) {
-		iconv_close(cd);
-		utf8_clear_cd_cache();
+		utf8_cd_discard(cd);
 		return NSERROR_NOMEM;
 	}
 
@@ -406,8 +599,7 @@ utf8_to_html(const char *string, const char *encname, size_t len, char **result)
 						&out, &outlen);
 				if (ret != NSERROR_OK) {
 					free(origout);
-					iconv_close(cd);
-					utf8_clear_cd_cache();
+					utf8_cd_discard(cd);
 					return ret;
 				}
 			}
@@ -420,8 +612,7 @@ utf8_to_html(const char *string, const char *encname, size_t len, char **result)
 					&out, &outlen);
 			if (ret != NSERROR_OK) {
 				free(origout);
-				iconv_close(cd);
-				utf8_clear_cd_cache();
+				utf8_cd_discard(cd);
 				return ret;
 			}
 
@@ -438,8 +629,7 @@ utf8_to_html(const char *string, const char *encname, size_t len, char **result)
 		ret = utf8_convert_html_chunk(cd, in, inlen, &out, &outlen);
 		if (ret != NSERROR_OK) {
 			free(origout);
-			iconv_close(cd);
-			utf8_clear_cd_cache();
+			utf8_cd_discard(cd);
 			return ret;
 		}
 	}